@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <initializer_list>
+#include <type_traits>
+#include <vector>
 
 #include "utils/allocator.hpp"
 #include "utils/base_config.hpp"
@@ -11,13 +13,24 @@
 #include "exp/grad_impl.hpp"
 #include "exp/operator/log_softmax.hpp"
 #include "exp/operator/nll_loss.hpp"
+#include "exp/operator/cross_entropy.hpp"
 #include "exp/operator/reduce_op.hpp"
 #include "exp/operator/conv.hpp"
 #include "exp/operator/constant.hpp"
+#include "exp/operator/linear.hpp"
+#include "exp/operator/matrix_op.hpp"
+#include "exp/operator/strided.hpp"
+#include "kernel/conv.hpp"
+#include "kernel/gemm.hpp"
+#include "kernel/im2col.hpp"
+#include "kernel/pool.hpp"
+#include "kernel/winograd.hpp"
+#include "kernel/fft_conv.hpp"
 
 namespace st {
 
 // forward declaration
+class TensorImpl;
 template<typename T> class ExpImpl;
 template<typename T> class ExpImplPtr;
 template<typename T> using OperandImplPtr = ExpImplPtr<T>;
@@ -34,6 +47,12 @@ public:
 private:
     index_t refcount_ = 0;
     index_t gradcount_ = 0;
+    // gradcount_ counts the uses of an expression node with grad, and is
+    // consumed by backward. Once the node has propagated its grad, it is
+    // restored from gradtotal_, so the same graph can be backward again (see
+    // tensor/forward_plan.hpp). Tensors don't count them, see
+    // ExpImplPtr<TensorImpl>.
+    index_t gradtotal_ = 0;
 };
 
 template<typename ImplType> 
@@ -54,12 +73,27 @@ public:
               with_grad_(with_grad && static_cast<ImplType*>(ptr_)->requires_grad()) {
         increment_counters();
     }
+    ExpImplPtr(const ExpImplPtr& other)
+            : ptr_(other.ptr_),
+              with_grad_(other.with_grad_) {
+        increment_counters();
+    }
+    ExpImplPtr& operator=(const ExpImplPtr& other) = delete;
     ~ExpImplPtr() { decrease_refcount(); }
 
     ImplType* operator->(void) const { return static_cast<ImplType*>(ptr_); }
     const ImplType& operator*(void) const { return *static_cast<ImplType*>(ptr_); }
     explicit operator bool() const { return ptr_ != nullptr; }
 
+    // Appends the tensors which invoke_backward() would send a grad to, the
+    // edges of the graph walked by autograd::Engine. A tensor is listed once
+    // per use.
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        auto ptr = static_cast<ImplType*>(ptr_);
+        if(ptr->requires_grad())
+            ptr->collect_grad_tensors(tensors);
+    }
+
     template<typename GradImplType>
     void invoke_backward(const GradImplType& grad) {
         auto ptr = static_cast<ImplType*>(ptr_);
@@ -67,13 +101,17 @@ public:
             if(with_grad_)
                 -- ptr_->gradcount_;
             ptr->backward(grad);
+            if(ptr_->gradcount_ == 0)
+                ptr_->gradcount_ = ptr_->gradtotal_;
         }
     }
 private:
     void increment_counters() { 
         ++ ptr_->refcount_; 
-        if(with_grad_)
+        if(with_grad_) {
             ++ ptr_->gradcount_;
+            ++ ptr_->gradtotal_;
+        }
     }
 
     void decrease_refcount() {
@@ -90,6 +128,33 @@ private:
 
 
 namespace st {
+// The grad passed by UnaryExpImpl to its operand. Usually a lazy UnaryGradImpl,
+// but the transpose of a GemmGradImpl is another GemmGradImpl, which keeps
+// the GEMM all the way down to the receiving TensorImpl.
+template<typename OpGrad, typename GIType, typename OIType>
+struct __UnaryGrad {
+    using type = UnaryGradImpl<OpGrad, GIType, OIType>;
+    static type make(const GIType& grad, const OIType& operand) {
+        return type(grad, operand);
+    }
+};
+
+template<typename OIType>
+struct __UnaryGrad<op::MatrixTranspose::Grad, GemmGradImpl, OIType> {
+    using type = GemmGradImpl;
+    static type make(const GemmGradImpl& grad, const OIType& operand) {
+        return grad.transposed();
+    }
+};
+
+template<typename OIType>
+struct __UnaryGrad<op::BatchMatrixTranspose::Grad, GemmGradImpl, OIType> {
+    using type = GemmGradImpl;
+    static type make(const GemmGradImpl& grad, const OIType& operand) {
+        return grad.transposed();
+    }
+};
+
 template<typename Op, typename OIType>  // OIType = OperandImplType
 class UnaryExpImpl 
         : public ExpImpl<UnaryExpImpl<Op, OIType>> {
@@ -115,14 +180,20 @@ public:
     }
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
+    const OIType& operand(void) const { return *operand_ptr_; }
+
+    void refresh(void) { operand_ptr_->refresh(); }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
 
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
 
-        UnaryGradImpl<typename Op::Grad, GIType, OIType> out_grad(
-            grad, *operand_ptr_
-        );
+        using OutGrad = __UnaryGrad<typename Op::Grad, GIType, OIType>;
+        typename OutGrad::type out_grad = OutGrad::make(grad, *operand_ptr_);
         operand_ptr_.invoke_backward(out_grad);
     }
 private:
@@ -159,6 +230,18 @@ public:
     bool requires_grad(void) const { 
         return lhs_ptr_->requires_grad() || rhs_ptr_->requires_grad(); 
     }
+    const LhsImplType& lhs(void) const { return *lhs_ptr_; }
+    const RhsImplType& rhs(void) const { return *rhs_ptr_; }
+
+    void refresh(void) {
+        lhs_ptr_->refresh();
+        rhs_ptr_->refresh();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        lhs_ptr_.collect_grad_tensors(tensors);
+        rhs_ptr_.collect_grad_tensors(tensors);
+    }
 
     template<typename GIType>
     void backward(const GIType& grad) {
@@ -225,6 +308,16 @@ public:
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) {
+        operand_ptr_->refresh();
+        op::LogSoftmax::precompute(*operand_ptr_, batch_sum_exp_.get(), 
+                                   batch_max_cls_.get());
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
@@ -270,6 +363,12 @@ public:
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) { operand_ptr_->refresh(); }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
@@ -314,6 +413,12 @@ public:
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) { operand_ptr_->refresh(); }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
@@ -357,6 +462,12 @@ public:
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) { operand_ptr_->refresh(); }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) const {
         THROW_ERROR("NotImplementError for backward of Argmax");
@@ -367,6 +478,14 @@ private:
     index_t reduce_dim_;    
 };
 
+// The labels of a loss against its n_cls classes. A StepGraph replays the
+// loss with the labels of each step, which are checked again on refresh.
+inline void __check_labels(index_t n_batch, index_t n_cls, const index_t* labels) {
+    for(index_t i = 0; i < n_batch; ++i)
+        CHECK_IN_RANGE(labels[i], 0, n_cls,
+            "%d classes got label of %d", n_cls, labels[i]);
+}
+
 template<typename OIType>
 class UnaryExpImpl<op::NLLLoss, OIType>
         : public ExpImpl<UnaryExpImpl<op::NLLLoss, OIType>> {
@@ -394,6 +513,15 @@ public:
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) {
+        operand_ptr_->refresh();
+        __check_labels(operand_ptr_->size(0), operand_ptr_->size(1), batch_label_.get());
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
@@ -408,6 +536,74 @@ private:
     std::shared_ptr<index_t> batch_label_;  
 };
 
+template<typename OIType>
+class UnaryExpImpl<op::CrossEntropy, OIType>
+        : public ExpImpl<UnaryExpImpl<op::CrossEntropy, OIType>> {
+public:
+    using op = op::CrossEntropy;
+    using operand_type = OIType;
+
+    UnaryExpImpl(const OperandImplPtr<OIType>& ptr,
+                 const std::shared_ptr<index_t>& batch_label)
+            : operand_ptr_(ptr, true),
+              batch_label_(batch_label),
+              prob_(Alloc::unique_allocate<data_t>(
+                  sizeof(data_t) * operand_ptr_->size().dsize())) {
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*operand_ptr_); }
+    index_t size(index_t idx) const { return op::size(idx, *operand_ptr_); }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const { return loss_; }
+
+    bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
+
+    // The labels are read again, see StepGraph.
+    void refresh(void) {
+        operand_ptr_->refresh();
+        __check_labels(operand_ptr_->size(0), operand_ptr_->size(1), batch_label_.get());
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        IndexArray inds(1);
+        inds[0] = 0;
+        operand_ptr_.invoke_backward(CrossEntropyGradImpl(
+            operand_ptr_->size(0), operand_ptr_->size(1), prob_.get(), 
+            batch_label_.get(), grad.eval(inds)));
+    }
+private:
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0);
+        loss_ = kernel::cross_entropy_forward(
+            operand_ptr_->size(0), operand_ptr_->size(1),
+            st::op::contiguous_data(*operand_ptr_, x_buffer),
+            batch_label_.get(), prob_.get()
+        );
+    }
+
+    OperandImplPtr<OIType> operand_ptr_;
+    std::shared_ptr<index_t> batch_label_;
+    Alloc::TrivialUniquePtr<data_t> prob_;
+    data_t loss_;
+};
+
+// The patches are written by kernel::im2col when the expression is built,
+// and the grad is summed back by kernel::col2im.
 template<typename OIType>
 class UnaryExpImpl<op::Img2col, OIType>
         : public ExpImpl<UnaryExpImpl<op::Img2col, OIType>> {
@@ -422,7 +618,8 @@ public:
             : operand_ptr_(ptr, true),
               kernel_size_(kernel_size),
               stride_size_(stride_size),
-              padding_size_(padding_size) {
+              padding_size_(padding_size),
+              output_(nullptr, 0) {
         index_t b = operand_ptr_->size(0);
         index_t c = operand_ptr_->size(1);
         index_t h = operand_ptr_->size(2);
@@ -433,6 +630,9 @@ public:
             (w + 2*padding_size_.second - kernel_size_.second) / stride_size_.second + 1;
         shape_.first = out_size_.first * out_size_.second * b;
         shape_.second = c * kernel_size_.first * kernel_size_.second;
+        output_ = Alloc::unique_allocate<data_t>(
+            sizeof(data_t) * shape_.first * shape_.second);
+        forward();
     }
 
     index_t ndim(void) const { return op::Img2col::ndim(*operand_ptr_); }
@@ -448,31 +648,71 @@ public:
     const op::Img2col::Wsize& conv_feat_size(void) const { return out_size_; }
 
     data_t eval(IndexArray& inds) const {
-        return op::Img2col::map(inds, *operand_ptr_, kernel_size_,
-                                  stride_size_, padding_size_, out_size_);
+        return output_.get()[inds[0] * shape_.second + inds[1]];
     }
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) { 
+        operand_ptr_->refresh(); 
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
         CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
 
-        UnaryGradImpl<typename op::Img2col::Grad, GIType, OIType> out_grad(
-            grad, *operand_ptr_, kernel_size_, stride_size_,
-            padding_size_, out_size_
-        );
-        operand_ptr_.invoke_backward(out_grad);
+        auto dcol = Alloc::unique_allocate<data_t>(
+            sizeof(data_t) * shape_.first * shape_.second);
+        IndexArray inds(2);
+        for(index_t i = 0, idx = 0; i < shape_.first; ++i) {
+            inds[0] = i;
+            for(index_t j = 0; j < shape_.second; ++j, ++idx) {
+                inds[1] = j;
+                dcol.get()[idx] = grad.eval(inds);
+            }
+        }
+
+        kernel::Conv2dShape shape = conv_shape();
+        auto dx = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+            * shape.batch * shape.channel * shape.height * shape.width);
+        kernel::col2im(shape, dcol.get(), dx.get());
+        operand_ptr_.invoke_backward(DenseGradImpl(dx.get(), operand_ptr_->size()));
     }
 private:
+    kernel::Conv2dShape conv_shape(void) const {
+        return kernel::Conv2dShape{
+            operand_ptr_->size(0), operand_ptr_->size(1),
+            operand_ptr_->size(2), operand_ptr_->size(3),
+            kernel_size_.first, kernel_size_.second,
+            stride_size_.first, stride_size_.second,
+            padding_size_.first, padding_size_.second
+        };
+    }
+
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> buffer(nullptr, 0);
+        index_t stride[4];
+        const data_t* x = st::op::strided_operand(*operand_ptr_, stride, buffer);
+        kernel::im2col(conv_shape(), x, stride, output_.get());
+    }
+
     OperandImplPtr<OIType> operand_ptr_;
     op::Img2col::Wsize kernel_size_;
     op::Img2col::Wsize stride_size_;
     op::Img2col::Wsize padding_size_;
     op::Img2col::Wsize out_size_;
     op::Img2col::Wsize shape_;
+    Alloc::TrivialUniquePtr<data_t> output_;
 };
 
+// The output is computed by kernel::max_pool2d_forward when the expression
+// is built, along with the argmax of each window, through which the backward
+// scatters the grad.
 template<typename OIType>
 class UnaryExpImpl<op::MaxPool2d, OIType>
         : public ExpImpl<UnaryExpImpl<op::MaxPool2d, OIType>> {
@@ -487,13 +727,16 @@ public:
             : operand_ptr_(ptr, true),
               kernel_size_(kernel_size),
               stride_size_(stride_size),
-              padding_size_(padding_size) {
-        index_t h = operand_ptr_->size(2);
-        index_t w = operand_ptr_->size(3);
-        out_size_.first = 
-            (h + 2*padding_size_.first - kernel_size_.first) / stride_size_.first + 1;
-        out_size_.second = 
-            (w + 2*padding_size_.second - kernel_size_.second) / stride_size_.second + 1;
+              padding_size_(padding_size),
+              output_(nullptr, 0),
+              argmax_(nullptr, 0) {
+        kernel::Conv2dShape shape = conv_shape();
+        out_size_.first = shape.out_h();
+        out_size_.second = shape.out_w();
+        index_t osize = size(0) * size(1) * size(2) * size(3);
+        output_ = Alloc::unique_allocate<data_t>(sizeof(data_t) * osize);
+        argmax_ = Alloc::unique_allocate<index_t>(sizeof(index_t) * osize);
+        forward();
     }
 
     index_t ndim(void) const { return op::MaxPool2d::ndim(*operand_ptr_); }
@@ -508,22 +751,907 @@ public:
     }
 
     data_t eval(IndexArray& inds) const {
-        return op::MaxPool2d::map(inds, *operand_ptr_, kernel_size_,
-                                  stride_size_, padding_size_);
+        return output_.get()[
+            ((inds[0] * size(1) + inds[1]) * size(2) + inds[2]) * size(3) + inds[3]
+        ];
     }
 
     bool requires_grad(void) const { return operand_ptr_->requires_grad(); }
 
+    void refresh(void) { 
+        operand_ptr_->refresh(); 
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+    }
+
     template<typename GIType>
     void backward(const GIType& grad) {
-        THROW_ERROR("NotImplmentError in backward of MaxPool2d");
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        index_t dsize = size(0) * size(1) * size(2) * size(3);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * dsize);
+        IndexArray inds(4);
+        inds.memset(0);
+        for(index_t i = 0; i < dsize; ++i) {
+            dy.get()[i] = grad.eval(inds);
+            for(index_t j = 4; j-- > 0; ) {
+                if(++inds[j] < size(j)) break;
+                inds[j] = 0;
+            }
+        }
+
+        kernel::Conv2dShape shape = conv_shape();
+        auto dx = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+            * shape.batch * shape.channel * shape.height * shape.width);
+        kernel::max_pool2d_backward(shape, dy.get(), argmax_.get(), dx.get());
+        operand_ptr_.invoke_backward(DenseGradImpl(dx.get(), operand_ptr_->size()));
     }
 private:
+    kernel::Conv2dShape conv_shape(void) const {
+        return kernel::Conv2dShape{
+            operand_ptr_->size(0), operand_ptr_->size(1),
+            operand_ptr_->size(2), operand_ptr_->size(3),
+            kernel_size_.first, kernel_size_.second,
+            stride_size_.first, stride_size_.second,
+            padding_size_.first, padding_size_.second
+        };
+    }
+
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> buffer(nullptr, 0);
+        index_t stride[4];
+        const data_t* x = st::op::strided_operand(*operand_ptr_, stride, buffer);
+        kernel::max_pool2d_forward(conv_shape(), x, stride, 
+                                   output_.get(), argmax_.get());
+    }
+
     OperandImplPtr<OIType> operand_ptr_;
     op::MaxPool2d::Wsize kernel_size_;
     op::MaxPool2d::Wsize stride_size_;
     op::MaxPool2d::Wsize padding_size_;
     op::MaxPool2d::Wsize out_size_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+    Alloc::TrivialUniquePtr<index_t> argmax_;
+};
+
+// The transform size of the Winograd or FFT kernels for shape.
+inline op::Conv2d::Wsize __conv_transform_size(kernel::Conv2dAlgorithm algorithm,
+                                               const kernel::Conv2dShape& shape) {
+    op::Conv2d::Wsize transform_size(0, 0);
+    if(algorithm == kernel::Conv2dAlgorithm::winograd) {
+        index_t tile = kernel::winograd_tile(shape);
+        transform_size = op::Conv2d::Wsize(tile, tile);
+    } else if(algorithm == kernel::Conv2dAlgorithm::fft) {
+        kernel::fft_conv2d_size(shape, transform_size.first, transform_size.second);
+    }
+    return transform_size;
+}
+
+template<typename WImplType>
+bool __conv_filter_valid(const op::ConvFilter& filter, const WImplType& weight,
+                         std::true_type) {
+    return filter.weight == weight.data()
+        && filter.version == weight.version()
+        && filter.update_count == weight.update_count();
+}
+template<typename WImplType>
+bool __conv_filter_valid(const op::ConvFilter&, const WImplType&, std::false_type) {
+    return false;
+}
+template<typename WImplType>
+void __stamp_conv_filter(op::ConvFilter& filter, const WImplType& weight,
+                         std::true_type) {
+    filter.weight = weight.data();
+    filter.version = weight.version();
+    filter.update_count = weight.update_count();
+}
+template<typename WImplType>
+void __stamp_conv_filter(op::ConvFilter&, const WImplType&, std::false_type) {}
+
+// The transformed filter of w, the data of weight, for the Winograd or FFT
+// kernels, from the cache or computed again if it is stale. Only the
+// TensorImpl weights are checked, other ones are transformed each time. The
+// returned reference keeps it alive while a kernel reads it.
+template<typename WImplType>
+std::shared_ptr<data_t> __conv_filter(op::ConvFilter& cache,
+                                      kernel::Conv2dAlgorithm algorithm,
+                                      const op::Conv2d::Wsize& transform_size,
+                                      const kernel::Conv2dShape& shape,
+                                      index_t out_channels, const WImplType& weight,
+                                      const data_t* w, const index_t* ws) {
+    using is_tensor = std::is_same<WImplType, TensorImpl>;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(!cache.data || cache.algorithm != algorithm
+            || cache.transform_size != transform_size
+            || !__conv_filter_valid(cache, weight, is_tensor())) {
+        index_t c = shape.channel;
+        if(algorithm == kernel::Conv2dAlgorithm::winograd) {
+            index_t tile = transform_size.first;
+            cache.data = Alloc::shared_allocate<data_t>(
+                sizeof(data_t) * kernel::winograd_filter_size(tile, out_channels, c));
+            kernel::winograd_filter(tile, out_channels, c, w, ws, cache.data.get());
+        } else {
+            cache.data = Alloc::shared_allocate<data_t>(
+                sizeof(data_t) * kernel::fft_filter_size(shape, out_channels));
+            kernel::fft_filter(shape, out_channels, w, ws, cache.data.get());
+        }
+        cache.algorithm = algorithm;
+        cache.transform_size = transform_size;
+        __stamp_conv_filter(cache, weight, is_tensor());
+    }
+    return cache.data;
+}
+
+// The output is computed by the kernels of algorithm when the expression is
+// built. With Winograd or FFT, the filter transform is kept in filter and
+// reused until the weight changes. It is only checked for TensorImpl weights, 
+// other ones are transformed at each forward.
+template<typename LhsImplType, typename RhsImplType>
+class BinaryExpImpl<op::Conv2d, LhsImplType, RhsImplType>
+        : public ExpImpl<BinaryExpImpl<op::Conv2d, LhsImplType, RhsImplType>> {
+public:
+    using op = op::Conv2d;
+    using lhs_type = LhsImplType;
+    using rhs_type = RhsImplType;
+
+    BinaryExpImpl(const OperandImplPtr<LhsImplType>& x_ptr,
+                  const OperandImplPtr<RhsImplType>& weight_ptr,
+                  const op::Conv2d::Wsize& kernel_size,
+                  const op::Conv2d::Wsize& stride_size,
+                  const op::Conv2d::Wsize& padding_size,
+                  index_t groups,
+                  kernel::Conv2dAlgorithm algorithm,
+                  const std::shared_ptr<st::op::ConvFilter>& filter)
+            : lhs_ptr_(x_ptr, true),
+              rhs_ptr_(weight_ptr, true),
+              kernel_size_(kernel_size),
+              stride_size_(stride_size),
+              padding_size_(padding_size),
+              groups_(groups),
+              algorithm_(algorithm),
+              transform_size_(0, 0),
+              filter_(filter),
+              output_(nullptr, 0) {
+        kernel::Conv2dShape shape = conv_shape();
+        out_size_.first = shape.out_h();
+        out_size_.second = shape.out_w();
+        transform_size_ = __conv_transform_size(algorithm_, shape);
+        output_ = Alloc::unique_allocate<data_t>(
+            sizeof(data_t) * size(0) * size(1) * size(2) * size(3));
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*lhs_ptr_, *rhs_ptr_); }
+    index_t size(index_t idx) const { 
+        return op::size(idx, *lhs_ptr_, *rhs_ptr_, out_size_); 
+    }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+    const op::Conv2d::Wsize& conv_feat_size(void) const { return out_size_; }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[
+            ((inds[0] * size(1) + inds[1]) * size(2) + inds[2]) * size(3) + inds[3]
+        ];
+    }
+
+    bool requires_grad(void) const { 
+        return lhs_ptr_->requires_grad() || rhs_ptr_->requires_grad(); 
+    }
+    const LhsImplType& lhs(void) const { return *lhs_ptr_; }
+    const RhsImplType& rhs(void) const { return *rhs_ptr_; }
+
+    void refresh(void) {
+        lhs_ptr_->refresh();
+        rhs_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        lhs_ptr_.collect_grad_tensors(tensors);
+        rhs_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        // dy is read by both grads, so it is gathered once.
+        index_t dsize = size(0) * size(1) * size(2) * size(3);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * dsize);
+        IndexArray inds(4);
+        inds.memset(0);
+        for(index_t i = 0; i < dsize; ++i) {
+            dy.get()[i] = grad.eval(inds);
+            for(index_t j = 4; j-- > 0; ) {
+                if(++inds[j] < size(j)) break;
+                inds[j] = 0;
+            }
+        }
+
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        index_t xs[4], ws[2];
+        const data_t* x = st::op::strided_operand(*lhs_ptr_, xs, x_buffer);
+        const data_t* w = st::op::strided_operand(*rhs_ptr_, ws, w_buffer);
+        kernel::Conv2dShape shape = conv_shape();
+
+        Alloc::TrivialUniquePtr<data_t> dx(nullptr, 0), dw(nullptr, 0);
+        if(lhs_ptr_->requires_grad())
+            dx = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+                * shape.batch * shape.channel * shape.height * shape.width);
+        if(rhs_ptr_->requires_grad())
+            dw = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+                * rhs_ptr_->size(0) * rhs_ptr_->size(1));
+
+        if(algorithm_ == kernel::Conv2dAlgorithm::winograd) {
+            kernel::winograd_backward(shape, transform_size_.first, size(1), x, xs,
+                                      filter(w, ws).get(), dy.get(), dx.get(), dw.get());
+        } else if(algorithm_ == kernel::Conv2dAlgorithm::fft) {
+            kernel::fft_conv2d_backward(shape, size(1), x, xs, filter(w, ws).get(),
+                                        dy.get(), dx.get(), dw.get());
+        } else {
+            if(dx) kernel::conv2d_backward_input(shape, size(1), dy.get(), w, ws, 
+                                                 dx.get(), groups_);
+            if(dw) kernel::conv2d_backward_weight(shape, size(1), x, xs, dy.get(), 
+                                                  dw.get(), groups_);
+        }
+
+        if(dx) lhs_ptr_.invoke_backward(DenseGradImpl(dx.get(), lhs_ptr_->size()));
+        if(dw) rhs_ptr_.invoke_backward(DenseGradImpl(dw.get(), rhs_ptr_->size()));
+    }
+private:
+    kernel::Conv2dShape conv_shape(void) const {
+        return kernel::Conv2dShape{
+            lhs_ptr_->size(0), lhs_ptr_->size(1),
+            lhs_ptr_->size(2), lhs_ptr_->size(3),
+            kernel_size_.first, kernel_size_.second,
+            stride_size_.first, stride_size_.second,
+            padding_size_.first, padding_size_.second
+        };
+    }
+
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        index_t xs[4], ws[2];
+        const data_t* x = st::op::strided_operand(*lhs_ptr_, xs, x_buffer);
+        const data_t* w = st::op::strided_operand(*rhs_ptr_, ws, w_buffer);
+        if(algorithm_ == kernel::Conv2dAlgorithm::winograd)
+            kernel::winograd_forward(conv_shape(), transform_size_.first, size(1), 
+                                     x, xs, filter(w, ws).get(), output_.get());
+        else if(algorithm_ == kernel::Conv2dAlgorithm::fft)
+            kernel::fft_conv2d_forward(conv_shape(), size(1), x, xs, 
+                                       filter(w, ws).get(), output_.get());
+        else
+            kernel::conv2d_forward(conv_shape(), size(1), x, xs, w, ws, 
+                                   output_.get(), groups_);
+    }
+
+    std::shared_ptr<data_t> filter(const data_t* w, const index_t* ws) {
+        return __conv_filter(*filter_, algorithm_, transform_size_, conv_shape(),
+                             size(1), *rhs_ptr_, w, ws);
+    }
+
+    OperandImplPtr<LhsImplType> lhs_ptr_;
+    OperandImplPtr<RhsImplType> rhs_ptr_;
+    op::Conv2d::Wsize kernel_size_;
+    op::Conv2d::Wsize stride_size_;
+    op::Conv2d::Wsize padding_size_;
+    op::Conv2d::Wsize out_size_;
+    index_t groups_;
+    kernel::Conv2dAlgorithm algorithm_;
+    // The Winograd tile or the size of the FFTs.
+    op::Conv2d::Wsize transform_size_;
+    std::shared_ptr<st::op::ConvFilter> filter_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+};
+
+// OIType is always TensorImpl here, see op::conv2d_bias in exp/function.hpp.
+// The output is computed by the kernels of algorithm, direct, Winograd or
+// FFT, with the bias, the activation and the pooling applied as their
+// epilogue. The backward takes the ReLU mask from the output and the pooling
+// one from the saved argmax, then runs the backward of the same algorithm.
+template<typename Act, typename OIType>
+class UnaryExpImpl<op::Conv2dBias<Act>, OIType>
+        : public ExpImpl<UnaryExpImpl<op::Conv2dBias<Act>, OIType>> {
+public:
+    using op = op::Conv2dBias<Act>;
+    using operand_type = OIType;
+
+    UnaryExpImpl(const OperandImplPtr<OIType>& ptr,
+                 const OperandImplPtr<OIType>& weight_ptr,
+                 const OperandImplPtr<OIType>& bias_ptr,
+                 const typename op::Wsize& kernel_size,
+                 const typename op::Wsize& stride_size,
+                 const typename op::Wsize& padding_size,
+                 index_t groups, bool pool,
+                 kernel::Conv2dAlgorithm algorithm,
+                 const std::shared_ptr<st::op::ConvFilter>& filter)
+            : operand_ptr_(ptr, true),
+              weight_ptr_(weight_ptr, true),
+              bias_ptr_(bias_ptr, true),
+              kernel_size_(kernel_size),
+              stride_size_(stride_size),
+              padding_size_(padding_size),
+              groups_(groups),
+              pool_(pool),
+              algorithm_(algorithm),
+              filter_(filter),
+              output_(nullptr, 0),
+              argmax_(nullptr, 0) {
+        kernel::Conv2dShape shape = conv_shape();
+        transform_size_ = __conv_transform_size(algorithm_, shape);
+        out_size_.first = pool_ ? shape.out_h() / 2 : shape.out_h();
+        out_size_.second = pool_ ? shape.out_w() / 2 : shape.out_w();
+        index_t osize = size(0) * size(1) * size(2) * size(3);
+        output_ = Alloc::unique_allocate<data_t>(sizeof(data_t) * osize);
+        if(pool_)
+            argmax_ = Alloc::unique_allocate<index_t>(sizeof(index_t) * osize);
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*operand_ptr_, *weight_ptr_); }
+    index_t size(index_t idx) const { 
+        return op::size(idx, *operand_ptr_, *weight_ptr_, out_size_); 
+    }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[
+            ((inds[0] * size(1) + inds[1]) * size(2) + inds[2]) * size(3) + inds[3]
+        ];
+    }
+
+    bool requires_grad(void) const { 
+        return operand_ptr_->requires_grad() || weight_ptr_->requires_grad()
+            || bias_ptr_->requires_grad();
+    }
+
+    void refresh(void) {
+        operand_ptr_->refresh();
+        weight_ptr_->refresh();
+        bias_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+        weight_ptr_.collect_grad_tensors(tensors);
+        bias_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        index_t dsize = size(0) * size(1) * size(2) * size(3);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * dsize);
+        IndexArray inds(4);
+        inds.memset(0);
+        for(index_t i = 0; i < dsize; ++i) {
+            dy.get()[i] = grad.eval(inds);
+            for(index_t j = 4; j-- > 0; ) {
+                if(++inds[j] < size(j)) break;
+                inds[j] = 0;
+            }
+        }
+
+        kernel::Conv2dShape shape = conv_shape();
+        index_t oc = size(1);
+        kernel::Conv2dEpilogue ep = epilogue(nullptr);
+        auto dconv = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+            * shape.batch * oc * shape.out_h() * shape.out_w());
+        Alloc::TrivialUniquePtr<data_t> db(nullptr, 0);
+        if(bias_ptr_->requires_grad())
+            db = Alloc::unique_allocate<data_t>(sizeof(data_t) * oc);
+        kernel::conv2d_epilogue_backward(shape, oc, ep, output_.get(), dy.get(),
+                                         dconv.get(), db.get());
+        dy.reset();
+
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        index_t xs[4], ws[2];
+        const data_t* x = st::op::strided_operand(*operand_ptr_, xs, x_buffer);
+        const data_t* w = st::op::strided_operand(*weight_ptr_, ws, w_buffer);
+        Alloc::TrivialUniquePtr<data_t> dx(nullptr, 0), dw(nullptr, 0);
+        if(operand_ptr_->requires_grad())
+            dx = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+                * shape.batch * shape.channel * shape.height * shape.width);
+        if(weight_ptr_->requires_grad())
+            dw = Alloc::unique_allocate<data_t>(sizeof(data_t) 
+                * weight_ptr_->size(0) * weight_ptr_->size(1));
+
+        if(algorithm_ == kernel::Conv2dAlgorithm::winograd) {
+            kernel::winograd_backward(shape, transform_size_.first, oc, x, xs,
+                                      filter(w, ws).get(), dconv.get(), 
+                                      dx.get(), dw.get());
+        } else if(algorithm_ == kernel::Conv2dAlgorithm::fft) {
+            kernel::fft_conv2d_backward(shape, oc, x, xs, filter(w, ws).get(),
+                                        dconv.get(), dx.get(), dw.get());
+        } else {
+            if(dx) kernel::conv2d_backward_input(shape, oc, dconv.get(), w, ws, 
+                                                 dx.get(), groups_);
+            if(dw) kernel::conv2d_backward_weight(shape, oc, x, xs, dconv.get(), 
+                                                  dw.get(), groups_);
+        }
+
+        if(dx) operand_ptr_.invoke_backward(DenseGradImpl(dx.get(), operand_ptr_->size()));
+        if(dw) weight_ptr_.invoke_backward(DenseGradImpl(dw.get(), weight_ptr_->size()));
+        if(db) bias_ptr_.invoke_backward(DenseGradImpl(db.get(), bias_ptr_->size()));
+    }
+private:
+    kernel::Conv2dShape conv_shape(void) const {
+        return kernel::Conv2dShape{
+            operand_ptr_->size(0), operand_ptr_->size(1),
+            operand_ptr_->size(2), operand_ptr_->size(3),
+            kernel_size_.first, kernel_size_.second,
+            stride_size_.first, stride_size_.second,
+            padding_size_.first, padding_size_.second
+        };
+    }
+
+    kernel::Conv2dEpilogue epilogue(const data_t* bias) const {
+        return kernel::Conv2dEpilogue{bias, op::activation, pool_, argmax_.get()};
+    }
+
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        Alloc::TrivialUniquePtr<data_t> b_buffer(nullptr, 0);
+        index_t xs[4], ws[2];
+        const data_t* x = st::op::strided_operand(*operand_ptr_, xs, x_buffer);
+        const data_t* w = st::op::strided_operand(*weight_ptr_, ws, w_buffer);
+        kernel::Conv2dEpilogue ep = epilogue(
+            st::op::contiguous_data(*bias_ptr_, b_buffer));
+        if(algorithm_ == kernel::Conv2dAlgorithm::winograd)
+            kernel::winograd_forward(conv_shape(), transform_size_.first, size(1),
+                                     x, xs, filter(w, ws).get(), output_.get(), &ep);
+        else if(algorithm_ == kernel::Conv2dAlgorithm::fft)
+            kernel::fft_conv2d_forward(conv_shape(), size(1), x, xs,
+                                       filter(w, ws).get(), output_.get(), &ep);
+        else
+            kernel::conv2d_forward(conv_shape(), size(1), x, xs, w, ws, 
+                                   output_.get(), groups_, &ep);
+    }
+
+    std::shared_ptr<data_t> filter(const data_t* w, const index_t* ws) {
+        return __conv_filter(*filter_, algorithm_, transform_size_, conv_shape(),
+                             size(1), *weight_ptr_, w, ws);
+    }
+
+    OperandImplPtr<OIType> operand_ptr_;
+    OperandImplPtr<OIType> weight_ptr_;
+    OperandImplPtr<OIType> bias_ptr_;
+    typename op::Wsize kernel_size_;
+    typename op::Wsize stride_size_;
+    typename op::Wsize padding_size_;
+    // Size of the output, after the pooling.
+    typename op::Wsize out_size_;
+    index_t groups_;
+    bool pool_;
+    kernel::Conv2dAlgorithm algorithm_;
+    // The Winograd tile or the size of the FFTs.
+    typename op::Wsize transform_size_;
+    std::shared_ptr<st::op::ConvFilter> filter_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+    Alloc::TrivialUniquePtr<index_t> argmax_;
+};
+
+// OIType is always TensorImpl here, see op::linear in exp/function.hpp. It is
+// kept as a parameter since TensorImpl is incomplete in this file.
+template<typename Act, typename OIType>
+class UnaryExpImpl<op::Linear<Act>, OIType>
+        : public ExpImpl<UnaryExpImpl<op::Linear<Act>, OIType>> {
+public:
+    using op = op::Linear<Act>;
+    using operand_type = OIType;
+
+    UnaryExpImpl(const OperandImplPtr<OIType>& ptr,
+                 const OperandImplPtr<OIType>& weight_ptr,
+                 const OperandImplPtr<OIType>& bias_ptr)
+            : operand_ptr_(ptr, true),
+              weight_ptr_(weight_ptr, true),
+              bias_ptr_(bias_ptr, true),
+              output_(Alloc::unique_allocate<data_t>(
+                  sizeof(data_t) * size(0) * size(1))) {
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*operand_ptr_, *weight_ptr_); }
+    index_t size(index_t idx) const { 
+        return op::size(idx, *operand_ptr_, *weight_ptr_); 
+    }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[inds[0] * size(1) + inds[1]];
+    }
+
+    bool requires_grad(void) const { 
+        return operand_ptr_->requires_grad() || weight_ptr_->requires_grad()
+            || bias_ptr_->requires_grad();
+    }
+
+    void refresh(void) {
+        operand_ptr_->refresh();
+        weight_ptr_->refresh();
+        bias_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+        weight_ptr_.collect_grad_tensors(tensors);
+        bias_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        index_t n = size(0), k = operand_ptr_->size(1), m = size(1);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * n * m);
+        IndexArray inds(2);
+        for(index_t i = 0; i < n; ++i) {
+            inds[0] = i;
+            for(index_t j = 0; j < m; ++j) {
+                inds[1] = j;
+                dy.get()[i * m + j] = grad.eval(inds);
+            }
+        }
+
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        Alloc::TrivialUniquePtr<data_t> dx(nullptr, 0), dw(nullptr, 0), db(nullptr, 0);
+        if(operand_ptr_->requires_grad())
+            dx = Alloc::unique_allocate<data_t>(sizeof(data_t) * n * k);
+        if(weight_ptr_->requires_grad())
+            dw = Alloc::unique_allocate<data_t>(sizeof(data_t) * m * k);
+        if(bias_ptr_->requires_grad())
+            db = Alloc::unique_allocate<data_t>(sizeof(data_t) * m);
+
+        kernel::linear_backward(
+            n, k, m, 
+            st::op::contiguous_data(*operand_ptr_, x_buffer),
+            st::op::contiguous_data(*weight_ptr_, w_buffer),
+            output_.get(), dy.get(), dx.get(), dw.get(), db.get(), 
+            op::activation
+        );
+
+        if(dx) operand_ptr_.invoke_backward(DenseGradImpl(dx.get(), operand_ptr_->size()));
+        if(dw) weight_ptr_.invoke_backward(DenseGradImpl(dw.get(), weight_ptr_->size()));
+        if(db) bias_ptr_.invoke_backward(DenseGradImpl(db.get(), bias_ptr_->size()));
+    }
+private:
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), w_buffer(nullptr, 0);
+        Alloc::TrivialUniquePtr<data_t> b_buffer(nullptr, 0);
+        kernel::linear_forward(
+            size(0), operand_ptr_->size(1), size(1),
+            st::op::contiguous_data(*operand_ptr_, x_buffer),
+            st::op::contiguous_data(*weight_ptr_, w_buffer),
+            st::op::contiguous_data(*bias_ptr_, b_buffer),
+            output_.get(), op::activation
+        );
+    }
+
+    OperandImplPtr<OIType> operand_ptr_;
+    OperandImplPtr<OIType> weight_ptr_;
+    OperandImplPtr<OIType> bias_ptr_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+};
+
+// The weight is given by its pattern, shared with the SparseTensor it comes
+// from, and by its stored values, an operand like x and bias.
+template<typename Act, typename OIType>
+class UnaryExpImpl<op::SparseLinear<Act>, OIType>
+        : public ExpImpl<UnaryExpImpl<op::SparseLinear<Act>, OIType>> {
+public:
+    using op = op::SparseLinear<Act>;
+    using operand_type = OIType;
+
+    UnaryExpImpl(const OperandImplPtr<OIType>& ptr,
+                 const std::shared_ptr<const kernel::SparsePattern>& pattern,
+                 const OperandImplPtr<OIType>& values_ptr,
+                 const OperandImplPtr<OIType>& bias_ptr)
+            : operand_ptr_(ptr, true),
+              pattern_(pattern),
+              values_ptr_(values_ptr, true),
+              bias_ptr_(bias_ptr, true),
+              output_(Alloc::unique_allocate<data_t>(
+                  sizeof(data_t) * size(0) * size(1))) {
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*operand_ptr_, *pattern_); }
+    index_t size(index_t idx) const { 
+        return op::size(idx, *operand_ptr_, *pattern_); 
+    }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[inds[0] * size(1) + inds[1]];
+    }
+
+    bool requires_grad(void) const { 
+        return operand_ptr_->requires_grad() || values_ptr_->requires_grad()
+            || bias_ptr_->requires_grad();
+    }
+
+    void refresh(void) {
+        operand_ptr_->refresh();
+        values_ptr_->refresh();
+        bias_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        operand_ptr_.collect_grad_tensors(tensors);
+        values_ptr_.collect_grad_tensors(tensors);
+        bias_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        index_t n = size(0), k = operand_ptr_->size(1), m = size(1);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * n * m);
+        IndexArray inds(2);
+        for(index_t i = 0; i < n; ++i) {
+            inds[0] = i;
+            for(index_t j = 0; j < m; ++j) {
+                inds[1] = j;
+                dy.get()[i * m + j] = grad.eval(inds);
+            }
+        }
+
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), v_buffer(nullptr, 0);
+        Alloc::TrivialUniquePtr<data_t> dx(nullptr, 0), dv(nullptr, 0), db(nullptr, 0);
+        if(operand_ptr_->requires_grad())
+            dx = Alloc::unique_allocate<data_t>(sizeof(data_t) * n * k);
+        if(values_ptr_->requires_grad())
+            dv = Alloc::unique_allocate<data_t>(sizeof(data_t) * pattern_->nnz());
+        if(bias_ptr_->requires_grad())
+            db = Alloc::unique_allocate<data_t>(sizeof(data_t) * m);
+
+        kernel::sparse_linear_backward(
+            n, *pattern_,
+            st::op::contiguous_data(*values_ptr_, v_buffer),
+            st::op::contiguous_data(*operand_ptr_, x_buffer),
+            output_.get(), dy.get(), dx.get(), dv.get(), db.get(), 
+            op::activation
+        );
+
+        if(dx) operand_ptr_.invoke_backward(DenseGradImpl(dx.get(), operand_ptr_->size()));
+        if(dv) values_ptr_.invoke_backward(DenseGradImpl(dv.get(), values_ptr_->size()));
+        if(db) bias_ptr_.invoke_backward(DenseGradImpl(db.get(), bias_ptr_->size()));
+    }
+private:
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> x_buffer(nullptr, 0), v_buffer(nullptr, 0);
+        Alloc::TrivialUniquePtr<data_t> b_buffer(nullptr, 0);
+        kernel::sparse_linear_forward(
+            size(0), *pattern_,
+            st::op::contiguous_data(*values_ptr_, v_buffer),
+            st::op::contiguous_data(*operand_ptr_, x_buffer),
+            st::op::contiguous_data(*bias_ptr_, b_buffer),
+            output_.get(), op::activation
+        );
+    }
+
+    OperandImplPtr<OIType> operand_ptr_;
+    std::shared_ptr<const kernel::SparsePattern> pattern_;
+    OperandImplPtr<OIType> values_ptr_;
+    OperandImplPtr<OIType> bias_ptr_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+};
+
+template<typename LhsImplType, typename RhsImplType>
+class BinaryExpImpl<op::MatrixMul, LhsImplType, RhsImplType>
+        : public ExpImpl<BinaryExpImpl<op::MatrixMul, LhsImplType, RhsImplType>> {
+public:
+    using op = op::MatrixMul;
+    using lhs_type = LhsImplType;
+    using rhs_type = RhsImplType;
+
+    BinaryExpImpl(const OperandImplPtr<LhsImplType>& lhs_ptr,
+                  const OperandImplPtr<RhsImplType>& rhs_ptr)
+            : lhs_ptr_(lhs_ptr, true),
+              rhs_ptr_(rhs_ptr, true),
+              output_(Alloc::unique_allocate<data_t>(
+                  sizeof(data_t) * size(0) * size(1))) {
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*lhs_ptr_, *rhs_ptr_); }
+    index_t size(index_t idx) const { return op::size(idx, *lhs_ptr_, *rhs_ptr_); }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[inds[0] * size(1) + inds[1]];
+    }
+
+    bool requires_grad(void) const { 
+        return lhs_ptr_->requires_grad() || rhs_ptr_->requires_grad(); 
+    }
+    const LhsImplType& lhs(void) const { return *lhs_ptr_; }
+    const RhsImplType& rhs(void) const { return *rhs_ptr_; }
+
+    void refresh(void) {
+        lhs_ptr_->refresh();
+        rhs_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        lhs_ptr_.collect_grad_tensors(tensors);
+        rhs_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        // dy is read by both products, so it is gathered once.
+        index_t m = size(0), n = size(1), k = lhs_ptr_->size(1);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * m * n);
+        IndexArray inds(2);
+        for(index_t i = 0; i < m; ++i) {
+            inds[0] = i;
+            for(index_t j = 0; j < n; ++j) {
+                inds[1] = j;
+                dy.get()[i * n + j] = grad.eval(inds);
+            }
+        }
+
+        Alloc::TrivialUniquePtr<data_t> lhs_buffer(nullptr, 0), rhs_buffer(nullptr, 0);
+        index_t ls[2], rs[2];
+        const data_t* lhs = st::op::strided_operand(*lhs_ptr_, ls, lhs_buffer);
+        const data_t* rhs = st::op::strided_operand(*rhs_ptr_, rs, rhs_buffer);
+
+        // d_lhs = dy * rhs^T, d_rhs = lhs^T * dy
+        lhs_ptr_.invoke_backward(GemmGradImpl(
+            m, k, n, dy.get(), n, 1, rhs, rs[1], rs[0]
+        ));
+        rhs_ptr_.invoke_backward(GemmGradImpl(
+            k, n, m, lhs, ls[1], ls[0], dy.get(), n, 1
+        ));
+    }
+private:
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> lhs_buffer(nullptr, 0), rhs_buffer(nullptr, 0);
+        index_t ls[2], rs[2];
+        const data_t* lhs = st::op::strided_operand(*lhs_ptr_, ls, lhs_buffer);
+        const data_t* rhs = st::op::strided_operand(*rhs_ptr_, rs, rhs_buffer);
+        kernel::gemm(size(0), size(1), lhs_ptr_->size(1), 
+                     lhs, ls[0], ls[1], rhs, rs[0], rs[1],
+                     output_.get(), size(1));
+    }
+
+    OperandImplPtr<LhsImplType> lhs_ptr_;
+    OperandImplPtr<RhsImplType> rhs_ptr_;
+    Alloc::TrivialUniquePtr<data_t> output_;
+};
+
+template<typename LhsImplType, typename RhsImplType>
+class BinaryExpImpl<op::BatchMatrixMul, LhsImplType, RhsImplType>
+        : public ExpImpl<BinaryExpImpl<op::BatchMatrixMul, LhsImplType, RhsImplType>> {
+public:
+    using op = op::BatchMatrixMul;
+    using lhs_type = LhsImplType;
+    using rhs_type = RhsImplType;
+
+    BinaryExpImpl(const OperandImplPtr<LhsImplType>& lhs_ptr,
+                  const OperandImplPtr<RhsImplType>& rhs_ptr)
+            : lhs_ptr_(lhs_ptr, true),
+              rhs_ptr_(rhs_ptr, true),
+              output_(Alloc::unique_allocate<data_t>(
+                  sizeof(data_t) * size(0) * size(1) * size(2))) {
+        forward();
+    }
+
+    index_t ndim(void) const { return op::ndim(*lhs_ptr_, *rhs_ptr_); }
+    index_t size(index_t idx) const { return op::size(idx, *lhs_ptr_, *rhs_ptr_); }
+    IndexArray size(void) const {
+        IndexArray shape(ndim());
+        for(index_t i = 0; i < shape.size(); ++i)
+            shape[i] = size(i);
+        return shape;
+    }
+
+    data_t eval(IndexArray& inds) const {
+        return output_.get()[(inds[0] * size(1) + inds[1]) * size(2) + inds[2]];
+    }
+
+    bool requires_grad(void) const { 
+        return lhs_ptr_->requires_grad() || rhs_ptr_->requires_grad(); 
+    }
+    const LhsImplType& lhs(void) const { return *lhs_ptr_; }
+    const RhsImplType& rhs(void) const { return *rhs_ptr_; }
+
+    void refresh(void) {
+        lhs_ptr_->refresh();
+        rhs_ptr_->refresh();
+        forward();
+    }
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        lhs_ptr_.collect_grad_tensors(tensors);
+        rhs_ptr_.collect_grad_tensors(tensors);
+    }
+
+    template<typename GIType>
+    void backward(const GIType& grad) {
+        CHECK_EQUAL(this->gradcount(), 0, "Reused ExpImpl can't be backward.");
+
+        index_t batch = size(0), m = size(1), n = size(2), k = lhs_ptr_->size(2);
+        auto dy = Alloc::unique_allocate<data_t>(sizeof(data_t) * batch * m * n);
+        IndexArray inds(3);
+        for(index_t t = 0, idx = 0; t < batch; ++t) {
+            inds[0] = t;
+            for(index_t i = 0; i < m; ++i) {
+                inds[1] = i;
+                for(index_t j = 0; j < n; ++j, ++idx) {
+                    inds[2] = j;
+                    dy.get()[idx] = grad.eval(inds);
+                }
+            }
+        }
+
+        Alloc::TrivialUniquePtr<data_t> lhs_buffer(nullptr, 0), rhs_buffer(nullptr, 0);
+        index_t ls[3], rs[3];
+        const data_t* lhs = st::op::strided_operand(*lhs_ptr_, ls, lhs_buffer);
+        const data_t* rhs = st::op::strided_operand(*rhs_ptr_, rs, rhs_buffer);
+
+        // d_lhs = dy * rhs^T, d_rhs = lhs^T * dy, for each item. The grad of
+        // an operand with a batch of 1 is summed over the batch.
+        lhs_ptr_.invoke_backward(GemmGradImpl(
+            batch, lhs_ptr_->size(0), m, k, n, 
+            dy.get(), m * n, n, 1, rhs, rs[0], rs[2], rs[1]
+        ));
+        rhs_ptr_.invoke_backward(GemmGradImpl(
+            batch, rhs_ptr_->size(0), k, n, m, 
+            lhs, ls[0], ls[2], ls[1], dy.get(), m * n, n, 1
+        ));
+    }
+private:
+    void forward(void) {
+        Alloc::TrivialUniquePtr<data_t> lhs_buffer(nullptr, 0), rhs_buffer(nullptr, 0);
+        index_t ls[3], rs[3];
+        const data_t* lhs = st::op::strided_operand(*lhs_ptr_, ls, lhs_buffer);
+        const data_t* rhs = st::op::strided_operand(*rhs_ptr_, rs, rhs_buffer);
+        kernel::batch_gemm(size(0), size(1), size(2), lhs_ptr_->size(2),
+                           lhs, ls[0], ls[1], ls[2], rhs, rs[0], rs[1], rs[2],
+                           output_.get(), size(1) * size(2), size(2));
+    }
+
+    OperandImplPtr<LhsImplType> lhs_ptr_;
+    OperandImplPtr<RhsImplType> rhs_ptr_;
+    Alloc::TrivialUniquePtr<data_t> output_;
 };
 
 template<>
@@ -550,6 +1678,11 @@ public:
     }
 
     bool requires_grad(void) const { return false; }
+    data_t value(void) const { return value_; }
+
+    void refresh(void) {}
+
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {}
 
     template<typename GIType>
     void backward(const GIType& grad) {
@@ -562,4 +1695,35 @@ private:
 };
 
 }  // namespace st
+
+
+// Compile-time cost of an expression. Every operator declares whether it is
+// evaluated lazily at O(n) or more per element, like the reductions and
+// LogSoftmax. Operators computed when the expression is built, like MatrixMul,
+// Conv2d or Linear, read their result in O(1) and are not expensive. An
+// expression is expensive if its operator or any operand is. Operators which
+// read each element of their operands more than once use this to decide
+// whether an operand should be materialized first, see exp/function.hpp.
+namespace st {
+
+template<typename ImplType>
+struct __is_expensive : public std::false_type {};
+
+template<typename Op, typename OIType>
+struct __is_expensive<UnaryExpImpl<Op, OIType>>
+        : public std::integral_constant<bool, 
+            Op::is_expensive::value || __is_expensive<OIType>::value> {};
+
+template<typename Op, typename LhsImplType, typename RhsImplType>
+struct __is_expensive<BinaryExpImpl<Op, LhsImplType, RhsImplType>>
+        : public std::integral_constant<bool, 
+            Op::is_expensive::value 
+            || __is_expensive<LhsImplType>::value
+            || __is_expensive<RhsImplType>::value> {};
+
+template<typename ImplType>
+using __materialized_t = typename std::conditional<
+    __is_expensive<ImplType>::value, TensorImpl, ImplType>::type;
+
+}  // namespace st
 #endif
\ No newline at end of file
@@ -9,13 +9,17 @@
 #include "utils/exception.hpp"
 #include "exp/exp_impl.hpp"
 #include "exp/exp.hpp"
+#include "tensor/tensor.hpp"
+#include "tensor/sparse_tensor.hpp"
 
 #include "exp/operator/basic_op.hpp"
 #include "exp/operator/matrix_op.hpp"
 #include "exp/operator/reduce_op.hpp"
 #include "exp/operator/nll_loss.hpp"
 #include "exp/operator/log_softmax.hpp"
+#include "exp/operator/cross_entropy.hpp"
 #include "exp/operator/conv.hpp"
+#include "exp/operator/linear.hpp"
 
 namespace st {
 
@@ -43,6 +47,24 @@ __binary_operation_function(const Exp<LhsImplType>& lhs, const Exp<RhsImplType>&
     );
 }
 
+// Operators like MatrixMul read every element of their operands many times.
+// If an operand is an expensive expression, evaluate it into a temporary
+// Tensor once instead of recomputing it for every read. The temporary keeps
+// the grad_fn of the expression, so backward is not affected.
+template<typename ImplType>
+typename std::enable_if<!__is_expensive<ImplType>::value,
+                        const Exp<ImplType>&>::type
+__materialize(const Exp<ImplType>& operand) {
+    return operand;
+}
+
+template<typename ImplType>
+typename std::enable_if<__is_expensive<ImplType>::value,
+                        Tensor>::type
+__materialize(const Exp<ImplType>& operand) {
+    return Tensor(operand);
+}
+
 template<typename LhsImplType, typename RhsImplType>
 typename std::enable_if<LhsImplType::op::Grad::allow_broadcast::value 
                      && RhsImplType::op::Grad::allow_broadcast::value,
@@ -139,7 +161,8 @@ batch_matrix_transpose(const Exp<OIType>& operand) {
 }
 
 template<typename LhsImplType, typename RhsImplType>
-Exp<BinaryExpImpl<MatrixMul, LhsImplType, RhsImplType>>
+Exp<BinaryExpImpl<MatrixMul, __materialized_t<LhsImplType>, 
+                  __materialized_t<RhsImplType>>>
 matrix_mul(const Exp<LhsImplType>& lhs, const Exp<RhsImplType>& rhs) {
     auto& lhs_impl = lhs.impl();
     auto& rhs_impl = rhs.impl();
@@ -149,34 +172,115 @@ matrix_mul(const Exp<LhsImplType>& lhs, const Exp<RhsImplType>& rhs) {
     CHECK_EQUAL(lhs_impl.size(1), rhs_impl.size(0), 
         "Size mismatch, m1: [%d, %d], m2: [%d, %d].",
         lhs_impl.size(0), lhs_impl.size(1), rhs_impl.size(0), rhs_impl.size(1));
-    return __binary_operation_function<MatrixMul, LhsImplType, RhsImplType>(lhs, rhs);
+    return __binary_operation_function<MatrixMul, __materialized_t<LhsImplType>,
+                                       __materialized_t<RhsImplType>>(
+        __materialize(lhs), __materialize(rhs)
+    );
 }
 
 template<typename LhsImplType, typename RhsImplType>
-Exp<BinaryExpImpl<BatchMatrixMul, LhsImplType, RhsImplType>>
+Exp<BinaryExpImpl<BatchMatrixMul, __materialized_t<LhsImplType>, 
+                  __materialized_t<RhsImplType>>>
 batch_matrix_mul(const Exp<LhsImplType>& lhs, const Exp<RhsImplType>& rhs) {
     auto& lhs_impl = lhs.impl();
     auto& rhs_impl = rhs.impl();
     CHECK_TRUE(lhs_impl.ndim() == 3 && rhs_impl.ndim() == 3, 
         "Baths of Matrices expected, got %dD and %dD Tensor。", 
         lhs_impl.ndim(), rhs_impl.ndim());
-    CHECK_TRUE(lhs_impl.size(0) == rhs_impl.size(0),
+    // a batch of 1 is broadcasted to the other one
+    CHECK_TRUE(lhs_impl.size(0) == rhs_impl.size(0) 
+            || lhs_impl.size(0) == 1 || rhs_impl.size(0) == 1,
         "Bath sizes, %d and %d, doesn't match.",
         lhs_impl.size(0), rhs_impl.size(0));
     CHECK_EQUAL(lhs_impl.size(2), rhs_impl.size(1),
         "Size mismatch, m1: [%d, %d], m2: [%d, %d].",
         lhs_impl.size(1), lhs_impl.size(2), rhs_impl.size(1), rhs_impl.size(2));
-    return __binary_operation_function<BatchMatrixMul, LhsImplType, RhsImplType>(lhs, rhs);
+    return __binary_operation_function<BatchMatrixMul, __materialized_t<LhsImplType>,
+                                       __materialized_t<RhsImplType>>(
+        __materialize(lhs), __materialize(rhs)
+    );
+}
+
+// function for linear, act(x * weight^T + bias) computed by one fused kernel
+template<typename Act>
+Exp<UnaryExpImpl<Linear<Act>, TensorImpl>>
+__linear(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight, 
+         const Exp<TensorImpl>& bias) {
+    auto& x_impl = x.impl();
+    auto& weight_impl = weight.impl();
+    auto& bias_impl = bias.impl();
+    CHECK_TRUE(x_impl.ndim() == 2 && weight_impl.ndim() == 2, 
+        "Matrices expected, got %dD and %dD Tensor.", 
+        x_impl.ndim(), weight_impl.ndim());
+    CHECK_EQUAL(x_impl.size(1), weight_impl.size(1), 
+        "Size mismatch, x: [%d, %d], weight: [%d, %d].",
+        x_impl.size(0), x_impl.size(1), weight_impl.size(0), weight_impl.size(1));
+    CHECK_EQUAL(bias_impl.size().dsize(), weight_impl.size(0),
+        "Bias of %d elements for %d output features.",
+        bias_impl.size().dsize(), weight_impl.size(0));
+    return Exp<UnaryExpImpl<Linear<Act>, TensorImpl>>(
+        Alloc::unique_construct<UnaryExpImpl<Linear<Act>, TensorImpl>>(
+            x.impl_ptr(), weight.impl_ptr(), bias.impl_ptr()
+        )
+    );
+}
+
+inline Exp<UnaryExpImpl<Linear<Identity>, TensorImpl>>
+linear(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight, 
+       const Exp<TensorImpl>& bias) {
+    return __linear<Identity>(x, weight, bias);
+}
+
+inline Exp<UnaryExpImpl<Linear<ReLU>, TensorImpl>>
+linear_relu(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight, 
+            const Exp<TensorImpl>& bias) {
+    return __linear<ReLU>(x, weight, bias);
+}
+
+// function for linear with a sparse weight, whose stored values get the grad
+template<typename Act>
+Exp<UnaryExpImpl<SparseLinear<Act>, TensorImpl>>
+__sparse_linear(const Exp<TensorImpl>& x, const SparseTensor& weight, 
+                const Exp<TensorImpl>& bias) {
+    auto& x_impl = x.impl();
+    auto& bias_impl = bias.impl();
+    CHECK_EQUAL(x_impl.ndim(), 2, "Matrix expected, got %dD Tensor.", x_impl.ndim());
+    CHECK_EQUAL(x_impl.size(1), weight.size(1), 
+        "Size mismatch, x: [%d, %d], weight: [%d, %d].",
+        x_impl.size(0), x_impl.size(1), weight.size(0), weight.size(1));
+    CHECK_EQUAL(bias_impl.size().dsize(), weight.size(0),
+        "Bias of %d elements for %d output features.",
+        bias_impl.size().dsize(), weight.size(0));
+    return Exp<UnaryExpImpl<SparseLinear<Act>, TensorImpl>>(
+        Alloc::unique_construct<UnaryExpImpl<SparseLinear<Act>, TensorImpl>>(
+            x.impl_ptr(), weight.pattern(), weight.values().impl_ptr(), 
+            bias.impl_ptr()
+        )
+    );
+}
+
+inline Exp<UnaryExpImpl<SparseLinear<Identity>, TensorImpl>>
+sparse_linear(const Exp<TensorImpl>& x, const SparseTensor& weight, 
+              const Exp<TensorImpl>& bias) {
+    return __sparse_linear<Identity>(x, weight, bias);
+}
+
+inline Exp<UnaryExpImpl<SparseLinear<ReLU>, TensorImpl>>
+sparse_linear_relu(const Exp<TensorImpl>& x, const SparseTensor& weight, 
+                   const Exp<TensorImpl>& bias) {
+    return __sparse_linear<ReLU>(x, weight, bias);
 }
 
 // function for log_softmax
 template<typename OIType>
-Exp<UnaryExpImpl<LogSoftmax, OIType>>
+Exp<UnaryExpImpl<LogSoftmax, __materialized_t<OIType>>>
 log_softmax(const Exp<OIType>& operand) {
     CHECK_EQUAL(operand.impl().ndim(), 2, 
         "log_softmax Only supported for 2D Tensor, but got a %dD one", 
         operand.impl().ndim());
-    return __unary_operation_function<LogSoftmax, OIType>(operand);
+    return __unary_operation_function<LogSoftmax, __materialized_t<OIType>>(
+        __materialize(operand)
+    );
 }
 
 
@@ -194,15 +298,17 @@ mean(const Exp<OIType>& operand, index_t dim) {
     );
 }
 
+// Backward of Max rescans the reduced dimension for every element.
 template<typename OIType>
-Exp<UnaryExpImpl<Max, OIType>>
+Exp<UnaryExpImpl<Max, __materialized_t<OIType>>>
 max(const Exp<OIType>& operand, index_t dim) {
     CHECK_IN_RANGE(dim, 0, operand.impl().ndim(), 
         "Dimension out of range (expected to be in range of [0, %d), but got %d)",
         operand.impl().ndim(), dim);
-    return Exp<UnaryExpImpl<Max, OIType>>(
-        Alloc::unique_construct<UnaryExpImpl<Max, OIType>>(
-            operand.impl_ptr(), dim
+    using OperandImplType = __materialized_t<OIType>;
+    return Exp<UnaryExpImpl<Max, OperandImplType>>(
+        Alloc::unique_construct<UnaryExpImpl<Max, OperandImplType>>(
+            __materialize(operand).impl_ptr(), dim
         )
     );
 }
@@ -276,9 +382,49 @@ nll_loss(const Exp<OIType>& operand,
     );
 }
 
+// function for cross_entropy, the fused mean(nll_loss(log_softmax(x)))
+template<typename OIType>
+Exp<UnaryExpImpl<CrossEntropy, __materialized_t<OIType>>>
+cross_entropy(const Exp<OIType>& operand,
+              const std::shared_ptr<index_t>& labels_ptr,
+              index_t n_label=-1) {
+    CHECK_EQUAL(operand.impl().ndim(), 2, 
+        "Cross entropy is only supported for 2D Tensor, but got %dD one.", 
+        operand.impl().ndim());
+
+    index_t n_batch = operand.impl().size(0);
+    index_t n_cls = operand.impl().size(1);
+    CHECK_TRUE(n_label == -1 || n_label == n_batch,
+        "Batch size mismatch, x: %d, labels: %d", n_batch, n_label);
+
+    auto labels = labels_ptr.get();
+    for(index_t i = 0; i < n_batch; ++i)
+        CHECK_IN_RANGE(labels[i], 0, n_cls,
+            "%d classes got label of %d", n_cls, labels[i]);
+
+    using OperandImplType = __materialized_t<OIType>;
+    return Exp<UnaryExpImpl<CrossEntropy, OperandImplType>>(
+        Alloc::unique_construct<UnaryExpImpl<CrossEntropy, OperandImplType>>(
+            __materialize(operand).impl_ptr(), labels_ptr
+        )
+    );
+}
+
+template<typename OIType>
+Exp<UnaryExpImpl<CrossEntropy, __materialized_t<OIType>>>
+cross_entropy(const Exp<OIType>& operand, 
+              const index_t* labels, 
+              index_t n_label=-1) {
+    index_t n_batch = operand.impl().size(0);
+    std::shared_ptr<index_t> labels_ptr = 
+        Alloc::shared_allocate<index_t>(n_batch * sizeof(index_t));
+    std::memcpy(labels_ptr.get(), labels, n_batch * sizeof(index_t));
+    return cross_entropy(operand, labels_ptr, n_label);
+}
+
 // function for conv
 template<typename OIType>
-Exp<UnaryExpImpl<Img2col, OIType>>
+Exp<UnaryExpImpl<Img2col, __materialized_t<OIType>>>
 img2col(const Exp<OIType>& operand, const Img2col::Wsize& kernel_size,
         const Img2col::Wsize& stride_size, const Img2col::Wsize& padding_size) {
     CHECK_EQUAL(operand.impl().ndim(), 4, 
@@ -294,15 +440,135 @@ img2col(const Exp<OIType>& operand, const Img2col::Wsize& kernel_size,
         "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
     CHECK_INDEX_VALID(operand.impl().size(3) + 2*padding_size.second - kernel_size.second, 
         "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
-    return Exp<UnaryExpImpl<Img2col, OIType>>(
-        Alloc::unique_construct<UnaryExpImpl<Img2col, OIType>>(
-            operand.impl_ptr(), kernel_size, stride_size, padding_size 
+    using OperandImplType = __materialized_t<OIType>;
+    return Exp<UnaryExpImpl<Img2col, OperandImplType>>(
+        Alloc::unique_construct<UnaryExpImpl<Img2col, OperandImplType>>(
+            __materialize(operand).impl_ptr(), kernel_size, stride_size, padding_size 
+        )
+    );
+}
+
+// Checks shared by the convolutions below.
+template<typename LhsImplType, typename RhsImplType>
+void __check_conv2d(const LhsImplType& x, const RhsImplType& weight,
+                    const Conv2d::Wsize& kernel_size, const Conv2d::Wsize& stride_size,
+                    const Conv2d::Wsize& padding_size, index_t groups) {
+    CHECK_EQUAL(x.ndim(), 4, 
+        "Conv2d is only supported for 4D Tensor, but got a %dD one", x.ndim());
+    CHECK_EQUAL(weight.ndim(), 2, 
+        "Weight of Conv2d should be a 2D Tensor, but got a %dD one", weight.ndim());
+    CHECK_INDEX_VALID(kernel_size.first, "Invalid kernel_size.");
+    CHECK_INDEX_VALID(kernel_size.second, "Invalid kernel_size.");
+    CHECK_IN_RANGE(stride_size.first, 1, INDEX_MAX, "Invalid stride_size.");
+    CHECK_IN_RANGE(stride_size.second, 1, INDEX_MAX, "Invalid stride_size.");
+    CHECK_INDEX_VALID(padding_size.first, "Invalid padding_size.");
+    CHECK_INDEX_VALID(padding_size.second, "Invalid padding_size.");
+    CHECK_INDEX_VALID(x.size(2) + 2*padding_size.first - kernel_size.first, 
+        "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
+    CHECK_INDEX_VALID(x.size(3) + 2*padding_size.second - kernel_size.second, 
+        "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
+    CHECK_IN_RANGE(groups, 1, INDEX_MAX, "Invalid groups.");
+    CHECK_TRUE(x.size(1) % groups == 0 && weight.size(0) % groups == 0,
+        "Channels (%d) and output channels (%d) should be divisible by groups (%d).",
+        x.size(1), weight.size(0), groups);
+    CHECK_EQUAL(weight.size(1), 
+        x.size(1) / groups * kernel_size.first * kernel_size.second,
+        "Size mismatch, x: %d channels, weight: [%d, %d].", x.size(1),
+        weight.size(0), weight.size(1));
+}
+
+template<typename LhsImplType, typename RhsImplType>
+Exp<BinaryExpImpl<Conv2d, __materialized_t<LhsImplType>, 
+                  __materialized_t<RhsImplType>>>
+conv2d(const Exp<LhsImplType>& x, const Exp<RhsImplType>& weight,
+       const Conv2d::Wsize& kernel_size, const Conv2d::Wsize& stride_size,
+       const Conv2d::Wsize& padding_size, index_t groups=1,
+       kernel::Conv2dAlgorithm algorithm=kernel::Conv2dAlgorithm::direct,
+       const std::shared_ptr<ConvFilter>& filter=nullptr) {
+    __check_conv2d(x.impl(), weight.impl(), kernel_size, stride_size, 
+                   padding_size, groups);
+    CHECK_TRUE(algorithm != kernel::Conv2dAlgorithm::im2col_gemm,
+        "im2col + gemm is made of img2col and matrix_mul, see nn::Conv2d.");
+    CHECK_TRUE(algorithm != kernel::Conv2dAlgorithm::winograd 
+            || (kernel_size.first == 3 && kernel_size.second == 3
+                && stride_size.first == 1 && stride_size.second == 1),
+        "Winograd conv is only supported for 3x3 kernels of stride 1.");
+    CHECK_TRUE(groups == 1 || algorithm == kernel::Conv2dAlgorithm::direct,
+        "Grouped conv is only supported by the direct kernels.");
+    using LhsType = __materialized_t<LhsImplType>;
+    using RhsType = __materialized_t<RhsImplType>;
+    return Exp<BinaryExpImpl<Conv2d, LhsType, RhsType>>(
+        Alloc::unique_construct<BinaryExpImpl<Conv2d, LhsType, RhsType>>(
+            __materialize(x).impl_ptr(), __materialize(weight).impl_ptr(),
+            kernel_size, stride_size, padding_size, groups, algorithm, 
+            filter ? filter : Alloc::shared_construct<ConvFilter>()
+        )
+    );
+}
+
+// function for the fused conv2d, act(conv2d(x, weight) + bias), followed by
+// a 2x2 max pooling of stride 2 if max_pool, see op::Conv2dBias.
+template<typename Act>
+Exp<UnaryExpImpl<Conv2dBias<Act>, TensorImpl>>
+__conv2d_bias(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight,
+              const Exp<TensorImpl>& bias, const Conv2d::Wsize& kernel_size, 
+              const Conv2d::Wsize& stride_size, const Conv2d::Wsize& padding_size,
+              index_t groups, bool max_pool, kernel::Conv2dAlgorithm algorithm,
+              const std::shared_ptr<ConvFilter>& filter) {
+    auto& x_impl = x.impl();
+    auto& weight_impl = weight.impl();
+    __check_conv2d(x_impl, weight_impl, kernel_size, stride_size, 
+                   padding_size, groups);
+    CHECK_TRUE(algorithm != kernel::Conv2dAlgorithm::im2col_gemm,
+        "The fused conv2d doesn't run by im2col + gemm, see nn::Conv2d.");
+    CHECK_TRUE(algorithm != kernel::Conv2dAlgorithm::winograd 
+            || (kernel_size.first == 3 && kernel_size.second == 3
+                && stride_size.first == 1 && stride_size.second == 1),
+        "Winograd conv is only supported for 3x3 kernels of stride 1.");
+    CHECK_TRUE(groups == 1 || algorithm == kernel::Conv2dAlgorithm::direct,
+        "Grouped conv is only supported by the direct kernels.");
+    CHECK_EQUAL(bias.impl().size().dsize(), weight_impl.size(0),
+        "Bias of %d elements for %d output channels.",
+        bias.impl().size().dsize(), weight_impl.size(0));
+    CHECK_TRUE(!max_pool 
+            || ((x_impl.size(2) + 2*padding_size.first - kernel_size.first) 
+                    / stride_size.first >= 1
+                && (x_impl.size(3) + 2*padding_size.second - kernel_size.second) 
+                    / stride_size.second >= 1),
+        "Output of Conv2d is too small for a 2x2 max pooling.");
+    return Exp<UnaryExpImpl<Conv2dBias<Act>, TensorImpl>>(
+        Alloc::unique_construct<UnaryExpImpl<Conv2dBias<Act>, TensorImpl>>(
+            x.impl_ptr(), weight.impl_ptr(), bias.impl_ptr(),
+            kernel_size, stride_size, padding_size, groups, max_pool, algorithm,
+            filter ? filter : Alloc::shared_construct<ConvFilter>()
         )
     );
 }
 
+inline Exp<UnaryExpImpl<Conv2dBias<Identity>, TensorImpl>>
+conv2d_bias(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight,
+            const Exp<TensorImpl>& bias, const Conv2d::Wsize& kernel_size, 
+            const Conv2d::Wsize& stride_size, const Conv2d::Wsize& padding_size,
+            index_t groups=1, bool max_pool=false,
+            kernel::Conv2dAlgorithm algorithm=kernel::Conv2dAlgorithm::direct,
+            const std::shared_ptr<ConvFilter>& filter=nullptr) {
+    return __conv2d_bias<Identity>(x, weight, bias, kernel_size, stride_size, 
+                                   padding_size, groups, max_pool, algorithm, filter);
+}
+
+inline Exp<UnaryExpImpl<Conv2dBias<ReLU>, TensorImpl>>
+conv2d_bias_relu(const Exp<TensorImpl>& x, const Exp<TensorImpl>& weight,
+                 const Exp<TensorImpl>& bias, const Conv2d::Wsize& kernel_size, 
+                 const Conv2d::Wsize& stride_size, const Conv2d::Wsize& padding_size,
+                 index_t groups=1, bool max_pool=false,
+                 kernel::Conv2dAlgorithm algorithm=kernel::Conv2dAlgorithm::direct,
+                 const std::shared_ptr<ConvFilter>& filter=nullptr) {
+    return __conv2d_bias<ReLU>(x, weight, bias, kernel_size, stride_size, 
+                               padding_size, groups, max_pool, algorithm, filter);
+}
+
 template<typename OIType>
-Exp<UnaryExpImpl<MaxPool2d, OIType>>
+Exp<UnaryExpImpl<MaxPool2d, __materialized_t<OIType>>>
 max_pool2d(const Exp<OIType>& operand, const MaxPool2d::Wsize& kernel_size,
            const MaxPool2d::Wsize& stride_size, const MaxPool2d::Wsize& padding_size) {
     CHECK_EQUAL(operand.impl().ndim(), 4, 
@@ -318,9 +584,10 @@ max_pool2d(const Exp<OIType>& operand, const MaxPool2d::Wsize& kernel_size,
         "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
     CHECK_INDEX_VALID(operand.impl().size(3) + 2*padding_size.second - kernel_size.second, 
         "Kernel size (%d %d) is too large", kernel_size.first, kernel_size.second);
-    return Exp<UnaryExpImpl<MaxPool2d, OIType>>(
-        Alloc::unique_construct<UnaryExpImpl<MaxPool2d, OIType>>(
-            operand.impl_ptr(), kernel_size, stride_size, padding_size 
+    using OperandImplType = __materialized_t<OIType>;
+    return Exp<UnaryExpImpl<MaxPool2d, OperandImplType>>(
+        Alloc::unique_construct<UnaryExpImpl<MaxPool2d, OperandImplType>>(
+            __materialize(operand).impl_ptr(), kernel_size, stride_size, padding_size 
         )
     );
 }
@@ -6,6 +6,8 @@
 #include "utils/base_config.hpp"
 #include "utils/array.hpp"
 #include "utils/exception.hpp"
+#include "kernel/cross_entropy.hpp"
+#include "kernel/gemm.hpp"
 
 #include "exp/operator/log_softmax.hpp"
 #include "exp/operator/constant.hpp"
@@ -108,6 +110,151 @@ private:
     const LhsImplType& lhs_;
     const RhsImplType& rhs_;
 };
+
+// Grad already computed into a row-major buffer by a kernel, like the 
+// backward of op::Linear. Dims of size 1 are read with stride 0, so the grad
+// of a broadcasted operand keeps its own shape.
+class DenseGradImpl : public GradImpl<DenseGradImpl> {
+public:
+    DenseGradImpl(const data_t* data, const IndexArray& shape)
+            : data_(data), shape_(shape), stride_(shape.size()) {
+        index_t subsize = 1;
+        for(index_t i = shape_.size(); i-- > 0; ) {
+            stride_[i] = shape_[i] == 1 ? 0 : subsize;
+            subsize *= shape_[i];
+        }
+    }
+
+    IndexArray grad_size(void) const { return shape_; }
+    const data_t* data(void) const { return data_; }
+    const IndexArray& stride(void) const { return stride_; }
+
+    data_t eval(IndexArray& inds) const {
+        index_t offset = 0;
+        for(index_t i = 0; i < stride_.size(); ++i)
+            offset += inds[i] * stride_[i];
+        return data_[offset];
+    }
+private:
+    const data_t* data_;
+    IndexArray shape_;
+    IndexArray stride_;
+};
+
+// Grad which is the product of two strided matrices, a: [m, k] and b: [k, n],
+// like the grads of MatrixMul, or a batch of such products for 
+// BatchMatrixMul. It is not computed in advance: a TensorImpl receiving it
+// runs kernel::gemm straight into its grad buffer, see accumulate(). eval()
+// is only the fallback for other receivers.
+class GemmGradImpl : public GradImpl<GemmGradImpl> {
+public:
+    GemmGradImpl(index_t m, index_t n, index_t k,
+                 const data_t* a, index_t a_row_stride, index_t a_col_stride,
+                 const data_t* b, index_t b_row_stride, index_t b_col_stride)
+            : GemmGradImpl(1, 1, m, n, k, a, 0, a_row_stride, a_col_stride,
+                           b, 0, b_row_stride, b_col_stride) {
+        ndim_ = 2;
+    }
+    // A [out_batch, m, n] grad from batch products. With out_batch of 1, all
+    // the products are summed up, it is the grad of a broadcasted operand.
+    GemmGradImpl(index_t batch, index_t out_batch, index_t m, index_t n, index_t k,
+                 const data_t* a, index_t a_batch_stride, 
+                 index_t a_row_stride, index_t a_col_stride,
+                 const data_t* b, index_t b_batch_stride,
+                 index_t b_row_stride, index_t b_col_stride)
+            : ndim_(3), batch_(batch), out_batch_(out_batch), m_(m), n_(n), k_(k), 
+              a_(a), a_bs_(a_batch_stride), a_rs_(a_row_stride), a_cs_(a_col_stride),
+              b_(b), b_bs_(b_batch_stride), b_rs_(b_row_stride), b_cs_(b_col_stride) {}
+
+    IndexArray grad_size(void) const { 
+        if(ndim_ == 2) return IndexArray{m_, n_};
+        return IndexArray{out_batch_, m_, n_}; 
+    }
+
+    data_t eval(IndexArray& inds) const {
+        index_t i = inds[ndim_ - 2], j = inds[ndim_ - 1];
+        index_t first = ndim_ == 3 && out_batch_ == batch_ ? inds[0] : 0;
+        index_t last = out_batch_ == batch_ ? first + 1 : batch_;
+        data_t value = 0;
+        for(index_t t = first; t < last; ++t) {
+            const data_t* a = a_ + t * a_bs_ + i * a_rs_;
+            const data_t* b = b_ + t * b_bs_ + j * b_cs_;
+            for(index_t p = 0; p < k_; ++p)
+                value += a[p * a_cs_] * b[p * b_rs_];
+        }
+        return value;
+    }
+
+    // (a * b)^T = b^T * a^T, still a product of two strided matrices.
+    GemmGradImpl transposed(void) const {
+        GemmGradImpl ret(batch_, out_batch_, n_, m_, k_, b_, b_bs_, b_cs_, b_rs_,
+                         a_, a_bs_, a_cs_, a_rs_);
+        ret.ndim_ = ndim_;
+        return ret;
+    }
+
+    // c += a * b, where c is addressed by stride, one stride per dim. One of
+    // the last two strides need be 1 (or the dim be of size 1), otherwise
+    // returns false and nothing is done.
+    bool accumulate(data_t* c, const IndexArray& stride) const {
+        if(stride.size() != ndim_)
+            return false;
+        index_t rs = stride[ndim_ - 2], cs = stride[ndim_ - 1];
+        index_t bs = ndim_ == 3 && out_batch_ != 1 ? stride[0] : 0;
+        if(n_ == 1 || cs == 1) {
+            kernel::batch_gemm(batch_, m_, n_, k_, a_, a_bs_, a_rs_, a_cs_, 
+                               b_, b_bs_, b_rs_, b_cs_, c, bs, rs, true);
+            return true;
+        }
+        if(m_ == 1 || rs == 1) {
+            kernel::batch_gemm(batch_, n_, m_, k_, b_, b_bs_, b_cs_, b_rs_, 
+                               a_, a_bs_, a_cs_, a_rs_, c, bs, cs, true);
+            return true;
+        }
+        return false;
+    }
+private:
+    index_t ndim_, batch_, out_batch_;
+    index_t m_, n_, k_;
+    const data_t* a_;
+    index_t a_bs_, a_rs_, a_cs_;
+    const data_t* b_;
+    index_t b_bs_, b_rs_, b_cs_;
+};
+
+// Grad of the logits of op::CrossEntropy, grad / n * (prob - onehot(labels))
+// for prob: [n, c]. Like GemmGradImpl, it is not computed in advance: a
+// TensorImpl receiving it runs kernel::cross_entropy_backward straight into
+// its grad buffer, see accumulate(). eval() is the fallback for others.
+class CrossEntropyGradImpl : public GradImpl<CrossEntropyGradImpl> {
+public:
+    CrossEntropyGradImpl(index_t n, index_t c, const data_t* prob,
+                         const index_t* labels, data_t grad)
+            : n_(n), c_(c), prob_(prob), labels_(labels), 
+              grad_(grad), scale_(n == 0 ? 0 : grad / n) {}
+
+    IndexArray grad_size(void) const { return IndexArray{n_, c_}; }
+
+    data_t eval(IndexArray& inds) const {
+        index_t i = inds[0], j = inds[1];
+        return scale_ * (prob_[i * c_ + j] - (labels_[i] == j ? 1 : 0));
+    }
+
+    // dx += the grad, where dx is addressed by stride. The rows need be
+    // contiguous, otherwise returns false and nothing is done.
+    bool accumulate(data_t* dx, const IndexArray& stride) const {
+        if(stride.size() != 2 || (c_ != 1 && stride[1] != 1)
+                || (n_ != 1 && stride[0] != c_))
+            return false;
+        kernel::cross_entropy_backward(n_, c_, prob_, labels_, grad_, dx, true);
+        return true;
+    }
+private:
+    index_t n_, c_;
+    const data_t* prob_;
+    const index_t* labels_;
+    data_t grad_, scale_;
+};
 }  // namespace st
 
 
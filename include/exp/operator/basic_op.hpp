@@ -11,6 +11,8 @@ namespace st {
 namespace op {
 
 struct UnaryBasicOperator {
+    using is_expensive = std::false_type;
+
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { 
         return operand.ndim(); 
@@ -22,6 +24,8 @@ struct UnaryBasicOperator {
 };
 
 struct BinaryBasicOperator {
+    using is_expensive = std::false_type;
+
     template<typename LhsType, typename RhsType>
     static index_t ndim(const LhsType& lhs, const RhsType& rhs) { 
         return std::max(lhs.ndim(), rhs.ndim()); 
@@ -11,6 +11,8 @@ namespace op {
 
 
 struct Constant {
+    using is_expensive = std::false_type;
+
     static index_t ndim() { return 1; }
     static index_t size(index_t idx) { return 1; }
     static data_t map(IndexArray& inds, data_t value) {
@@ -4,17 +4,23 @@
 #include <utility>
 #include <algorithm>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <type_traits>
 
 #include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
 #include "utils/array.hpp"
 #include "utils/exception.hpp"
+#include "kernel/conv.hpp"
+#include "exp/operator/linear.hpp"
 
 namespace st {
 namespace op {
 
 struct Img2col {
     using Wsize = std::pair<index_t, index_t>;
+    using is_expensive = std::false_type;
 
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 2; }
@@ -127,8 +133,96 @@ struct Img2col {
     };
 };
 
+// Transformed filter of a Winograd or FFT conv, see kernel::winograd_filter
+// and kernel::fft_filter. nn::Conv2d keeps it across steps, and it is only
+// computed again when the weight is written or updated by an optimizer, see
+// Storage::update_count(), or when the transform changes. The backwards of
+// two uses of one module may run on two threads, so the fields are only
+// read or written under mutex, and each use holds its own reference to the
+// data it reads, which outlives a replacement by the other.
+struct ConvFilter {
+    ConvFilter()
+            : data(nullptr), algorithm(kernel::Conv2dAlgorithm::direct),
+              transform_size(0, 0), weight(nullptr),
+              version(0), update_count(0) {}
+
+    std::mutex mutex;
+    std::shared_ptr<data_t> data;
+    kernel::Conv2dAlgorithm algorithm;
+    // The Winograd tile, or the size of the FFTs.
+    std::pair<index_t, index_t> transform_size;
+    // The weight data was computed from.
+    const data_t* weight;
+    index_t version;
+    index_t update_count;
+};
+
+// Convolution of x, [batch, channel, height, width], by weight, [out_channels,
+// channel / groups * kernel_h * kernel_w], computed without an im2col matrix
+// by the direct kernels in kernel/conv.hpp, the Winograd ones in
+// kernel/winograd.hpp or the FFT ones in kernel/fft_conv.hpp. The output is
+// [batch, out_channels, out_h, out_w].
+// This operator need specialize BinaryExpImpl in exp/exp_impl.hpp, where the
+// window sizes, the groups and the algorithm are held.
+struct Conv2d {
+    using Wsize = std::pair<index_t, index_t>;
+    using is_expensive = std::false_type;
+
+    template<typename LhsType, typename RhsType>
+    static index_t ndim(const LhsType& x, const RhsType& weight) { return 4; }
+
+    template<typename LhsType, typename RhsType>
+    static index_t size(index_t idx, const LhsType& x, const RhsType& weight,
+                        const Wsize& out_size) {
+        switch(idx) {
+            case 1: return weight.size(0);  // out_channels
+            case 2: return out_size.first;
+            case 3: return out_size.second;
+            default: return x.size(0);  // num_batch
+        }
+    }
+
+    struct Grad {
+        using allow_broadcast = std::false_type;
+        using is_lhs = std::false_type;
+        using is_rhs = std::false_type;
+    };
+};
+
+// Fused act(conv2d(x, weight) + bias), followed by a 2x2 max pooling of
+// stride 2 if pool, computed by the direct kernels with the epilogue of
+// kernel::conv2d_forward, or by the Winograd or FFT ones which apply it to
+// each plane of their output. The output is [batch, out_channels, out_h, out_w],
+// halved by the pooling. This operator need specialize UnaryExpImpl in 
+// exp/exp_impl.hpp, where weight and bias are held besides the operand x.
+template<typename Act>
+struct Conv2dBias {
+    using Wsize = std::pair<index_t, index_t>;
+    using is_expensive = std::false_type;
+    static constexpr kernel::Activation activation = __linear_activation<Act>::value;
+
+    template<typename OperandType>
+    static index_t ndim(const OperandType& x, const OperandType& weight) { return 4; }
+
+    template<typename OperandType>
+    static index_t size(index_t idx, const OperandType& x, const OperandType& weight,
+                        const Wsize& out_size) {
+        return Conv2d::size(idx, x, weight, out_size);
+    }
+
+    struct Grad {
+        using allow_broadcast = std::false_type;
+        using is_lhs = std::false_type;
+        using is_rhs = std::false_type;
+    };
+};
+
+template<typename Act>
+constexpr kernel::Activation Conv2dBias<Act>::activation;
+
 struct MaxPool2d {
     using Wsize = std::pair<index_t, index_t>;
+    using is_expensive = std::false_type;
 
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 4; }
@@ -0,0 +1,36 @@
+#ifndef EXP_OPERATOR_CROSS_ENTROPY_H
+#define EXP_OPERATOR_CROSS_ENTROPY_H
+
+#include <type_traits>
+
+#include "utils/base_config.hpp"
+#include "kernel/cross_entropy.hpp"
+
+namespace st {
+namespace op {
+
+// Fused mean(nll_loss(log_softmax(x), labels)), computed by
+// kernel::cross_entropy_forward when the expression is built. Only the
+// softmax of x is kept, and the grad of x is written from it at once by
+// kernel::cross_entropy_backward. This operator need specialize
+// UnaryExpImpl in exp/exp_impl.hpp, where the labels are held.
+struct CrossEntropy {
+    using is_expensive = std::false_type;
+
+    // The loss is of shape [1], as mean(nll_loss(...), 0) is.
+    template<typename OperandType>
+    static index_t ndim(const OperandType& operand) { return 1; }
+
+    template<typename OperandType>
+    static index_t size(index_t idx, const OperandType& operand) { return 1; }
+
+    struct Grad {
+        using allow_broadcast = std::false_type;
+        using is_lhs = std::false_type;
+        using is_rhs = std::false_type;
+    };
+};
+
+}  // namespace op
+}  // namespace st
+#endif
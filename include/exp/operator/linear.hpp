@@ -0,0 +1,77 @@
+#ifndef EXP_OPERATOR_LINEAR_H
+#define EXP_OPERATOR_LINEAR_H
+
+#include <type_traits>
+
+#include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
+#include "utils/array.hpp"
+#include "kernel/linear.hpp"
+#include "kernel/sparse.hpp"
+#include "exp/operator/basic_op.hpp"
+
+namespace st {
+namespace op {
+
+template<typename Act> struct __linear_activation;
+template<> struct __linear_activation<Identity> {
+    static constexpr kernel::Activation value = kernel::Activation::identity;
+};
+template<> struct __linear_activation<ReLU> {
+    static constexpr kernel::Activation value = kernel::Activation::relu;
+};
+
+// Fused act(x * weight^T + bias), computed by kernel::linear_forward when the
+// expression is built. This operator need specialize UnaryExpImpl in 
+// exp/exp_impl.hpp, where weight and bias are held besides the operand x.
+template<typename Act>
+struct Linear {
+    using is_expensive = std::false_type;
+    static constexpr kernel::Activation activation = __linear_activation<Act>::value;
+
+    template<typename OperandType>
+    static index_t ndim(const OperandType& x, const OperandType& weight) { return 2; }
+
+    template<typename OperandType>
+    static index_t size(index_t idx, const OperandType& x, const OperandType& weight) {
+        return idx == 0 ? x.size(0) : weight.size(0);
+    }
+
+    struct Grad {
+        using allow_broadcast = std::false_type;
+        using is_lhs = std::false_type;
+        using is_rhs = std::false_type;
+    };
+};
+
+template<typename Act>
+constexpr kernel::Activation Linear<Act>::activation;
+
+// Linear of a sparse weight, see SparseTensor, computed by 
+// kernel::sparse_linear_forward. Its UnaryExpImpl holds the pattern of the
+// weight, and its stored values as an operand, which get the grad.
+template<typename Act>
+struct SparseLinear {
+    using is_expensive = std::false_type;
+    static constexpr kernel::Activation activation = Linear<Act>::activation;
+
+    template<typename OperandType>
+    static index_t ndim(const OperandType& x, const kernel::SparsePattern& weight) { 
+        return 2; 
+    }
+
+    template<typename OperandType>
+    static index_t size(index_t idx, const OperandType& x, 
+                        const kernel::SparsePattern& weight) {
+        return idx == 0 ? x.size(0) : weight.rows;
+    }
+
+    using Grad = typename Linear<Act>::Grad;
+};
+
+template<typename Act>
+constexpr kernel::Activation SparseLinear<Act>::activation;
+
+}  // namespace op
+}  // namespace st
+#endif
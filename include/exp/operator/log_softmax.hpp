@@ -14,6 +14,7 @@ namespace op {
 
 // This operator need specialize UnaryExpImpl in exp/exp_impl.hpp
 struct LogSoftmax {
+    using is_expensive = std::true_type;
 
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 2; }
@@ -7,13 +7,15 @@
 #include "utils/base_config.hpp"
 #include "utils/allocator.hpp"
 #include "utils/array.hpp"
+#include "exp/operator/strided.hpp"
 
 
 namespace st {
 namespace op {
 
 struct MatrixTranspose {
-    
+    using is_expensive = std::false_type;
+
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 2; }
 
@@ -46,8 +48,12 @@ struct MatrixTranspose {
     };
 };
 
+// The product is computed by kernel::gemm when the expression is built, so 
+// this operator need specialize BinaryExpImpl in exp/exp_impl.hpp, where the
+// result is held. map is the reference definition.
 struct MatrixMul {
-    
+    using is_expensive = std::false_type;
+
     template<typename LhsType, typename RhsType>
     static index_t ndim(const LhsType& lhs, const RhsType& rhs) { return 2; }
 
@@ -131,7 +137,8 @@ struct MatrixMul {
 };
 
 struct BatchMatrixTranspose {
-    
+    using is_expensive = std::false_type;
+
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 3; }
 
@@ -164,7 +171,11 @@ struct BatchMatrixTranspose {
     };
 };
 
+// Like MatrixMul, computed by kernel::batch_gemm in the specialization of 
+// BinaryExpImpl in exp/exp_impl.hpp.
 struct BatchMatrixMul {
+    using is_expensive = std::false_type;
+
     template<typename LhsType, typename RhsType>
     static index_t ndim(const LhsType& lhs, const RhsType& rhs) { return 3; }
 
@@ -208,7 +219,7 @@ struct BatchMatrixMul {
                 IndexArray grad_inds({inds[0], inds[1], 0});
                 IndexArray rhs_inds({inds[0], inds[2], 0});
 
-                data_t value;
+                data_t value = 0;
                 for(index_t i = 0; i < hsize; ++i) {
                     grad_inds[2] = i;
                     rhs_inds[2] = i;
@@ -252,6 +263,33 @@ struct BatchMatrixMul {
     };
 };
 
+// (batch_)matrix_transpose of a TensorImpl is read in place by the GEMM, as
+// the TensorImpl with its last two strides swapped.
+template<typename Op, typename OIType>
+const data_t* __transposed_strided_operand(const UnaryExpImpl<Op, OIType>& operand, 
+                                           index_t* stride,
+                                           Alloc::TrivialUniquePtr<data_t>& buffer) {
+    if(!std::is_same<OIType, TensorImpl>::value)
+        return __strided_operand(operand, stride, buffer, std::false_type());
+    index_t ndim = operand.ndim();
+    const data_t* data = __strided_operand(operand.operand(), stride, buffer,
+                                           std::is_same<OIType, TensorImpl>());
+    std::swap(stride[ndim - 2], stride[ndim - 1]);
+    return data;
+}
+
+template<typename OIType>
+const data_t* strided_operand(const UnaryExpImpl<MatrixTranspose, OIType>& operand,
+                              index_t* stride, Alloc::TrivialUniquePtr<data_t>& buffer) {
+    return __transposed_strided_operand(operand, stride, buffer);
+}
+
+template<typename OIType>
+const data_t* strided_operand(const UnaryExpImpl<BatchMatrixTranspose, OIType>& operand,
+                              index_t* stride, Alloc::TrivialUniquePtr<data_t>& buffer) {
+    return __transposed_strided_operand(operand, stride, buffer);
+}
+
 }  // namespace op
 }  // namespace st
-#endif
\ No newline at end of file
+#endif
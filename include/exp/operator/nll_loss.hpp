@@ -1,6 +1,8 @@
 #ifndef EXP_OPERATOR_NLL_LOSS_H
 #define EXP_OPERATOR_NLL_LOSS_H
 
+#include <type_traits>
+
 #include "utils/base_config.hpp"
 #include "utils/allocator.hpp"
 #include "utils/array.hpp"
@@ -9,6 +11,8 @@ namespace st{
 namespace op {
 
 struct NLLLoss {
+    using is_expensive = std::false_type;
+
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { return 1; }
 
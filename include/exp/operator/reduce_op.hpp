@@ -2,6 +2,7 @@
 #define EXP_OPERATOR_REDUCE_OP_H
 
 #include <algorithm>
+#include <type_traits>
 
 #include "utils/base_config.hpp"
 #include "utils/exception.hpp"
@@ -12,6 +13,8 @@ namespace st {
 namespace op {
 
 struct ReduceOperator {
+    using is_expensive = std::true_type;
+
     template<typename OperandType>
     static index_t ndim(const OperandType& operand) { 
         return std::max(operand.ndim() - 1, static_cast<index_t>(1)); 
@@ -0,0 +1,83 @@
+#ifndef EXP_OPERATOR_STRIDED_H
+#define EXP_OPERATOR_STRIDED_H
+
+#include <type_traits>
+
+#include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
+#include "utils/array.hpp"
+#include "kernel/transpose.hpp"
+
+namespace st {
+
+class TensorImpl;
+template<typename Op, typename OIType> class UnaryExpImpl;
+
+namespace op {
+
+// Describes an operand as a strided array for the kernels in kernel/, which
+// walk raw memory. stride gets one stride per dim. TensorImpls are read in
+// place, any other expression is evaluated into buffer first. Dims of size 1
+// get stride 0 either way, so a batch of 1 is broadcasted. Operators may add
+// overloads, like matrix_transpose in exp/operator/matrix_op.hpp.
+template<typename OperandType>
+const data_t* __strided_operand(const OperandType& operand, index_t* stride,
+                                Alloc::TrivialUniquePtr<data_t>& buffer,
+                                std::false_type) {
+    index_t ndim = operand.ndim(), dsize = 1;
+    for(index_t i = ndim; i-- > 0; ) {
+        stride[i] = operand.size(i) == 1 ? 0 : dsize;
+        dsize *= operand.size(i);
+    }
+    buffer = Alloc::unique_allocate<data_t>(dsize * sizeof(data_t));
+    IndexArray inds(ndim);
+    inds.memset(0);
+    for(index_t i = 0; i < dsize; ++i) {
+        buffer.get()[i] = operand.eval(inds);
+        for(index_t j = ndim; j-- > 0; ) {
+            if(++inds[j] < operand.size(j)) break;
+            inds[j] = 0;
+        }
+    }
+    return buffer.get();
+}
+
+template<typename OperandType>
+const data_t* __strided_operand(const OperandType& operand, index_t* stride,
+                                Alloc::TrivialUniquePtr<data_t>& buffer,
+                                std::true_type) {
+    for(index_t i = 0; i < operand.ndim(); ++i)
+        stride[i] = operand.size(i) == 1 ? 0 : operand.stride()[i];
+    return operand.data();
+}
+
+template<typename OperandType>
+const data_t* strided_operand(const OperandType& operand, index_t* stride,
+                              Alloc::TrivialUniquePtr<data_t>& buffer) {
+    return __strided_operand(operand, stride, buffer,
+                             std::is_same<OperandType, TensorImpl>());
+}
+
+// Returns the data of a TensorImpl in row-major order, for the kernels which
+// take no strides. Contiguous operands are read in place, others are gathered
+// into buffer by kernel::strided_copy.
+template<typename OperandType>
+const data_t* contiguous_data(const OperandType& operand,
+                              Alloc::TrivialUniquePtr<data_t>& buffer) {
+    if(operand.is_contiguous())
+        return operand.data();
+
+    IndexArray shape = operand.size();
+    IndexArray stride(shape.size());
+    for(index_t i = shape.size(); i-- > 0; )
+        stride[i] = i + 1 == shape.size() ? 1 : stride[i + 1] * shape[i + 1];
+    buffer = Alloc::unique_allocate<data_t>(operand.size().dsize() * sizeof(data_t));
+    kernel::strided_copy(shape.size(), shape.data(), 
+                         operand.data(), operand.stride().data(),
+                         buffer.get(), stride.data());
+    return buffer.get();
+}
+
+}  // namespace op
+}  // namespace st
+#endif
@@ -0,0 +1,241 @@
+#ifndef JIT_JIT_H
+#define JIT_JIT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <type_traits>
+
+#include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
+#include "exp/exp_impl.hpp"
+#include "exp/operator/basic_op.hpp"
+#include "exp/operator/constant.hpp"
+#include "tensor/tensor_impl.hpp"
+#include "tensor/forward_plan.hpp"
+
+namespace st {
+namespace jit {
+
+// The JIT is opt-in. It is enabled by set_enabled(true) or by setting the
+// environment variable ST_JIT=1. When enabled, assignments recorded by a
+// ForwardPlan are compiled into native kernels, see __JitForwardFn below.
+bool enabled(void);
+void set_enabled(bool enabled);
+
+// Kernels are compiled by the compiler in ST_JIT_CXX (g++ by default) and the
+// shared objects are cached in ST_JIT_CACHE, by default the per-user
+// $XDG_CACHE_HOME/simple-tensor-jit or ~/.cache/simple-tensor-jit. They are
+// named by the hash of the source, the compile command and the CPU, so a
+// later run only needs to dlopen them. The cache is created accessible only
+// to the user, and refused if it belongs to someone else or others can
+// write to it. load() may be called from several threads.
+using KernelFn = void (*)(const data_t* const* inputs, data_t* output);
+KernelFn load(const std::string& source);
+std::string cache_dir(void);
+
+// KernelSource writes the C++ source of a kernel which evaluates one
+// expression into dist with flat nested loops. Shapes and strides are baked
+// into the source as constants, the data pointers are passed at runtime.
+class KernelSource {
+public:
+    explicit KernelSource(const TensorImpl& dist);
+    KernelSource(const KernelSource& other) = delete;
+    ~KernelSource() = default;
+
+    // Registers leaf as an input and returns the code reading it at the
+    // current indices. Leaves are aligned with the leading dims of dist and
+    // broadcasted through zero strides, just like TensorImpl::eval.
+    std::string input(const TensorImpl& leaf);
+    // Evaluates impl into a scratch tensor before the kernel runs, and reads
+    // it as an input. Used for operators the JIT can't fuse.
+    template<typename ImplType> std::string opaque(const ImplType& impl);
+    std::string constant(data_t value) const;
+
+    // The whole translation unit, with value as the code for each element.
+    std::string str(const std::string& value) const;
+
+    const std::vector<const TensorImpl*>& inputs(void) const { return inputs_; }
+    const std::vector<std::shared_ptr<ForwardFn>>& opaques(void) const {
+        return opaques_;
+    }
+private:
+    IndexArray shape_;
+    IndexArray stride_;
+    std::vector<const TensorImpl*> inputs_;
+    std::vector<std::shared_ptr<ForwardFn>> opaques_;
+};
+
+// Operators which can be fused into a kernel. emit() gets the code of the
+// operands and returns the code of the result.
+template<typename Op>
+struct __JitOp { using supported = std::false_type; };
+
+template<> struct __JitOp<op::Minus> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x) { return "(-" + x + ")"; }
+};
+
+template<> struct __JitOp<op::ReLU> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x) { return "st_relu(" + x + ")"; }
+};
+
+template<> struct __JitOp<op::Sigmoid> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x) { return "st_sigmoid(" + x + ")"; }
+};
+
+template<> struct __JitOp<op::Identity> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x) { return x; }
+};
+
+template<> struct __JitOp<op::Add> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x, const std::string& y) {
+        return "(" + x + " + " + y + ")";
+    }
+};
+
+template<> struct __JitOp<op::Sub> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x, const std::string& y) {
+        return "(" + x + " - " + y + ")";
+    }
+};
+
+template<> struct __JitOp<op::Mul> {
+    using supported = std::true_type;
+    static std::string emit(const std::string& x, const std::string& y) {
+        return "(" + x + " * " + y + ")";
+    }
+};
+
+// Walks the type of an expression and emits the code of each node. Nodes
+// without a __JitOp are evaluated by the interpreter into a scratch tensor.
+template<typename ImplType>
+struct __JitEmitter {
+    using fusible = std::false_type;
+
+    static std::string emit(const ImplType& impl, KernelSource& source) {
+        return source.opaque(impl);
+    }
+};
+
+template<>
+struct __JitEmitter<TensorImpl> {
+    using fusible = std::false_type;
+
+    static std::string emit(const TensorImpl& impl, KernelSource& source) {
+        return source.input(impl);
+    }
+};
+
+template<>
+struct __JitEmitter<UnaryExpImpl<op::Constant, data_t>> {
+    using fusible = std::false_type;
+
+    static std::string emit(const UnaryExpImpl<op::Constant, data_t>& impl,
+                            KernelSource& source) {
+        return source.constant(impl.value());
+    }
+};
+
+template<typename Op, typename OIType>
+struct __JitEmitter<UnaryExpImpl<Op, OIType>> {
+    using fusible = typename __JitOp<Op>::supported;
+
+    static std::string emit(const UnaryExpImpl<Op, OIType>& impl,
+                            KernelSource& source) {
+        return emit(impl, source, fusible());
+    }
+private:
+    static std::string emit(const UnaryExpImpl<Op, OIType>& impl,
+                            KernelSource& source, std::true_type) {
+        return __JitOp<Op>::emit(
+            __JitEmitter<OIType>::emit(impl.operand(), source)
+        );
+    }
+    static std::string emit(const UnaryExpImpl<Op, OIType>& impl,
+                            KernelSource& source, std::false_type) {
+        return source.opaque(impl);
+    }
+};
+
+template<typename Op, typename LhsImplType, typename RhsImplType>
+struct __JitEmitter<BinaryExpImpl<Op, LhsImplType, RhsImplType>> {
+    using fusible = typename __JitOp<Op>::supported;
+
+    static std::string emit(const BinaryExpImpl<Op, LhsImplType, RhsImplType>& impl,
+                            KernelSource& source) {
+        return emit(impl, source, fusible());
+    }
+private:
+    static std::string emit(const BinaryExpImpl<Op, LhsImplType, RhsImplType>& impl,
+                            KernelSource& source, std::true_type) {
+        std::string lhs = __JitEmitter<LhsImplType>::emit(impl.lhs(), source);
+        std::string rhs = __JitEmitter<RhsImplType>::emit(impl.rhs(), source);
+        return __JitOp<Op>::emit(lhs, rhs);
+    }
+    static std::string emit(const BinaryExpImpl<Op, LhsImplType, RhsImplType>& impl,
+                            KernelSource& source, std::false_type) {
+        return source.opaque(impl);
+    }
+};
+
+// A recorded assignment whose src is evaluated by a compiled kernel. The
+// kernel is compiled at the first replay, not at capture, so plans which are
+// never replayed cost nothing.
+template<typename ImplType>
+class __JitForwardFn: public __ForwardFn<ImplType> {
+public:
+    __JitForwardFn(const TensorImpl& dist, const ImplType& src)
+            : __ForwardFn<ImplType>(dist, src), source_(dist), kernel_(nullptr) {
+        value_ = __JitEmitter<ImplType>::emit(src, source_);
+    }
+    ~__JitForwardFn() = default;
+protected:
+    void assign(void) override {
+        if(kernel_ == nullptr)
+            kernel_ = load(source_.str(value_));
+
+        for(auto& opaque : source_.opaques())
+            (*opaque)();
+
+        auto& leaves = source_.inputs();
+        std::vector<const data_t*> inputs(leaves.size());
+        for(index_t i = 0; i < leaves.size(); ++i)
+            inputs[i] = leaves[i]->data();
+        kernel_(inputs.data(), this->dist_->data());
+    }
+private:
+    KernelSource source_;
+    std::string value_;
+    KernelFn kernel_;
+};
+
+template<typename ImplType>
+std::string KernelSource::opaque(const ImplType& impl) {
+    // the scratch tensor is owned by the recorded assignment into it.
+    ExpImplPtr<TensorImpl> scratch(
+        Alloc::unique_construct<TensorImpl>(Shape(impl.size())), false
+    );
+    opaques_.push_back(
+        Alloc::shared_construct<__ForwardFn<ImplType>>(*scratch, impl)
+    );
+    return input(*scratch);
+}
+
+// Returns how ForwardPlan replays dist = src. Only roots which fuse at least
+// one operator are worth a kernel, others are left to the interpreter.
+template<typename ImplType>
+std::shared_ptr<ForwardFn> forward_fn(const TensorImpl& dist, const ImplType& src) {
+    if(enabled() && __JitEmitter<ImplType>::fusible::value)
+        return Alloc::shared_construct<__JitForwardFn<ImplType>>(dist, src);
+    return Alloc::shared_construct<__ForwardFn<ImplType>>(dist, src);
+}
+
+}  // namespace jit
+}  // namespace st
+#endif
@@ -0,0 +1,100 @@
+#ifndef KERNEL_CONV_H
+#define KERNEL_CONV_H
+
+#include "utils/base_config.hpp"
+#include "kernel/im2col.hpp"
+#include "kernel/linear.hpp"
+
+namespace st {
+namespace kernel {
+
+// Applied by conv2d_forward to its output while a tile of it is still in
+// registers or L1: y = act(y + bias), then a 2x2 max pooling of stride 2 if
+// pool, which drops the last row or column of an odd output. bias is
+// [out_channels], or null. With pool, y is [batch, out_channels, out_h / 2,
+// out_w / 2] and argmax, of the same size, receives the offset i * out_w + j
+// of the max of each window in its plane of the conv output.
+struct Conv2dEpilogue {
+    const data_t* bias;
+    Activation activation;
+    bool pool;
+    index_t* argmax;
+};
+
+// Direct convolution, which never builds the im2col matrix. x is an input of
+// shape, addressed by x_stride, one stride per dim. w is the weight of
+// [out_channels, channel / groups * kernel_h * kernel_w], the layout of
+// nn::Conv2d, addressed by its row and column strides. y is a contiguous
+// [batch, out_channels, out_h, out_w] output, which is overwritten.
+//
+// The channels and output channels are split into groups, each output
+// channel only sees the channels of its group. Tiles of output channels by
+// output columns, as wide as the vectors of cpu::isa(), are accumulated in
+// registers, images and blocks of output channels run in parallel. A
+// depthwise conv (groups == channel) has its own kernel, sliding over the
+// rows of each channel. The input is copied once when it is padded or not
+// contiguous.
+void conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                    const data_t* x, const index_t* x_stride,
+                    const data_t* w, const index_t* w_stride,
+                    data_t* y, index_t groups=1, 
+                    const Conv2dEpilogue* epilogue=nullptr);
+
+// Grad of x, dy is a contiguous [batch, out_channels, out_h, out_w] grad of
+// y and dx a contiguous [batch, channel, height, width] buffer which is
+// overwritten. Images and channels run in parallel.
+void conv2d_backward_input(const Conv2dShape& shape, index_t out_channels,
+                           const data_t* dy,
+                           const data_t* w, const index_t* w_stride,
+                           data_t* dx, index_t groups=1);
+
+// Grad of w, dw is a contiguous [out_channels, channel / groups * kernel_h
+// * kernel_w] buffer which is overwritten. Blocks of output channels and
+// channels run in parallel.
+void conv2d_backward_weight(const Conv2dShape& shape, index_t out_channels,
+                            const data_t* x, const index_t* x_stride,
+                            const data_t* dy, data_t* dw, index_t groups=1);
+
+// The epilogue for the kernels which finish the conv output a plane at a
+// time, Winograd and FFT, applied to the plane of image and output channel
+// plane = b * out_channels + o while it is still in cache. conv is the
+// [out_h, out_w] conv output of the plane, which gets the bias and the
+// activation in place. With pool, it is then pooled into the plane of y,
+// and argmax set as conv2d_forward does. Without pool, conv is the plane of
+// y already.
+void conv2d_epilogue_plane(const Conv2dShape& shape, index_t out_channels,
+                           const Conv2dEpilogue& epilogue, index_t plane,
+                           data_t* conv, data_t* y);
+
+// Backward of the epilogue of conv2d_forward, y and dy are its output and
+// the grad of it. dconv, a contiguous [batch, out_channels, out_h, out_w]
+// buffer which is overwritten, receives the grad of the conv output. The
+// ReLU is masked by the sign of y, the pooling goes through argmax. dbias,
+// [out_channels], is overwritten by the sum of dconv over each channel, it
+// may be null. Output channels run in parallel.
+void conv2d_epilogue_backward(const Conv2dShape& shape, index_t out_channels,
+                              const Conv2dEpilogue& epilogue,
+                              const data_t* y, const data_t* dy,
+                              data_t* dconv, data_t* dbias);
+
+// The ways to compute a 2D convolution: im2col + gemm, the direct kernels
+// above, the Winograd kernels in kernel/winograd.hpp or the FFT kernels in
+// kernel/fft_conv.hpp.
+enum class Conv2dAlgorithm { im2col_gemm, direct, winograd, fft };
+
+// The fastest algorithm for this convolution. Large convs, up to 256 MB of
+// operands, are tuned by utils/autotune.hpp, which times a forward and a
+// backward by each of the algorithms which can run them, FFT only from 5x5
+// kernels. Others, or all of them if tuning is disabled, take a guess:
+// Winograd for 3x3 kernels of stride 1 with enough channels, FFT for large
+// kernels of stride 1 whose spectra take at most 256 MB, see
+// fft_conv2d_bytes. Otherwise deep patches (channel * kernel_h * kernel_w)
+// keep the packed gemm busy, while the direct kernels win on shallow
+// patches, and an im2col matrix of more than 32 MB is never built. Grouped
+// convs are only supported by the direct kernels.
+Conv2dAlgorithm conv2d_algorithm(const Conv2dShape& shape, index_t out_channels,
+                                 index_t groups=1);
+
+}  // namespace kernel
+}  // namespace st
+#endif
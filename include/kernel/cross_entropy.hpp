@@ -0,0 +1,24 @@
+#ifndef KERNEL_CROSS_ENTROPY_H
+#define KERNEL_CROSS_ENTROPY_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+// Softmax cross-entropy of the logits x: [n, c] with a label per row, the
+// mean over the rows of -log(softmax(x)[i, labels[i]]), which is returned.
+// softmax(x) is written into prob for the backward.
+data_t cross_entropy_forward(index_t n, index_t c, const data_t* x,
+                             const index_t* labels, data_t* prob);
+
+// Grad of the logits, dx = grad / n * (prob - onehot(labels)), where grad
+// is the one of the loss. With accumulate, dx += it instead, so it can be
+// written straight into the grad of the logits.
+void cross_entropy_backward(index_t n, index_t c, const data_t* prob,
+                            const index_t* labels, data_t grad, data_t* dx,
+                            bool accumulate=false);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -0,0 +1,55 @@
+#ifndef KERNEL_FFT_H
+#define KERNEL_FFT_H
+
+#include <complex>
+#include <vector>
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+using Complex = std::complex<data_t>;
+
+// Radix-2 FFT of n points, n a power of 2. The bit reversal and the twiddle
+// factors are computed once by the constructor.
+class Fft {
+public:
+    explicit Fft(index_t n);
+
+    index_t size(void) const { return n_; }
+    // In place, x[k] = sum of x[j] * exp(-2 pi i jk / n), every stride-th
+    // element of data. inverse uses exp(+2 pi i jk / n), unnormalized.
+    void transform(Complex* data, index_t stride, bool inverse) const;
+private:
+    index_t n_;
+    std::vector<index_t> reversed_;
+    std::vector<Complex> twiddles_;
+};
+
+// 2D FFT of a real [h, w] array, h and w powers of 2 and w >= 2. The
+// spectrum of a real array is Hermitian, so only its [h, w / 2 + 1] left
+// half is kept. Rows are transformed by an FFT of w / 2 points each, the
+// even and odd elements packed as one complex number, then the columns.
+class RealFft2d {
+public:
+    RealFft2d(index_t h, index_t w);
+
+    index_t spectrum_size(void) const { return h_ * (w_ / 2 + 1); }
+    // spectrum = FFT(in), in is contiguous.
+    void forward(const data_t* in, Complex* spectrum) const;
+    // out = IFFT(spectrum), normalized, spectrum is used as workspace.
+    void inverse(Complex* spectrum, data_t* out) const;
+private:
+    index_t h_, w_;
+    Fft rows_, cols_;
+    // exp(-2 pi i k / w) for k <= w / 2, to split the packed rows.
+    std::vector<Complex> split_;
+};
+
+// The smallest power of 2 not less than n.
+index_t fft_size(index_t n);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -0,0 +1,57 @@
+#ifndef KERNEL_FFT_CONV_H
+#define KERNEL_FFT_CONV_H
+
+#include "utils/base_config.hpp"
+#include "kernel/im2col.hpp"
+#include "kernel/conv.hpp"
+
+namespace st {
+namespace kernel {
+
+// Convolution through 2D real FFTs of the padded input, rounded up to
+// powers of 2. The products over channels are pointwise in the frequency
+// domain, so the cost hardly depends on the kernel size, unlike im2col or
+// direct conv which scale with kernel_h * kernel_w. Strided convs are
+// computed at stride 1 and subsampled.
+
+// Size of the FFTs for shape.
+void fft_conv2d_size(const Conv2dShape& shape, index_t& fft_h, index_t& fft_w);
+
+// Number of data_t in the spectrum of a weight, 2 * out_channels * channel
+// * fft_h * (fft_w / 2 + 1).
+size_t fft_filter_size(const Conv2dShape& shape, index_t out_channels);
+
+// Bytes of the spectra a forward and a backward keep at once: those of the
+// weight, of the batch of inputs and of the output grads. The kernels below
+// refuse shapes whose buffers don't fit the index_t sizes of Alloc.
+size_t fft_conv2d_bytes(const Conv2dShape& shape, index_t out_channels);
+
+// The spectrum of each kernel of w, the weight of [out_channels, channel *
+// kernel_h * kernel_w] in the layout of nn::Conv2d, addressed by its row and
+// column strides. It is read by the kernels below and can be kept as long
+// as w doesn't change.
+void fft_filter(const Conv2dShape& shape, index_t out_channels,
+                const data_t* w, const index_t* w_stride, data_t* spectrum);
+
+// y = conv(x, w) with the spectrum of w from fft_filter. x is addressed by
+// x_stride, one stride per dim, y is a contiguous [batch, out_channels,
+// out_h, out_w] output, which is overwritten. Images and output channels
+// run in parallel. The epilogue, if any, is applied as winograd_forward
+// does.
+void fft_conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                        const data_t* x, const index_t* x_stride,
+                        const data_t* spectrum, data_t* y,
+                        const Conv2dEpilogue* epilogue=nullptr);
+
+// Grads of fft_conv2d_forward for a contiguous dy. dx is a contiguous
+// [batch, channel, height, width] buffer and dw a contiguous [out_channels,
+// channel * kernel_h * kernel_w] one, either of them may be null if not
+// needed. Both are overwritten.
+void fft_conv2d_backward(const Conv2dShape& shape, index_t out_channels,
+                         const data_t* x, const index_t* x_stride,
+                         const data_t* spectrum, const data_t* dy,
+                         data_t* dx, data_t* dw);
+
+}  // namespace kernel
+}  // namespace st
+#endif
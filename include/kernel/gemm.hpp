@@ -0,0 +1,48 @@
+#ifndef KERNEL_GEMM_H
+#define KERNEL_GEMM_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+enum class Activation { identity, relu };
+
+// Applied by gemm to each tile of c once its whole product is accumulated,
+// while the tile is still in cache: c = act(c + bias[j]) in column j. bias
+// may be nullptr.
+struct GemmEpilogue {
+    const data_t* bias;
+    Activation activation;
+};
+
+// c = a * b (c += a * b with accumulate), with a: [m, k], b: [k, n] and 
+// c: [m, n] row-major with leading dimension ldc. a and b are addressed by 
+// their row and column strides, so a transposed operand is just a matrix
+// with swapped strides and is never copied beforehand.
+//
+// Blocks of a and b are packed into contiguous panels sized for L2 and L1,
+// then multiplied by a register-tiled micro-kernel. Large products are split
+// over the threads of utils/parallel.hpp, with block sizes tuned for their
+// shape by utils/autotune.hpp.
+void gemm(index_t m, index_t n, index_t k,
+          const data_t* a, index_t a_row_stride, index_t a_col_stride,
+          const data_t* b, index_t b_row_stride, index_t b_col_stride,
+          data_t* c, index_t ldc, bool accumulate=false,
+          const GemmEpilogue* epilogue=nullptr);
+
+// gemm over batch items, the t-th of which starts at a + t * a_batch_stride
+// and so on. A batch stride of 0 broadcasts one matrix to all the items, 
+// for c it means the products of all the items are summed into it. Items
+// are run in parallel.
+void batch_gemm(index_t batch, index_t m, index_t n, index_t k,
+                const data_t* a, index_t a_batch_stride, 
+                index_t a_row_stride, index_t a_col_stride,
+                const data_t* b, index_t b_batch_stride,
+                index_t b_row_stride, index_t b_col_stride,
+                data_t* c, index_t c_batch_stride, index_t ldc, 
+                bool accumulate=false);
+
+}  // namespace kernel
+}  // namespace st
+#endif
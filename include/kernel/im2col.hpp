@@ -0,0 +1,40 @@
+#ifndef KERNEL_IM2COL_H
+#define KERNEL_IM2COL_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+// Shape of a 2D convolution (or pooling) over an input of 
+// [batch, channel, height, width].
+struct Conv2dShape {
+    index_t batch, channel, height, width;
+    index_t kernel_h, kernel_w;
+    index_t stride_h, stride_w;
+    index_t padding_h, padding_w;
+
+    index_t out_h(void) const { 
+        return (height + 2 * padding_h - kernel_h) / stride_h + 1; 
+    }
+    index_t out_w(void) const {
+        return (width + 2 * padding_w - kernel_w) / stride_w + 1;
+    }
+};
+
+// Writes the patches of x into col, [out_h * out_w * batch, channel * 
+// kernel_h * kernel_w], in the layout of op::Img2col: row 
+// (oh * out_w + ow) * batch + b holds the patch at (oh, ow) of the b-th
+// image. x is addressed by x_stride, one stride per dim. Each row of a patch
+// is one copy, the padding around it is zero-filled. Rows run in parallel.
+void im2col(const Conv2dShape& shape, const data_t* x, const index_t* x_stride,
+            data_t* col);
+
+// Backward of im2col, sums every entry of col back into its pixel of x, a
+// contiguous [batch, channel, height, width] buffer which is overwritten.
+// Images and channels run in parallel.
+void col2im(const Conv2dShape& shape, const data_t* col, data_t* x);
+
+}  // namespace kernel
+}  // namespace st
+#endif
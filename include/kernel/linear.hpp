@@ -0,0 +1,31 @@
+#ifndef KERNEL_LINEAR_H
+#define KERNEL_LINEAR_H
+
+#include "utils/base_config.hpp"
+#include "kernel/gemm.hpp"
+
+namespace st {
+namespace kernel {
+
+// Kernels in this folder work on raw row-major buffers, the expression 
+// templates in exp/ call them once they have contiguous data.
+
+// y = act(x * w^T + b), with x: [n, k], w: [m, k], b: [m] and y: [n, m].
+// The product runs by gemm, whose epilogue applies the bias and the
+// activation to each tile of y while it is still in cache.
+void linear_forward(index_t n, index_t k, index_t m,
+                    const data_t* x, const data_t* w, const data_t* b,
+                    data_t* y, Activation act);
+
+// Backward of linear_forward. dy is the grad of y and is overwritten by the
+// grad before activation. dx = dy * w and dw = dy^T * x are two gemms, and
+// db = sum(dy, 0) is summed by blocks of columns in parallel. They are
+// assigned, any of them can be nullptr to be skipped.
+void linear_backward(index_t n, index_t k, index_t m,
+                     const data_t* x, const data_t* w, const data_t* y,
+                     data_t* dy, data_t* dx, data_t* dw, data_t* db,
+                     Activation act);
+
+}  // namespace kernel
+}  // namespace st
+#endif
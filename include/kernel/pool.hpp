@@ -0,0 +1,31 @@
+#ifndef KERNEL_POOL_H
+#define KERNEL_POOL_H
+
+#include "utils/base_config.hpp"
+#include "kernel/im2col.hpp"
+
+namespace st {
+namespace kernel {
+
+// Argmax of a window whose max is one of the zeros of the padding, it has
+// no pixel in x to pass the grad to.
+constexpr index_t pool_padding = INDEX_MAX;
+
+// y = max_pool(x) in one pass over each window, with the same zero padding
+// as img2col. x is addressed by x_stride, one stride per dim, y is a
+// contiguous [batch, channel, out_h, out_w] output and argmax holds, for
+// each element of y, the offset h * width + w of its max in its plane of x,
+// or pool_padding. The first max of a window wins. Images and channels run
+// in parallel.
+void max_pool2d_forward(const Conv2dShape& shape, const data_t* x,
+                        const index_t* x_stride, data_t* y, index_t* argmax);
+
+// Backward of max_pool2d_forward, scatters each element of dy to the pixel
+// of its argmax. dx is a contiguous [batch, channel, height, width] buffer
+// which is overwritten. Images and channels run in parallel.
+void max_pool2d_backward(const Conv2dShape& shape, const data_t* dy,
+                         const index_t* argmax, data_t* dx);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -0,0 +1,55 @@
+#ifndef KERNEL_QUANT_H
+#define KERNEL_QUANT_H
+
+#include <cstdint>
+
+#include "utils/base_config.hpp"
+#include "kernel/linear.hpp"
+#include "kernel/im2col.hpp"
+
+namespace st {
+namespace kernel {
+
+// Int8 kernels for inference. Values are quantized symmetrically, q =
+// round(v / scale) saturated to [-127, 127], so 0 is exact and padding is 0.
+
+// max(|x|), the range of x seen by a calibration.
+data_t max_abs(index_t n, const data_t* x);
+
+// Quantizes x with one scale.
+void quantize(index_t n, const data_t* x, data_t scale, int8_t* q);
+
+// Quantizes each row of w, [rows, cols], with its own scale max|row| / 127,
+// which is written into scales.
+void quantize_rows(index_t rows, index_t cols, const data_t* w,
+                   int8_t* q, data_t* scales);
+
+// Applied to the int32 accumulator of output channel j, y = act(acc *
+// x_scale * w_scales[j] + bias[j]). The kernels write y as double, or
+// requantize it with y_scale into an int8 output for a next int8 layer.
+struct Int8Epilogue {
+    const data_t* bias;
+    Activation activation;
+    data_t y_scale;
+};
+
+// y = act(x * w^T + b) with x: [n, k] and w: [m, k] in int8, with a scale per
+// row of w. The products are accumulated in int32 by SSE2 or AVX2, whichever
+// cpu::isa() allows. y: [n, m] is written if not nullptr, and so is yq.
+void int8_linear_forward(index_t n, index_t k, index_t m,
+                         const int8_t* x, data_t x_scale,
+                         const int8_t* w, const data_t* w_scales,
+                         const Int8Epilogue& epilogue, data_t* y, int8_t* yq);
+
+// The conv of x, a contiguous int8 [batch, channel, height, width] input, by
+// w, [out_channels, channel / groups * kernel_h * kernel_w] in int8, through
+// an int8 im2col of each image. y and yq are [batch, out_channels, out_h,
+// out_w], as int8_linear_forward.
+void int8_conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                         index_t groups, const int8_t* x, data_t x_scale,
+                         const int8_t* w, const data_t* w_scales,
+                         const Int8Epilogue& epilogue, data_t* y, int8_t* yq);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -0,0 +1,19 @@
+#ifndef KERNEL_REDUCE_H
+#define KERNEL_REDUCE_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+// dst += src summed over the dims where dst_stride is 0, both of the given
+// shape and addressed by their own strides, e.g. the grad of a broadcast
+// bias. The threads split the elements of dst, and the sums along the
+// innermost dim go through the vector kernels, which gather a strided one.
+void sum_broadcast(index_t ndim, const index_t* shape,
+                   const data_t* src, const index_t* src_stride,
+                   data_t* dst, const index_t* dst_stride);
+
+}  // namespace kernel
+}  // namespace st
+#endif
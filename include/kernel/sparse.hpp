@@ -0,0 +1,57 @@
+#ifndef KERNEL_SPARSE_H
+#define KERNEL_SPARSE_H
+
+#include <vector>
+
+#include "utils/base_config.hpp"
+#include "kernel/linear.hpp"
+
+namespace st {
+namespace kernel {
+
+// Layout of a sparse [rows, cols] matrix split into block_h x block_w blocks,
+// of which only the nonzero ones are stored, row of blocks by row of blocks
+// (BSR). 1x1 blocks are plain CSR. The values of the blocks are kept apart,
+// block after block, each of them in row-major order.
+struct SparsePattern {
+    index_t rows, cols;
+    index_t block_h, block_w;
+    // The blocks of the i-th row of blocks are [row_ptr[i], row_ptr[i + 1]).
+    std::vector<index_t> row_ptr;
+    // The column of blocks of each block.
+    std::vector<index_t> col_idx;
+
+    index_t nnz_blocks(void) const { return col_idx.size(); }
+    index_t nnz(void) const { return nnz_blocks() * block_h * block_w; }
+};
+
+// The pattern of the blocks of dense with a nonzero value, dense being a
+// [rows, cols] row-major matrix whose sizes are multiples of the block.
+SparsePattern sparse_pattern(index_t rows, index_t cols,
+                             index_t block_h, index_t block_w,
+                             const data_t* dense);
+
+// Gathers the values of the blocks of pattern from dense, or scatters them
+// back into dense, whose other values are set to 0.
+void sparse_gather(const SparsePattern& pattern, const data_t* dense,
+                   data_t* values);
+void sparse_scatter(const SparsePattern& pattern, const data_t* values,
+                    data_t* dense);
+
+// y = act(x * w^T + b) for a sparse w: [m, k] given by pattern and values,
+// with x: [n, k], b: [m] and y: [n, m]. Only the stored blocks are read, so
+// the cost is proportional to the density of w.
+void sparse_linear_forward(index_t n, const SparsePattern& pattern,
+                           const data_t* values, const data_t* x,
+                           const data_t* b, data_t* y, Activation act);
+
+// Backward of sparse_linear_forward, as linear_backward does. dvalues is
+// the grad of the stored values only, the zeros of w get no grad.
+void sparse_linear_backward(index_t n, const SparsePattern& pattern,
+                            const data_t* values, const data_t* x,
+                            const data_t* y, data_t* dy, data_t* dx,
+                            data_t* dvalues, data_t* db, Activation act);
+
+}  // namespace kernel
+}  // namespace st
+#endif
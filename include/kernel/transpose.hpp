@@ -0,0 +1,26 @@
+#ifndef KERNEL_TRANSPOSE_H
+#define KERNEL_TRANSPOSE_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+// dst[j * ldd + i] = src[i * lds + j] for i < rows and j < cols. The matrix
+// is walked in 32x32 tiles, so both the reads and the writes of a tile stay 
+// in L1, and each tile is moved by 4x4 (SSE2 when available) blocks.
+void transpose(index_t rows, index_t cols, const data_t* src, index_t lds,
+               data_t* dst, index_t ldd);
+
+// Copies src into dst, both of the given shape, addressed by their own 
+// strides, e.g. the copy behind TensorImpl::contiguous(). With accumulate,
+// dst += src instead. When the dims where src and dst are unit-strided differ,
+// the copy is a tiled transpose over these two dims. ndim is at most 16.
+void strided_copy(index_t ndim, const index_t* shape,
+                  const data_t* src, const index_t* src_stride,
+                  data_t* dst, const index_t* dst_stride,
+                  bool accumulate=false);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -0,0 +1,35 @@
+#ifndef KERNEL_VECTOR_H
+#define KERNEL_VECTOR_H
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace kernel {
+
+// Kernels over vectors, contiguous unless given a stride, each one in SSE2,
+// AVX2 and AVX-512 variants run by the level of cpu::isa().
+
+// y += a * x
+void axpy(index_t n, data_t a, const data_t* x, data_t* y);
+
+// The sum of x, in as many partial sums as the vectors allow.
+data_t sum(index_t n, const data_t* x);
+
+// The same on x read every incx elements. AVX2 and AVX-512 gather it.
+void axpy(index_t n, data_t a, const data_t* x, index_t incx, data_t* y);
+data_t sum(index_t n, const data_t* x, index_t incx);
+
+// y = y + bias, then y = 0 where y < 0 if relu.
+void bias_act(index_t n, data_t bias, bool relu, data_t* y);
+
+// dy = 0 where !(y > 0), the grad of a ReLU from its output.
+void relu_mask(index_t n, const data_t* y, data_t* dy);
+
+// A step of SGD with momentum, velocity = momentum * velocity + grad, then
+// param -= lr * velocity.
+void momentum_update(index_t n, data_t lr, data_t momentum, const data_t* grad,
+                     data_t* velocity, data_t* param);
+
+}  // namespace kernel
+}  // namespace st
+#endif
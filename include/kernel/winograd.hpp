@@ -0,0 +1,55 @@
+#ifndef KERNEL_WINOGRAD_H
+#define KERNEL_WINOGRAD_H
+
+#include "utils/base_config.hpp"
+#include "kernel/im2col.hpp"
+#include "kernel/conv.hpp"
+
+namespace st {
+namespace kernel {
+
+// Winograd convolution F(m x m, 3 x 3) for 3x3 kernels of stride 1, with m
+// of 2 or 4. Each tile of (m + 2) x (m + 2) inputs is transformed, and the
+// (m + 2)^2 points of the transform are (out_channels x channel) by
+// (channel x tiles) products run by batch_gemm. They cost (m + 2)^2 / m^2
+// multiplies per output, instead of 9 for a direct conv.
+
+// Whether shape can run on these kernels.
+bool winograd_eligible(const Conv2dShape& shape);
+
+// The output tile m for shape, 4 unless the output is too small to fill
+// the tiles of F(4x4, 3x3).
+index_t winograd_tile(const Conv2dShape& shape);
+
+// Size of the transformed filter, (m + 2)^2 * out_channels * channel.
+index_t winograd_filter_size(index_t m, index_t out_channels, index_t channel);
+
+// u = G w G^T for each pair of output channel and channel. w is the weight of
+// [out_channels, channel * 9], the layout of nn::Conv2d, addressed by its row
+// and column strides. u is read by the kernels below and can be kept as long
+// as w doesn't change.
+void winograd_filter(index_t m, index_t out_channels, index_t channel,
+                     const data_t* w, const index_t* w_stride, data_t* u);
+
+// y = conv(x, w) with u from winograd_filter. x is addressed by x_stride,
+// one stride per dim, y is a contiguous [batch, out_channels, out_h, out_w]
+// output, which is overwritten. The epilogue, if any, is applied to each
+// plane of the output once its tiles are transformed, see
+// conv2d_epilogue_plane, and y is then the pooled output if it pools.
+void winograd_forward(const Conv2dShape& shape, index_t m, index_t out_channels,
+                      const data_t* x, const index_t* x_stride,
+                      const data_t* u, data_t* y,
+                      const Conv2dEpilogue* epilogue=nullptr);
+
+// Grads of winograd_forward for a contiguous dy, through the transposed
+// transforms. dx is a contiguous [batch, channel, height, width] buffer and
+// dw a contiguous [out_channels, channel * 9] one, either of them may be
+// null if not needed. Both are overwritten.
+void winograd_backward(const Conv2dShape& shape, index_t m, index_t out_channels,
+                       const data_t* x, const index_t* x_stride,
+                       const data_t* u, const data_t* dy,
+                       data_t* dx, data_t* dw);
+
+}  // namespace kernel
+}  // namespace st
+#endif
@@ -26,7 +26,9 @@ protected:
         return param_.shape_.dsize();
     }
 
+    // The storage is about to be written, see Storage::update_count().
     data_t* get_storage(void) const {
+        param_.storage_.increment_update_count();
         return param_.storage_.dptr_;
     }
 
@@ -6,8 +6,13 @@
 #include <unordered_map>
 #include <functional>
 #include <initializer_list>
+#include <memory>
 
 #include "tensor/tensor.hpp"
+#include "tensor/sparse_tensor.hpp"
+#include "kernel/im2col.hpp"
+#include "kernel/linear.hpp"
+#include "nn/quantize.hpp"
 
 namespace st {
 namespace nn {
@@ -54,9 +59,52 @@ public:
 
     Tensor forward(const Tensor& input) override;
     ParamsDict parameters(void) override;
+
+    // Keeps only the nonzero values of the weight, e.g. once it is pruned,
+    // as CSR or in block_h x block_w blocks, see SparseTensor. The forward
+    // then runs kernel::sparse_linear_forward, and "weight" of parameters()
+    // is the stored values, so optimizers train them and keep the zeros.
+    // The dense weight is released, sparse_weight()->to_dense() rebuilds it.
+    void sparsify(index_t block_h=1, index_t block_w=1);
+    // The weight, or nullptr if it isn't sparsified.
+    const SparseTensor* sparse_weight(void) const { return sparse_weight_.get(); }
+
+    // Post-training int8 quantization, for inference. After 
+    // start_calibration(), forward records the range of its inputs, e.g. 
+    // over some batches of a dataset, then quantize() stores the weight in
+    // int8, see Int8Quantizer. The forward then runs the int8 kernels, and
+    // its output doesn't require grad. Unless keep_weight, the double
+    // weight is released: parameters() no longer has "weight", sparsify()
+    // can't run, and dequantize() rebuilds a dense weight from the int8 one,
+    // q * scale, each value within half a step of its scale of the original.
+    void start_calibration(void) { quantizer_.start_calibration(); }
+    void quantize(bool keep_weight=true);
+    void dequantize(void);
+    bool quantized(void) const { return quantizer_.quantized(); }
+
+    // Chains quantized layers in int8. quantize_input() quantizes the input
+    // of the first one with its calibrated scale, forward_int8(x, y_scale)
+    // requantizes the output with y_scale, the input_scale() of the next
+    // layer, in the epilogue of the int8 kernels, and forward_int8(x) writes
+    // the output of the last one in double.
+    data_t input_scale(void) const { return quantizer_.input_scale(); }
+    Int8Tensor quantize_input(const Tensor& x) const;
+    Int8Tensor forward_int8(const Int8Tensor& x, data_t y_scale) const;
+    Tensor forward_int8(const Int8Tensor& x) const;
 protected:
-    Tensor weight_;
+    // act(x * w^T + b) with x quantized into a buffer of the quantizer.
+    Tensor int8_forward(const Tensor& x);
+    // act(x * w^T + b) by kernel::int8_linear_forward, x: [n, k] quantized
+    // with x_scale, into y and yq if not nullptr.
+    void int8_forward(const Shape& x_shape, const int8_t* x, data_t x_scale,
+                      data_t y_scale, data_t* y, int8_t* yq) const;
+
+    // nullptr once sparsified, or dropped by quantize(/*keep_weight=*/false).
+    std::unique_ptr<Tensor> weight_;
     Tensor bias_;
+    std::unique_ptr<SparseTensor> sparse_weight_;
+    Int8Quantizer quantizer_;
+    kernel::Activation activation_ = kernel::Activation::identity;
 };
 
 class LinearWithReLU : public Linear {
@@ -69,30 +117,74 @@ class Conv2d : public Module {
 public:
     using Wsize = op::Img2col::Wsize;
 
+    // The channels are split into groups convolved separately, each one by
+    // out_channels / groups kernels. groups == in_channels is a depthwise conv.
     Conv2d(index_t in_channels, index_t out_channels, 
            const Wsize& kernel_size, const Wsize& stride, 
-           const Wsize& padding);
+           const Wsize& padding, index_t groups=1);
     Conv2d(const Conv2d& other) = delete;
     ~Conv2d() = default;
 
+    // Runs op::conv2d or im2col + matrix_mul, with the algorithm which
+    // kernel::conv2d_algorithm expects to be the fastest.
     Tensor forward(const Tensor& input) override;
     ParamsDict parameters(void) override;
+
+    // Post-training int8 quantization and chains, as Linear::quantize().
+    // The int8 conv runs by im2col + int8 gemm, with the bias and the ReLU
+    // in its epilogue. forward_int8 doesn't pool, see Conv2dWithReLU.
+    void start_calibration(void) { quantizer_.start_calibration(); }
+    void quantize(bool keep_weight=true);
+    void dequantize(void);
+    bool quantized(void) const { return quantizer_.quantized(); }
+
+    data_t input_scale(void) const { return quantizer_.input_scale(); }
+    Int8Tensor quantize_input(const Tensor& x) const;
+    Int8Tensor forward_int8(const Int8Tensor& x, data_t y_scale) const;
+    Tensor forward_int8(const Int8Tensor& x) const;
 protected:
+    kernel::Conv2dShape conv_shape(const Shape& x_shape) const;
+    // conv2d(x) + bias, followed by a ReLU if relu and a 2x2 max pooling of
+    // stride 2 if max_pool. The direct, Winograd and FFT kernels apply them
+    // as the epilogue of the conv, see op::conv2d_bias. im2col + gemm runs
+    // the fused linear kernel and pools by a separate op.
+    Tensor forward_with(const Tensor& x, bool relu, bool max_pool);
+    // act(conv2d(x) + bias) by im2col + gemm.
+    Tensor im2col_forward(const Tensor& x, bool relu);
+    // act(conv2d(x) + bias) with x quantized into a buffer of the quantizer.
+    Tensor int8_forward(const Tensor& x);
+    // act(conv2d(x) + bias) by kernel::int8_conv2d_forward, x quantized with
+    // x_scale, into y and yq if not nullptr.
+    void int8_forward(const Shape& x_shape, const int8_t* x, data_t x_scale,
+                      data_t y_scale, data_t* y, int8_t* yq) const;
+
     index_t in_channels_;
     index_t out_channels_;
 
     Wsize kernel_size_;
     Wsize stride_;
     Wsize padding_;
+    index_t groups_;
 
-    Tensor weight_;
+    // nullptr once sparsified, or dropped by quantize(/*keep_weight=*/false).
+    std::unique_ptr<Tensor> weight_;
+    Tensor bias_;
+    // Kept across steps for the Winograd and FFT algorithms.
+    std::shared_ptr<op::ConvFilter> filter_;
+    Int8Quantizer quantizer_;
+    bool relu_ = false;
+    bool max_pool_ = false;
 };
 
+// The ReLU, and the 2x2 max pooling of stride 2 which follows it if
+// max_pool, are fused into the conv unless it runs by im2col + gemm. The
+// int8 forward pools by a separate op, and forward_int8 refuses max_pool.
 class Conv2dWithReLU : public Conv2d {
 public:
     Conv2dWithReLU(index_t in_channels, index_t out_channels,
                    const Wsize& kernel_size, const Wsize& stride,
-                   const Wsize& padding);
+                   const Wsize& padding, index_t groups=1, 
+                   bool max_pool=false);
     Tensor forward(const Tensor& input) override;
 };
 
@@ -120,6 +212,9 @@ public:
 
     Tensor forward(const Tensor& input,
                    const index_t* labels);
+    // labels are read again whenever the loss is refreshed, see StepGraph.
+    Tensor forward(const Tensor& input,
+                   const std::shared_ptr<index_t>& labels);
 };
 
 }  // namespace nn
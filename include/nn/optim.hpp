@@ -18,7 +18,9 @@ protected:
     static index_t data_size(const TensorImpl& t) {
         return t.shape_.dsize();
     }
+    // The storage is about to be updated, see Storage::update_count().
     static data_t* get_storage(TensorImpl& t) {
+        t.storage_.increment_update_count();
         return t.storage_.dptr_;
     };
     static data_t* get_grad(TensorImpl& t) {
@@ -0,0 +1,63 @@
+#ifndef NN_QUANTIZE_H
+#define NN_QUANTIZE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "tensor/tensor.hpp"
+
+namespace st {
+namespace nn {
+
+// An int8 activation, data[i] * scale, passed between quantized layers
+// without going through double, see Linear::forward_int8().
+struct Int8Tensor {
+    Shape shape;
+    data_t scale;
+    std::vector<int8_t> data;
+};
+
+// Post-training int8 quantization of the weight of a layer and calibration
+// of the range of its input, see Linear::quantize(). The weight is quantized
+// per output channel by kernel::quantize_rows, the input by one scale r / 127,
+// r being the largest |x| observed while calibrating.
+class Int8Quantizer {
+public:
+    // Forgets the range observed so far, observe() then records it.
+    void start_calibration(void);
+    void observe(const Tensor& x);
+    // Quantizes weight, [out_channels, ...], and ends the calibration. A
+    // range must have been observed.
+    void quantize(const Tensor& weight);
+    // Drops the int8 weight, the layer runs in double again.
+    void dequantize(void);
+    // The int8 weight in double, q * scale, [rows, cols], which stands for a
+    // weight dropped after quantization, see Linear::quantize().
+    Tensor dequantized_weight(void) const;
+
+    bool calibrating(void) const { return calibrating_; }
+    bool quantized(void) const { return !weight_.empty(); }
+    data_t input_scale(void) const { return input_range_ / 127; }
+    // The quantized weight, [rows(), cols()], and its scale per row.
+    index_t rows(void) const { return rows_; }
+    index_t cols(void) const { return cols_; }
+    const int8_t* weight(void) const { return weight_.data(); }
+    const data_t* weight_scales(void) const { return weight_scales_.data(); }
+
+    // x, contiguous or not, quantized with input_scale().
+    Int8Tensor quantize_input(const Tensor& x) const;
+    // The same into a buffer kept across the forwards of the layer.
+    const int8_t* buffered_input(const Tensor& x);
+private:
+    bool calibrating_ = false;
+    data_t input_range_ = 0;
+    index_t rows_ = 0;
+    index_t cols_ = 0;
+    std::vector<int8_t> weight_;
+    std::vector<data_t> weight_scales_;
+    std::vector<int8_t> input_;
+};
+
+}  // namespace nn
+}  // namespace st
+#endif
@@ -0,0 +1,51 @@
+#ifndef NN_STEP_GRAPH_H
+#define NN_STEP_GRAPH_H
+
+#include <memory>
+
+#include "tensor/tensor.hpp"
+#include "tensor/forward_plan.hpp"
+#include "nn/module.hpp"
+
+namespace st {
+namespace nn {
+
+// StepGraph runs the forward and backward of a training step. The first 
+// step is run eagerly and captured into a ForwardPlan. Later steps copy the
+// new samples and labels into the captured buffers and replay the plan, so
+// no ExpImpl, AutoGradMeta or GradFn is built again.
+//
+//     StepGraph graph(model, criterion, {batch_size, n_features});
+//     const Tensor& loss = graph.step(samples, labels);
+//     optimizer.step();
+//     optimizer.zero_grad();
+//
+// The shape of the input is fixed at construction. step() with a number of
+// samples runs batches of another size, e.g. the last incomplete batch,
+// eagerly, and replays the plan for the others.
+class StepGraph {
+public:
+    StepGraph(Module& model, CrossEntropy& criterion, const Shape& input_shape);
+    StepGraph(const StepGraph& other) = delete;
+    ~StepGraph() = default;
+
+    const Tensor& step(const data_t* samples, const index_t* labels);
+    const Tensor& step(const data_t* samples, const index_t* labels,
+                       index_t n_samples);
+    bool captured(void) const { return bool(loss_); }
+    const Tensor& input(void) const { return input_; }
+private:
+    Module& model_;
+    CrossEntropy& criterion_;
+
+    Tensor input_;
+    std::shared_ptr<index_t> labels_;
+    ForwardPlan plan_;
+    Alloc::NontrivialUniquePtr<Tensor> loss_;
+    // The loss of the last eager step.
+    Alloc::NontrivialUniquePtr<Tensor> eager_loss_;
+};
+
+}  // namespace nn
+}  // namespace st
+#endif
@@ -0,0 +1,79 @@
+#ifndef TENSOR_AUTOGRAD_H
+#define TENSOR_AUTOGRAD_H
+
+#include <mutex>
+#include <vector>
+
+#include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
+
+namespace st {
+
+class TensorImpl;
+class Storage;
+template<typename T> class ExpImplPtr;
+
+namespace autograd {
+
+// Runs the backward of a graph of TensorImpls, each one linked by its
+// grad_fn to the tensors it passes its grad to. The graph is walked once
+// from the root to count, for each tensor, the tensors it gets a grad from.
+// Then the grad_fn of a tensor is run from a ready queue once all of them
+// have run, so each grad_fn runs once, on a complete grad, and the depth of
+// the recursion is only that of the expression of one grad_fn. Unless the
+// graph is retained, a grad_fn is released once it has run, so the forward
+// intermediates are freed as the backward goes instead of when it ends.
+// The ready tensors are run wave by wave. The grad_fns of a wave are on
+// independent branches, so they are split among the threads by
+// parallel_tasks, each branch keeping a share of the threads for its
+// kernels, while a single grad_fn keeps all of them. The leaves of a wave
+// have no grad_fn and aren't counted. Grads passed to one tensor from
+// several threads are summed in no fixed order.
+class Engine {
+public:
+    // The grad of root must have been accumulated already.
+    static void backward(TensorImpl& root, bool retain_graph);
+private:
+    struct Node {
+        // Owned until the grad_fn has run, as the grad_fns released before
+        // may have held the last reference to the tensor.
+        Alloc::NontrivialUniquePtr<ExpImplPtr<TensorImpl>> tensor;
+        // The tensors the grad_fn passes a grad to, once each.
+        std::vector<index_t> next;
+        // The number of tensors which pass a grad to this one and haven't
+        // run yet.
+        index_t dependencies;
+    };
+
+    static std::vector<Node> build_graph(TensorImpl& root);
+};
+
+// Locks taken while grad_fns run on several threads. grad_mutex guards the
+// accumulation into a grad, keyed by its buffer since the grads of views
+// share the one of their base. expression_mutex guards the backward of an
+// expression, which more than one tensor may have as grad_fn. The mutexes
+// are shared by stripes of keys.
+std::mutex& grad_mutex(const Storage& grad);
+std::mutex& expression_mutex(const void* expression);
+
+// Whether autograd records the tensors built on the current thread. It is
+// false while a NoGradGuard lives: the tensors built from expressions or as
+// views don't require grad, so they get no grad buffer and no grad_fn, and
+// an assignment to a tensor which requires grad doesn't replace its grad_fn.
+bool grad_enabled(void);
+
+// Disables autograd on the current thread for its lifetime, e.g. around an
+// evaluation loop, so that a forward costs only its math.
+class NoGradGuard {
+public:
+    NoGradGuard();
+    ~NoGradGuard();
+    NoGradGuard(const NoGradGuard&) = delete;
+    NoGradGuard& operator=(const NoGradGuard&) = delete;
+private:
+    bool previous_;
+};
+
+}  // namespace autograd
+}  // namespace st
+#endif
@@ -0,0 +1,50 @@
+#ifndef TENSOR_FORWARD_PLAN_H
+#define TENSOR_FORWARD_PLAN_H
+
+#include <memory>
+#include <vector>
+
+#include "utils/base_config.hpp"
+#include "utils/allocator.hpp"
+
+namespace st {
+
+// A forward assignment which can be evaluated again. See __ForwardFn in 
+// tensor/tensor_impl.hpp.
+struct ForwardFn {
+    virtual void operator()(void) = 0;
+    virtual ~ForwardFn() = default;
+};
+
+// ForwardPlan records every assignment to a Tensor between begin_capture()
+// and end_capture(), in the order they happen. These assignments keep the 
+// expressions and the TensorImpls they write into alive, so replay() runs the
+// same forward computation again into the same buffers. New input is fed by
+// overwriting the storage of the captured input tensors in place.
+//
+// Only Tensor construction from an expression and Tensor::operator= are 
+// recorded. operator+= is not, since replaying it would accumulate twice.
+class ForwardPlan {
+public:
+    ForwardPlan() = default;
+    ForwardPlan(const ForwardPlan& other) = delete;
+    ~ForwardPlan();
+
+    void begin_capture(void);
+    void end_capture(void);
+    void replay(void) const;
+    void clear(void);
+
+    index_t size(void) const { return fns_.size(); }
+    bool empty(void) const { return fns_.empty(); }
+
+    static bool capturing(void) { return active_ != nullptr; }
+    static void record(std::shared_ptr<ForwardFn>&& fn);
+private:
+    std::vector<std::shared_ptr<ForwardFn>> fns_;
+    // One plan captures at a time on each thread.
+    static thread_local ForwardPlan* active_;
+};
+
+}  // namespace st
+#endif
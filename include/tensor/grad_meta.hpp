@@ -1,6 +1,8 @@
 #ifndef TENSOR_GRAD_META_H
 #define TENSOR_GRAD_META_H
 
+#include <vector>
+
 // #include "utils/exception.hpp"
 #include "exp/grad_impl.hpp"
 // #include "tensor/tensor_impl.hpp"
@@ -9,6 +11,8 @@
 
 
 namespace st {
+class TensorImpl;
+
 // TensorImpl isn't a template class, which means AutoGradMeta couldn't be a template
 // class. But AutoGradMeta need store the information of next_exp via template class
 // ExpImplPtr<ImplType>. 
@@ -18,6 +22,8 @@ struct GradFn {
     virtual void operator()(void) = 0;
     virtual void operator()(const Storage& grad, const Shape& shape,
                             const IndexArray& stride) = 0;
+    // Appends the tensors the grad is passed to, see autograd::Engine.
+    virtual void collect_next(std::vector<TensorImpl*>& tensors) const = 0;
     virtual ~GradFn() = default;
 
     struct TensorGradImpl: public GradImpl<TensorGradImpl> {
@@ -115,24 +121,27 @@ struct GradFn {
 Backward workflow:
 1. Tensor::backward()
     1. check requires_grad of TensorImpl;
-    2. check TensorImpl is scalar tensor;
+    2. accumulate the grad of the root TensorImpl;
+    3. run autograd::Engine::backward() from the root.
+
+2. autograd::Engine::backward()
+    1. walk the graph once from the root through GradFn::collect_next(), and
+       count for each TensorImpl the TensorImpls which pass it a grad;
+    2. run the ready TensorImpls wave by wave, release their grad_fns unless
+       the graph is retained, and make ready the next ones whose count
+       drops to 0.
 
-2. ExpImplPtr<Impl>::invoke_backward()
+3. ExpImplPtr<Impl>::invoke_backward()
     1. ExpImpl<TensorImpl>::invoke_backward()
-        1. check with_grad;
-        2. decrease gradcount of TensorImpl;
-        3. check version
+        1. check version
+        2. accumulate grad, the grad_fn is left to the engine
     2. ExpImpl<Impl>::invoke_backward()
         1. check with_grad
         2. decrease gradcount of Impl
 
-3. ExpImpl<Impl>::backward()
+4. ExpImpl<Impl>::backward()
     1. UnaryExpImpl
         1. check gradcount == 0. if not, throw Error
     2. BinaryExpImpl
         1. check gradcount == 0. if not, throw Error
-    3. TensorImpl
-        1. acculate grad
-        2. check gradcount == 0. if so, call grad_fn
-        3. check from_view is False. if so, don't pass grad
 */
\ No newline at end of file
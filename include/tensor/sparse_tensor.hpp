@@ -0,0 +1,46 @@
+#ifndef TENSOR_SPARSE_TENSOR_H
+#define TENSOR_SPARSE_TENSOR_H
+
+#include <memory>
+
+#include "kernel/sparse.hpp"
+#include "tensor/tensor.hpp"
+
+namespace st {
+
+// A matrix of which only the blocks with a nonzero value are stored, see
+// kernel::SparsePattern. The pattern is fixed once built, e.g. from a pruned
+// weight, while the stored values are a 1D Tensor which can be trained: it
+// gets the grads of the stored values only, and optimizers update it as any
+// other parameter.
+class SparseTensor {
+public:
+    // The nonzero values of dense as CSR, or its block_h x block_w blocks
+    // with a nonzero value, as block-sparse.
+    explicit SparseTensor(const Tensor& dense, index_t block_h=1, 
+                          index_t block_w=1, bool requires_grad=false);
+    SparseTensor(const SparseTensor& other) = default;
+
+    index_t ndim(void) const { return 2; }
+    index_t size(index_t idx) const;
+    Shape size(void) const;
+    index_t nnz(void) const { return pattern_->nnz(); }
+    // Ratio of the stored values to the size of the matrix.
+    data_t density(void) const;
+    bool is_block_sparse(void) const;
+
+    const std::shared_ptr<const kernel::SparsePattern>& pattern(void) const {
+        return pattern_;
+    }
+    Tensor& values(void) { return values_; }
+    const Tensor& values(void) const { return values_; }
+
+    // The matrix with zeros where no value is stored.
+    Tensor to_dense(void) const;
+private:
+    std::shared_ptr<const kernel::SparsePattern> pattern_;
+    Tensor values_;
+};
+
+}  // namespace st
+#endif
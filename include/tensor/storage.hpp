@@ -28,9 +28,18 @@ public:
     // inline function
     data_t operator[](index_t idx) const { return dptr_[idx]; }
     data_t& operator[](index_t idx) { return dptr_[idx]; }
+    const data_t* data(void) const { return dptr_; }
+    data_t* data(void) { return dptr_; }
     index_t offset(void) const { return dptr_ - bptr_->data_; }
+    // The start of the buffer shared by the storage and its views.
+    const data_t* base(void) const { return bptr_->data_; }
     index_t version(void) const { return bptr_->version_; }
     void increment_version(void) const { ++bptr_->version_; }
+    // Counts the writes by initializers and optimizers. Unlike version, it
+    // doesn't invalidate the graphs which read the storage, it is for the
+    // caches derived from parameters, like the filters of Winograd conv.
+    index_t update_count(void) const { return bptr_->update_count_; }
+    void increment_update_count(void) const { ++bptr_->update_count_; }
 
     // friend function
     friend class nn::InitializerBase;
@@ -38,6 +47,7 @@ public:
 private:
     struct Vdata {
         index_t version_;
+        index_t update_count_;
         data_t data_[1];
     };
 
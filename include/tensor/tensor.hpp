@@ -7,6 +7,7 @@
 #include "exp/exp.hpp"
 #include "exp/exp_impl.hpp"
 #include "tensor/tensor_impl.hpp"
+#include "jit/jit.hpp"
 
 
 namespace st {
@@ -43,6 +44,7 @@ public:
     index_t version(void) const;
     
     bool is_contiguous(void) const;
+    bool requires_grad(void) const;
     Tensor grad(void) const;
 
     data_t& operator[](std::initializer_list<index_t> ids);
@@ -56,11 +58,16 @@ public:
     Tensor squeeze(void) const;
     Tensor unsqueeze(index_t dim) const;
     Tensor permute(std::initializer_list<index_t> dims) const;
+    // A contiguous tensor with the same values, see TensorImpl::contiguous().
+    Tensor contiguous(void) const;
 
     template<typename ImplType> Tensor& operator=(const Exp<ImplType>& exp);
     template<typename ImplType> Tensor& operator+=(const Exp<ImplType>& exp);
 
-    void backward(void);
+    // Backward from this tensor. The grad_fns of the graph are released as
+    // they run, unless retain_graph or captured by a ForwardPlan, so that
+    // backward can go through them again.
+    void backward(bool retain_graph=false);
 
     // friend function
     friend std::ostream& operator<<(std::ostream& out, const Tensor& t);
@@ -68,11 +75,19 @@ public:
 
 template<typename ImplType> 
 Tensor::Tensor(const Exp<ImplType>& exp)
-        : Exp<TensorImpl>(Alloc::unique_construct<TensorImpl>(exp.impl()))
-    {}
+        : Exp<TensorImpl>(Alloc::unique_construct<TensorImpl>(exp.impl())) {
+    if(ForwardPlan::capturing())
+        ForwardPlan::record(
+            jit::forward_fn(impl(), exp.impl())
+        );
+}
 
 template<typename ImplType> Tensor& Tensor::operator=(const Exp<ImplType>& exp) {
     impl_ptr_->operator=(exp.impl());
+    if(ForwardPlan::capturing())
+        ForwardPlan::record(
+            jit::forward_fn(impl(), exp.impl())
+        );
     return *this;
 }
 
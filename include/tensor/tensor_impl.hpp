@@ -2,11 +2,17 @@
 #define TENSOR_TENSOR_IMPL_H
 
 #include <initializer_list>
+#include <cstring>
+#include <mutex>
+#include <vector>
 // #include <utility>
 
 #include "exp/exp_impl.hpp"
 #include "tensor/storage.hpp"
 #include "tensor/shape.hpp"
+#include "tensor/forward_plan.hpp"
+#include "tensor/autograd.hpp"
+#include "kernel/reduce.hpp"
 #include "utils/exception.hpp"
 
 
@@ -52,7 +58,12 @@ public:
     index_t offset(void) const { return storage_.offset(); }
     const IndexArray& stride(void) const { return stride_; }
     index_t version(void) const { return storage_.version(); }
+    index_t update_count(void) const { return storage_.update_count(); }
     bool requires_grad(void) const { return requires_grad_; }
+    // Address of the first element, for kernels which walk the storage 
+    // with stride() themselves.
+    const data_t* data(void) const { return storage_.data(); }
+    data_t* data(void) { return storage_.data(); }
 
     // other method
     bool is_contiguous(void) const;
@@ -71,22 +82,37 @@ public:
     Alloc::NontrivialUniquePtr<TensorImpl> unsqueeze(index_t dim) const;
     Alloc::NontrivialUniquePtr<TensorImpl> 
     permute(std::initializer_list<index_t> dims) const;
+    // Returns a view of itself if it is already contiguous, otherwise a
+    // contiguous copy whose gradient flows back into this tensor.
+    Alloc::NontrivialUniquePtr<TensorImpl> contiguous(void) const;
 
     // member function for expression template
     data_t eval(IndexArray& inds) const;
     data_t eval(index_t idx) const;
+    // TensorImpl is where a recorded graph stops. Its own value is refreshed
+    // by replaying the assignment which produced it.
+    void refresh(void) {}
     template<typename ImplType> TensorImpl& operator=(const ImplType& exp_impl);
     template<typename ImplType> TensorImpl& operator+=(const ImplType& exp_impl);
 
     // friend function
     friend std::ostream& operator<<(std::ostream& out, const TensorImpl& t);
     friend ExpImplPtr<TensorImpl>;
+    template<typename ImplType> friend class __ForwardFn;
     friend class nn::InitializerBase;
     friend class nn::OptimizerBase;
+    friend class autograd::Engine;
 private:
-
+    // Accumulates grad into the grad of this tensor. Its grad_fn is run later
+    // by autograd::Engine, once all the grads have come.
     template<typename ImplType> void backward(const ImplType& grad);
-    void backward(void);
+    // Passes the grad on through the grad_fn, if any, and lists the tensors
+    // it is passed to.
+    void run_grad_fn(void);
+    void collect_grad_fn_tensors(std::vector<TensorImpl*>& tensors) const;
+    void release_grad_fn(void);
+    // Whether run_grad_fn() has a grad_fn to run, false for the leaves.
+    bool has_grad_fn(void) const;
 
     Storage storage_;
     Shape shape_;
@@ -102,56 +128,61 @@ class ExpImplPtr<TensorImpl> {
 public:
     ExpImplPtr(Alloc::NontrivialUniquePtr<TensorImpl>&& ptr, bool with_grad)
             : ptr_(ptr.release()),
-              with_grad_(with_grad && static_cast<TensorImpl*>(ptr_)->requires_grad()),
               version_(static_cast<TensorImpl*>(ptr_)->version()) {
         increment_counters();
     }
     ExpImplPtr(const TensorImpl& impl, bool with_grad)
             : ptr_(const_cast<TensorImpl*>(&impl)),
-              with_grad_(with_grad && static_cast<TensorImpl*>(ptr_)->requires_grad()),
               version_(static_cast<TensorImpl*>(ptr_)->version()) {
         increment_counters();
     }
     ExpImplPtr(const ExpImplPtr& other, bool with_grad)
             : ptr_(other.ptr_),
-              with_grad_(with_grad && static_cast<TensorImpl*>(ptr_)->requires_grad()),
               version_(static_cast<TensorImpl*>(ptr_)->version()) { 
         increment_counters(); 
     }
+    ExpImplPtr(const ExpImplPtr& other)
+            : ptr_(other.ptr_),
+              version_(other.version_) {
+        increment_counters();
+    }
+    ExpImplPtr& operator=(const ExpImplPtr& other) = delete;
     ~ExpImplPtr() { decrease_refcount(); }
 
     TensorImpl* operator->(void) const { return static_cast<TensorImpl*>(ptr_); }
     const TensorImpl& operator*(void) const { return *static_cast<TensorImpl*>(ptr_); }
     explicit operator bool() const { return ptr_ != nullptr; }
 
+    void collect_grad_tensors(std::vector<TensorImpl*>& tensors) const {
+        TensorImpl* ptr = static_cast<TensorImpl*>(ptr_);
+        if(ptr->requires_grad())
+            tensors.push_back(ptr);
+    }
+
+    // A tensor is where the walk of an expression stops: the grad is only
+    // accumulated, autograd::Engine runs the grad_fn of the tensor later.
     template<typename GradImplType>
     void invoke_backward(const GradImplType& grad) {
         TensorImpl* ptr = static_cast<TensorImpl*>(ptr_);
         if(ptr->requires_grad()) {
             CHECK_EQUAL(version_, ptr->version(),
                 "Leaf variable has been moved into the graph interior");
-            if(with_grad_)
-                --ptr->gradcount_;
             ptr->backward(grad);
         }
     }
 
+    // The grad of a view is accumulated into the grad of its base already.
     void invoke_backward(void) {
         TensorImpl* ptr = static_cast<TensorImpl*>(ptr_);
         if(ptr->requires_grad()) {
             CHECK_EQUAL(version_, ptr->version(),
                 "Leaf variable has been moved into the graph interior");
-            if(with_grad_)
-                --ptr->gradcount_;
-            ptr->backward();
         }
     }
 private:
-    void increment_counters() { 
-        ++ ptr_->refcount_; 
-        if(with_grad_)
-            ++ ptr_->gradcount_;
-    }
+    // The uses of a tensor aren't counted for backward, autograd::Engine
+    // orders the grad_fns of tensors by itself.
+    void increment_counters() { ++ ptr_->refcount_; }
 
     void decrease_refcount() {
         -- ptr_->refcount_;
@@ -160,7 +191,6 @@ private:
     }
 
     ExpImpl<TensorImpl>* ptr_;
-    bool with_grad_;
     index_t version_;
     Alloc::nontrivial_delete_handler<TensorImpl> delete_handler;
 };
@@ -182,8 +212,15 @@ public:
     void operator()(const Storage& grad, const Shape& shape, 
                     const IndexArray& stride) override {
         TensorGradImpl grad_exp_impl(grad, shape, stride);
+        // The grad counts of the expression are changed by its backward.
+        std::lock_guard<std::mutex> lock(
+            autograd::expression_mutex(next_exp_.operator->()));
         next_exp_.invoke_backward(grad_exp_impl);
     }
+
+    void collect_next(std::vector<TensorImpl*>& tensors) const override {
+        next_exp_->collect_grad_tensors(tensors);
+    }
 private:
     ExpImplPtr<ImplType> next_exp_;
 };
@@ -203,6 +240,10 @@ public:
         TensorGradImpl grad_exp_impl(grad, shape, stride);
         next_exp_.invoke_backward(grad_exp_impl);
     }
+
+    void collect_next(std::vector<TensorImpl*>& tensors) const override {
+        tensors.push_back(next_exp_.operator->());
+    }
 private:
     ExpImplPtr<TensorImpl> next_exp_;
 };
@@ -213,16 +254,25 @@ struct AutoGradMeta {
     Storage grad_;
     bool from_view_;
     std::shared_ptr<GradFn> grad_fn_ptr_;
+    // Whether the grad_fn was dropped by a backward, see release_grad_fn().
+    bool released_;
+    // Whether the grad_fn was set during a ForwardPlan capture, whose
+    // replays need the graph again.
+    bool captured_;
 
     AutoGradMeta(const Shape& tensor_shape)
             : grad_(tensor_shape.dsize(), 0),
               from_view_(false),
-              grad_fn_ptr_(nullptr) {}
+              grad_fn_ptr_(nullptr),
+              released_(false),
+              captured_(false) {}
     
     AutoGradMeta(const Storage& grad, index_t offset)
             : grad_(grad, offset),
               from_view_(false),
-              grad_fn_ptr_(nullptr) {}
+              grad_fn_ptr_(nullptr),
+              released_(false),
+              captured_(false) {}
 
     void set_from_view(bool from_view) { from_view_ = from_view; }
 
@@ -230,6 +280,17 @@ struct AutoGradMeta {
     void set_grad_fn(const ImplType& impl) {
         auto ptr = Alloc::shared_construct<__GradFn<ImplType>>(impl);
         grad_fn_ptr_ = ptr;
+        released_ = false;
+        captured_ = ForwardPlan::capturing();
+    }
+
+    // Frees the expression of the grad_fn, and the tensors of the forward it
+    // was the last to hold, once the grad has been passed on.
+    void release_grad_fn(void) {
+        if(bool(grad_fn_ptr_) && !captured_) {
+            grad_fn_ptr_.reset();
+            released_ = true;
+        }
     }
 };
 
@@ -246,12 +307,97 @@ template<typename ImplType>
 void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
                                     const IndexArray& dist_stride, 
                                     const ImplType& src_exp);
+// Copies between tensors, e.g. contiguous() or the gradient flowing into a
+// tensor, don't need to evaluate element by element. These overloads move
+// the data with kernel::strided_copy instead, and products are accumulated
+// by kernel::gemm.
+void __assign(Storage& dist_storage, const Shape& dist_shape, 
+              const IndexArray& dist_stride, const TensorImpl& src_exp);
+void __assign_uncontiguous(Storage& dist_storage, const Shape& dist_shape, 
+                           const IndexArray& dist_stride, const TensorImpl& src_exp);
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, 
+                       const GradFn::TensorGradImpl& src_exp);
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const GradFn::TensorGradImpl& src_exp);
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, const DenseGradImpl& src_exp);
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const DenseGradImpl& src_exp);
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, const GemmGradImpl& src_exp);
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const GemmGradImpl& src_exp);
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, 
+                       const CrossEntropyGradImpl& src_exp);
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const CrossEntropyGradImpl& src_exp);
+
+// The grad of a tensor broadcast along some dims, those of stride 0 where
+// the grad isn't of size 1, is summed over them by kernel::sum_broadcast.
+// Grads other than these two are evaluated into a dense buffer first.
+template<typename ImplType>
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, const ImplType& grad);
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, 
+                        const GradFn::TensorGradImpl& grad);
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, const DenseGradImpl& grad);
+
+inline bool __is_broadcast(const Shape& grad_shape, const IndexArray& dist_stride) {
+    if(grad_shape.ndim() != dist_stride.size())
+        return false;
+    for(index_t i = 0; i < dist_stride.size(); ++i)
+        if(dist_stride[i] == 0 && grad_shape[i] != 1)
+            return true;
+    return false;
+}
+
+
+// A forward assignment recorded by ForwardPlan. Replaying it clears the grad
+// of dist, refreshes the states cached in src and evaluates src into dist
+// again, without building any new ExpImpl, AutoGradMeta or GradFn.
+template<typename ImplType>
+class __ForwardFn: public ForwardFn {
+public:
+    __ForwardFn(const TensorImpl& dist, const ImplType& src)
+            : dist_(dist, false), src_(src, false) {}
+    ~__ForwardFn() = default;
+
+    void operator()(void) override {
+        TensorImpl* dist = dist_.operator->();
+        AutoGradMeta* gradmeta = dist->gradmeta_ptr_.get();
+        if(dist->requires_grad_ && !gradmeta->from_view_)
+            std::memset(&gradmeta->grad_[0], 0, 
+                        dist->shape_.dsize() * sizeof(data_t));
+        assign();
+    }
+protected:
+    // Evaluates src into dist. Overridden by jit::__JitForwardFn.
+    virtual void assign(void) {
+        TensorImpl* dist = dist_.operator->();
+        src_->refresh();
+        if(dist->is_contiguous())
+            __assign(dist->storage_, dist->shape_, dist->stride_, *src_);
+        else
+            __assign_uncontiguous(dist->storage_, dist->shape_, dist->stride_, *src_);
+    }
+
+    ExpImplPtr<TensorImpl> dist_;
+    ExpImplPtr<ImplType> src_;
+};
 
 
 // member template function definition
 template<typename ImplType>
 TensorImpl::TensorImpl(const ImplType& impl)
-        : TensorImpl(impl.size(), impl.requires_grad()) {
+        : TensorImpl(impl.size(), impl.requires_grad() && autograd::grad_enabled()) {
     this->operator=(impl);
 }
 
@@ -260,8 +406,10 @@ TensorImpl& TensorImpl::operator=(const ImplType& exp_impl) {
     CHECK_EXP_SAME_SHAPE(*this, exp_impl);
 
     if(requires_grad_) {
-        gradmeta_ptr_->set_grad_fn(exp_impl);
-        gradmeta_ptr_->set_from_view(false);
+        if(autograd::grad_enabled()) {
+            gradmeta_ptr_->set_grad_fn(exp_impl);
+            gradmeta_ptr_->set_from_view(false);
+        }
         storage_.increment_version();
     }
 
@@ -277,8 +425,10 @@ TensorImpl& TensorImpl::operator+=(const ImplType& exp_impl) {
     CHECK_EXP_SAME_SHAPE(*this, exp_impl);
 
     if(requires_grad_) {
-        gradmeta_ptr_->set_grad_fn(exp_impl);
-        gradmeta_ptr_->set_from_view(false);
+        if(autograd::grad_enabled()) {
+            gradmeta_ptr_->set_grad_fn(exp_impl);
+            gradmeta_ptr_->set_from_view(false);
+        }
         storage_.increment_version();
     }
     
@@ -293,8 +443,10 @@ inline TensorImpl& TensorImpl::operator=(const TensorImpl& other) {
     CHECK_EXP_SAME_SHAPE(*this, other);
 
     if(requires_grad_) {
-        gradmeta_ptr_->set_grad_fn(other);
-        gradmeta_ptr_->set_from_view(false);
+        if(autograd::grad_enabled()) {
+            gradmeta_ptr_->set_grad_fn(other);
+            gradmeta_ptr_->set_from_view(false);
+        }
         storage_.increment_version();
     }
 
@@ -311,18 +463,22 @@ void TensorImpl::backward(const ImplType& grad) {
     // shape will be the same to this->shape_;
     // Otherwise, shape will be broadcasted.
     Shape shape(grad.grad_size());
+    std::lock_guard<std::mutex> lock(autograd::grad_mutex(gradmeta_ptr_->grad_));
     if(is_contiguous() && shape == shape_) {
         __inplacement_add(gradmeta_ptr_->grad_, shape, stride_, grad);
+    } else if(__is_broadcast(shape, stride_)) {
+        __reduce_broadcast(gradmeta_ptr_->grad_, shape, stride_, grad);
     } else {
         __inplacement_add_uncontiguous(
             gradmeta_ptr_->grad_, shape, stride_, grad
         );
     }
-    backward();
 }
 
-inline void TensorImpl::backward(void) {
-    if(bool(gradmeta_ptr_->grad_fn_ptr_) && gradcount() == 0) {
+inline void TensorImpl::run_grad_fn(void) {
+    CHECK_TRUE(!gradmeta_ptr_->released_,
+        "The graph has been freed by a backward, call backward(true) to keep it.");
+    if(bool(gradmeta_ptr_->grad_fn_ptr_)) {
         auto& grad_fn = *(gradmeta_ptr_->grad_fn_ptr_);
         if(gradmeta_ptr_->from_view_)
             grad_fn();
@@ -331,6 +487,19 @@ inline void TensorImpl::backward(void) {
     }
 }
 
+inline void TensorImpl::release_grad_fn(void) {
+    gradmeta_ptr_->release_grad_fn();
+}
+
+inline bool TensorImpl::has_grad_fn(void) const {
+    return bool(gradmeta_ptr_->grad_fn_ptr_);
+}
+
+inline void TensorImpl::collect_grad_fn_tensors(std::vector<TensorImpl*>& tensors) const {
+    if(bool(gradmeta_ptr_->grad_fn_ptr_))
+        gradmeta_ptr_->grad_fn_ptr_->collect_next(tensors);
+}
+
 template<typename ImplType>
 void __assign(Storage& dist_storage, const Shape& dist_shape, 
               const IndexArray& dist_stride, const ImplType& src_exp) {
@@ -394,6 +563,19 @@ void __assign_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
     }
 }
 
+template<typename ImplType>
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, const ImplType& grad) {
+    Storage buffer(grad_shape.dsize());
+    IndexArray stride(grad_shape.ndim());
+    for(index_t i = 0; i < stride.size(); ++i)
+        stride[i] = grad_shape[i] == 1 ? 0 : grad_shape.subsize(i + 1);
+    __assign(buffer, grad_shape, stride, grad);
+    IndexArray shape = grad_shape;
+    kernel::sum_broadcast(shape.size(), shape.data(), buffer.data(), stride.data(),
+                          dist_storage.data(), dist_stride.data());
+}
+
 template<typename ImplType>
 void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape, 
                                     const IndexArray& dist_stride, const ImplType& src_exp) {
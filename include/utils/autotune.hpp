@@ -0,0 +1,51 @@
+#ifndef UTILS_AUTOTUNE_H
+#define UTILS_AUTOTUNE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace autotune {
+
+// A configuration of a kernel, such as the block sizes of gemm or the
+// algorithm of a conv, or the key of a problem, such as (m, n, k).
+using Config = std::vector<index_t>;
+
+// Whether the kernels are tuned. It is false by default, and can be changed
+// by set_enabled() or the environment variable ST_AUTOTUNE=1.
+bool enabled(void);
+void set_enabled(bool enable);
+
+// The file the results are appended to and loaded from, each of them keyed
+// by the CPU model, so machines of a fleet can share one. It is given by the
+// environment variable ST_TUNING_FILE, or is ~/.st_tuning by default. It is
+// loaded on the first select(), or by set_tuning_file(), which forgets all
+// the results of the former file, and only written to while tuning is
+// enabled. An empty path keeps the results in memory.
+std::string tuning_file(void);
+void set_tuning_file(const std::string& path);
+
+// The clock candidates are timed by, in seconds, steady_clock by default.
+// A null one restores the default.
+void set_timer(const std::function<double(void)>& now);
+
+// Brand string of the CPU, see cpu::brand().
+const std::string& cpu_model(void);
+
+// The fastest of candidates for the problem key of kind, with the current
+// number of threads and instruction set, see cpu::isa(). A result from the
+// tuning file or from a former call is returned as is. Otherwise, if tuning
+// is enabled, each candidate is timed by run(candidate) and the fastest one
+// is recorded. candidates[0] is the default, returned when tuning is
+// disabled or inside parallel_for, whose timings would be spoiled by the
+// other chunks.
+Config select(const std::string& kind, const Config& key,
+              const std::vector<Config>& candidates,
+              const std::function<void(const Config&)>& run);
+
+}  // namespace autotune
+}  // namespace st
+#endif
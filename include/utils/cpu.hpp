@@ -0,0 +1,46 @@
+#ifndef UTILS_CPU_H
+#define UTILS_CPU_H
+
+#include <string>
+
+#include "utils/base_config.hpp"
+
+// Kernels are built for baseline x86-64 (SSE2). Those of kernel/vector.hpp
+// and the inner loops of the direct convs also have AVX2 and AVX-512
+// variants, and gemm and the int8 kernels an AVX2 one, by the target
+// attribute of GCC and Clang, which are picked at runtime by cpu::isa(). The
+// optimizers, the accumulation of grads and sum_broadcast run on the vector
+// kernels. Expressions evaluated element by element stay baseline. Other
+// compilers and CPUs only get the baseline.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ST_ISA_DISPATCH
+#define ST_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define ST_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace st {
+namespace cpu {
+
+// Instruction sets of the kernel variants, each one includes the former
+// ones. avx2 comes with FMA.
+enum class Isa { sse2, avx2, avx512 };
+
+// The best instruction set supported by the CPU and the OS, from cpuid.
+Isa detected_isa(void);
+
+// The instruction set of the kernels which are run. It is detected_isa() by
+// default, and can be lowered by set_isa() or the environment variable
+// ST_ISA=sse2|avx2|avx512, for testing or benchmarking. A level above the
+// detected one is clamped to it. It may be set while other threads run
+// kernels, which pick up the new level at their next dispatch.
+Isa isa(void);
+void set_isa(Isa level);
+
+const char* isa_name(Isa level);
+
+// Brand string of the CPU, from cpuid, or "unknown".
+const std::string& brand(void);
+
+}  // namespace cpu
+}  // namespace st
+#endif
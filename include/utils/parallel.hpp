@@ -0,0 +1,42 @@
+#ifndef UTILS_PARALLEL_H
+#define UTILS_PARALLEL_H
+
+#include <functional>
+
+#include "utils/base_config.hpp"
+
+namespace st {
+namespace parallel {
+
+// Number of threads used by parallel_for, the calling thread included. It is
+// std::thread::hardware_concurrency() by default, and can be changed by 
+// set_num_threads() or the environment variable ST_NUM_THREADS.
+index_t num_threads(void);
+void set_num_threads(index_t num);
+
+// Splits [begin, end) into chunks of at least grain indices and calls
+// fn(chunk_begin, chunk_end) for each of them, on the workers of a global
+// pool and on the calling thread. Returns when all chunks are done, and
+// rethrows the first exception thrown by fn. A parallel_for inside fn runs
+// serially, so kernels can be nested freely.
+void parallel_for(index_t begin, index_t end, index_t grain,
+                  const std::function<void(index_t, index_t)>& fn);
+
+// Calls fn(i) for i in [0, num), splitting the tasks among the threads as
+// parallel_for does, but each thread gets an equal share of the threads
+// for the parallel_fors of its tasks instead of running them serially. It
+// is meant for independent tasks which are parallel inside, e.g. the
+// branches of a backward.
+void parallel_tasks(index_t num, const std::function<void(index_t)>& fn);
+
+// Whether the current thread is running a chunk of parallel_for.
+bool in_parallel(void);
+
+// The number of threads a parallel_for called from the current thread may
+// use: num_threads() at the top level, the share of a task of
+// parallel_tasks, and 1 inside a chunk of parallel_for.
+index_t available_threads(void);
+
+}  // namespace parallel
+}  // namespace st
+#endif
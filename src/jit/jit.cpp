@@ -0,0 +1,232 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "jit/jit.hpp"
+#include "utils/cpu.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+namespace jit {
+
+static_assert(std::is_same<data_t, double>::value
+              && std::is_same<index_t, unsigned int>::value,
+              "The prelude of kernel source should match utils/base_config.hpp");
+
+namespace {
+
+const char* prelude =
+    "#include <cmath>\n"
+    "typedef double data_t;\n"
+    "typedef unsigned int index_t;\n"
+    "static inline data_t st_relu(data_t x) { return x < 0. ? 0. : x; }\n"
+    "static inline data_t st_sigmoid(data_t x) { return 1 / (1 + std::exp(-x)); }\n";
+
+const char* kernel_name = "st_jit_kernel";
+const char* cxx_flags = "-std=c++11 -O3 -march=native -fPIC -shared";
+
+bool enabled_from_env(void) {
+    const char* value = std::getenv("ST_JIT");
+    return value != nullptr && std::strcmp(value, "0") != 0 && value[0] != '\0';
+}
+
+bool jit_enabled = enabled_from_env();
+
+std::string compiler(void) {
+    const char* value = std::getenv("ST_JIT_CXX");
+    return value != nullptr ? value : "g++";
+}
+
+// 64-bit FNV-1a, stable across runs and builds unlike std::hash.
+std::string hash_hex(const std::string& str) {
+    unsigned long long hash = 14695981039346656037ull;
+    for(unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", hash);
+    return buffer;
+}
+
+// path in single quotes for the shell.
+std::string quote(const std::string& path) {
+    std::string quoted = "'";
+    for(char c : path) {
+        if(c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+#ifndef _WIN32
+// Creates dir and its missing parents, the created ones only accessible to
+// the user. Then dir must be a directory of the user which nobody else can
+// write to, since the objects found in it are loaded into the process.
+void make_private_dir(const std::string& dir) {
+    for(std::size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+        std::string prefix = dir.substr(0, pos);
+        if(!prefix.empty())
+            mkdir(prefix.c_str(), 0700);
+        if(pos == std::string::npos) break;
+    }
+    struct stat info;
+    CHECK_TRUE(lstat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode),
+        "JIT cache %.200s isn't a directory.", dir.c_str());
+    CHECK_TRUE(info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0,
+        "JIT cache %.200s should be owned by the user and not writable by others.",
+        dir.c_str());
+}
+#endif
+
+bool read_file(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    std::stringstream s;
+    s << file.rdbuf();
+    content = s.str();
+    return true;
+}
+
+}  // namespace
+
+
+bool enabled(void) { return jit_enabled; }
+void set_enabled(bool enabled) { jit_enabled = enabled; }
+
+std::string cache_dir(void) {
+    const char* value = std::getenv("ST_JIT_CACHE");
+    if(value != nullptr && value[0] != '\0')
+        return value;
+    value = std::getenv("XDG_CACHE_HOME");
+    if(value != nullptr && value[0] == '/')
+        return std::string(value) + "/simple-tensor-jit";
+    value = std::getenv("HOME");
+    CHECK_TRUE(value != nullptr && value[0] == '/',
+        "Set ST_JIT_CACHE, XDG_CACHE_HOME or HOME for the JIT cache.");
+    return std::string(value) + "/.cache/simple-tensor-jit";
+}
+
+#ifdef _WIN32
+KernelFn load(const std::string& source) {
+    THROW_ERROR("JIT is not supported on this platform.");
+    return nullptr;
+}
+#else
+KernelFn load(const std::string& source) {
+    static std::unordered_map<std::string, KernelFn> loaded;
+    // Also keeps two threads from compiling the same kernel.
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The objects are built with -march=native, so they are only shared
+    // by the same CPUs.
+    std::string command = compiler() + " " + cxx_flags;
+    std::string key = hash_hex(command + '\n' + cpu::brand() + '\n'
+                               + cpu::isa_name(cpu::detected_isa()) + '\n' + source);
+    auto iter = loaded.find(key);
+    if(iter != loaded.end())
+        return iter->second;
+
+    std::string dir = cache_dir();
+    make_private_dir(dir);
+    std::string base = dir + "/st_jit_" + key;
+    std::string src_path = base + ".cpp";
+    std::string so_path = base + ".so";
+
+    // The source is kept next to the shared object, so a hash collision is
+    // detected instead of loading the wrong kernel.
+    std::string cached;
+    bool hit = read_file(src_path, cached) && cached == source
+            && access(so_path.c_str(), R_OK) == 0;
+    if(!hit) {
+        std::string tmp_path = base + "." + std::to_string(getpid());
+        {
+            std::ofstream file(src_path, std::ios::binary | std::ios::trunc);
+            CHECK_TRUE(bool(file), "Can't write JIT source to %.200s",
+                       src_path.c_str());
+            file << source;
+        }
+        std::string cmd = command + " -o " + quote(tmp_path + ".so") + " " 
+                        + quote(src_path);
+        if(std::system(cmd.c_str()) != 0)
+            THROW_ERROR("JIT compilation failed: %.250s", cmd.c_str());
+        // rename is atomic, concurrent runs never see a partial object.
+        CHECK_TRUE(std::rename((tmp_path + ".so").c_str(), so_path.c_str()) == 0,
+                   "Can't move JIT kernel to %.200s", so_path.c_str());
+    }
+
+    void* handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(handle == nullptr)
+        THROW_ERROR("dlopen failed: %.250s", dlerror());
+    KernelFn fn = reinterpret_cast<KernelFn>(dlsym(handle, kernel_name));
+    CHECK_NOT_NULL(fn, "Can't find %s in %.200s", kernel_name, so_path.c_str());
+
+    loaded.emplace(key, fn);
+    return fn;
+}
+#endif
+
+KernelSource::KernelSource(const TensorImpl& dist)
+        : shape_(dist.size()), stride_(dist.stride()) {}
+
+std::string KernelSource::input(const TensorImpl& leaf) {
+    index_t idx = inputs_.size();
+    inputs_.push_back(&leaf);
+
+    std::string offset;
+    for(index_t i = 0; i < leaf.ndim(); ++i) {
+        if(leaf.stride()[i] == 0) continue;
+        if(!offset.empty()) offset += " + ";
+        offset += "i" + std::to_string(i) + "*" + std::to_string(leaf.stride()[i]) + "u";
+    }
+    if(offset.empty()) offset = "0";
+    return "in" + std::to_string(idx) + "[" + offset + "]";
+}
+
+std::string KernelSource::constant(data_t value) const {
+    if(std::isnan(value)) return "__builtin_nan(\"\")";
+    if(std::isinf(value)) return value > 0 ? "__builtin_inf()" : "(-__builtin_inf())";
+    // 17 significant digits are enough to read back the same double.
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return std::string("(") + buffer + ")";
+}
+
+std::string KernelSource::str(const std::string& value) const {
+    std::stringstream s;
+    s << prelude;
+    s << "extern \"C\" void " << kernel_name
+      << "(const data_t* const* in, data_t* out) {\n";
+    for(index_t i = 0; i < inputs_.size(); ++i)
+        s << "    const data_t* in" << i << " = in[" << i << "];\n";
+
+    std::string indent = "    ";
+    std::string offset;
+    for(index_t i = 0; i < shape_.size(); ++i) {
+        s << indent << "for(index_t i" << i << " = 0; i" << i << " < "
+          << shape_[i] << "u; ++i" << i << ")\n";
+        indent += "    ";
+        if(stride_[i] == 0) continue;
+        if(!offset.empty()) offset += " + ";
+        offset += "i" + std::to_string(i) + "*" + std::to_string(stride_[i]) + "u";
+    }
+    if(offset.empty()) offset = "0";
+    s << indent << "out[" << offset << "] = " << value << ";\n";
+    s << "}\n";
+    return s.str();
+}
+
+}  // namespace jit
+}  // namespace st
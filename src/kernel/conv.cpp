@@ -0,0 +1,1278 @@
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel/conv.hpp"
+#include "kernel/fft_conv.hpp"
+#include "kernel/gemm.hpp"
+#include "kernel/vector.hpp"
+#include "kernel/winograd.hpp"
+#include "utils/allocator.hpp"
+#include "utils/autotune.hpp"
+#include "utils/cpu.hpp"
+#include "utils/parallel.hpp"
+
+#ifdef ST_ISA_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Register tile of the forward, output channels by output columns. The
+// backward kernels work on the same blocks of output channels.
+constexpr index_t oc_tile = 4;
+constexpr index_t ow_tile = 4;
+
+inline index_t min(index_t a, index_t b) { return a < b ? a : b; }
+
+// Returns x as a contiguous [batch, channel, hp, wp] image, zero-padded
+// around. x is read in place if it is one already, otherwise it is copied
+// into buffer.
+const data_t* padded_input(const Conv2dShape& shape, const data_t* x,
+                           const index_t* x_stride,
+                           Alloc::TrivialUniquePtr<data_t>& buffer) {
+    index_t hp = shape.height + 2 * shape.padding_h;
+    index_t wp = shape.width + 2 * shape.padding_w;
+    index_t size[4] = {shape.batch, shape.channel, shape.height, shape.width};
+    bool contiguous = shape.padding_h == 0 && shape.padding_w == 0;
+    for(index_t i = 4, dsize = 1; contiguous && i-- > 0; dsize *= size[i])
+        contiguous = size[i] == 1 || x_stride[i] == dsize;
+    if(contiguous)
+        return x;
+
+    buffer = Alloc::unique_allocate<data_t>(
+        sizeof(data_t) * shape.batch * shape.channel * hp * wp);
+    data_t* xp = buffer.get();
+    bool unit = x_stride[3] == 1 || shape.width == 1;
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            const data_t* src_c = x + b * x_stride[0] + c * x_stride[1];
+            data_t* dst_c = xp + (size_t)bc * hp * wp;
+            std::memset(dst_c, 0, sizeof(data_t) * hp * wp);
+            for(index_t h = 0; h < shape.height; ++h) {
+                const data_t* src = src_c + h * x_stride[2];
+                data_t* dst = dst_c + (h + shape.padding_h) * wp + shape.padding_w;
+                if(unit) {
+                    std::memcpy(dst, src, sizeof(data_t) * shape.width);
+                } else {
+                    for(index_t j = 0; j < shape.width; ++j)
+                        dst[j] = src[j * x_stride[3]];
+                }
+            }
+        }
+    });
+    return xp;
+}
+
+// The bias and the activation of an epilogue, applied to a tile before it
+// is stored. bias points at the bias of the first channel of the tile, or is
+// null.
+struct TileEpilogue {
+    const data_t* bias;
+    bool relu;
+
+    data_t apply(data_t value, index_t o) const {
+        if(bias) value += bias[o];
+        return relu && value < 0 ? 0 : value;
+    }
+};
+
+// y[o][t] = sum of w[o][c, i, j] * xp[c][oh * stride_h + i][(ow + t) *
+// stride_w + j] over c, i and j, for no <= oc_tile channels and nt <= ow_tile
+// columns. xp is one padded image, w points at the first channel of the
+// tile and y at y[o0][oh][ow], ldy apart from one channel to the next.
+void forward_edge(const Conv2dShape& shape, index_t no, index_t nt,
+                  const data_t* xp, index_t hp, index_t wp,
+                  const data_t* w, index_t ws0, index_t ws1,
+                  index_t oh, index_t ow, data_t* y, index_t ldy,
+                  const TileEpilogue& epilogue) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    data_t acc[oc_tile][ow_tile] = {};
+    for(index_t c = 0; c < shape.channel; ++c) {
+        for(index_t i = 0; i < kh; ++i) {
+            const data_t* row = xp + ((size_t)c * hp + oh * shape.stride_h + i) * wp
+                              + ow * sw;
+            const data_t* wk = w + (c * kh + i) * kw * ws1;
+            for(index_t j = 0; j < kw; ++j)
+                for(index_t o = 0; o < no; ++o) {
+                    data_t wv = wk[o * ws0 + j * ws1];
+                    for(index_t t = 0; t < nt; ++t)
+                        acc[o][t] += wv * row[t * sw + j];
+                }
+        }
+    }
+    for(index_t o = 0; o < no; ++o)
+        for(index_t t = 0; t < nt; ++t)
+            y[o * ldy + t] = epilogue.apply(acc[o][t], o);
+}
+
+// forward_edge on a full tile, with the accumulators held in registers.
+// unit tells whether stride_w is 1, so the columns are loaded at once.
+template<bool unit>
+void forward_tile_sse2(const Conv2dShape& shape,
+                       const data_t* xp, index_t hp, index_t wp,
+                       const data_t* w, index_t ws0, index_t ws1,
+                       index_t oh, index_t ow, data_t* y, index_t ldy,
+                       const TileEpilogue& epilogue) {
+#ifdef __SSE2__
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+    for(index_t c = 0; c < shape.channel; ++c) {
+        for(index_t i = 0; i < kh; ++i) {
+            const data_t* row = xp + ((size_t)c * hp + oh * shape.stride_h + i) * wp
+                              + ow * sw;
+            const data_t* wk = w + (c * kh + i) * kw * ws1;
+            for(index_t j = 0; j < kw; ++j, wk += ws1) {
+                __m128d x0, x1;
+                if(unit) {
+                    x0 = _mm_loadu_pd(row + j);
+                    x1 = _mm_loadu_pd(row + j + 2);
+                } else {
+                    x0 = _mm_set_pd(row[sw + j], row[j]);
+                    x1 = _mm_set_pd(row[3 * sw + j], row[2 * sw + j]);
+                }
+                __m128d w0 = _mm_set1_pd(wk[0]);
+                __m128d w1 = _mm_set1_pd(wk[ws0]);
+                __m128d w2 = _mm_set1_pd(wk[2 * ws0]);
+                __m128d w3 = _mm_set1_pd(wk[3 * ws0]);
+                c00 = _mm_add_pd(c00, _mm_mul_pd(w0, x0));
+                c01 = _mm_add_pd(c01, _mm_mul_pd(w0, x1));
+                c10 = _mm_add_pd(c10, _mm_mul_pd(w1, x0));
+                c11 = _mm_add_pd(c11, _mm_mul_pd(w1, x1));
+                c20 = _mm_add_pd(c20, _mm_mul_pd(w2, x0));
+                c21 = _mm_add_pd(c21, _mm_mul_pd(w2, x1));
+                c30 = _mm_add_pd(c30, _mm_mul_pd(w3, x0));
+                c31 = _mm_add_pd(c31, _mm_mul_pd(w3, x1));
+            }
+        }
+    }
+    if(epilogue.bias) {
+        __m128d b0 = _mm_set1_pd(epilogue.bias[0]);
+        __m128d b1 = _mm_set1_pd(epilogue.bias[1]);
+        __m128d b2 = _mm_set1_pd(epilogue.bias[2]);
+        __m128d b3 = _mm_set1_pd(epilogue.bias[3]);
+        c00 = _mm_add_pd(c00, b0); c01 = _mm_add_pd(c01, b0);
+        c10 = _mm_add_pd(c10, b1); c11 = _mm_add_pd(c11, b1);
+        c20 = _mm_add_pd(c20, b2); c21 = _mm_add_pd(c21, b2);
+        c30 = _mm_add_pd(c30, b3); c31 = _mm_add_pd(c31, b3);
+    }
+    if(epilogue.relu) {
+        __m128d zero = _mm_setzero_pd();
+        c00 = _mm_max_pd(c00, zero); c01 = _mm_max_pd(c01, zero);
+        c10 = _mm_max_pd(c10, zero); c11 = _mm_max_pd(c11, zero);
+        c20 = _mm_max_pd(c20, zero); c21 = _mm_max_pd(c21, zero);
+        c30 = _mm_max_pd(c30, zero); c31 = _mm_max_pd(c31, zero);
+    }
+    _mm_storeu_pd(y, c00);
+    _mm_storeu_pd(y + 2, c01);
+    _mm_storeu_pd(y + ldy, c10);
+    _mm_storeu_pd(y + ldy + 2, c11);
+    _mm_storeu_pd(y + 2 * ldy, c20);
+    _mm_storeu_pd(y + 2 * ldy + 2, c21);
+    _mm_storeu_pd(y + 3 * ldy, c30);
+    _mm_storeu_pd(y + 3 * ldy + 2, c31);
+#else
+    forward_edge(shape, oc_tile, ow_tile, xp, hp, wp, w, ws0, ws1, oh, ow, y, ldy,
+                 epilogue);
+#endif
+}
+
+// Row oh of the output of a full block of oc_tile channels, width columns
+// from y, by tiles of ow_tile columns.
+void forward_row_sse2(const Conv2dShape& shape,
+                      const data_t* xp, index_t hp, index_t wp,
+                      const data_t* w, index_t ws0, index_t ws1,
+                      index_t oh, index_t width, data_t* y, index_t ldy,
+                      const TileEpilogue& epilogue) {
+    for(index_t col = 0; col < width; col += ow_tile) {
+        index_t nt = min(ow_tile, width - col);
+        if(nt < ow_tile)
+            forward_edge(shape, oc_tile, nt, xp, hp, wp, w, ws0, ws1, oh, col,
+                         y + col, ldy, epilogue);
+        else if(shape.stride_w == 1)
+            forward_tile_sse2<true>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                                    y + col, ldy, epilogue);
+        else
+            forward_tile_sse2<false>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                                     y + col, ldy, epilogue);
+    }
+}
+
+// The inner loops below come in SSE2, AVX2 and AVX-512 variants, see
+// ConvKernels. Each one handles whole vectors, then the remaining [t, n)
+// goes through these scalar loops.
+inline void scatter_row_tail(index_t t, index_t n, index_t no, const data_t* wv,
+                             const data_t* src, index_t plane, data_t* dst,
+                             index_t sw) {
+    for(; t < n; ++t) {
+        data_t sum = 0;
+        for(index_t o = 0; o < no; ++o)
+            sum += wv[o] * src[o * plane + t];
+        dst[t * sw] += sum;
+    }
+}
+
+inline void dot_rows_tail(index_t t, index_t n, index_t no, const data_t* dy,
+                          index_t plane, const data_t* x, index_t sw, data_t* acc) {
+    for(; t < n; ++t)
+        for(index_t o = 0; o < no; ++o)
+            acc[o] += dy[o * plane + t] * x[t * sw];
+}
+
+inline void depthwise_tail(const Conv2dShape& shape, index_t t, index_t n,
+                           const data_t* x, index_t ldx, const data_t* w,
+                           index_t ws1, data_t* y, const TileEpilogue& epilogue) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    for(; t < n; ++t) {
+        data_t sum = 0;
+        for(index_t i = 0; i < kh; ++i)
+            for(index_t j = 0; j < kw; ++j)
+                sum += w[(i * kw + j) * ws1] * x[i * ldx + t * sw + j];
+        y[t] = epilogue.apply(sum, 0);
+    }
+}
+
+// dst[t * sw] += sum of wv[o] * src[o * plane + t] over o < no, for t < n.
+void scatter_row_sse2(index_t n, index_t no, const data_t* wv,
+                 const data_t* src, index_t plane, data_t* dst, index_t sw) {
+    index_t t = 0;
+#ifdef __SSE2__
+    if(no == oc_tile && sw == 1) {
+        __m128d w0 = _mm_set1_pd(wv[0]), w1 = _mm_set1_pd(wv[1]);
+        __m128d w2 = _mm_set1_pd(wv[2]), w3 = _mm_set1_pd(wv[3]);
+        for(; t + 2 <= n; t += 2) {
+            __m128d sum = _mm_loadu_pd(dst + t);
+            sum = _mm_add_pd(sum, _mm_mul_pd(w0, _mm_loadu_pd(src + t)));
+            sum = _mm_add_pd(sum, _mm_mul_pd(w1, _mm_loadu_pd(src + plane + t)));
+            sum = _mm_add_pd(sum, _mm_mul_pd(w2, _mm_loadu_pd(src + 2 * plane + t)));
+            sum = _mm_add_pd(sum, _mm_mul_pd(w3, _mm_loadu_pd(src + 3 * plane + t)));
+            _mm_storeu_pd(dst + t, sum);
+        }
+    } else if(no == 1 && sw == 1) {
+        __m128d w0 = _mm_set1_pd(wv[0]);
+        for(; t + 2 <= n; t += 2)
+            _mm_storeu_pd(dst + t, _mm_add_pd(_mm_loadu_pd(dst + t),
+                                              _mm_mul_pd(w0, _mm_loadu_pd(src + t))));
+    }
+#endif
+    scatter_row_tail(t, n, no, wv, src, plane, dst, sw);
+}
+
+// acc[o] += sum of dy[o * plane + t] * x[t * sw] over t < n, for o < no.
+void dot_rows_sse2(index_t n, index_t no, const data_t* dy, index_t plane,
+              const data_t* x, index_t sw, data_t* acc) {
+    index_t t = 0;
+#ifdef __SSE2__
+    if(no == oc_tile) {
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        __m128d a2 = _mm_setzero_pd(), a3 = _mm_setzero_pd();
+        for(; t + 2 <= n; t += 2) {
+            __m128d xv = sw == 1 ? _mm_loadu_pd(x + t)
+                                 : _mm_set_pd(x[(t + 1) * sw], x[t * sw]);
+            a0 = _mm_add_pd(a0, _mm_mul_pd(xv, _mm_loadu_pd(dy + t)));
+            a1 = _mm_add_pd(a1, _mm_mul_pd(xv, _mm_loadu_pd(dy + plane + t)));
+            a2 = _mm_add_pd(a2, _mm_mul_pd(xv, _mm_loadu_pd(dy + 2 * plane + t)));
+            a3 = _mm_add_pd(a3, _mm_mul_pd(xv, _mm_loadu_pd(dy + 3 * plane + t)));
+        }
+        data_t sum[2];
+        _mm_storeu_pd(sum, a0); acc[0] += sum[0] + sum[1];
+        _mm_storeu_pd(sum, a1); acc[1] += sum[0] + sum[1];
+        _mm_storeu_pd(sum, a2); acc[2] += sum[0] + sum[1];
+        _mm_storeu_pd(sum, a3); acc[3] += sum[0] + sum[1];
+    } else if(no == 1) {
+        __m128d a0 = _mm_setzero_pd();
+        for(; t + 2 <= n; t += 2) {
+            __m128d xv = sw == 1 ? _mm_loadu_pd(x + t)
+                                 : _mm_set_pd(x[(t + 1) * sw], x[t * sw]);
+            a0 = _mm_add_pd(a0, _mm_mul_pd(xv, _mm_loadu_pd(dy + t)));
+        }
+        data_t sum[2];
+        _mm_storeu_pd(sum, a0); acc[0] += sum[0] + sum[1];
+    }
+#endif
+    dot_rows_tail(t, n, no, dy, plane, x, sw, acc);
+}
+
+// y[t] = sum of w[i * kw + j] * x[i * ldx + t * sw + j] over the window,
+// for t < n. x points at the first row of the windows in a padded plane.
+void depthwise_row_sse2(const Conv2dShape& shape, index_t n,
+                   const data_t* x, index_t ldx,
+                   const data_t* w, index_t ws1, data_t* y,
+                   const TileEpilogue& epilogue) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    index_t t = 0;
+#ifdef __SSE2__
+    for(; t + 4 <= n; t += 4) {
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        for(index_t i = 0; i < kh; ++i) {
+            const data_t* row = x + i * ldx + t * sw;
+            const data_t* wk = w + i * kw * ws1;
+            for(index_t j = 0; j < kw; ++j) {
+                __m128d x0, x1;
+                if(sw == 1) {
+                    x0 = _mm_loadu_pd(row + j);
+                    x1 = _mm_loadu_pd(row + j + 2);
+                } else {
+                    x0 = _mm_set_pd(row[sw + j], row[j]);
+                    x1 = _mm_set_pd(row[3 * sw + j], row[2 * sw + j]);
+                }
+                __m128d wv = _mm_set1_pd(wk[j * ws1]);
+                a0 = _mm_add_pd(a0, _mm_mul_pd(wv, x0));
+                a1 = _mm_add_pd(a1, _mm_mul_pd(wv, x1));
+            }
+        }
+        if(epilogue.bias) {
+            __m128d bv = _mm_set1_pd(epilogue.bias[0]);
+            a0 = _mm_add_pd(a0, bv);
+            a1 = _mm_add_pd(a1, bv);
+        }
+        if(epilogue.relu) {
+            a0 = _mm_max_pd(a0, _mm_setzero_pd());
+            a1 = _mm_max_pd(a1, _mm_setzero_pd());
+        }
+        _mm_storeu_pd(y + t, a0);
+        _mm_storeu_pd(y + t + 2, a1);
+    }
+#endif
+    depthwise_tail(shape, t, n, x, ldx, w, ws1, y, epilogue);
+}
+
+#ifdef ST_ISA_DISPATCH
+// Vectors of 4 doubles step apart from p, gathered by offsets when step
+// isn't 1. The masked load reads the lanes of mask only, the others are 0.
+ST_TARGET_AVX2
+inline __m256d load_avx2(const data_t* p, index_t step, __m128i offsets) {
+    return step == 1 ? _mm256_loadu_pd(p) : _mm256_i32gather_pd(p, offsets, 8);
+}
+
+ST_TARGET_AVX2
+inline __m256d load_avx2(const data_t* p, index_t step, __m128i offsets,
+                         __m256i mask) {
+    return step == 1 ? _mm256_maskload_pd(p, mask)
+                     : _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p, offsets,
+                                                _mm256_castsi256_pd(mask), 8);
+}
+
+// The first n of the 4 lanes.
+ST_TARGET_AVX2
+inline __m256i lanes_avx2(index_t n) {
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3));
+}
+
+ST_TARGET_AVX2
+inline __m128i offsets_avx2(index_t step) {
+    return _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(step));
+}
+
+ST_TARGET_AVX2
+inline data_t hsum_avx2(__m256d v) {
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+// The sums of a, b, c and d in one vector.
+ST_TARGET_AVX2
+inline __m256d hsum4_avx2(__m256d a, __m256d b, __m256d c, __m256d d) {
+    __m256d ab = _mm256_hadd_pd(a, b), cd = _mm256_hadd_pd(c, d);
+    return _mm256_add_pd(_mm256_permute2f128_pd(ab, cd, 0x20),
+                         _mm256_permute2f128_pd(ab, cd, 0x31));
+}
+
+// forward_tile_sse2 on vecs vectors of 4 columns by FMA. If edge, the last
+// vector only has the columns of mask.
+template<index_t vecs, bool edge>
+ST_TARGET_AVX2
+void forward_tile_avx2(const Conv2dShape& shape,
+                       const data_t* xp, index_t hp, index_t wp,
+                       const data_t* w, index_t ws0, index_t ws1,
+                       index_t oh, index_t ow, data_t* y, index_t ldy,
+                       const TileEpilogue& epilogue, __m256i mask) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    __m128i offsets = offsets_avx2(sw);
+    __m256d acc[oc_tile][vecs];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < oc_tile; ++o)
+        #pragma GCC unroll 4
+        for(index_t v = 0; v < vecs; ++v)
+            acc[o][v] = _mm256_setzero_pd();
+    for(index_t c = 0; c < shape.channel; ++c) {
+        for(index_t i = 0; i < kh; ++i) {
+            const data_t* row = xp + ((size_t)c * hp + oh * shape.stride_h + i) * wp
+                              + ow * sw;
+            const data_t* wk = w + (c * kh + i) * kw * ws1;
+            for(index_t j = 0; j < kw; ++j, wk += ws1) {
+                __m256d x[vecs];
+                #pragma GCC unroll 4
+                for(index_t v = 0; v < vecs; ++v)
+                    x[v] = edge && v + 1 == vecs
+                         ? load_avx2(row + 4 * v * sw + j, sw, offsets, mask)
+                         : load_avx2(row + 4 * v * sw + j, sw, offsets);
+                #pragma GCC unroll 4
+                for(index_t o = 0; o < oc_tile; ++o) {
+                    __m256d wv = _mm256_broadcast_sd(wk + o * ws0);
+                    #pragma GCC unroll 4
+                    for(index_t v = 0; v < vecs; ++v)
+                        acc[o][v] = _mm256_fmadd_pd(wv, x[v], acc[o][v]);
+                }
+            }
+        }
+    }
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < oc_tile; ++o)
+        #pragma GCC unroll 4
+        for(index_t v = 0; v < vecs; ++v) {
+            __m256d value = acc[o][v];
+            if(epilogue.bias)
+                value = _mm256_add_pd(value, _mm256_broadcast_sd(epilogue.bias + o));
+            if(epilogue.relu)
+                value = _mm256_max_pd(value, _mm256_setzero_pd());
+            if(edge && v + 1 == vecs)
+                _mm256_maskstore_pd(y + o * ldy + 4 * v, mask, value);
+            else
+                _mm256_storeu_pd(y + o * ldy + 4 * v, value);
+        }
+}
+
+// forward_row_sse2 by tiles of 8 columns, the last one masked.
+ST_TARGET_AVX2
+void forward_row_avx2(const Conv2dShape& shape,
+                      const data_t* xp, index_t hp, index_t wp,
+                      const data_t* w, index_t ws0, index_t ws1,
+                      index_t oh, index_t width, data_t* y, index_t ldy,
+                      const TileEpilogue& epilogue) {
+    index_t col = 0;
+    __m256i all = _mm256_set1_epi64x(-1);
+    for(; col + 8 <= width; col += 8)
+        forward_tile_avx2<2, false>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                                    y + col, ldy, epilogue, all);
+    index_t rest = width - col;
+    if(rest > 4)
+        forward_tile_avx2<2, true>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                                   y + col, ldy, epilogue, lanes_avx2(rest - 4));
+    else if(rest > 0)
+        forward_tile_avx2<1, true>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                                   y + col, ldy, epilogue, lanes_avx2(rest));
+}
+
+// scatter_row_sse2 on no channels known at compile time, so the weights
+// and the accumulators stay in registers.
+template<index_t no>
+ST_TARGET_AVX2
+index_t scatter_row_avx2(index_t n, const data_t* wv, const data_t* src,
+                         index_t plane, data_t* dst) {
+    index_t t = 0;
+    __m256d w[no];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < no; ++o)
+        w[o] = _mm256_broadcast_sd(wv + o);
+    for(; t + 4 <= n; t += 4) {
+        __m256d sum = _mm256_loadu_pd(dst + t);
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            sum = _mm256_fmadd_pd(w[o], _mm256_loadu_pd(src + o * plane + t), sum);
+        _mm256_storeu_pd(dst + t, sum);
+    }
+    return t;
+}
+
+ST_TARGET_AVX2
+void scatter_row_avx2(index_t n, index_t no, const data_t* wv,
+                      const data_t* src, index_t plane, data_t* dst, index_t sw) {
+    index_t t = 0;
+    if(sw == 1 && no == oc_tile)
+        t = scatter_row_avx2<oc_tile>(n, wv, src, plane, dst);
+    else if(sw == 1 && no == 1)
+        t = scatter_row_avx2<1>(n, wv, src, plane, dst);
+    scatter_row_tail(t, n, no, wv, src, plane, dst, sw);
+}
+
+template<index_t no>
+ST_TARGET_AVX2
+index_t dot_rows_avx2(index_t n, const data_t* dy, index_t plane,
+                      const data_t* x, index_t sw, data_t* acc) {
+    index_t t = 0;
+    __m128i offsets = offsets_avx2(sw);
+    __m256d a[no];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < no; ++o)
+        a[o] = _mm256_setzero_pd();
+    for(; t + 4 <= n; t += 4) {
+        __m256d xv = load_avx2(x + t * sw, sw, offsets);
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            a[o] = _mm256_fmadd_pd(xv, _mm256_loadu_pd(dy + o * plane + t), a[o]);
+    }
+    if(no == oc_tile)
+        _mm256_storeu_pd(acc, _mm256_add_pd(_mm256_loadu_pd(acc),
+                                            hsum4_avx2(a[0], a[1], a[2], a[3])));
+    else
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            acc[o] += hsum_avx2(a[o]);
+    return t;
+}
+
+ST_TARGET_AVX2
+void dot_rows_avx2(index_t n, index_t no, const data_t* dy, index_t plane,
+                   const data_t* x, index_t sw, data_t* acc) {
+    index_t t = 0;
+    if(no == oc_tile)
+        t = dot_rows_avx2<oc_tile>(n, dy, plane, x, sw, acc);
+    else if(no == 1)
+        t = dot_rows_avx2<1>(n, dy, plane, x, sw, acc);
+    dot_rows_tail(t, n, no, dy, plane, x, sw, acc);
+}
+
+// depthwise_row_sse2 on vecs vectors of 4 columns from y, by FMA. If edge,
+// the last vector only has the columns of mask.
+template<index_t vecs, bool edge>
+ST_TARGET_AVX2
+void depthwise_tile_avx2(const Conv2dShape& shape, const data_t* x, index_t ldx,
+                         const data_t* w, index_t ws1, data_t* y,
+                         const TileEpilogue& epilogue, __m256i mask) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    __m128i offsets = offsets_avx2(sw);
+    __m256d acc[vecs];
+    #pragma GCC unroll 4
+    for(index_t v = 0; v < vecs; ++v)
+        acc[v] = _mm256_setzero_pd();
+    for(index_t i = 0; i < kh; ++i) {
+        const data_t* row = x + i * ldx;
+        const data_t* wk = w + i * kw * ws1;
+        for(index_t j = 0; j < kw; ++j) {
+            __m256d wv = _mm256_broadcast_sd(wk + j * ws1);
+            #pragma GCC unroll 4
+            for(index_t v = 0; v < vecs; ++v) {
+                __m256d xv = edge && v + 1 == vecs
+                           ? load_avx2(row + 4 * v * sw + j, sw, offsets, mask)
+                           : load_avx2(row + 4 * v * sw + j, sw, offsets);
+                acc[v] = _mm256_fmadd_pd(wv, xv, acc[v]);
+            }
+        }
+    }
+    #pragma GCC unroll 4
+    for(index_t v = 0; v < vecs; ++v) {
+        __m256d value = acc[v];
+        if(epilogue.bias)
+            value = _mm256_add_pd(value, _mm256_broadcast_sd(epilogue.bias));
+        if(epilogue.relu)
+            value = _mm256_max_pd(value, _mm256_setzero_pd());
+        if(edge && v + 1 == vecs)
+            _mm256_maskstore_pd(y + 4 * v, mask, value);
+        else
+            _mm256_storeu_pd(y + 4 * v, value);
+    }
+}
+
+ST_TARGET_AVX2
+void depthwise_row_avx2(const Conv2dShape& shape, index_t n,
+                        const data_t* x, index_t ldx,
+                        const data_t* w, index_t ws1, data_t* y,
+                        const TileEpilogue& epilogue) {
+    index_t t = 0, sw = shape.stride_w;
+    __m256i all = _mm256_set1_epi64x(-1);
+    for(; t + 8 <= n; t += 8)
+        depthwise_tile_avx2<2, false>(shape, x + t * sw, ldx, w, ws1, y + t,
+                                      epilogue, all);
+    if(n - t > 4)
+        depthwise_tile_avx2<2, true>(shape, x + t * sw, ldx, w, ws1, y + t,
+                                     epilogue, lanes_avx2(n - t - 4));
+    else if(n > t)
+        depthwise_tile_avx2<1, true>(shape, x + t * sw, ldx, w, ws1, y + t,
+                                     epilogue, lanes_avx2(n - t));
+}
+
+// The same in vectors of 8 doubles, where masks are native, so the edges
+// are masked rather than left to the scalar loops.
+ST_TARGET_AVX512
+inline __m512d load_avx512(const data_t* p, index_t step, __m256i offsets,
+                           __mmask8 mask) {
+    return step == 1 ? _mm512_maskz_loadu_pd(mask, p)
+                     : _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offsets, p, 8);
+}
+
+// The first n of the 8 lanes, n <= 8.
+inline __mmask8 lanes_avx512(index_t n) {
+    return __mmask8((1u << n) - 1);
+}
+
+ST_TARGET_AVX512
+inline __m256i offsets_avx512(index_t step) {
+    return _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                              _mm256_set1_epi32(step));
+}
+
+// forward_tile_avx2 on vectors of 8 columns, the last one has the columns
+// of mask.
+template<index_t vecs>
+ST_TARGET_AVX512
+void forward_tile_avx512(const Conv2dShape& shape,
+                         const data_t* xp, index_t hp, index_t wp,
+                         const data_t* w, index_t ws0, index_t ws1,
+                         index_t oh, index_t ow, data_t* y, index_t ldy,
+                         const TileEpilogue& epilogue, __mmask8 mask) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    __m256i offsets = offsets_avx512(sw);
+    __m512d acc[oc_tile][vecs];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < oc_tile; ++o)
+        #pragma GCC unroll 4
+        for(index_t v = 0; v < vecs; ++v)
+            acc[o][v] = _mm512_setzero_pd();
+    for(index_t c = 0; c < shape.channel; ++c) {
+        for(index_t i = 0; i < kh; ++i) {
+            const data_t* row = xp + ((size_t)c * hp + oh * shape.stride_h + i) * wp
+                              + ow * sw;
+            const data_t* wk = w + (c * kh + i) * kw * ws1;
+            for(index_t j = 0; j < kw; ++j, wk += ws1) {
+                __m512d x[vecs];
+                #pragma GCC unroll 4
+                for(index_t v = 0; v < vecs; ++v)
+                    x[v] = load_avx512(row + 8 * v * sw + j, sw, offsets,
+                                       v + 1 == vecs ? mask : __mmask8(0xff));
+                #pragma GCC unroll 4
+                for(index_t o = 0; o < oc_tile; ++o) {
+                    __m512d wv = _mm512_set1_pd(wk[o * ws0]);
+                    #pragma GCC unroll 4
+                    for(index_t v = 0; v < vecs; ++v)
+                        acc[o][v] = _mm512_fmadd_pd(wv, x[v], acc[o][v]);
+                }
+            }
+        }
+    }
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < oc_tile; ++o)
+        #pragma GCC unroll 4
+        for(index_t v = 0; v < vecs; ++v) {
+            __m512d value = acc[o][v];
+            if(epilogue.bias)
+                value = _mm512_add_pd(value, _mm512_set1_pd(epilogue.bias[o]));
+            if(epilogue.relu)
+                value = _mm512_max_pd(value, _mm512_setzero_pd());
+            _mm512_mask_storeu_pd(y + o * ldy + 8 * v, 
+                                  v + 1 == vecs ? mask : __mmask8(0xff), value);
+        }
+}
+
+// forward_row_sse2 by tiles of 16 columns, the last one masked.
+ST_TARGET_AVX512
+void forward_row_avx512(const Conv2dShape& shape,
+                        const data_t* xp, index_t hp, index_t wp,
+                        const data_t* w, index_t ws0, index_t ws1,
+                        index_t oh, index_t width, data_t* y, index_t ldy,
+                        const TileEpilogue& epilogue) {
+    index_t col = 0;
+    for(; col + 16 <= width; col += 16)
+        forward_tile_avx512<2>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                               y + col, ldy, epilogue, 0xff);
+    index_t rest = width - col;
+    if(rest > 8)
+        forward_tile_avx512<2>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                               y + col, ldy, epilogue, lanes_avx512(rest - 8));
+    else if(rest > 0)
+        forward_tile_avx512<1>(shape, xp, hp, wp, w, ws0, ws1, oh, col,
+                               y + col, ldy, epilogue, lanes_avx512(rest));
+}
+
+template<index_t no>
+ST_TARGET_AVX512
+void scatter_row_avx512(index_t n, const data_t* wv, const data_t* src,
+                        index_t plane, data_t* dst) {
+    __m512d w[no];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < no; ++o)
+        w[o] = _mm512_set1_pd(wv[o]);
+    for(index_t t = 0; t < n; t += 8) {
+        __mmask8 mask = n - t < 8 ? lanes_avx512(n - t) : __mmask8(0xff);
+        __m512d sum = _mm512_maskz_loadu_pd(mask, dst + t);
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            sum = _mm512_fmadd_pd(w[o], _mm512_maskz_loadu_pd(mask, src + o * plane + t),
+                                  sum);
+        _mm512_mask_storeu_pd(dst + t, mask, sum);
+    }
+}
+
+ST_TARGET_AVX512
+void scatter_row_avx512(index_t n, index_t no, const data_t* wv,
+                        const data_t* src, index_t plane, data_t* dst, index_t sw) {
+    if(sw == 1 && no == oc_tile)
+        scatter_row_avx512<oc_tile>(n, wv, src, plane, dst);
+    else if(sw == 1 && no == 1)
+        scatter_row_avx512<1>(n, wv, src, plane, dst);
+    else
+        scatter_row_tail(0, n, no, wv, src, plane, dst, sw);
+}
+
+template<index_t no>
+ST_TARGET_AVX512
+void dot_rows_avx512(index_t n, const data_t* dy, index_t plane,
+                     const data_t* x, index_t sw, data_t* acc) {
+    __m256i offsets = offsets_avx512(sw);
+    __m512d a[no];
+    #pragma GCC unroll 4
+    for(index_t o = 0; o < no; ++o)
+        a[o] = _mm512_setzero_pd();
+    for(index_t t = 0; t < n; t += 8) {
+        __mmask8 mask = n - t < 8 ? lanes_avx512(n - t) : __mmask8(0xff);
+        __m512d xv = load_avx512(x + t * sw, sw, offsets, mask);
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            a[o] = _mm512_fmadd_pd(xv, _mm512_maskz_loadu_pd(mask, dy + o * plane + t),
+                                   a[o]);
+    }
+    if(no == oc_tile) {
+        __m256d h[oc_tile];
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < oc_tile; ++o)
+            h[o] = _mm256_add_pd(_mm512_castpd512_pd256(a[o]), 
+                                 _mm512_extractf64x4_pd(a[o], 1));
+        _mm256_storeu_pd(acc, _mm256_add_pd(_mm256_loadu_pd(acc),
+                                            hsum4_avx2(h[0], h[1], h[2], h[3])));
+    } else {
+        #pragma GCC unroll 4
+        for(index_t o = 0; o < no; ++o)
+            acc[o] += _mm512_reduce_add_pd(a[o]);
+    }
+}
+
+ST_TARGET_AVX512
+void dot_rows_avx512(index_t n, index_t no, const data_t* dy, index_t plane,
+                     const data_t* x, index_t sw, data_t* acc) {
+    if(no == oc_tile)
+        dot_rows_avx512<oc_tile>(n, dy, plane, x, sw, acc);
+    else if(no == 1)
+        dot_rows_avx512<1>(n, dy, plane, x, sw, acc);
+    else
+        dot_rows_tail(0, n, no, dy, plane, x, sw, acc);
+}
+
+// depthwise_tile_avx2 on vectors of 8 columns, the last one has the
+// columns of mask.
+template<index_t vecs>
+ST_TARGET_AVX512
+void depthwise_tile_avx512(const Conv2dShape& shape, const data_t* x, index_t ldx,
+                           const data_t* w, index_t ws1, data_t* y,
+                           const TileEpilogue& epilogue, __mmask8 mask) {
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, sw = shape.stride_w;
+    __m256i offsets = offsets_avx512(sw);
+    __m512d acc[vecs];
+    #pragma GCC unroll 4
+    for(index_t v = 0; v < vecs; ++v)
+        acc[v] = _mm512_setzero_pd();
+    for(index_t i = 0; i < kh; ++i) {
+        const data_t* row = x + i * ldx;
+        const data_t* wk = w + i * kw * ws1;
+        for(index_t j = 0; j < kw; ++j) {
+            __m512d wv = _mm512_set1_pd(wk[j * ws1]);
+            #pragma GCC unroll 4
+            for(index_t v = 0; v < vecs; ++v)
+                acc[v] = _mm512_fmadd_pd(wv, load_avx512(row + 8 * v * sw + j, sw, offsets,
+                                             v + 1 == vecs ? mask : __mmask8(0xff)),
+                                         acc[v]);
+        }
+    }
+    #pragma GCC unroll 4
+    for(index_t v = 0; v < vecs; ++v) {
+        __m512d value = acc[v];
+        if(epilogue.bias)
+            value = _mm512_add_pd(value, _mm512_set1_pd(epilogue.bias[0]));
+        if(epilogue.relu)
+            value = _mm512_max_pd(value, _mm512_setzero_pd());
+        _mm512_mask_storeu_pd(y + 8 * v, v + 1 == vecs ? mask : __mmask8(0xff), value);
+    }
+}
+
+ST_TARGET_AVX512
+void depthwise_row_avx512(const Conv2dShape& shape, index_t n,
+                          const data_t* x, index_t ldx,
+                          const data_t* w, index_t ws1, data_t* y,
+                          const TileEpilogue& epilogue) {
+    index_t t = 0, sw = shape.stride_w;
+    for(; t + 16 <= n; t += 16)
+        depthwise_tile_avx512<2>(shape, x + t * sw, ldx, w, ws1, y + t, epilogue, 0xff);
+    if(n - t > 8)
+        depthwise_tile_avx512<2>(shape, x + t * sw, ldx, w, ws1, y + t, epilogue,
+                                 lanes_avx512(n - t - 8));
+    else if(n > t)
+        depthwise_tile_avx512<1>(shape, x + t * sw, ldx, w, ws1, y + t, epilogue,
+                                 lanes_avx512(n - t));
+}
+#endif
+
+// The inner loops of the direct kernels for one instruction set.
+struct ConvKernels {
+    decltype(&forward_row_sse2) forward_row;
+    decltype(&scatter_row_sse2) scatter_row;
+    decltype(&dot_rows_sse2) dot_rows;
+    decltype(&depthwise_row_sse2) depthwise_row;
+};
+
+// The inner loops of cpu::isa(), picked once by each kernel so all its
+// threads run the same ones.
+const ConvKernels& select_conv_kernels(void) {
+    static const ConvKernels sse2{forward_row_sse2, scatter_row_sse2,
+                                  dot_rows_sse2, depthwise_row_sse2};
+#ifdef ST_ISA_DISPATCH
+    static const ConvKernels avx2{forward_row_avx2, scatter_row_avx2,
+                                  dot_rows_avx2, depthwise_row_avx2};
+    static const ConvKernels avx512{forward_row_avx512, scatter_row_avx512,
+                                    dot_rows_avx512, depthwise_row_avx512};
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512: return avx512;
+        case cpu::Isa::avx2: return avx2;
+        default: break;
+    }
+#endif
+    return sse2;
+}
+
+// The 2x2 max pooling of stride 2 of two rows of the conv output of no
+// channels, ldy apart from one channel to the next. r is the index of the
+// first row. pooled and argmax point at the pooled row of the first channel,
+// pooled_plane apart from one channel to the next. The first max wins.
+void pool_rows(index_t no, index_t ow, const data_t* y, index_t ldy, index_t r,
+               data_t* pooled, index_t* argmax, index_t pooled_plane) {
+    for(index_t o = 0; o < no; ++o) {
+        const data_t* y0 = y + o * ldy;
+        const data_t* y1 = y0 + ow;
+        data_t* p = pooled + o * pooled_plane;
+        index_t* arg = argmax + o * pooled_plane;
+        for(index_t j = 0; j < ow / 2; ++j) {
+            index_t col = 2 * j, best = r * ow + col;
+            data_t value = y0[col];
+            if(y0[col + 1] > value) { value = y0[col + 1]; best = r * ow + col + 1; }
+            if(y1[col] > value) { value = y1[col]; best = (r + 1) * ow + col; }
+            if(y1[col + 1] > value) { value = y1[col + 1]; best = (r + 1) * ow + col + 1; }
+            p[j] = value;
+            arg[j] = best;
+        }
+    }
+}
+
+// Forward of a depthwise conv, every channel convolved by its own
+// out_channels / channel kernels of one channel each, xp is the padded input.
+// The windows slide along the rows with the kernel in registers, channels
+// of all the images run in parallel.
+void depthwise_forward(const Conv2dShape& shape, index_t out_channels,
+                       const data_t* xp, const data_t* w, 
+                       const index_t* w_stride, data_t* y,
+                       const Conv2dEpilogue& epilogue) {
+    index_t hp = shape.height + 2 * shape.padding_h;
+    index_t wp = shape.width + 2 * shape.padding_w;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t multiplier = out_channels / shape.channel;
+    bool pool = epilogue.pool;
+    // A pooled output is pooled two rows at a time from scratch.
+    index_t rows = pool ? oh / 2 * 2 : oh;
+    index_t plane = pool ? (oh / 2) * (ow / 2) : oh * ow;
+    const ConvKernels& kernels = select_conv_kernels();
+
+    parallel::parallel_for(0, shape.batch * out_channels, 1,
+            [&](index_t begin, index_t end) {
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        if(pool)
+            scratch = Alloc::unique_allocate<data_t>(sizeof(data_t) * 2 * ow);
+        for(index_t bo = begin; bo < end; ++bo) {
+            index_t b = bo / out_channels, o = bo % out_channels;
+            const data_t* x_c = xp + ((size_t)b * shape.channel + o / multiplier)
+                                     * hp * wp;
+            data_t* y_o = y + (size_t)bo * plane;
+            TileEpilogue tile_epilogue{
+                epilogue.bias ? epilogue.bias + o : nullptr,
+                epilogue.activation == Activation::relu
+            };
+            for(index_t r = 0; r < rows; ++r) {
+                data_t* y_row = pool ? scratch.get() + r % 2 * ow : y_o + r * ow;
+                kernels.depthwise_row(shape, ow, x_c + r * shape.stride_h * wp, wp,
+                              w + o * w_stride[0], w_stride[1], y_row, tile_epilogue);
+                if(pool && r % 2 == 1)
+                    pool_rows(1, ow, scratch.get(), 2 * ow, r - 1,
+                              y_o + r / 2 * (ow / 2),
+                              epilogue.argmax + (size_t)bo * plane + r / 2 * (ow / 2),
+                              plane);
+            }
+        }
+    });
+}
+
+}  // namespace
+
+void conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                    const data_t* x, const index_t* x_stride,
+                    const data_t* w, const index_t* w_stride,
+                    data_t* y, index_t groups, const Conv2dEpilogue* epilogue) {
+    Conv2dEpilogue no_epilogue{nullptr, Activation::identity, false, nullptr};
+    const Conv2dEpilogue& ep = epilogue ? *epilogue : no_epilogue;
+    Alloc::TrivialUniquePtr<data_t> buffer(nullptr, 0);
+    const data_t* xp = padded_input(shape, x, x_stride, buffer);
+    if(groups == shape.channel && groups > 1) {
+        depthwise_forward(shape, out_channels, xp, w, w_stride, y, ep);
+        return;
+    }
+
+    index_t hp = shape.height + 2 * shape.padding_h;
+    index_t wp = shape.width + 2 * shape.padding_w;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    bool pool = ep.pool;
+    // A pooled output is pooled two rows at a time from scratch, while they
+    // are in L1.
+    index_t rows = pool ? oh / 2 * 2 : oh;
+    index_t plane = pool ? (oh / 2) * (ow / 2) : oh * ow;
+    // The tiles see the channels of one group only.
+    Conv2dShape group_shape = shape;
+    group_shape.channel = shape.channel / groups;
+    index_t group_oc = out_channels / groups;
+    index_t oc_blocks = (group_oc + oc_tile - 1) / oc_tile;
+    const ConvKernels& kernels = select_conv_kernels();
+
+    parallel::parallel_for(0, shape.batch * groups * oc_blocks, 1,
+            [&](index_t begin, index_t end) {
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        if(pool)
+            scratch = Alloc::unique_allocate<data_t>(sizeof(data_t) * oc_tile * 2 * ow);
+        for(index_t task = begin; task < end; ++task) {
+            index_t b = task / (groups * oc_blocks);
+            index_t g = task / oc_blocks % groups;
+            index_t o0 = g * group_oc + task % oc_blocks * oc_tile;
+            index_t no = min(oc_tile, (g + 1) * group_oc - o0);
+            const data_t* xb = xp + ((size_t)b * shape.channel 
+                                     + g * group_shape.channel) * hp * wp;
+            const data_t* wo = w + o0 * w_stride[0];
+            data_t* yb = y + ((size_t)b * out_channels + o0) * plane;
+            TileEpilogue tile_epilogue{
+                ep.bias ? ep.bias + o0 : nullptr, ep.activation == Activation::relu
+            };
+            index_t ldy = pool ? 2 * ow : plane;
+            for(index_t r = 0; r < rows; ++r) {
+                data_t* y_row = pool ? scratch.get() + r % 2 * ow : yb + r * ow;
+                if(no == oc_tile)
+                    kernels.forward_row(group_shape, xb, hp, wp, wo, w_stride[0],
+                                        w_stride[1], r, ow, y_row, ldy, tile_epilogue);
+                else
+                    for(index_t col = 0; col < ow; col += ow_tile)
+                        forward_edge(group_shape, no, min(ow_tile, ow - col), xb, hp, wp,
+                                     wo, w_stride[0], w_stride[1], r, col, y_row + col,
+                                     ldy, tile_epilogue);
+                if(pool && r % 2 == 1)
+                    pool_rows(no, ow, scratch.get(), ldy, r - 1, yb + r / 2 * (ow / 2),
+                              ep.argmax + ((size_t)b * out_channels + o0) * plane
+                              + r / 2 * (ow / 2), plane);
+            }
+        }
+    });
+}
+
+void conv2d_backward_input(const Conv2dShape& shape, index_t out_channels,
+                           const data_t* dy,
+                           const data_t* w, const index_t* w_stride,
+                           data_t* dx, index_t groups) {
+    index_t hp = shape.height + 2 * shape.padding_h;
+    index_t wp = shape.width + 2 * shape.padding_w;
+    index_t oh = shape.out_h(), ow = shape.out_w(), plane = oh * ow;
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+    index_t group_c = shape.channel / groups, group_oc = out_channels / groups;
+    bool padded = shape.padding_h != 0 || shape.padding_w != 0;
+    const ConvKernels& kernels = select_conv_kernels();
+
+    // Each (image, channel) plane of dx is only written by its own task. A
+    // padded plane is summed into scratch first, then cropped.
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        if(padded)
+            scratch = Alloc::unique_allocate<data_t>(sizeof(data_t) * hp * wp);
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            index_t g = c / group_c, gc = c % group_c;
+            data_t* dx_c = dx + (size_t)bc * shape.height * shape.width;
+            data_t* dst_c = padded ? scratch.get() : dx_c;
+            std::memset(dst_c, 0, sizeof(data_t) * hp * wp);
+
+            for(index_t o0 = g * group_oc; o0 < (g + 1) * group_oc; o0 += oc_tile) {
+                index_t no = min(oc_tile, (g + 1) * group_oc - o0);
+                const data_t* dy_o = dy + ((size_t)b * out_channels + o0) * plane;
+                for(index_t i = 0; i < kh; ++i)
+                    for(index_t j = 0; j < kw; ++j) {
+                        data_t wv[oc_tile];
+                        for(index_t o = 0; o < no; ++o)
+                            wv[o] = w[(o0 + o) * w_stride[0]
+                                      + ((gc * kh + i) * kw + j) * w_stride[1]];
+                        for(index_t r = 0; r < oh; ++r)
+                            kernels.scatter_row(ow, no, wv, dy_o + r * ow, plane,
+                                        dst_c + (r * shape.stride_h + i) * wp + j,
+                                        shape.stride_w);
+                    }
+            }
+
+            if(padded)
+                for(index_t h = 0; h < shape.height; ++h)
+                    std::memcpy(dx_c + h * shape.width,
+                                dst_c + (h + shape.padding_h) * wp + shape.padding_w,
+                                sizeof(data_t) * shape.width);
+        }
+    });
+}
+
+void conv2d_backward_weight(const Conv2dShape& shape, index_t out_channels,
+                            const data_t* x, const index_t* x_stride,
+                            const data_t* dy, data_t* dw, index_t groups) {
+    Alloc::TrivialUniquePtr<data_t> buffer(nullptr, 0);
+    const data_t* xp = padded_input(shape, x, x_stride, buffer);
+    index_t hp = shape.height + 2 * shape.padding_h;
+    index_t wp = shape.width + 2 * shape.padding_w;
+    index_t oh = shape.out_h(), ow = shape.out_w(), plane = oh * ow;
+    index_t kh = shape.kernel_h, kw = shape.kernel_w, kernel = kh * kw;
+    index_t group_c = shape.channel / groups, group_oc = out_channels / groups;
+    index_t row_size = group_c * kernel;
+    index_t oc_blocks = (group_oc + oc_tile - 1) / oc_tile;
+    const ConvKernels& kernels = select_conv_kernels();
+
+    // Each task owns the entries of a block of output channels and one
+    // channel of their group in dw. A row of dy is read for all the kernel
+    // offsets while it is in L1.
+    parallel::parallel_for(0, groups * oc_blocks * group_c, 1,
+            [&](index_t begin, index_t end) {
+        auto acc = Alloc::unique_allocate<data_t>(sizeof(data_t) * kernel * oc_tile);
+        for(index_t task = begin; task < end; ++task) {
+            index_t g = task / (oc_blocks * group_c);
+            index_t o0 = g * group_oc + task / group_c % oc_blocks * oc_tile;
+            index_t gc = task % group_c, c = g * group_c + gc;
+            index_t no = min(oc_tile, (g + 1) * group_oc - o0);
+            std::memset(acc.get(), 0, sizeof(data_t) * kernel * oc_tile);
+            for(index_t b = 0; b < shape.batch; ++b) {
+                const data_t* x_c = xp + ((size_t)b * shape.channel + c) * hp * wp;
+                const data_t* dy_o = dy + ((size_t)b * out_channels + o0) * plane;
+                for(index_t r = 0; r < oh; ++r)
+                    for(index_t i = 0; i < kh; ++i) {
+                        const data_t* x_row = x_c + (r * shape.stride_h + i) * wp;
+                        for(index_t j = 0; j < kw; ++j)
+                            kernels.dot_rows(ow, no, dy_o + r * ow, plane, x_row + j,
+                                             shape.stride_w,
+                                             acc.get() + (i * kw + j) * oc_tile);
+                    }
+            }
+            for(index_t o = 0; o < no; ++o)
+                for(index_t k = 0; k < kernel; ++k)
+                    dw[(o0 + o) * row_size + gc * kernel + k] = acc.get()[k * oc_tile + o];
+        }
+    });
+}
+
+void conv2d_epilogue_plane(const Conv2dShape& shape, index_t out_channels,
+                           const Conv2dEpilogue& epilogue, index_t plane,
+                           data_t* conv, data_t* y) {
+    index_t oh = shape.out_h(), ow = shape.out_w(), o = plane % out_channels;
+    TileEpilogue tile_epilogue{
+        epilogue.bias ? epilogue.bias + o : nullptr,
+        epilogue.activation == Activation::relu
+    };
+    if(tile_epilogue.bias || tile_epilogue.relu)
+        bias_act(oh * ow, tile_epilogue.bias ? tile_epilogue.bias[0] : 0,
+                 tile_epilogue.relu, conv);
+    if(!epilogue.pool)
+        return;
+    index_t pooled_plane = (oh / 2) * (ow / 2);
+    for(index_t r = 0; r + 1 < oh; r += 2)
+        pool_rows(1, ow, conv + r * ow, ow, r,
+                  y + (size_t)plane * pooled_plane + r / 2 * (ow / 2),
+                  epilogue.argmax + (size_t)plane * pooled_plane + r / 2 * (ow / 2),
+                  pooled_plane);
+}
+
+void conv2d_epilogue_backward(const Conv2dShape& shape, index_t out_channels,
+                              const Conv2dEpilogue& epilogue,
+                              const data_t* y, const data_t* dy,
+                              data_t* dconv, data_t* dbias) {
+    index_t oh = shape.out_h(), ow = shape.out_w(), plane = oh * ow;
+    index_t pooled_plane = (oh / 2) * (ow / 2);
+    bool relu = epilogue.activation == Activation::relu;
+
+    // Each task owns an output channel, its planes of dconv and its bias.
+    parallel::parallel_for(0, out_channels, 1, [&](index_t begin, index_t end) {
+        for(index_t o = begin; o < end; ++o) {
+            data_t sum = 0;
+            for(index_t b = 0; b < shape.batch; ++b) {
+                index_t bo = b * out_channels + o;
+                data_t* dconv_o = dconv + (size_t)bo * plane;
+                if(epilogue.pool) {
+                    // The grad of a pooled output goes to its argmax, and
+                    // the ReLU mask is the sign of the pooled output.
+                    const data_t* y_o = y + (size_t)bo * pooled_plane;
+                    const data_t* dy_o = dy + (size_t)bo * pooled_plane;
+                    const index_t* arg_o = epilogue.argmax + (size_t)bo * pooled_plane;
+                    std::memset(dconv_o, 0, sizeof(data_t) * plane);
+                    for(index_t k = 0; k < pooled_plane; ++k) {
+                        data_t g = relu && y_o[k] <= 0 ? 0 : dy_o[k];
+                        dconv_o[arg_o[k]] = g;
+                        sum += g;
+                    }
+                } else {
+                    std::memcpy(dconv_o, dy + (size_t)bo * plane, sizeof(data_t) * plane);
+                    if(relu)
+                        relu_mask(plane, y + (size_t)bo * plane, dconv_o);
+                    sum += kernel::sum(plane, dconv_o);
+                }
+            }
+            if(dbias) dbias[o] = sum;
+        }
+    });
+}
+
+namespace {
+
+// Convs with fewer multiply-adds are left to the guess below.
+constexpr double tune_threshold = 1 << 22;
+// Largest im2col matrix built while tuning.
+constexpr double max_col_bytes = 256 << 20;
+// Largest operands and results of a timed run, larger convs keep the guess.
+constexpr double max_tune_bytes = 256 << 20;
+// Smallest kernel area FFT is timed for, it never wins on smaller kernels.
+constexpr index_t min_fft_tune_area = 25;
+// Largest spectra of an FFT conv, see fft_conv2d_bytes.
+constexpr size_t max_spectra_bytes = 256 << 20;
+
+// FFT conv wastes most of its output on strided convs, and its spectra grow
+// with the padded image rather than with the kernel.
+bool fft_eligible(const Conv2dShape& shape, index_t out_channels) {
+    return shape.stride_h == 1 && shape.stride_w == 1
+        && fft_conv2d_bytes(shape, out_channels) <= max_spectra_bytes;
+}
+
+Conv2dAlgorithm guess_algorithm(const Conv2dShape& shape, index_t out_channels) {
+    // The transforms only pay off with 32 channels or more, then Winograd is
+    // 1.7x to 3x faster than the others for a forward + backward.
+    if(winograd_eligible(shape) && shape.channel >= 32 && out_channels >= 32)
+        return Conv2dAlgorithm::winograd;
+
+    // The cost of FFT conv doesn't grow with the kernel, it overtakes the
+    // others from 10x10 kernels, or 9x9 ones with 32 channels.
+    index_t area = shape.kernel_h * shape.kernel_w;
+    if(fft_eligible(shape, out_channels)
+            && (area >= 100 || (area >= 81 && shape.channel >= 32)))
+        return Conv2dAlgorithm::fft;
+
+    // Measured on the shapes of train_cnn.cpp and a few deeper ones: the
+    // direct kernels are faster up to 64 channels of 3x3, the gemm beyond.
+    index_t depth = shape.channel * shape.kernel_h * shape.kernel_w;
+    double col_size = (double)shape.out_h() * shape.out_w() * shape.batch * depth;
+    if(depth <= 576 || out_channels < oc_tile
+            || col_size * sizeof(data_t) > (32 << 20))
+        return Conv2dAlgorithm::direct;
+    return Conv2dAlgorithm::im2col_gemm;
+}
+
+// A forward and a backward of a conv of shape by algorithm, on x, w and dy,
+// with the layouts of nn::Conv2d.
+void run_conv2d(const Conv2dShape& shape, index_t out_channels,
+                Conv2dAlgorithm algorithm, const data_t* x, 
+                const data_t* w, const data_t* dy) {
+    index_t oc = out_channels, c = shape.channel;
+    index_t depth = c * shape.kernel_h * shape.kernel_w;
+    index_t rows = shape.out_h() * shape.out_w() * shape.batch;
+    index_t xs[4] = {c * shape.height * shape.width, shape.height * shape.width,
+                     shape.width, 1};
+    index_t ws[2] = {depth, 1};
+    auto y = Alloc::unique_allocate<data_t>(sizeof(data_t) * rows * oc);
+    auto dx = Alloc::unique_allocate<data_t>(sizeof(data_t) * xs[0] * shape.batch);
+    auto dw = Alloc::unique_allocate<data_t>(sizeof(data_t) * oc * depth);
+
+    switch(algorithm) {
+        case Conv2dAlgorithm::im2col_gemm: {
+            auto col = Alloc::unique_allocate<data_t>(sizeof(data_t) * rows * depth);
+            im2col(shape, x, xs, col.get());
+            gemm(rows, oc, depth, col.get(), depth, 1, w, 1, depth, y.get(), oc);
+            gemm(oc, depth, rows, dy, 1, oc, col.get(), depth, 1, dw.get(), depth);
+            gemm(rows, depth, oc, dy, oc, 1, w, depth, 1, col.get(), depth);
+            col2im(shape, col.get(), dx.get());
+            break;
+        }
+        case Conv2dAlgorithm::winograd: {
+            index_t tile = winograd_tile(shape);
+            auto u = Alloc::unique_allocate<data_t>(
+                sizeof(data_t) * winograd_filter_size(tile, oc, c));
+            winograd_filter(tile, oc, c, w, ws, u.get());
+            winograd_forward(shape, tile, oc, x, xs, u.get(), y.get());
+            winograd_backward(shape, tile, oc, x, xs, u.get(), dy, dx.get(), dw.get());
+            break;
+        }
+        case Conv2dAlgorithm::fft: {
+            auto spectrum = Alloc::unique_allocate<data_t>(
+                sizeof(data_t) * fft_filter_size(shape, oc));
+            fft_filter(shape, oc, w, ws, spectrum.get());
+            fft_conv2d_forward(shape, oc, x, xs, spectrum.get(), y.get());
+            fft_conv2d_backward(shape, oc, x, xs, spectrum.get(), dy, dx.get(), dw.get());
+            break;
+        }
+        default:
+            conv2d_forward(shape, oc, x, xs, w, ws, y.get());
+            conv2d_backward_input(shape, oc, dy, w, ws, dx.get());
+            conv2d_backward_weight(shape, oc, x, xs, dy, dw.get());
+    }
+}
+
+}  // namespace
+
+Conv2dAlgorithm conv2d_algorithm(const Conv2dShape& shape, index_t out_channels,
+                                 index_t groups) {
+    if(groups > 1)
+        return Conv2dAlgorithm::direct;
+
+    Conv2dAlgorithm guess = guess_algorithm(shape, out_channels);
+    index_t depth = shape.channel * shape.kernel_h * shape.kernel_w;
+    double rows = (double)shape.out_h() * shape.out_w() * shape.batch;
+    // x, w and y, and their grads.
+    double run_bytes = 2. * sizeof(data_t) * ((double)shape.batch * shape.channel 
+        * shape.height * shape.width + (double)out_channels * depth + rows * out_channels);
+    if(rows * depth * out_channels < tune_threshold || run_bytes > max_tune_bytes)
+        return guess;
+
+    // The algorithms which can run this conv, the guess first.
+    std::vector<autotune::Config> candidates{{index_t(guess)}};
+    auto add = [&](Conv2dAlgorithm algorithm, bool eligible) {
+        if(eligible && algorithm != guess)
+            candidates.push_back({index_t(algorithm)});
+    };
+    add(Conv2dAlgorithm::direct, true);
+    add(Conv2dAlgorithm::im2col_gemm, rows * depth * sizeof(data_t) <= max_col_bytes);
+    add(Conv2dAlgorithm::winograd, winograd_eligible(shape));
+    add(Conv2dAlgorithm::fft, fft_eligible(shape, out_channels)
+        && shape.kernel_h * shape.kernel_w >= min_fft_tune_area);
+
+    // The inputs of the timed runs only need to be finite, they are made 
+    // once for all the candidates.
+    Alloc::TrivialUniquePtr<data_t> x(nullptr, 0), w(nullptr, 0), dy(nullptr, 0);
+    autotune::Config key{shape.batch, shape.channel, shape.height, shape.width,
+                         shape.kernel_h, shape.kernel_w, shape.stride_h, shape.stride_w,
+                         shape.padding_h, shape.padding_w, out_channels};
+    autotune::Config winner = autotune::select("conv2d", key, candidates,
+            [&](const autotune::Config& candidate) {
+        if(!x) {
+            index_t sizes[3] = {shape.batch * shape.channel * shape.height * shape.width,
+                                out_channels * depth, index_t(rows) * out_channels};
+            Alloc::TrivialUniquePtr<data_t>* buffers[3] = {&x, &w, &dy};
+            for(index_t i = 0; i < 3; ++i) {
+                *buffers[i] = Alloc::unique_allocate<data_t>(sizeof(data_t) * sizes[i]);
+                for(index_t j = 0; j < sizes[i]; ++j)
+                    buffers[i]->get()[j] = data_t(j % 17) / 17 - 0.5;
+            }
+        }
+        run_conv2d(shape, out_channels, Conv2dAlgorithm(candidate[0]),
+                   x.get(), w.get(), dy.get());
+    });
+    return Conv2dAlgorithm(winner[0]);
+}
+
+}  // namespace kernel
+}  // namespace st
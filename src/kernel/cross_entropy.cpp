@@ -0,0 +1,69 @@
+#include <cmath>
+
+#include "kernel/cross_entropy.hpp"
+#include "kernel/vector.hpp"
+#include "utils/allocator.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Rows per chunk of parallel_for, so that a chunk reads about 2^14 logits.
+index_t row_grain(index_t c) {
+    return (1u << 14) / (c == 0 ? 1 : c) + 1;
+}
+
+}  // namespace
+
+data_t cross_entropy_forward(index_t n, index_t c, const data_t* x,
+                             const index_t* labels, data_t* prob) {
+    auto row_loss = Alloc::unique_allocate<data_t>(n * sizeof(data_t));
+    parallel::parallel_for(0, n, row_grain(c), [&](index_t begin, index_t end) {
+        for(index_t i = begin; i < end; ++i) {
+            const data_t* xi = x + i * c;
+            data_t* pi = prob + i * c;
+            data_t max_cls = xi[0];
+            for(index_t j = 1; j < c; ++j)
+                max_cls = xi[j] > max_cls ? xi[j] : max_cls;
+            data_t sum_exp = 0;
+            for(index_t j = 0; j < c; ++j) {
+                pi[j] = std::exp(xi[j] - max_cls);
+                sum_exp += pi[j];
+            }
+            data_t inv_sum = 1 / sum_exp;
+            for(index_t j = 0; j < c; ++j)
+                pi[j] *= inv_sum;
+            // From the logits rather than log(prob), which may underflow to 0.
+            row_loss.get()[i] = max_cls + std::log(sum_exp) - xi[labels[i]];
+        }
+    });
+    // Summed in order, so the loss doesn't depend on the threads.
+    data_t loss = 0;
+    for(index_t i = 0; i < n; ++i)
+        loss += row_loss.get()[i];
+    return n == 0 ? 0 : loss / n;
+}
+
+void cross_entropy_backward(index_t n, index_t c, const data_t* prob,
+                            const index_t* labels, data_t grad, data_t* dx,
+                            bool accumulate) {
+    data_t scale = n == 0 ? 0 : grad / n;
+    parallel::parallel_for(0, n, row_grain(c), [&](index_t begin, index_t end) {
+        for(index_t i = begin; i < end; ++i) {
+            const data_t* pi = prob + i * c;
+            data_t* dxi = dx + i * c;
+            if(accumulate) {
+                axpy(c, scale, pi, dxi);
+            } else {
+                for(index_t j = 0; j < c; ++j)
+                    dxi[j] = scale * pi[j];
+            }
+            dxi[labels[i]] -= scale;
+        }
+    });
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,116 @@
+#include <cmath>
+
+#include "kernel/fft.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+const data_t pi = 3.14159265358979323846;
+
+}  // namespace
+
+index_t fft_size(index_t n) {
+    index_t size = 1;
+    while(size < n)
+        size <<= 1;
+    return size;
+}
+
+Fft::Fft(index_t n) : n_(n), reversed_(n), twiddles_(n / 2) {
+    CHECK_TRUE(n > 0 && (n & (n - 1)) == 0, "FFT size %d isn't a power of 2.", n);
+    index_t bits = 0;
+    while((1u << bits) < n)
+        ++bits;
+    for(index_t i = 0; i < n; ++i) {
+        index_t r = 0;
+        for(index_t b = 0; b < bits; ++b)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        reversed_[i] = r;
+    }
+    for(index_t k = 0; k < n / 2; ++k)
+        twiddles_[k] = std::polar(data_t(1), -2 * pi * k / n);
+}
+
+void Fft::transform(Complex* data, index_t stride, bool inverse) const {
+    for(index_t i = 0; i < n_; ++i)
+        if(i < reversed_[i])
+            std::swap(data[i * stride], data[reversed_[i] * stride]);
+
+    for(index_t len = 2; len <= n_; len <<= 1) {
+        index_t half = len / 2, step = n_ / len;
+        for(index_t start = 0; start < n_; start += len)
+            for(index_t k = 0; k < half; ++k) {
+                // Written out since the operator* of std::complex checks
+                // for NaNs.
+                data_t tr = twiddles_[k * step].real();
+                data_t ti = inverse ? -twiddles_[k * step].imag()
+                                    : twiddles_[k * step].imag();
+                Complex& a = data[(start + k) * stride];
+                Complex& b = data[(start + k + half) * stride];
+                Complex v(b.real() * tr - b.imag() * ti,
+                          b.real() * ti + b.imag() * tr);
+                b = a - v;
+                a += v;
+            }
+    }
+}
+
+RealFft2d::RealFft2d(index_t h, index_t w)
+        : h_(h), w_(w), rows_(w / 2), cols_(h), split_(w / 2 + 1) {
+    CHECK_TRUE(w >= 2, "Width of a real FFT should be at least 2, but got %d.", w);
+    for(index_t k = 0; k <= w / 2; ++k)
+        split_[k] = std::polar(data_t(1), -2 * pi * k / w);
+}
+
+void RealFft2d::forward(const data_t* in, Complex* spectrum) const {
+    index_t m = w_ / 2, wc = m + 1;
+    std::vector<Complex> z(m);
+    for(index_t r = 0; r < h_; ++r) {
+        const data_t* row = in + r * w_;
+        for(index_t j = 0; j < m; ++j)
+            z[j] = Complex(row[2 * j], row[2 * j + 1]);
+        rows_.transform(z.data(), 1, false);
+
+        // X[k] = E[k] + exp(-2 pi i k / w) O[k], where E and O are the
+        // spectra of the even and odd elements, unpacked from z.
+        Complex* out = spectrum + r * wc;
+        for(index_t k = 0; k <= m; ++k) {
+            Complex zk = z[k % m], zc = std::conj(z[(m - k) % m]);
+            Complex even = (zk + zc) * data_t(0.5);
+            Complex odd = (zk - zc) * Complex(0, -0.5);
+            out[k] = even + split_[k] * odd;
+        }
+    }
+    for(index_t k = 0; k < wc; ++k)
+        cols_.transform(spectrum + k, wc, false);
+}
+
+void RealFft2d::inverse(Complex* spectrum, data_t* out) const {
+    index_t m = w_ / 2, wc = m + 1;
+    for(index_t k = 0; k < wc; ++k)
+        cols_.transform(spectrum + k, wc, true);
+
+    std::vector<Complex> z(m);
+    data_t scale = data_t(1) / (data_t(h_) * m);
+    for(index_t r = 0; r < h_; ++r) {
+        const Complex* in = spectrum + r * wc;
+        for(index_t k = 0; k < m; ++k) {
+            Complex xc = std::conj(in[m - k]);
+            Complex even = (in[k] + xc) * data_t(0.5);
+            Complex odd = (in[k] - xc) * std::conj(split_[k]) * data_t(0.5);
+            z[k] = even + Complex(0, 1) * odd;
+        }
+        rows_.transform(z.data(), 1, true);
+        data_t* row = out + r * w_;
+        for(index_t j = 0; j < m; ++j) {
+            row[2 * j] = z[j].real() * scale;
+            row[2 * j + 1] = z[j].imag() * scale;
+        }
+    }
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,237 @@
+#include <cstring>
+#include <limits>
+
+#include "kernel/fft_conv.hpp"
+#include "kernel/fft.hpp"
+#include "utils/allocator.hpp"
+#include "utils/exception.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Spectra are stored as pairs of data_t, 2 * spectrum_size() each.
+inline Complex* as_complex(data_t* data) {
+    return reinterpret_cast<Complex*>(data);
+}
+
+// acc += a * b, or a * conj(b), over n complex numbers. Written out since
+// the operator* of std::complex checks for NaNs.
+void multiply_add(index_t n, const data_t* a, const data_t* b, bool conj,
+                  data_t* acc) {
+    data_t sign = conj ? -1 : 1;
+    for(index_t i = 0; i < n; ++i) {
+        data_t ar = a[2 * i], ai = a[2 * i + 1];
+        data_t br = b[2 * i], bi = sign * b[2 * i + 1];
+        acc[2 * i] += ar * br - ai * bi;
+        acc[2 * i + 1] += ar * bi + ai * br;
+    }
+}
+
+// The spectrum of the padded plane of each image and channel of x.
+void input_spectra(const Conv2dShape& shape, const RealFft2d& fft,
+                   index_t fft_h, index_t fft_w,
+                   const data_t* x, const index_t* x_stride, data_t* xf) {
+    index_t sc = fft.spectrum_size();
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            const data_t* x_c = x + b * x_stride[0] + c * x_stride[1];
+            std::memset(plane.get(), 0, sizeof(data_t) * fft_h * fft_w);
+            for(index_t h = 0; h < shape.height; ++h) {
+                data_t* dst = plane.get() + (h + shape.padding_h) * fft_w
+                            + shape.padding_w;
+                for(index_t w = 0; w < shape.width; ++w)
+                    dst[w] = x_c[h * x_stride[2] + w * x_stride[3]];
+            }
+            fft.forward(plane.get(), as_complex(xf + 2 * sc * bc));
+        }
+    });
+}
+
+// Alloc sizes the buffers of the spectra by index_t.
+void check_spectra(const Conv2dShape& shape, index_t out_channels) {
+    size_t bytes = fft_conv2d_bytes(shape, out_channels);
+    CHECK_TRUE(bytes <= std::numeric_limits<index_t>::max(),
+        "Spectra of %.0f bytes are too large for an FFT conv.", double(bytes));
+}
+
+}  // namespace
+
+void fft_conv2d_size(const Conv2dShape& shape, index_t& fft_h, index_t& fft_w) {
+    fft_h = fft_size(shape.height + 2 * shape.padding_h);
+    fft_w = fft_size(shape.width + 2 * shape.padding_w);
+    if(fft_w < 2) fft_w = 2;
+}
+
+size_t fft_filter_size(const Conv2dShape& shape, index_t out_channels) {
+    index_t fft_h, fft_w;
+    fft_conv2d_size(shape, fft_h, fft_w);
+    return (size_t)2 * out_channels * shape.channel * fft_h * (fft_w / 2 + 1);
+}
+
+size_t fft_conv2d_bytes(const Conv2dShape& shape, index_t out_channels) {
+    index_t fft_h, fft_w;
+    fft_conv2d_size(shape, fft_h, fft_w);
+    size_t spectrum = (size_t)2 * fft_h * (fft_w / 2 + 1);
+    size_t spectra = (size_t)out_channels * shape.channel 
+        + (size_t)shape.batch * shape.channel + (size_t)shape.batch * out_channels;
+    return sizeof(data_t) * spectrum * spectra;
+}
+
+void fft_filter(const Conv2dShape& shape, index_t out_channels,
+                const data_t* w, const index_t* w_stride, data_t* spectrum) {
+    check_spectra(shape, out_channels);
+    index_t fft_h, fft_w;
+    fft_conv2d_size(shape, fft_h, fft_w);
+    RealFft2d fft(fft_h, fft_w);
+    index_t sc = fft.spectrum_size();
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+
+    parallel::parallel_for(0, out_channels, 1, [&](index_t begin, index_t end) {
+        auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+        for(index_t o = begin; o < end; ++o)
+            for(index_t c = 0; c < shape.channel; ++c) {
+                std::memset(plane.get(), 0, sizeof(data_t) * fft_h * fft_w);
+                for(index_t u = 0; u < kh; ++u)
+                    for(index_t v = 0; v < kw; ++v)
+                        plane.get()[u * fft_w + v] = w[o * w_stride[0]
+                            + ((c * kh + u) * kw + v) * w_stride[1]];
+                fft.forward(plane.get(),
+                            as_complex(spectrum + 2 * sc * (o * shape.channel + c)));
+            }
+    });
+}
+
+void fft_conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                        const data_t* x, const index_t* x_stride,
+                        const data_t* spectrum, data_t* y,
+                        const Conv2dEpilogue* epilogue) {
+    check_spectra(shape, out_channels);
+    index_t fft_h, fft_w;
+    fft_conv2d_size(shape, fft_h, fft_w);
+    RealFft2d fft(fft_h, fft_w);
+    index_t sc = fft.spectrum_size(), channel = shape.channel;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+
+    auto xf = Alloc::unique_allocate<data_t>(
+        sizeof(data_t) * 2 * sc * shape.batch * channel);
+    input_spectra(shape, fft, fft_h, fft_w, x, x_stride, xf.get());
+
+    // y is the correlation of x and w, sum of X * conj(W) over channels. A
+    // pooled plane is cropped into scratch first.
+    bool pool = epilogue && epilogue->pool;
+    parallel::parallel_for(0, shape.batch * out_channels, 1,
+            [&](index_t begin, index_t end) {
+        auto acc = Alloc::unique_allocate<data_t>(sizeof(data_t) * 2 * sc);
+        auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        if(pool)
+            scratch = Alloc::unique_allocate<data_t>(sizeof(data_t) * oh * ow);
+        for(index_t bo = begin; bo < end; ++bo) {
+            index_t b = bo / out_channels, o = bo % out_channels;
+            std::memset(acc.get(), 0, sizeof(data_t) * 2 * sc);
+            for(index_t c = 0; c < channel; ++c)
+                multiply_add(sc, xf.get() + 2 * sc * (b * channel + c),
+                             spectrum + 2 * sc * (o * channel + c), true, acc.get());
+            fft.inverse(as_complex(acc.get()), plane.get());
+
+            data_t* y_o = pool ? scratch.get() : y + (size_t)bo * oh * ow;
+            for(index_t i = 0; i < oh; ++i)
+                for(index_t j = 0; j < ow; ++j)
+                    y_o[i * ow + j] = plane.get()[
+                        i * shape.stride_h * fft_w + j * shape.stride_w];
+            if(epilogue)
+                conv2d_epilogue_plane(shape, out_channels, *epilogue, bo, y_o, y);
+        }
+    });
+}
+
+void fft_conv2d_backward(const Conv2dShape& shape, index_t out_channels,
+                         const data_t* x, const index_t* x_stride,
+                         const data_t* spectrum, const data_t* dy,
+                         data_t* dx, data_t* dw) {
+    check_spectra(shape, out_channels);
+    index_t fft_h, fft_w;
+    fft_conv2d_size(shape, fft_h, fft_w);
+    RealFft2d fft(fft_h, fft_w);
+    index_t sc = fft.spectrum_size(), channel = shape.channel;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+
+    // The spectrum of dy, spread out by the stride.
+    auto dyf = Alloc::unique_allocate<data_t>(
+        sizeof(data_t) * 2 * sc * shape.batch * out_channels);
+    parallel::parallel_for(0, shape.batch * out_channels, 1,
+            [&](index_t begin, index_t end) {
+        auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+        for(index_t bo = begin; bo < end; ++bo) {
+            const data_t* dy_o = dy + (size_t)bo * oh * ow;
+            std::memset(plane.get(), 0, sizeof(data_t) * fft_h * fft_w);
+            for(index_t i = 0; i < oh; ++i)
+                for(index_t j = 0; j < ow; ++j)
+                    plane.get()[i * shape.stride_h * fft_w + j * shape.stride_w] =
+                        dy_o[i * ow + j];
+            fft.forward(plane.get(), as_complex(dyf.get() + 2 * sc * bo));
+        }
+    });
+
+    if(dx != nullptr) {
+        // dx is the convolution of dy and w, sum of DY * W over output
+        // channels, cropped to the unpadded image.
+        parallel::parallel_for(0, shape.batch * channel, 1,
+                [&](index_t begin, index_t end) {
+            auto acc = Alloc::unique_allocate<data_t>(sizeof(data_t) * 2 * sc);
+            auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+            for(index_t bc = begin; bc < end; ++bc) {
+                index_t b = bc / channel, c = bc % channel;
+                std::memset(acc.get(), 0, sizeof(data_t) * 2 * sc);
+                for(index_t o = 0; o < out_channels; ++o)
+                    multiply_add(sc, dyf.get() + 2 * sc * (b * out_channels + o),
+                                 spectrum + 2 * sc * (o * channel + c), false, acc.get());
+                fft.inverse(as_complex(acc.get()), plane.get());
+
+                data_t* dx_c = dx + (size_t)bc * shape.height * shape.width;
+                for(index_t h = 0; h < shape.height; ++h)
+                    std::memcpy(dx_c + h * shape.width,
+                                plane.get() + (h + shape.padding_h) * fft_w
+                                + shape.padding_w,
+                                sizeof(data_t) * shape.width);
+            }
+        });
+    }
+
+    if(dw != nullptr) {
+        // dw is the correlation of x and dy, sum of X * conj(DY) over images.
+        auto xf = Alloc::unique_allocate<data_t>(
+            sizeof(data_t) * 2 * sc * shape.batch * channel);
+        input_spectra(shape, fft, fft_h, fft_w, x, x_stride, xf.get());
+
+        parallel::parallel_for(0, out_channels * channel, 1,
+                [&](index_t begin, index_t end) {
+            auto acc = Alloc::unique_allocate<data_t>(sizeof(data_t) * 2 * sc);
+            auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * fft_h * fft_w);
+            for(index_t oc = begin; oc < end; ++oc) {
+                index_t o = oc / channel, c = oc % channel;
+                std::memset(acc.get(), 0, sizeof(data_t) * 2 * sc);
+                for(index_t b = 0; b < shape.batch; ++b)
+                    multiply_add(sc, xf.get() + 2 * sc * (b * channel + c),
+                                 dyf.get() + 2 * sc * (b * out_channels + o),
+                                 true, acc.get());
+                fft.inverse(as_complex(acc.get()), plane.get());
+
+                data_t* dw_oc = dw + (size_t)oc * kh * kw;
+                for(index_t u = 0; u < kh; ++u)
+                    std::memcpy(dw_oc + u * kw, plane.get() + u * fft_w,
+                                sizeof(data_t) * kw);
+            }
+        });
+    }
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,370 @@
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel/gemm.hpp"
+#include "utils/allocator.hpp"
+#include "utils/autotune.hpp"
+#include "utils/cpu.hpp"
+#include "utils/parallel.hpp"
+
+#ifdef ST_ISA_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Register tile of the micro-kernel.
+constexpr index_t mr = 4;
+constexpr index_t nr = 4;
+// Products with fewer multiply-adds are not worth waking the thread pool,
+// nor tuning.
+constexpr double parallel_threshold = 1 << 18;
+
+// kc x nr panel of b stays in L1, mc x kc block of a stays in L2 and
+// kc x nc block of b is shared by all the blocks of a. The sizes which fit
+// best depend on the caches and the shape, so they are tuned for each shape
+// among the candidates below, the first of which is the default.
+struct Blocking {
+    index_t mc;
+    index_t kc;
+    index_t nc;
+};
+
+const std::vector<autotune::Config>& blocking_candidates(void) {
+    static const std::vector<autotune::Config> candidates = {
+        {96, 256, 2048}, {48, 128, 2048}, {96, 128, 2048},
+        {192, 256, 2048}, {96, 512, 2048}, {96, 256, 512}
+    };
+    return candidates;
+}
+
+inline index_t min(index_t a, index_t b) { return a < b ? a : b; }
+
+// Packs a[0:rows, 0:depth] into slivers of mr rows, each stored column by
+// column, so the micro-kernel reads it with unit stride. The last sliver is
+// padded with zeros.
+void pack_a(index_t rows, index_t depth, const data_t* a, 
+            index_t row_stride, index_t col_stride, data_t* buffer) {
+    for(index_t i = 0; i < rows; i += mr) {
+        index_t h = min(mr, rows - i);
+        for(index_t p = 0; p < depth; ++p) {
+            const data_t* src = a + i * row_stride + p * col_stride;
+            for(index_t r = 0; r < h; ++r)
+                buffer[r] = src[r * row_stride];
+            for(index_t r = h; r < mr; ++r)
+                buffer[r] = 0;
+            buffer += mr;
+        }
+    }
+}
+
+// Packs b[0:depth, 0:cols] into slivers of nr columns, each stored row by
+// row.
+void pack_b(index_t depth, index_t cols, const data_t* b,
+            index_t row_stride, index_t col_stride, data_t* buffer) {
+    for(index_t j = 0; j < cols; j += nr) {
+        index_t w = min(nr, cols - j);
+        for(index_t p = 0; p < depth; ++p) {
+            const data_t* src = b + p * row_stride + j * col_stride;
+            for(index_t c = 0; c < w; ++c)
+                buffer[c] = src[c * col_stride];
+            for(index_t c = w; c < nr; ++c)
+                buffer[c] = 0;
+            buffer += nr;
+        }
+    }
+}
+
+// c[0:mr, 0:nr] (+)= a_panel * b_panel, over depth.
+void micro_kernel(index_t depth, const data_t* a, const data_t* b,
+                  data_t* c, index_t ldc, bool accumulate) {
+#ifdef __SSE2__
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+    for(index_t p = 0; p < depth; ++p) {
+        __m128d b0 = _mm_loadu_pd(b);
+        __m128d b1 = _mm_loadu_pd(b + 2);
+        __m128d a0 = _mm_set1_pd(a[0]);
+        __m128d a1 = _mm_set1_pd(a[1]);
+        __m128d a2 = _mm_set1_pd(a[2]);
+        __m128d a3 = _mm_set1_pd(a[3]);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(a0, b0));
+        c01 = _mm_add_pd(c01, _mm_mul_pd(a0, b1));
+        c10 = _mm_add_pd(c10, _mm_mul_pd(a1, b0));
+        c11 = _mm_add_pd(c11, _mm_mul_pd(a1, b1));
+        c20 = _mm_add_pd(c20, _mm_mul_pd(a2, b0));
+        c21 = _mm_add_pd(c21, _mm_mul_pd(a2, b1));
+        c30 = _mm_add_pd(c30, _mm_mul_pd(a3, b0));
+        c31 = _mm_add_pd(c31, _mm_mul_pd(a3, b1));
+        a += mr;
+        b += nr;
+    }
+    __m128d acc[mr][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for(index_t r = 0; r < mr; ++r) {
+        data_t* row = c + r * ldc;
+        if(accumulate) {
+            acc[r][0] = _mm_add_pd(acc[r][0], _mm_loadu_pd(row));
+            acc[r][1] = _mm_add_pd(acc[r][1], _mm_loadu_pd(row + 2));
+        }
+        _mm_storeu_pd(row, acc[r][0]);
+        _mm_storeu_pd(row + 2, acc[r][1]);
+    }
+#else
+    data_t acc[mr][nr] = {{0}};
+    for(index_t p = 0; p < depth; ++p) {
+        for(index_t r = 0; r < mr; ++r)
+            for(index_t s = 0; s < nr; ++s)
+                acc[r][s] += a[r] * b[s];
+        a += mr;
+        b += nr;
+    }
+    for(index_t r = 0; r < mr; ++r)
+        for(index_t s = 0; s < nr; ++s) {
+            if(accumulate) c[r * ldc + s] += acc[r][s];
+            else c[r * ldc + s] = acc[r][s];
+        }
+#endif
+}
+
+#ifdef ST_ISA_DISPATCH
+// micro_kernel by FMA, a row of the tile per register. Even and odd steps of
+// depth go to their own accumulators, so more FMAs are in flight.
+ST_TARGET_AVX2
+void micro_kernel_avx2(index_t depth, const data_t* a, const data_t* b,
+                       data_t* c, index_t ldc, bool accumulate) {
+    __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+    __m256d c2 = _mm256_setzero_pd(), c3 = _mm256_setzero_pd();
+    __m256d d0 = _mm256_setzero_pd(), d1 = _mm256_setzero_pd();
+    __m256d d2 = _mm256_setzero_pd(), d3 = _mm256_setzero_pd();
+    index_t p = 0;
+    for(; p + 2 <= depth; p += 2) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + nr);
+        c0 = _mm256_fmadd_pd(_mm256_broadcast_sd(a), b0, c0);
+        c1 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 1), b0, c1);
+        c2 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 2), b0, c2);
+        c3 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 3), b0, c3);
+        d0 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + mr), b1, d0);
+        d1 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + mr + 1), b1, d1);
+        d2 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + mr + 2), b1, d2);
+        d3 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + mr + 3), b1, d3);
+        a += 2 * mr;
+        b += 2 * nr;
+    }
+    if(p < depth) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        c0 = _mm256_fmadd_pd(_mm256_broadcast_sd(a), b0, c0);
+        c1 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 1), b0, c1);
+        c2 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 2), b0, c2);
+        c3 = _mm256_fmadd_pd(_mm256_broadcast_sd(a + 3), b0, c3);
+    }
+    __m256d acc[mr] = {_mm256_add_pd(c0, d0), _mm256_add_pd(c1, d1),
+                       _mm256_add_pd(c2, d2), _mm256_add_pd(c3, d3)};
+    for(index_t r = 0; r < mr; ++r) {
+        data_t* row = c + r * ldc;
+        if(accumulate)
+            acc[r] = _mm256_add_pd(acc[r], _mm256_loadu_pd(row));
+        _mm256_storeu_pd(row, acc[r]);
+    }
+}
+#endif
+
+using MicroKernel = void (*)(index_t, const data_t*, const data_t*, 
+                             data_t*, index_t, bool);
+
+// The micro-kernel of cpu::isa(). The tile of nr doubles is a single AVX2
+// register, so AVX-512 runs the AVX2 one too.
+MicroKernel select_micro_kernel(void) {
+#ifdef ST_ISA_DISPATCH
+    if(cpu::isa() != cpu::Isa::sse2)
+        return micro_kernel_avx2;
+#endif
+    return micro_kernel;
+}
+
+// c[0:rows, 0:cols] = act(c + bias), bias of the first column of c.
+void apply_epilogue(const GemmEpilogue& epilogue, const data_t* bias,
+                    index_t rows, index_t cols, data_t* c, index_t ldc) {
+    bool relu = epilogue.activation == Activation::relu;
+    for(index_t r = 0; r < rows; ++r) {
+        data_t* row = c + r * ldc;
+        for(index_t s = 0; s < cols; ++s) {
+            data_t value = bias == nullptr ? row[s] : row[s] + bias[s];
+            row[s] = relu && value < 0 ? 0 : value;
+        }
+    }
+}
+
+// c[0:rows, 0:cols] (+)= packed block of a * packed block of b, followed by
+// the epilogue, if any, with bias of the first column of c.
+void macro_kernel(MicroKernel micro_kernel, 
+                  index_t rows, index_t cols, index_t depth,
+                  const data_t* a, const data_t* b,
+                  data_t* c, index_t ldc, bool accumulate,
+                  const GemmEpilogue* epilogue, const data_t* bias) {
+    data_t tile[mr * nr];
+    for(index_t j = 0; j < cols; j += nr) {
+        index_t w = min(nr, cols - j);
+        const data_t* b_panel = b + j * depth;
+        const data_t* b_tile = bias == nullptr ? nullptr : bias + j;
+        for(index_t i = 0; i < rows; i += mr) {
+            index_t h = min(mr, rows - i);
+            const data_t* a_panel = a + i * depth;
+            data_t* c_tile = c + i * ldc + j;
+            if(h == mr && w == nr) {
+                micro_kernel(depth, a_panel, b_panel, c_tile, ldc, accumulate);
+            } else {
+                // edge tiles go through a scratch tile, padded lanes are 
+                // dropped
+                micro_kernel(depth, a_panel, b_panel, tile, nr, false);
+                for(index_t r = 0; r < h; ++r)
+                    for(index_t s = 0; s < w; ++s) {
+                        if(accumulate) c_tile[r * ldc + s] += tile[r * nr + s];
+                        else c_tile[r * ldc + s] = tile[r * nr + s];
+                    }
+            }
+            if(epilogue != nullptr)
+                apply_epilogue(*epilogue, b_tile, h, w, c_tile, ldc);
+        }
+    }
+}
+
+// gemm with the block sizes of blocking.
+void blocked_gemm(const Blocking& blocking, index_t m, index_t n, index_t k,
+                  const data_t* a, index_t a_row_stride, index_t a_col_stride,
+                  const data_t* b, index_t b_row_stride, index_t b_col_stride,
+                  data_t* c, index_t ldc, bool accumulate,
+                  const GemmEpilogue* epilogue) {
+    index_t mc = blocking.mc, kc = blocking.kc, nc = blocking.nc;
+    MicroKernel micro_kernel = select_micro_kernel();
+    index_t kc_max = min(kc, k);
+    index_t mc_max = (min(mc, m) + mr - 1) / mr * mr;
+    index_t nc_max = (min(nc, n) + nr - 1) / nr * nr;
+    auto b_buffer = Alloc::unique_allocate<data_t>(kc_max * nc_max * sizeof(data_t));
+
+    // Each task multiplies one block of rows of a by a range of the columns
+    // of the packed b. Columns are split only when there are fewer blocks of
+    // rows than threads, and nothing is split for small products.
+    index_t row_blocks = (m + mc - 1) / mc;
+    bool large = double(m) * n * k >= parallel_threshold;
+    index_t threads = large ? parallel::available_threads() : 1;
+
+    for(index_t j = 0; j < n; j += nc) {
+        index_t cols = min(nc, n - j);
+        index_t slivers = (cols + nr - 1) / nr;
+        index_t col_chunks = row_blocks >= threads ? 1 
+                           : min(slivers, (threads + row_blocks - 1) / row_blocks);
+        index_t chunk_cols = (slivers + col_chunks - 1) / col_chunks * nr;
+        col_chunks = (cols + chunk_cols - 1) / chunk_cols;
+        index_t tasks = row_blocks * col_chunks;
+
+        for(index_t p = 0; p < k; p += kc) {
+            index_t depth = min(kc, k - p);
+            // only the first block of k may overwrite c, and only the last
+            // one runs the epilogue
+            bool acc = accumulate || p != 0;
+            const GemmEpilogue* last = p + depth == k ? epilogue : nullptr;
+            const data_t* bias = last != nullptr && last->bias != nullptr 
+                               ? last->bias + j : nullptr;
+            pack_b(depth, cols, b + p * b_row_stride + j * b_col_stride,
+                   b_row_stride, b_col_stride, b_buffer.get());
+
+            parallel::parallel_for(0, tasks, large ? 1 : tasks,
+                    [&](index_t begin, index_t end) {
+                auto a_buffer = Alloc::unique_allocate<data_t>(
+                    mc_max * depth * sizeof(data_t));
+                index_t packed = row_blocks;
+                for(index_t t = begin; t < end; ++t) {
+                    index_t block = t / col_chunks;
+                    index_t i = block * mc, rows = min(mc, m - i);
+                    index_t j0 = t % col_chunks * chunk_cols;
+                    if(packed != block) {
+                        pack_a(rows, depth, a + i * a_row_stride + p * a_col_stride,
+                               a_row_stride, a_col_stride, a_buffer.get());
+                        packed = block;
+                    }
+                    macro_kernel(micro_kernel, 
+                                 rows, min(chunk_cols, cols - j0), depth, 
+                                 a_buffer.get(), b_buffer.get() + j0 * depth,
+                                 c + i * ldc + j + j0, ldc, acc, last,
+                                 bias == nullptr ? nullptr : bias + j0);
+                }
+            });
+        }
+    }
+}
+
+}  // namespace
+
+void gemm(index_t m, index_t n, index_t k,
+          const data_t* a, index_t a_row_stride, index_t a_col_stride,
+          const data_t* b, index_t b_row_stride, index_t b_col_stride,
+          data_t* c, index_t ldc, bool accumulate,
+          const GemmEpilogue* epilogue) {
+    if(m == 0 || n == 0)
+        return;
+    if(k == 0) {
+        if(!accumulate)
+            for(index_t i = 0; i < m; ++i)
+                std::memset(c + i * ldc, 0, n * sizeof(data_t));
+        if(epilogue != nullptr)
+            apply_epilogue(*epilogue, epilogue->bias, m, n, c, ldc);
+        return;
+    }
+
+    // Candidates are timed on the operands themselves, into a scratch c.
+    autotune::Config config = blocking_candidates()[0];
+    if(double(m) * n * k >= parallel_threshold) {
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        config = autotune::select("gemm", {m, n, k}, blocking_candidates(),
+                [&](const autotune::Config& candidate) {
+            if(!scratch)
+                scratch = Alloc::unique_allocate<data_t>(m * n * sizeof(data_t));
+            blocked_gemm(Blocking{candidate[0], candidate[1], candidate[2]}, 
+                         m, n, k, a, a_row_stride, a_col_stride,
+                         b, b_row_stride, b_col_stride, scratch.get(), n, false,
+                         nullptr);
+        });
+    }
+    blocked_gemm(Blocking{config[0], config[1], config[2]}, m, n, k, 
+                 a, a_row_stride, a_col_stride, b, b_row_stride, b_col_stride,
+                 c, ldc, accumulate, epilogue);
+}
+
+void batch_gemm(index_t batch, index_t m, index_t n, index_t k,
+                const data_t* a, index_t a_batch_stride, 
+                index_t a_row_stride, index_t a_col_stride,
+                const data_t* b, index_t b_batch_stride,
+                index_t b_row_stride, index_t b_col_stride,
+                data_t* c, index_t c_batch_stride, index_t ldc, 
+                bool accumulate) {
+    // Items written to the same c are summed up in turn, each of them is 
+    // still split over rows and columns by gemm.
+    if(c_batch_stride == 0) {
+        for(index_t t = 0; t < batch; ++t)
+            gemm(m, n, k, a + t * a_batch_stride, a_row_stride, a_col_stride,
+                 b + t * b_batch_stride, b_row_stride, b_col_stride,
+                 c, ldc, accumulate || t != 0);
+        return;
+    }
+    bool large = double(batch) * m * n * k >= parallel_threshold;
+    parallel::parallel_for(0, batch, large ? 1 : batch, 
+            [&](index_t begin, index_t end) {
+        for(index_t t = begin; t < end; ++t)
+            gemm(m, n, k, a + t * a_batch_stride, a_row_stride, a_col_stride,
+                 b + t * b_batch_stride, b_row_stride, b_col_stride,
+                 c + t * c_batch_stride, ldc, accumulate);
+    });
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,102 @@
+#include <cstring>
+
+#include "kernel/im2col.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// The columns [lo, hi) of a patch row which fall inside the image, for a
+// patch starting at column start (which may be negative).
+inline void valid_span(long long start, index_t kernel, index_t size,
+                       index_t& lo, index_t& hi) {
+    long long first = start < 0 ? -start : 0;
+    long long last = (long long)size - start;
+    if(last > kernel) last = kernel;
+    if(first > kernel) first = kernel;
+    if(last < first) last = first;
+    lo = index_t(first);
+    hi = index_t(last);
+}
+
+}  // namespace
+
+void im2col(const Conv2dShape& shape, const data_t* x, const index_t* x_stride,
+            data_t* col) {
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+    index_t row_size = shape.channel * kh * kw;
+    index_t rows = oh * ow * shape.batch;
+    bool unit = x_stride[3] == 1 || shape.width == 1;
+
+    parallel::parallel_for(0, rows, 64, [&](index_t begin, index_t end) {
+        for(index_t r = begin; r < end; ++r) {
+            index_t b = r % shape.batch;
+            index_t pos = r / shape.batch;
+            long long h0 = (long long)(pos / ow) * shape.stride_h - shape.padding_h;
+            long long w0 = (long long)(pos % ow) * shape.stride_w - shape.padding_w;
+            index_t lo, hi;
+            valid_span(w0, kw, shape.width, lo, hi);
+
+            data_t* dst = col + (size_t)r * row_size;
+            for(index_t c = 0; c < shape.channel; ++c) {
+                const data_t* src_c = x + b * x_stride[0] + c * x_stride[1];
+                for(index_t i = 0; i < kh; ++i, dst += kw) {
+                    long long h = h0 + i;
+                    if(h < 0 || h >= shape.height || lo == hi) {
+                        std::memset(dst, 0, kw * sizeof(data_t));
+                        continue;
+                    }
+                    std::memset(dst, 0, lo * sizeof(data_t));
+                    const data_t* src = src_c + h * x_stride[2];
+                    if(unit) {
+                        std::memcpy(dst + lo, src + (w0 + lo), 
+                                    (hi - lo) * sizeof(data_t));
+                    } else {
+                        for(index_t j = lo; j < hi; ++j)
+                            dst[j] = src[(w0 + j) * x_stride[3]];
+                    }
+                    std::memset(dst + hi, 0, (kw - hi) * sizeof(data_t));
+                }
+            }
+        }
+    });
+}
+
+void col2im(const Conv2dShape& shape, const data_t* col, data_t* x) {
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+    index_t row_size = shape.channel * kh * kw;
+    index_t plane = shape.height * shape.width;
+
+    // Each (image, channel) plane of x is only written by its own task.
+    parallel::parallel_for(0, shape.batch * shape.channel, 1, 
+            [&](index_t begin, index_t end) {
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            data_t* dst_c = x + (size_t)bc * plane;
+            std::memset(dst_c, 0, plane * sizeof(data_t));
+            for(index_t pos = 0; pos < oh * ow; ++pos) {
+                long long h0 = (long long)(pos / ow) * shape.stride_h - shape.padding_h;
+                long long w0 = (long long)(pos % ow) * shape.stride_w - shape.padding_w;
+                index_t lo, hi;
+                valid_span(w0, kw, shape.width, lo, hi);
+
+                const data_t* src = col + (size_t)(pos * shape.batch + b) * row_size
+                                  + c * kh * kw;
+                for(index_t i = 0; i < kh; ++i, src += kw) {
+                    long long h = h0 + i;
+                    if(h < 0 || h >= shape.height) continue;
+                    data_t* dst = dst_c + h * shape.width;
+                    for(index_t j = lo; j < hi; ++j)
+                        dst[w0 + j] += src[j];
+                }
+            }
+        }
+    });
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,53 @@
+#include <cstring>
+
+#include "kernel/linear.hpp"
+#include "kernel/vector.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Elements of dy per chunk of the ReLU mask and of the bias grad.
+constexpr index_t grain = 1 << 14;
+
+}  // namespace
+
+void linear_forward(index_t n, index_t k, index_t m,
+                    const data_t* x, const data_t* w, const data_t* b,
+                    data_t* y, Activation act) {
+    // w^T is w with swapped strides.
+    GemmEpilogue epilogue{b, act};
+    gemm(n, m, k, x, k, 1, w, 1, k, y, m, false, &epilogue);
+}
+
+void linear_backward(index_t n, index_t k, index_t m,
+                     const data_t* x, const data_t* w, const data_t* y,
+                     data_t* dy, data_t* dx, data_t* dw, data_t* db,
+                     Activation act) {
+    // relu'(z) is read from the saved output, y > 0 iff z > 0.
+    if(act == Activation::relu)
+        parallel::parallel_for(0, n * m, grain, [&](index_t begin, index_t end) {
+            relu_mask(end - begin, y + begin, dy + begin);
+        });
+
+    if(db != nullptr) {
+        index_t cols = n == 0 ? m : grain / n + 1;
+        parallel::parallel_for(0, m, cols, [&](index_t begin, index_t end) {
+            std::memset(db + begin, 0, (end - begin) * sizeof(data_t));
+            for(index_t i = 0; i < n; ++i)
+                axpy(end - begin, 1, dy + i * m + begin, db + begin);
+        });
+    }
+
+    // dw = dy^T * x, dy^T being dy with swapped strides.
+    if(dw != nullptr)
+        gemm(m, k, n, dy, 1, m, x, k, 1, dw, k);
+
+    if(dx != nullptr)
+        gemm(n, k, m, dy, m, 1, w, k, 1, dx, k);
+}
+
+}  // namespace kernel
+}  // namespace st
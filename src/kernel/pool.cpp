@@ -0,0 +1,91 @@
+#include <cstring>
+
+#include "kernel/pool.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// The part [lo, hi) of a window starting at start (which may be negative)
+// which falls inside [0, size).
+inline void clip_window(long long start, index_t kernel, index_t size,
+                        index_t& lo, index_t& hi) {
+    long long first = start < 0 ? 0 : start;
+    long long last = start + kernel;
+    if(last > (long long)size) last = size;
+    if(last < first) last = first;
+    lo = index_t(first);
+    hi = index_t(last);
+}
+
+}  // namespace
+
+void max_pool2d_forward(const Conv2dShape& shape, const data_t* x,
+                        const index_t* x_stride, data_t* y, index_t* argmax) {
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t area = shape.kernel_h * shape.kernel_w;
+
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            const data_t* x_c = x + b * x_stride[0] + c * x_stride[1];
+            data_t* y_c = y + (size_t)bc * oh * ow;
+            index_t* arg_c = argmax + (size_t)bc * oh * ow;
+
+            for(index_t i = 0; i < oh; ++i) {
+                index_t h_lo, h_hi;
+                clip_window((long long)i * shape.stride_h - shape.padding_h,
+                            shape.kernel_h, shape.height, h_lo, h_hi);
+                for(index_t j = 0; j < ow; ++j) {
+                    index_t w_lo, w_hi;
+                    clip_window((long long)j * shape.stride_w - shape.padding_w,
+                                shape.kernel_w, shape.width, w_lo, w_hi);
+
+                    // A clipped window also holds zeros of the padding.
+                    data_t max_value = DATA_MIN;
+                    index_t max_idx = pool_padding;
+                    if((h_hi - h_lo) * (w_hi - w_lo) < area)
+                        max_value = 0;
+                    for(index_t h = h_lo; h < h_hi; ++h) {
+                        const data_t* row = x_c + h * x_stride[2];
+                        for(index_t w = w_lo; w < w_hi; ++w) {
+                            data_t value = row[w * x_stride[3]];
+                            if(value > max_value) {
+                                max_value = value;
+                                max_idx = h * shape.width + w;
+                            }
+                        }
+                    }
+                    y_c[i * ow + j] = max_value;
+                    arg_c[i * ow + j] = max_idx;
+                }
+            }
+        }
+    });
+}
+
+void max_pool2d_backward(const Conv2dShape& shape, const data_t* dy,
+                         const index_t* argmax, data_t* dx) {
+    index_t out_plane = shape.out_h() * shape.out_w();
+    index_t plane = shape.height * shape.width;
+
+    // Each (image, channel) plane of dx is only written by its own task.
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        for(index_t bc = begin; bc < end; ++bc) {
+            data_t* dx_c = dx + (size_t)bc * plane;
+            const data_t* dy_c = dy + (size_t)bc * out_plane;
+            const index_t* arg_c = argmax + (size_t)bc * out_plane;
+            std::memset(dx_c, 0, plane * sizeof(data_t));
+            for(index_t k = 0; k < out_plane; ++k)
+                if(arg_c[k] != pool_padding)
+                    dx_c[arg_c[k]] += dy_c[k];
+        }
+    });
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,251 @@
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel/quant.hpp"
+#include "utils/allocator.hpp"
+#include "utils/cpu.hpp"
+#include "utils/parallel.hpp"
+
+#ifdef ST_ISA_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+inline int8_t saturate(data_t value) {
+    data_t rounded = std::nearbyint(value);
+    return rounded > 127 ? 127 : rounded < -127 ? -127 : int8_t(rounded);
+}
+
+// out[r] = x . w[r], r < 4, for the 4 rows of w ldw apart. It is the
+// micro kernel of int8_gemm, a load of x is shared by the 4 rows.
+using Dot4 = void (*)(index_t k, const int8_t* x, const int8_t* w, index_t ldw,
+                      int32_t* out);
+
+inline void dot4_tail(index_t p, index_t k, const int8_t* x, const int8_t* w,
+                      index_t ldw, int32_t* out) {
+    for(; p < k; ++p)
+        for(index_t r = 0; r < 4; ++r)
+            out[r] += int32_t(x[p]) * w[r * ldw + p];
+}
+
+#ifdef __SSE2__
+// Sign-extends the 16 int8 at p into two vectors of 8 int16.
+inline void widen_sse2(const int8_t* p, __m128i& lo, __m128i& hi) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+    hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+}
+
+inline int32_t hsum_sse2(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+#endif
+
+void dot4_sse2(index_t k, const int8_t* x, const int8_t* w, index_t ldw,
+               int32_t* out) {
+    index_t p = 0;
+    out[0] = out[1] = out[2] = out[3] = 0;
+#ifdef __SSE2__
+    __m128i acc[4] = {_mm_setzero_si128(), _mm_setzero_si128(),
+                      _mm_setzero_si128(), _mm_setzero_si128()};
+    for(; p + 16 <= k; p += 16) {
+        __m128i x_lo, x_hi, w_lo, w_hi;
+        widen_sse2(x + p, x_lo, x_hi);
+        for(index_t r = 0; r < 4; ++r) {
+            widen_sse2(w + r * ldw + p, w_lo, w_hi);
+            acc[r] = _mm_add_epi32(acc[r], _mm_add_epi32(_mm_madd_epi16(x_lo, w_lo),
+                                                         _mm_madd_epi16(x_hi, w_hi)));
+        }
+    }
+    for(index_t r = 0; r < 4; ++r)
+        out[r] = hsum_sse2(acc[r]);
+#endif
+    dot4_tail(p, k, x, w, ldw, out);
+}
+
+#ifdef ST_ISA_DISPATCH
+ST_TARGET_AVX2
+inline __m256i widen_avx2(const int8_t* p) {
+    return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+ST_TARGET_AVX2
+void dot4_avx2(index_t k, const int8_t* x, const int8_t* w, index_t ldw,
+               int32_t* out) {
+    index_t p = 0;
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+    const int8_t* w0 = w;
+    const int8_t* w1 = w0 + ldw;
+    const int8_t* w2 = w1 + ldw;
+    const int8_t* w3 = w2 + ldw;
+    for(; p + 16 <= k; p += 16) {
+        __m256i xv = widen_avx2(x + p);
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(xv, widen_avx2(w0 + p)));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(xv, widen_avx2(w1 + p)));
+        acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(xv, widen_avx2(w2 + p)));
+        acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(xv, widen_avx2(w3 + p)));
+    }
+    // Sums the 8 lanes of each accumulator, the 4 sums end in one vector.
+    __m256i s01 = _mm256_hadd_epi32(acc0, acc1);
+    __m256i s23 = _mm256_hadd_epi32(acc2, acc3);
+    __m256i s = _mm256_hadd_epi32(s01, s23);
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), sum);
+    dot4_tail(p, k, x, w, ldw, out);
+}
+#endif
+
+// The int8 products of AVX-512 need AVX512BW, which isa() doesn't tell, so
+// the avx512 level runs the AVX2 kernel.
+Dot4 select_dot4(void) {
+#ifdef ST_ISA_DISPATCH
+    if(cpu::isa() != cpu::Isa::sse2)
+        return dot4_avx2;
+#endif
+    return dot4_sse2;
+}
+
+inline void store(const Int8Epilogue& epilogue, data_t scale, index_t j,
+                  int32_t acc, data_t* y, int8_t* yq, index_t offset) {
+    data_t value = acc * scale;
+    if(epilogue.bias != nullptr)
+        value += epilogue.bias[j];
+    if(epilogue.activation == Activation::relu && value < 0)
+        value = 0;
+    if(y != nullptr)
+        y[offset] = value;
+    if(yq != nullptr)
+        yq[offset] = saturate(value / epilogue.y_scale);
+}
+
+// int8_linear_forward with x rows ldx apart and w rows ldw apart, writing
+// output (i, j) at i * y_row + j * y_col.
+void int8_gemm(index_t n, index_t k, index_t m,
+               const int8_t* x, index_t ldx, data_t x_scale,
+               const int8_t* w, index_t ldw, const data_t* w_scales,
+               const Int8Epilogue& epilogue, data_t* y, int8_t* yq,
+               index_t y_row, index_t y_col) {
+    Dot4 dot4 = select_dot4();
+    index_t grain = k * m == 0 ? n : (1u << 16) / (k * m) + 1;
+    parallel::parallel_for(0, n, grain, [&](index_t begin, index_t end) {
+        int32_t acc[4];
+        for(index_t i = begin; i < end; ++i) {
+            const int8_t* xi = x + i * ldx;
+            index_t j = 0;
+            for(; j + 4 <= m; j += 4) {
+                dot4(k, xi, w + j * ldw, ldw, acc);
+                for(index_t r = 0; r < 4; ++r)
+                    store(epilogue, x_scale * w_scales[j + r], j + r, acc[r],
+                          y, yq, i * y_row + (j + r) * y_col);
+            }
+            for(; j < m; ++j) {
+                const int8_t* wj = w + j * ldw;
+                int32_t sum = 0;
+                for(index_t p = 0; p < k; ++p)
+                    sum += int32_t(xi[p]) * wj[p];
+                store(epilogue, x_scale * w_scales[j], j, sum, y, yq,
+                      i * y_row + j * y_col);
+            }
+        }
+    });
+}
+
+// The patches of the image x, [channel, height, width], into col,
+// [out_h * out_w, channel * kernel_h * kernel_w], as im2col does.
+void im2col_s8(const Conv2dShape& shape, const int8_t* x, int8_t* col) {
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t kh = shape.kernel_h, kw = shape.kernel_w;
+    index_t row_size = shape.channel * kh * kw;
+    std::memset(col, 0, (size_t)oh * ow * row_size);
+    for(index_t pos = 0; pos < oh * ow; ++pos) {
+        long long h0 = (long long)(pos / ow) * shape.stride_h - shape.padding_h;
+        long long w0 = (long long)(pos % ow) * shape.stride_w - shape.padding_w;
+        int8_t* dst = col + (size_t)pos * row_size;
+        for(index_t c = 0; c < shape.channel; ++c)
+            for(index_t i = 0; i < kh; ++i, dst += kw) {
+                long long h = h0 + i;
+                if(h < 0 || h >= shape.height)
+                    continue;
+                const int8_t* src = x + (c * shape.height + h) * shape.width;
+                for(index_t j = 0; j < kw; ++j) {
+                    long long v = w0 + j;
+                    if(v >= 0 && v < shape.width)
+                        dst[j] = src[v];
+                }
+            }
+    }
+}
+
+}  // namespace
+
+data_t max_abs(index_t n, const data_t* x) {
+    data_t result = 0;
+    for(index_t i = 0; i < n; ++i)
+        result = std::fabs(x[i]) > result ? std::fabs(x[i]) : result;
+    return result;
+}
+
+void quantize(index_t n, const data_t* x, data_t scale, int8_t* q) {
+    data_t inv_scale = 1. / scale;
+    for(index_t i = 0; i < n; ++i)
+        q[i] = saturate(x[i] * inv_scale);
+}
+
+void quantize_rows(index_t rows, index_t cols, const data_t* w,
+                   int8_t* q, data_t* scales) {
+    for(index_t r = 0; r < rows; ++r) {
+        data_t range = max_abs(cols, w + r * cols);
+        // An all-zero row gets 0 whatever its scale.
+        scales[r] = range == 0 ? 1 : range / 127;
+        quantize(cols, w + r * cols, scales[r], q + r * cols);
+    }
+}
+
+void int8_linear_forward(index_t n, index_t k, index_t m,
+                         const int8_t* x, data_t x_scale,
+                         const int8_t* w, const data_t* w_scales,
+                         const Int8Epilogue& epilogue, data_t* y, int8_t* yq) {
+    int8_gemm(n, k, m, x, k, x_scale, w, k, w_scales, epilogue, y, yq, m, 1);
+}
+
+void int8_conv2d_forward(const Conv2dShape& shape, index_t out_channels,
+                         index_t groups, const int8_t* x, data_t x_scale,
+                         const int8_t* w, const data_t* w_scales,
+                         const Int8Epilogue& epilogue, data_t* y, int8_t* yq) {
+    index_t positions = shape.out_h() * shape.out_w();
+    index_t row_size = shape.channel * shape.kernel_h * shape.kernel_w;
+    index_t group_size = row_size / groups, group_oc = out_channels / groups;
+    auto col = Alloc::unique_allocate<int8_t>((size_t)positions * row_size);
+    // Output (pos, j) of a group goes to channel j of the image, so y is
+    // written as [out_channels, out_h * out_w] with no transpose.
+    for(index_t b = 0; b < shape.batch; ++b) {
+        im2col_s8(shape, x + (size_t)b * shape.channel * shape.height * shape.width,
+                  col.get());
+        for(index_t g = 0; g < groups; ++g) {
+            Int8Epilogue group_epilogue = epilogue;
+            if(epilogue.bias != nullptr)
+                group_epilogue.bias = epilogue.bias + g * group_oc;
+            size_t offset = ((size_t)b * out_channels + g * group_oc) * positions;
+            int8_gemm(positions, group_size, group_oc,
+                      col.get() + g * group_size, row_size, x_scale,
+                      w + (size_t)g * group_oc * group_size, group_size,
+                      w_scales + g * group_oc, group_epilogue,
+                      y == nullptr ? nullptr : y + offset,
+                      yq == nullptr ? nullptr : yq + offset, 1, positions);
+        }
+    }
+}
+
+}  // namespace kernel
+}  // namespace st
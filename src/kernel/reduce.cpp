@@ -0,0 +1,111 @@
+#include <vector>
+
+#include "kernel/reduce.hpp"
+#include "kernel/vector.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+struct Dim {
+    index_t size;
+    index_t src_stride;
+    index_t dst_stride;
+};
+
+// Elements of a kept innermost dim summed by one task.
+constexpr index_t block = 256;
+
+}  // namespace
+
+void sum_broadcast(index_t ndim, const index_t* shape,
+                   const data_t* src, const index_t* src_stride,
+                   data_t* dst, const index_t* dst_stride) {
+    // Dims of size 1 are dropped, and a dim is merged into the next one
+    // when both src and dst walk them as a single dim.
+    std::vector<Dim> dims;
+    for(index_t i = 0; i < ndim; ++i) {
+        if(shape[i] == 1) continue;
+        Dim dim{shape[i], src_stride[i], dst_stride[i]};
+        if(!dims.empty() && dims.back().src_stride == dim.size * dim.src_stride
+                && dims.back().dst_stride == dim.size * dim.dst_stride) {
+            dim.size *= dims.back().size;
+            dims.pop_back();
+        }
+        dims.push_back(dim);
+    }
+    if(dims.empty()) {
+        *dst += *src;
+        return;
+    }
+
+    Dim inner = dims.back();
+    dims.pop_back();
+    std::vector<Dim> kept, reduced;
+    index_t n_kept = 1, n_reduced = 1;
+    for(const Dim& dim : dims) {
+        if(dim.dst_stride == 0) {
+            reduced.push_back(dim);
+            n_reduced *= dim.size;
+        } else {
+            kept.push_back(dim);
+            n_kept *= dim.size;
+        }
+    }
+
+    // A task is an element of dst when the innermost dim is reduced, or a
+    // block of a row of dst when it is kept, so no two tasks write the same
+    // element.
+    bool inner_kept = inner.dst_stride != 0;
+    index_t n_blocks = inner_kept ? (inner.size + block - 1) / block : 1;
+    index_t task_size = n_reduced * (inner_kept && inner.size > block ? block : inner.size);
+    index_t grain = (1u << 15) / task_size + 1;
+    parallel::parallel_for(0, n_kept * n_blocks, grain, [&](index_t begin, index_t end) {
+        data_t acc[block];
+        std::vector<index_t> counter(reduced.size(), 0);
+        for(index_t task = begin; task < end; ++task) {
+            index_t k = task / n_blocks, start = task % n_blocks * block;
+            const data_t* src_ptr = src + start * inner.src_stride;
+            data_t* dst_ptr = dst + start * inner.dst_stride;
+            for(index_t i = kept.size(); i-- > 0; ) {
+                index_t idx = k % kept[i].size;
+                k /= kept[i].size;
+                src_ptr += idx * kept[i].src_stride;
+                dst_ptr += idx * kept[i].dst_stride;
+            }
+            index_t len = inner.size;
+            if(inner_kept)
+                len = inner.size - start < block ? inner.size - start : block;
+
+            data_t total = 0;
+            if(inner_kept)
+                for(index_t j = 0; j < len; ++j) acc[j] = 0;
+            // odometer over the reduced dims
+            for(index_t r = 0; r < n_reduced; ++r) {
+                if(inner_kept)
+                    axpy(len, 1, src_ptr, inner.src_stride, acc);
+                else
+                    total += sum(len, src_ptr, inner.src_stride);
+                for(index_t i = reduced.size(); i-- > 0; ) {
+                    src_ptr += reduced[i].src_stride;
+                    if(++counter[i] < reduced[i].size) break;
+                    src_ptr -= reduced[i].size * reduced[i].src_stride;
+                    counter[i] = 0;
+                }
+            }
+            if(inner_kept && inner.dst_stride == 1) {
+                axpy(len, 1, acc, dst_ptr);
+            } else if(inner_kept) {
+                for(index_t j = 0; j < len; ++j)
+                    dst_ptr[j * inner.dst_stride] += acc[j];
+            } else {
+                *dst_ptr += total;
+            }
+        }
+    });
+}
+
+}  // namespace kernel
+}  // namespace st
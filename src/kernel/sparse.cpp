@@ -0,0 +1,200 @@
+#include <cstring>
+
+#include "kernel/sparse.hpp"
+#include "kernel/vector.hpp"
+#include "utils/exception.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+inline data_t activate(data_t value, Activation act) {
+    if(act == Activation::relu)
+        return value < 0 ? 0 : value;
+    return value;
+}
+
+// Samples per chunk of parallel_for, so that a chunk does about 2^15
+// multiply-adds.
+index_t sample_grain(const SparsePattern& pattern) {
+    index_t nnz = pattern.nnz() == 0 ? 1 : pattern.nnz();
+    index_t grain = (1u << 15) / nnz;
+    return grain < 4 ? 4 : grain;
+}
+
+}  // namespace
+
+SparsePattern sparse_pattern(index_t rows, index_t cols,
+                             index_t block_h, index_t block_w,
+                             const data_t* dense) {
+    CHECK_TRUE(block_h > 0 && block_w > 0 && rows % block_h == 0 && cols % block_w == 0,
+        "Blocks of %dx%d don't tile a [%d, %d] matrix.", block_h, block_w, rows, cols);
+    SparsePattern pattern;
+    pattern.rows = rows;
+    pattern.cols = cols;
+    pattern.block_h = block_h;
+    pattern.block_w = block_w;
+    pattern.row_ptr.push_back(0);
+    for(index_t br = 0; br < rows / block_h; ++br) {
+        for(index_t bc = 0; bc < cols / block_w; ++bc) {
+            bool nonzero = false;
+            for(index_t r = 0; r < block_h && !nonzero; ++r) {
+                const data_t* row = dense + (br * block_h + r) * cols + bc * block_w;
+                for(index_t c = 0; c < block_w && !nonzero; ++c)
+                    nonzero = row[c] != 0;
+            }
+            if(nonzero) pattern.col_idx.push_back(bc);
+        }
+        pattern.row_ptr.push_back(pattern.col_idx.size());
+    }
+    return pattern;
+}
+
+void sparse_gather(const SparsePattern& pattern, const data_t* dense,
+                   data_t* values) {
+    index_t bh = pattern.block_h, bw = pattern.block_w;
+    for(index_t br = 0; br + 1 < pattern.row_ptr.size(); ++br)
+        for(index_t p = pattern.row_ptr[br]; p < pattern.row_ptr[br + 1]; ++p)
+            for(index_t r = 0; r < bh; ++r)
+                std::memcpy(values + (p * bh + r) * bw,
+                            dense + (br * bh + r) * pattern.cols + pattern.col_idx[p] * bw,
+                            bw * sizeof(data_t));
+}
+
+void sparse_scatter(const SparsePattern& pattern, const data_t* values,
+                    data_t* dense) {
+    index_t bh = pattern.block_h, bw = pattern.block_w;
+    std::memset(dense, 0, pattern.rows * pattern.cols * sizeof(data_t));
+    for(index_t br = 0; br + 1 < pattern.row_ptr.size(); ++br)
+        for(index_t p = pattern.row_ptr[br]; p < pattern.row_ptr[br + 1]; ++p)
+            for(index_t r = 0; r < bh; ++r)
+                std::memcpy(dense + (br * bh + r) * pattern.cols + pattern.col_idx[p] * bw,
+                            values + (p * bh + r) * bw,
+                            bw * sizeof(data_t));
+}
+
+void sparse_linear_forward(index_t n, const SparsePattern& pattern,
+                           const data_t* values, const data_t* x,
+                           const data_t* b, data_t* y, Activation act) {
+    index_t k = pattern.cols, m = pattern.rows;
+    index_t bh = pattern.block_h, bw = pattern.block_w;
+    const index_t* row_ptr = pattern.row_ptr.data();
+    const index_t* col_idx = pattern.col_idx.data();
+    // Four rows of x share every load of a stored value and of its column,
+    // as in linear_forward. The chunks start at multiples of 4.
+    parallel::parallel_for(0, (n + 3) / 4, sample_grain(pattern) / 4,
+            [&](index_t begin, index_t end) {
+        index_t i = begin * 4, last = end * 4 < n ? end * 4 : n;
+        for(; i + 4 <= last; i += 4) {
+            const data_t* x0 = x + i * k;
+            const data_t* x1 = x0 + k;
+            const data_t* x2 = x1 + k;
+            const data_t* x3 = x2 + k;
+            for(index_t j = 0; j < m; ++j) {
+                index_t br = j / bh, r = j % bh;
+                data_t bias = b == nullptr ? 0 : b[j];
+                data_t acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+                for(index_t p = row_ptr[br]; p < row_ptr[br + 1]; ++p) {
+                    const data_t* v = values + (p * bh + r) * bw;
+                    index_t col = col_idx[p] * bw;
+                    for(index_t c = 0; c < bw; ++c) {
+                        data_t wv = v[c];
+                        acc0 += x0[col + c] * wv;
+                        acc1 += x1[col + c] * wv;
+                        acc2 += x2[col + c] * wv;
+                        acc3 += x3[col + c] * wv;
+                    }
+                }
+                y[i * m + j] = activate(acc0, act);
+                y[(i + 1) * m + j] = activate(acc1, act);
+                y[(i + 2) * m + j] = activate(acc2, act);
+                y[(i + 3) * m + j] = activate(acc3, act);
+            }
+        }
+        for(; i < last; ++i) {
+            const data_t* xi = x + i * k;
+            for(index_t j = 0; j < m; ++j) {
+                index_t br = j / bh, r = j % bh;
+                data_t acc = b == nullptr ? 0 : b[j];
+                for(index_t p = row_ptr[br]; p < row_ptr[br + 1]; ++p) {
+                    const data_t* v = values + (p * bh + r) * bw;
+                    const data_t* xc = xi + col_idx[p] * bw;
+                    for(index_t c = 0; c < bw; ++c)
+                        acc += xc[c] * v[c];
+                }
+                y[i * m + j] = activate(acc, act);
+            }
+        }
+    });
+}
+
+void sparse_linear_backward(index_t n, const SparsePattern& pattern,
+                            const data_t* values, const data_t* x,
+                            const data_t* y, data_t* dy, data_t* dx,
+                            data_t* dvalues, data_t* db, Activation act) {
+    index_t k = pattern.cols, m = pattern.rows;
+    index_t bh = pattern.block_h, bw = pattern.block_w;
+    const index_t* row_ptr = pattern.row_ptr.data();
+    const index_t* col_idx = pattern.col_idx.data();
+
+    if(act == Activation::relu)
+        relu_mask(n * m, y, dy);
+
+    if(db != nullptr) {
+        std::memset(db, 0, m * sizeof(data_t));
+        for(index_t i = 0; i < n; ++i)
+            axpy(m, 1, dy + i * m, db);
+    }
+
+    // Each row of blocks owns its values, so the rows of blocks are split
+    // among the threads. The dense dw is never formed, only the grads of the
+    // stored values, each one the dot of a column of dy and a column of x.
+    if(dvalues != nullptr) {
+        index_t block_rows = m / bh;
+        parallel::parallel_for(0, block_rows, 1, [&](index_t begin, index_t end) {
+            std::memset(dvalues + row_ptr[begin] * bh * bw, 0,
+                        (row_ptr[end] - row_ptr[begin]) * bh * bw * sizeof(data_t));
+            for(index_t i = 0; i < n; ++i) {
+                const data_t* xi = x + i * k;
+                const data_t* dyi = dy + i * m;
+                for(index_t br = begin; br < end; ++br)
+                    for(index_t r = 0; r < bh; ++r) {
+                        data_t g = dyi[br * bh + r];
+                        if(g == 0) continue;
+                        for(index_t p = row_ptr[br]; p < row_ptr[br + 1]; ++p) {
+                            const data_t* xc = xi + col_idx[p] * bw;
+                            data_t* dv = dvalues + (p * bh + r) * bw;
+                            for(index_t c = 0; c < bw; ++c)
+                                dv[c] += g * xc[c];
+                        }
+                    }
+            }
+        });
+    }
+
+    if(dx != nullptr) {
+        parallel::parallel_for(0, n, sample_grain(pattern), [&](index_t begin, index_t end) {
+            std::memset(dx + begin * k, 0, (end - begin) * k * sizeof(data_t));
+            for(index_t i = begin; i < end; ++i) {
+                const data_t* dyi = dy + i * m;
+                data_t* dxi = dx + i * k;
+                for(index_t j = 0; j < m; ++j) {
+                    data_t g = dyi[j];
+                    if(g == 0) continue;
+                    index_t br = j / bh, r = j % bh;
+                    for(index_t p = row_ptr[br]; p < row_ptr[br + 1]; ++p) {
+                        const data_t* v = values + (p * bh + r) * bw;
+                        data_t* dxc = dxi + col_idx[p] * bw;
+                        for(index_t c = 0; c < bw; ++c)
+                            dxc[c] += g * v[c];
+                    }
+                }
+            }
+        });
+    }
+}
+
+}  // namespace kernel
+}  // namespace st
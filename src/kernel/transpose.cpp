@@ -0,0 +1,179 @@
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel/transpose.hpp"
+#include "kernel/vector.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Dims of the odometer of strided_copy.
+constexpr index_t max_copy_dims = 16;
+
+constexpr index_t tile = 32;
+
+template<bool accumulate>
+inline void store(data_t* dst, data_t value) {
+    if(accumulate) *dst += value;
+    else *dst = value;
+}
+
+template<bool accumulate>
+inline void transpose_4x4(const data_t* src, index_t lds, data_t* dst, index_t ldd) {
+#ifdef __SSE2__
+    for(index_t r = 0; r < 4; r += 2)
+        for(index_t c = 0; c < 4; c += 2) {
+            __m128d row0 = _mm_loadu_pd(src + r * lds + c);
+            __m128d row1 = _mm_loadu_pd(src + (r + 1) * lds + c);
+            __m128d col0 = _mm_unpacklo_pd(row0, row1);
+            __m128d col1 = _mm_unpackhi_pd(row0, row1);
+            data_t* dst0 = dst + c * ldd + r;
+            data_t* dst1 = dst0 + ldd;
+            if(accumulate) {
+                col0 = _mm_add_pd(col0, _mm_loadu_pd(dst0));
+                col1 = _mm_add_pd(col1, _mm_loadu_pd(dst1));
+            }
+            _mm_storeu_pd(dst0, col0);
+            _mm_storeu_pd(dst1, col1);
+        }
+#else
+    for(index_t r = 0; r < 4; ++r)
+        for(index_t c = 0; c < 4; ++c)
+            store<accumulate>(dst + c * ldd + r, src[r * lds + c]);
+#endif
+}
+
+template<bool accumulate>
+void transpose_tiled(index_t rows, index_t cols, const data_t* src, index_t lds,
+                     data_t* dst, index_t ldd) {
+    for(index_t i0 = 0; i0 < rows; i0 += tile) {
+        index_t i1 = i0 + tile < rows ? i0 + tile : rows;
+        for(index_t j0 = 0; j0 < cols; j0 += tile) {
+            index_t j1 = j0 + tile < cols ? j0 + tile : cols;
+
+            index_t i = i0;
+            for(; i + 4 <= i1; i += 4) {
+                index_t j = j0;
+                for(; j + 4 <= j1; j += 4)
+                    transpose_4x4<accumulate>(src + i * lds + j, lds, 
+                                              dst + j * ldd + i, ldd);
+                for(; j < j1; ++j)
+                    for(index_t r = i; r < i + 4; ++r)
+                        store<accumulate>(dst + j * ldd + r, src[r * lds + j]);
+            }
+            for(; i < i1; ++i)
+                for(index_t j = j0; j < j1; ++j)
+                    store<accumulate>(dst + j * ldd + i, src[i * lds + j]);
+        }
+    }
+}
+
+// Tiled copy over dims a (unit-strided in dst) and b (unit-strided in src).
+template<bool accumulate>
+void copy_2d(index_t size_a, index_t size_b, 
+             const data_t* src, index_t src_a, index_t src_b,
+             data_t* dst, index_t dst_a, index_t dst_b) {
+    if(dst_a == 1 && src_b == 1) {
+        transpose_tiled<accumulate>(size_a, size_b, src, src_a, dst, dst_b);
+        return;
+    }
+    for(index_t a0 = 0; a0 < size_a; a0 += tile) {
+        index_t a1 = a0 + tile < size_a ? a0 + tile : size_a;
+        for(index_t b0 = 0; b0 < size_b; b0 += tile) {
+            index_t b1 = b0 + tile < size_b ? b0 + tile : size_b;
+            for(index_t a = a0; a < a1; ++a)
+                for(index_t b = b0; b < b1; ++b)
+                    store<accumulate>(dst + a * dst_a + b * dst_b, 
+                                      src[a * src_a + b * src_b]);
+        }
+    }
+}
+
+template<bool accumulate>
+void copy_1d(index_t size, const data_t* src, index_t src_stride,
+             data_t* dst, index_t dst_stride) {
+    if(src_stride == 1 && dst_stride == 1) {
+        if(accumulate) axpy(size, 1, src, dst);
+        else std::memcpy(dst, src, size * sizeof(data_t));
+        return;
+    }
+    for(index_t i = 0; i < size; ++i)
+        store<accumulate>(dst + i * dst_stride, src[i * src_stride]);
+}
+
+template<bool accumulate>
+void strided_copy_impl(index_t ndim, const index_t* shape,
+                       const data_t* src, const index_t* src_stride,
+                       data_t* dst, const index_t* dst_stride) {
+    // a: the dim walked with the smallest step in dst, b: the same in src.
+    // Dims of size 1 are never walked.
+    index_t a = ndim, b = ndim;
+    for(index_t i = 0; i < ndim; ++i) {
+        if(shape[i] == 1) continue;
+        if(a == ndim || dst_stride[i] < dst_stride[a]) a = i;
+        if(src_stride[i] != 0 && (b == ndim || src_stride[i] < src_stride[b])) b = i;
+    }
+    if(a == ndim) {
+        store<accumulate>(dst, *src);
+        return;
+    }
+    if(b == ndim) b = a;
+
+    index_t outer = 1;
+    for(index_t i = 0; i < ndim; ++i)
+        if(i != a && i != b) outer *= shape[i];
+
+    // odometer over the other dims
+    index_t counter[max_copy_dims] = {0};
+    const data_t* src_ptr = src;
+    data_t* dst_ptr = dst;
+    for(index_t n = 0; n < outer; ++n) {
+        if(a == b)
+            copy_1d<accumulate>(shape[a], src_ptr, src_stride[a], 
+                                dst_ptr, dst_stride[a]);
+        else
+            copy_2d<accumulate>(shape[a], shape[b], 
+                                src_ptr, src_stride[a], src_stride[b],
+                                dst_ptr, dst_stride[a], dst_stride[b]);
+
+        for(index_t i = ndim; i-- > 0; ) {
+            if(i == a || i == b) continue;
+            if(++counter[i] < shape[i]) {
+                src_ptr += src_stride[i];
+                dst_ptr += dst_stride[i];
+                break;
+            }
+            src_ptr -= (shape[i] - 1) * src_stride[i];
+            dst_ptr -= (shape[i] - 1) * dst_stride[i];
+            counter[i] = 0;
+        }
+    }
+}
+
+}  // namespace
+
+void transpose(index_t rows, index_t cols, const data_t* src, index_t lds,
+               data_t* dst, index_t ldd) {
+    transpose_tiled<false>(rows, cols, src, lds, dst, ldd);
+}
+
+void strided_copy(index_t ndim, const index_t* shape,
+                  const data_t* src, const index_t* src_stride,
+                  data_t* dst, const index_t* dst_stride,
+                  bool accumulate) {
+    CHECK_TRUE(ndim <= max_copy_dims, 
+        "Copy of a %dD tensor, at most %d dims are supported.", ndim, max_copy_dims);
+    if(accumulate)
+        strided_copy_impl<true>(ndim, shape, src, src_stride, dst, dst_stride);
+    else
+        strided_copy_impl<false>(ndim, shape, src, src_stride, dst, dst_stride);
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,392 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel/vector.hpp"
+#include "utils/cpu.hpp"
+
+#ifdef ST_ISA_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// The variants handle whole vectors, then the remaining [i, n) goes through
+// these scalar loops.
+inline void axpy_tail(index_t i, index_t n, data_t a, const data_t* x, data_t* y) {
+    for(; i < n; ++i)
+        y[i] += a * x[i];
+}
+
+inline data_t sum_tail(index_t i, index_t n, const data_t* x, data_t result) {
+    for(; i < n; ++i)
+        result += x[i];
+    return result;
+}
+
+inline void relu_mask_tail(index_t i, index_t n, const data_t* y, data_t* dy) {
+    for(; i < n; ++i)
+        if(!(y[i] > 0)) dy[i] = 0;
+}
+
+inline void axpy_strided_tail(index_t i, index_t n, data_t a, const data_t* x,
+                              index_t incx, data_t* y) {
+    for(; i < n; ++i)
+        y[i] += a * x[i * incx];
+}
+
+inline data_t sum_strided_tail(index_t i, index_t n, const data_t* x, index_t incx,
+                               data_t result) {
+    for(; i < n; ++i)
+        result += x[i * incx];
+    return result;
+}
+
+inline void bias_act_tail(index_t i, index_t n, data_t bias, bool relu, data_t* y) {
+    for(; i < n; ++i) {
+        data_t value = y[i] + bias;
+        y[i] = relu && value < 0 ? 0 : value;
+    }
+}
+
+inline void momentum_tail(index_t i, index_t n, data_t lr, data_t momentum,
+                          const data_t* grad, data_t* velocity, data_t* param) {
+    for(; i < n; ++i) {
+        velocity[i] = momentum * velocity[i] + grad[i];
+        param[i] -= lr * velocity[i];
+    }
+}
+
+void axpy_sse2(index_t n, data_t a, const data_t* x, data_t* y) {
+    index_t i = 0;
+#ifdef __SSE2__
+    __m128d av = _mm_set1_pd(a);
+    for(; i + 2 <= n; i += 2)
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i),
+                                        _mm_mul_pd(av, _mm_loadu_pd(x + i))));
+#endif
+    axpy_tail(i, n, a, x, y);
+}
+
+data_t sum_sse2(index_t n, const data_t* x) {
+    index_t i = 0;
+    data_t result = 0;
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    for(; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+    }
+    __m128d acc = _mm_add_pd(acc0, acc1);
+    result = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+#endif
+    return sum_tail(i, n, x, result);
+}
+
+void relu_mask_sse2(index_t n, const data_t* y, data_t* dy) {
+    index_t i = 0;
+#ifdef __SSE2__
+    __m128d zero = _mm_setzero_pd();
+    for(; i + 2 <= n; i += 2) {
+        __m128d positive = _mm_cmpgt_pd(_mm_loadu_pd(y + i), zero);
+        _mm_storeu_pd(dy + i, _mm_and_pd(positive, _mm_loadu_pd(dy + i)));
+    }
+#endif
+    relu_mask_tail(i, n, y, dy);
+}
+
+void bias_act_sse2(index_t n, data_t bias, bool relu, data_t* y) {
+    index_t i = 0;
+#ifdef __SSE2__
+    __m128d bv = _mm_set1_pd(bias), zero = _mm_setzero_pd();
+    for(; i + 2 <= n; i += 2) {
+        __m128d v = _mm_add_pd(_mm_loadu_pd(y + i), bv);
+        _mm_storeu_pd(y + i, relu ? _mm_max_pd(v, zero) : v);
+    }
+#endif
+    bias_act_tail(i, n, bias, relu, y);
+}
+
+void momentum_sse2(index_t n, data_t lr, data_t momentum, const data_t* grad,
+                   data_t* velocity, data_t* param) {
+    index_t i = 0;
+#ifdef __SSE2__
+    __m128d lv = _mm_set1_pd(lr), mv = _mm_set1_pd(momentum);
+    for(; i + 2 <= n; i += 2) {
+        __m128d v = _mm_add_pd(_mm_mul_pd(mv, _mm_loadu_pd(velocity + i)),
+                               _mm_loadu_pd(grad + i));
+        _mm_storeu_pd(velocity + i, v);
+        _mm_storeu_pd(param + i, _mm_sub_pd(_mm_loadu_pd(param + i),
+                                            _mm_mul_pd(lv, v)));
+    }
+#endif
+    momentum_tail(i, n, lr, momentum, grad, velocity, param);
+}
+
+#ifdef ST_ISA_DISPATCH
+ST_TARGET_AVX2
+void axpy_avx2(index_t n, data_t a, const data_t* x, data_t* y) {
+    index_t i = 0;
+    __m256d av = _mm256_set1_pd(a);
+    for(; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(av, _mm256_loadu_pd(x + i),
+                                                _mm256_loadu_pd(y + i)));
+    axpy_tail(i, n, a, x, y);
+}
+
+ST_TARGET_AVX2
+data_t sum_avx2(index_t n, const data_t* x) {
+    index_t i = 0;
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    for(; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+    }
+    __m256d acc = _mm256_add_pd(acc0, acc1);
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    data_t result = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    return sum_tail(i, n, x, result);
+}
+
+ST_TARGET_AVX2
+void relu_mask_avx2(index_t n, const data_t* y, data_t* dy) {
+    index_t i = 0;
+    __m256d zero = _mm256_setzero_pd();
+    for(; i + 4 <= n; i += 4) {
+        __m256d positive = _mm256_cmp_pd(_mm256_loadu_pd(y + i), zero, _CMP_GT_OQ);
+        _mm256_storeu_pd(dy + i, _mm256_and_pd(positive, _mm256_loadu_pd(dy + i)));
+    }
+    relu_mask_tail(i, n, y, dy);
+}
+
+// The strided variants gather 4 or 8 elements at offsets 0, incx, ... from
+// the current one, see max_gather_stride.
+ST_TARGET_AVX2
+void axpy_strided_avx2(index_t n, data_t a, const data_t* x, index_t incx, data_t* y) {
+    index_t i = 0;
+    __m256d av = _mm256_set1_pd(a);
+    __m128i offsets = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(incx));
+    for(; i + 4 <= n; i += 4) {
+        __m256d xv = _mm256_i32gather_pd(x + i * incx, offsets, 8);
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(av, xv, _mm256_loadu_pd(y + i)));
+    }
+    axpy_strided_tail(i, n, a, x, incx, y);
+}
+
+ST_TARGET_AVX2
+data_t sum_strided_avx2(index_t n, const data_t* x, index_t incx) {
+    index_t i = 0;
+    __m256d acc = _mm256_setzero_pd();
+    __m128i offsets = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(incx));
+    for(; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_i32gather_pd(x + i * incx, offsets, 8));
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    data_t result = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    return sum_strided_tail(i, n, x, incx, result);
+}
+
+ST_TARGET_AVX2
+void bias_act_avx2(index_t n, data_t bias, bool relu, data_t* y) {
+    index_t i = 0;
+    __m256d bv = _mm256_set1_pd(bias), zero = _mm256_setzero_pd();
+    for(; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_add_pd(_mm256_loadu_pd(y + i), bv);
+        _mm256_storeu_pd(y + i, relu ? _mm256_max_pd(v, zero) : v);
+    }
+    bias_act_tail(i, n, bias, relu, y);
+}
+
+ST_TARGET_AVX2
+void momentum_avx2(index_t n, data_t lr, data_t momentum, const data_t* grad,
+                   data_t* velocity, data_t* param) {
+    index_t i = 0;
+    __m256d lv = _mm256_set1_pd(lr), mv = _mm256_set1_pd(momentum);
+    for(; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_fmadd_pd(mv, _mm256_loadu_pd(velocity + i),
+                                    _mm256_loadu_pd(grad + i));
+        _mm256_storeu_pd(velocity + i, v);
+        _mm256_storeu_pd(param + i, _mm256_fnmadd_pd(lv, v, _mm256_loadu_pd(param + i)));
+    }
+    momentum_tail(i, n, lr, momentum, grad, velocity, param);
+}
+
+ST_TARGET_AVX512
+void axpy_avx512(index_t n, data_t a, const data_t* x, data_t* y) {
+    index_t i = 0;
+    __m512d av = _mm512_set1_pd(a);
+    for(; i + 8 <= n; i += 8)
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(av, _mm512_loadu_pd(x + i),
+                                                _mm512_loadu_pd(y + i)));
+    axpy_tail(i, n, a, x, y);
+}
+
+ST_TARGET_AVX512
+data_t sum_avx512(index_t n, const data_t* x) {
+    index_t i = 0;
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    for(; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_pd(acc0, _mm512_loadu_pd(x + i));
+        acc1 = _mm512_add_pd(acc1, _mm512_loadu_pd(x + i + 8));
+    }
+    data_t result = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    return sum_tail(i, n, x, result);
+}
+
+ST_TARGET_AVX512
+void relu_mask_avx512(index_t n, const data_t* y, data_t* dy) {
+    index_t i = 0;
+    __m512d zero = _mm512_setzero_pd();
+    for(; i + 8 <= n; i += 8) {
+        __mmask8 positive = _mm512_cmp_pd_mask(_mm512_loadu_pd(y + i), zero, _CMP_GT_OQ);
+        _mm512_storeu_pd(dy + i, _mm512_maskz_mov_pd(positive, _mm512_loadu_pd(dy + i)));
+    }
+    relu_mask_tail(i, n, y, dy);
+}
+
+ST_TARGET_AVX512
+void axpy_strided_avx512(index_t n, data_t a, const data_t* x, index_t incx,
+                         data_t* y) {
+    index_t i = 0;
+    __m512d av = _mm512_set1_pd(a);
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                         _mm256_set1_epi32(incx));
+    for(; i + 8 <= n; i += 8) {
+        __m512d xv = _mm512_i32gather_pd(offsets, x + i * incx, 8);
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(av, xv, _mm512_loadu_pd(y + i)));
+    }
+    axpy_strided_tail(i, n, a, x, incx, y);
+}
+
+ST_TARGET_AVX512
+data_t sum_strided_avx512(index_t n, const data_t* x, index_t incx) {
+    index_t i = 0;
+    __m512d acc = _mm512_setzero_pd();
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                         _mm256_set1_epi32(incx));
+    for(; i + 8 <= n; i += 8)
+        acc = _mm512_add_pd(acc, _mm512_i32gather_pd(offsets, x + i * incx, 8));
+    return sum_strided_tail(i, n, x, incx, _mm512_reduce_add_pd(acc));
+}
+
+ST_TARGET_AVX512
+void bias_act_avx512(index_t n, data_t bias, bool relu, data_t* y) {
+    index_t i = 0;
+    __m512d bv = _mm512_set1_pd(bias), zero = _mm512_setzero_pd();
+    for(; i + 8 <= n; i += 8) {
+        __m512d v = _mm512_add_pd(_mm512_loadu_pd(y + i), bv);
+        _mm512_storeu_pd(y + i, relu ? _mm512_max_pd(v, zero) : v);
+    }
+    bias_act_tail(i, n, bias, relu, y);
+}
+
+ST_TARGET_AVX512
+void momentum_avx512(index_t n, data_t lr, data_t momentum, const data_t* grad,
+                     data_t* velocity, data_t* param) {
+    index_t i = 0;
+    __m512d lv = _mm512_set1_pd(lr), mv = _mm512_set1_pd(momentum);
+    for(; i + 8 <= n; i += 8) {
+        __m512d v = _mm512_fmadd_pd(mv, _mm512_loadu_pd(velocity + i),
+                                    _mm512_loadu_pd(grad + i));
+        _mm512_storeu_pd(velocity + i, v);
+        _mm512_storeu_pd(param + i, _mm512_fnmadd_pd(lv, v, _mm512_loadu_pd(param + i)));
+    }
+    momentum_tail(i, n, lr, momentum, grad, velocity, param);
+}
+#endif
+
+// Largest stride gathered, so the offsets of a vector fit in 32 bits.
+constexpr index_t max_gather_stride = 1 << 27;
+
+}  // namespace
+
+void axpy(index_t n, data_t a, const data_t* x, data_t* y) {
+#ifdef ST_ISA_DISPATCH
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512: return axpy_avx512(n, a, x, y);
+        case cpu::Isa::avx2: return axpy_avx2(n, a, x, y);
+        default: break;
+    }
+#endif
+    axpy_sse2(n, a, x, y);
+}
+
+data_t sum(index_t n, const data_t* x) {
+#ifdef ST_ISA_DISPATCH
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512: return sum_avx512(n, x);
+        case cpu::Isa::avx2: return sum_avx2(n, x);
+        default: break;
+    }
+#endif
+    return sum_sse2(n, x);
+}
+
+void relu_mask(index_t n, const data_t* y, data_t* dy) {
+#ifdef ST_ISA_DISPATCH
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512: return relu_mask_avx512(n, y, dy);
+        case cpu::Isa::avx2: return relu_mask_avx2(n, y, dy);
+        default: break;
+    }
+#endif
+    relu_mask_sse2(n, y, dy);
+}
+
+void axpy(index_t n, data_t a, const data_t* x, index_t incx, data_t* y) {
+    if(incx == 1)
+        return axpy(n, a, x, y);
+#ifdef ST_ISA_DISPATCH
+    if(incx <= max_gather_stride)
+        switch(cpu::isa()) {
+            case cpu::Isa::avx512: return axpy_strided_avx512(n, a, x, incx, y);
+            case cpu::Isa::avx2: return axpy_strided_avx2(n, a, x, incx, y);
+            default: break;
+        }
+#endif
+    axpy_strided_tail(0, n, a, x, incx, y);
+}
+
+data_t sum(index_t n, const data_t* x, index_t incx) {
+    if(incx == 1)
+        return sum(n, x);
+#ifdef ST_ISA_DISPATCH
+    if(incx <= max_gather_stride)
+        switch(cpu::isa()) {
+            case cpu::Isa::avx512: return sum_strided_avx512(n, x, incx);
+            case cpu::Isa::avx2: return sum_strided_avx2(n, x, incx);
+            default: break;
+        }
+#endif
+    return sum_strided_tail(0, n, x, incx, 0);
+}
+
+void bias_act(index_t n, data_t bias, bool relu, data_t* y) {
+#ifdef ST_ISA_DISPATCH
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512: return bias_act_avx512(n, bias, relu, y);
+        case cpu::Isa::avx2: return bias_act_avx2(n, bias, relu, y);
+        default: break;
+    }
+#endif
+    bias_act_sse2(n, bias, relu, y);
+}
+
+void momentum_update(index_t n, data_t lr, data_t momentum, const data_t* grad,
+                     data_t* velocity, data_t* param) {
+#ifdef ST_ISA_DISPATCH
+    switch(cpu::isa()) {
+        case cpu::Isa::avx512:
+            return momentum_avx512(n, lr, momentum, grad, velocity, param);
+        case cpu::Isa::avx2:
+            return momentum_avx2(n, lr, momentum, grad, velocity, param);
+        default: break;
+    }
+#endif
+    momentum_sse2(n, lr, momentum, grad, velocity, param);
+}
+
+}  // namespace kernel
+}  // namespace st
@@ -0,0 +1,312 @@
+#include "kernel/winograd.hpp"
+#include "kernel/gemm.hpp"
+#include "utils/allocator.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace kernel {
+
+namespace {
+
+// Transforms of F(m x m, 3 x 3) from Lavin & Gray, Fast Algorithms for
+// Convolutional Neural Networks. y = A^T [(G g G^T) . (B^T d B)] A.
+struct Transform {
+    index_t m, alpha;
+    const data_t* bt;  // [alpha, alpha]
+    const data_t* g;   // [alpha, 3]
+    const data_t* at;  // [m, alpha]
+};
+
+const data_t bt2[] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1
+};
+const data_t g2[] = {
+    1,    0,   0,
+    0.5,  0.5, 0.5,
+    0.5, -0.5, 0.5,
+    0,    0,   1
+};
+const data_t at2[] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1
+};
+
+const data_t bt4[] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1
+};
+const data_t g4[] = {
+     1. / 4,        0,       0,
+    -1. / 6,  -1. / 6, -1. / 6,
+    -1. / 6,   1. / 6, -1. / 6,
+     1. / 24,  1. / 12, 1. / 6,
+     1. / 24, -1. / 12, 1. / 6,
+     0,        0,       1
+};
+const data_t at4[] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1
+};
+
+constexpr index_t max_alpha = 6;
+
+Transform transform(index_t m) {
+    if(m == 2)
+        return Transform{2, 4, bt2, g2, at2};
+    return Transform{4, 6, bt4, g4, at4};
+}
+
+// out = l * in * l^T, with l: [rows, cols] addressed by its row and column
+// strides, so a transposed matrix is passed by swapping them. in is
+// [cols, cols] with leading dimension ldi and out a contiguous [rows, rows].
+// The zeros of the transforms are skipped.
+void sandwich(const data_t* l, index_t l_rs, index_t l_cs,
+              index_t rows, index_t cols,
+              const data_t* in, index_t ldi, data_t* out) {
+    data_t tmp[max_alpha * max_alpha] = {};
+    for(index_t r = 0; r < rows; ++r)
+        for(index_t k = 0; k < cols; ++k) {
+            data_t lv = l[r * l_rs + k * l_cs];
+            if(lv == 0) continue;
+            for(index_t j = 0; j < cols; ++j)
+                tmp[r * cols + j] += lv * in[k * ldi + j];
+        }
+    for(index_t i = 0; i < rows * rows; ++i)
+        out[i] = 0;
+    for(index_t q = 0; q < rows; ++q)
+        for(index_t k = 0; k < cols; ++k) {
+            data_t lv = l[q * l_rs + k * l_cs];
+            if(lv == 0) continue;
+            for(index_t r = 0; r < rows; ++r)
+                out[r * rows + q] += tmp[r * cols + k] * lv;
+        }
+}
+
+// Output tiles of m x m, tiles_h by tiles_w for each image. The tile
+// (b, i, j) is the column (b * tiles_h + i) * tiles_w + j of the products.
+struct Tiling {
+    index_t tiles_h, tiles_w, count;
+
+    Tiling(const Conv2dShape& shape, index_t m)
+            : tiles_h((shape.out_h() + m - 1) / m),
+              tiles_w((shape.out_w() + m - 1) / m),
+              count(shape.batch * tiles_h * tiles_w) {}
+};
+
+// v[xi][c][p] = (B^T d B)[xi] of the input tile d of each channel c and
+// tile p. The padding and whatever lies past the image are zeros.
+void input_transform(const Conv2dShape& shape, const Transform& t,
+                     const Tiling& tiling, const data_t* x,
+                     const index_t* x_stride, data_t* v) {
+    index_t alpha = t.alpha, a2 = alpha * alpha;
+    parallel::parallel_for(0, shape.batch * shape.channel, 1,
+            [&](index_t begin, index_t end) {
+        data_t d[max_alpha * max_alpha], out[max_alpha * max_alpha];
+        for(index_t bc = begin; bc < end; ++bc) {
+            index_t b = bc / shape.channel, c = bc % shape.channel;
+            const data_t* x_c = x + b * x_stride[0] + c * x_stride[1];
+            for(index_t ti = 0; ti < tiling.tiles_h; ++ti)
+                for(index_t tj = 0; tj < tiling.tiles_w; ++tj) {
+                    long long h0 = (long long)(ti * t.m) - shape.padding_h;
+                    long long w0 = (long long)(tj * t.m) - shape.padding_w;
+                    for(index_t r = 0; r < alpha; ++r) {
+                        long long h = h0 + r;
+                        bool row_in = h >= 0 && h < shape.height;
+                        for(index_t q = 0; q < alpha; ++q) {
+                            long long w = w0 + q;
+                            d[r * alpha + q] = row_in && w >= 0 && w < shape.width
+                                ? x_c[h * x_stride[2] + w * x_stride[3]] : 0;
+                        }
+                    }
+                    sandwich(t.bt, alpha, 1, alpha, alpha, d, alpha, out);
+                    size_t p = (b * tiling.tiles_h + ti) * tiling.tiles_w + tj;
+                    for(index_t xi = 0; xi < a2; ++xi)
+                        v[((size_t)xi * shape.channel + c) * tiling.count + p] = out[xi];
+                }
+        }
+    });
+}
+
+}  // namespace
+
+bool winograd_eligible(const Conv2dShape& shape) {
+    return shape.kernel_h == 3 && shape.kernel_w == 3
+        && shape.stride_h == 1 && shape.stride_w == 1;
+}
+
+index_t winograd_tile(const Conv2dShape& shape) {
+    return shape.out_h() >= 8 && shape.out_w() >= 8 ? 4 : 2;
+}
+
+index_t winograd_filter_size(index_t m, index_t out_channels, index_t channel) {
+    return (m + 2) * (m + 2) * out_channels * channel;
+}
+
+void winograd_filter(index_t m, index_t out_channels, index_t channel,
+                     const data_t* w, const index_t* w_stride, data_t* u) {
+    Transform t = transform(m);
+    index_t a2 = t.alpha * t.alpha;
+    parallel::parallel_for(0, out_channels, 1, [&](index_t begin, index_t end) {
+        data_t g[9], out[max_alpha * max_alpha];
+        for(index_t o = begin; o < end; ++o)
+            for(index_t c = 0; c < channel; ++c) {
+                for(index_t k = 0; k < 9; ++k)
+                    g[k] = w[o * w_stride[0] + (c * 9 + k) * w_stride[1]];
+                sandwich(t.g, 3, 1, t.alpha, 3, g, 3, out);
+                for(index_t xi = 0; xi < a2; ++xi)
+                    u[((size_t)xi * out_channels + o) * channel + c] = out[xi];
+            }
+    });
+}
+
+void winograd_forward(const Conv2dShape& shape, index_t m, index_t out_channels,
+                      const data_t* x, const index_t* x_stride,
+                      const data_t* u, data_t* y,
+                      const Conv2dEpilogue* epilogue) {
+    Transform t = transform(m);
+    Tiling tiling(shape, m);
+    index_t a2 = t.alpha * t.alpha, n = tiling.count;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    auto v = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * shape.channel * n);
+    auto prod = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * out_channels * n);
+
+    input_transform(shape, t, tiling, x, x_stride, v.get());
+    batch_gemm(a2, out_channels, n, shape.channel,
+               u, out_channels * shape.channel, shape.channel, 1,
+               v.get(), shape.channel * n, n, 1,
+               prod.get(), out_channels * n, n);
+
+    // y = A^T prod A, cropped at the right and bottom edges. A pooled plane
+    // is transformed into scratch first.
+    bool pool = epilogue && epilogue->pool;
+    parallel::parallel_for(0, shape.batch * out_channels, 1,
+            [&](index_t begin, index_t end) {
+        data_t in[max_alpha * max_alpha], out[max_alpha * max_alpha];
+        Alloc::TrivialUniquePtr<data_t> scratch(nullptr, 0);
+        if(pool)
+            scratch = Alloc::unique_allocate<data_t>(sizeof(data_t) * oh * ow);
+        for(index_t bo = begin; bo < end; ++bo) {
+            index_t b = bo / out_channels, o = bo % out_channels;
+            data_t* y_o = pool ? scratch.get() : y + (size_t)bo * oh * ow;
+            for(index_t ti = 0; ti < tiling.tiles_h; ++ti)
+                for(index_t tj = 0; tj < tiling.tiles_w; ++tj) {
+                    size_t p = (b * tiling.tiles_h + ti) * tiling.tiles_w + tj;
+                    for(index_t xi = 0; xi < a2; ++xi)
+                        in[xi] = prod.get()[((size_t)xi * out_channels + o) * n + p];
+                    sandwich(t.at, t.alpha, 1, m, t.alpha, in, t.alpha, out);
+                    for(index_t r = 0; r < m && ti * m + r < oh; ++r)
+                        for(index_t q = 0; q < m && tj * m + q < ow; ++q)
+                            y_o[(ti * m + r) * ow + tj * m + q] = out[r * m + q];
+                }
+            if(epilogue)
+                conv2d_epilogue_plane(shape, out_channels, *epilogue, bo, y_o, y);
+        }
+    });
+}
+
+void winograd_backward(const Conv2dShape& shape, index_t m, index_t out_channels,
+                       const data_t* x, const index_t* x_stride,
+                       const data_t* u, const data_t* dy,
+                       data_t* dx, data_t* dw) {
+    Transform t = transform(m);
+    Tiling tiling(shape, m);
+    index_t alpha = t.alpha, a2 = alpha * alpha, n = tiling.count;
+    index_t oh = shape.out_h(), ow = shape.out_w();
+    index_t channel = shape.channel;
+
+    // dprod = A dy A^T, with zeros past the edges of dy.
+    auto dprod = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * out_channels * n);
+    parallel::parallel_for(0, shape.batch * out_channels, 1,
+            [&](index_t begin, index_t end) {
+        data_t in[max_alpha * max_alpha], out[max_alpha * max_alpha];
+        for(index_t bo = begin; bo < end; ++bo) {
+            index_t b = bo / out_channels, o = bo % out_channels;
+            const data_t* dy_o = dy + (size_t)bo * oh * ow;
+            for(index_t ti = 0; ti < tiling.tiles_h; ++ti)
+                for(index_t tj = 0; tj < tiling.tiles_w; ++tj) {
+                    for(index_t r = 0; r < m; ++r)
+                        for(index_t q = 0; q < m; ++q) {
+                            index_t h = ti * m + r, w = tj * m + q;
+                            in[r * m + q] = h < oh && w < ow ? dy_o[h * ow + w] : 0;
+                        }
+                    sandwich(t.at, 1, alpha, alpha, m, in, m, out);
+                    size_t p = (b * tiling.tiles_h + ti) * tiling.tiles_w + tj;
+                    for(index_t xi = 0; xi < a2; ++xi)
+                        dprod.get()[((size_t)xi * out_channels + o) * n + p] = out[xi];
+                }
+        }
+    });
+
+    if(dx != nullptr) {
+        // dv = u^T dprod, then dx = B dv B^T summed over the overlapping
+        // tiles of a padded plane, which is cropped.
+        auto dv = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * channel * n);
+        batch_gemm(a2, channel, n, out_channels,
+                   u, out_channels * channel, 1, channel,
+                   dprod.get(), out_channels * n, n, 1,
+                   dv.get(), channel * n, n);
+
+        index_t plane_h = tiling.tiles_h * m + 2, plane_w = tiling.tiles_w * m + 2;
+        parallel::parallel_for(0, shape.batch * channel, 1,
+                [&](index_t begin, index_t end) {
+            auto plane = Alloc::unique_allocate<data_t>(sizeof(data_t) * plane_h * plane_w);
+            data_t in[max_alpha * max_alpha], out[max_alpha * max_alpha];
+            for(index_t bc = begin; bc < end; ++bc) {
+                index_t b = bc / channel, c = bc % channel;
+                for(index_t i = 0; i < plane_h * plane_w; ++i)
+                    plane.get()[i] = 0;
+                for(index_t ti = 0; ti < tiling.tiles_h; ++ti)
+                    for(index_t tj = 0; tj < tiling.tiles_w; ++tj) {
+                        size_t p = (b * tiling.tiles_h + ti) * tiling.tiles_w + tj;
+                        for(index_t xi = 0; xi < a2; ++xi)
+                            in[xi] = dv.get()[((size_t)xi * channel + c) * n + p];
+                        sandwich(t.bt, 1, alpha, alpha, alpha, in, alpha, out);
+                        data_t* dst = plane.get() + ti * m * plane_w + tj * m;
+                        for(index_t r = 0; r < alpha; ++r)
+                            for(index_t q = 0; q < alpha; ++q)
+                                dst[r * plane_w + q] += out[r * alpha + q];
+                    }
+                data_t* dx_c = dx + (size_t)bc * shape.height * shape.width;
+                for(index_t h = 0; h < shape.height; ++h)
+                    for(index_t w = 0; w < shape.width; ++w)
+                        dx_c[h * shape.width + w] = plane.get()[
+                            (h + shape.padding_h) * plane_w + w + shape.padding_w];
+            }
+        });
+    }
+
+    if(dw != nullptr) {
+        // du = dprod v^T, then dw = G^T du G.
+        auto v = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * channel * n);
+        auto du = Alloc::unique_allocate<data_t>(sizeof(data_t) * a2 * out_channels * channel);
+        input_transform(shape, t, tiling, x, x_stride, v.get());
+        batch_gemm(a2, out_channels, channel, n,
+                   dprod.get(), out_channels * n, n, 1,
+                   v.get(), channel * n, 1, n,
+                   du.get(), out_channels * channel, channel);
+
+        parallel::parallel_for(0, out_channels, 1, [&](index_t begin, index_t end) {
+            data_t in[max_alpha * max_alpha], out[9];
+            for(index_t o = begin; o < end; ++o)
+                for(index_t c = 0; c < channel; ++c) {
+                    for(index_t xi = 0; xi < a2; ++xi)
+                        in[xi] = du.get()[((size_t)xi * out_channels + o) * channel + c];
+                    sandwich(t.g, 1, 3, 3, alpha, in, alpha, out);
+                    for(index_t k = 0; k < 9; ++k)
+                        dw[(o * channel + c) * 9 + k] = out[k];
+                }
+        });
+    }
+}
+
+}  // namespace kernel
+}  // namespace st
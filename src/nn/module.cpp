@@ -3,73 +3,212 @@
 #include "exp/function.hpp"
 #include "nn/module.hpp"
 #include "nn/init.hpp"
+#include "kernel/conv.hpp"
+#include "kernel/quant.hpp"
 
 namespace st {
 namespace nn {
 Linear::Linear(index_t in_features, index_t out_features)
-        : weight_(Shape{out_features, in_features}, true),
+        : weight_(new Tensor(Shape{out_features, in_features}, true)),
           bias_(Shape{ 1, out_features}, true) {
-    KaimingInitializer weight_init(weight_);
+    KaimingInitializer weight_init(*weight_);
     weight_init.init();
 
-    index_t fan_in = weight_.size(1);
+    index_t fan_in = weight_->size(1);
     data_t bound = 1. / std::sqrt(fan_in);
     UniformInitializer bias_init(bias_);
     bias_init.init();
 }
 
 Tensor Linear::forward(const Tensor& x) {
-    Tensor y1 = op::matrix_mul(
-        x, op::matrix_transpose(weight_)
-    );
-    Tensor y2 = y1 + bias_;
-    return y2;
+    quantizer_.observe(x);
+    if(quantized())
+        return int8_forward(x);
+    if(sparse_weight_) {
+        Tensor y = op::sparse_linear(x, *sparse_weight_, bias_);
+        return y;
+    }
+    Tensor y = op::linear(x, *weight_, bias_);
+    return y;
 }
 
 ParamsDict Linear::parameters(void) {
-    return {
-        {"weight", weight_},
-        {"bias", bias_}
-    };
+    if(sparse_weight_)
+        return {{"weight", sparse_weight_->values()}, {"bias", bias_}};
+    if(!weight_)
+        return {{"bias", bias_}};
+    return {{"weight", *weight_}, {"bias", bias_}};
+}
+
+void Linear::sparsify(index_t block_h, index_t block_w) {
+    CHECK_TRUE(weight_ || sparse_weight_, 
+        "The weight was dropped by quantize(), dequantize() it first.");
+    Tensor weight = sparse_weight_ ? sparse_weight_->to_dense() : *weight_;
+    sparse_weight_.reset(new SparseTensor(weight, block_h, block_w, true));
+    weight_.reset();
+}
+
+void Linear::quantize(bool keep_weight) {
+    CHECK_TRUE(weight_ || sparse_weight_, 
+        "The weight was dropped by quantize(), dequantize() it first.");
+    quantizer_.quantize(sparse_weight_ ? sparse_weight_->to_dense() : *weight_);
+    if(keep_weight)
+        return;
+    weight_.reset();
+    sparse_weight_.reset();
+}
+
+void Linear::dequantize(void) {
+    if(!weight_ && !sparse_weight_ && quantized())
+        weight_.reset(new Tensor(quantizer_.dequantized_weight()));
+    quantizer_.dequantize();
+}
+
+Int8Tensor Linear::quantize_input(const Tensor& x) const {
+    return quantizer_.quantize_input(x);
+}
+
+Int8Tensor Linear::forward_int8(const Int8Tensor& x, data_t y_scale) const {
+    CHECK_TRUE(quantized() && y_scale > 0, 
+        "Int8 forward of a layer which isn't quantized, or to a scale of %f.", y_scale);
+    index_t n = x.shape.ndim() > 0 ? x.shape[0] : 0;
+    Int8Tensor y{Shape{n, quantizer_.rows()}, y_scale, {}};
+    y.data.resize(y.shape.dsize());
+    int8_forward(x.shape, x.data.data(), x.scale, y_scale, nullptr, y.data.data());
+    return y;
+}
+
+Tensor Linear::forward_int8(const Int8Tensor& x) const {
+    CHECK_TRUE(quantized(), "Int8 forward of a layer which isn't quantized.");
+    index_t n = x.shape.ndim() > 0 ? x.shape[0] : 0;
+    Tensor y(Shape{n, quantizer_.rows()});
+    int8_forward(x.shape, x.data.data(), x.scale, 1,
+                 const_cast<TensorImpl&>(y.impl()).data(), nullptr);
+    return y;
+}
+
+Tensor Linear::int8_forward(const Tensor& x) {
+    const int8_t* xq = quantizer_.buffered_input(x);
+    Tensor y(Shape{x.size(0), quantizer_.rows()});
+    int8_forward(x.size(), xq, quantizer_.input_scale(), 1,
+                 const_cast<TensorImpl&>(y.impl()).data(), nullptr);
+    return y;
+}
+
+void Linear::int8_forward(const Shape& x_shape, const int8_t* x, data_t x_scale,
+                          data_t y_scale, data_t* y, int8_t* yq) const {
+    index_t k = quantizer_.cols(), m = quantizer_.rows();
+    CHECK_TRUE(x_shape.ndim() == 2 && x_shape[1] == k, 
+        "Input of %d features expected, got %dD Tensor.", k, x_shape.ndim());
+    Tensor bias = bias_.contiguous();
+    kernel::Int8Epilogue epilogue{bias.impl().data(), activation_, y_scale};
+    kernel::int8_linear_forward(x_shape[0], k, m, x, x_scale,
+                                quantizer_.weight(), quantizer_.weight_scales(),
+                                epilogue, y, yq);
 }
 
 LinearWithReLU::LinearWithReLU(index_t in_features, index_t out_features)
-        : Linear(in_features, out_features)
-    {}
+        : Linear(in_features, out_features) {
+    activation_ = kernel::Activation::relu;
+}
 
 Tensor LinearWithReLU::forward(const Tensor& x) {
-    Tensor y1 = op::matrix_mul(
-        x, op::matrix_transpose(weight_)
-    );
-    Tensor y2 = op::relu(y1 + bias_);
-    return y2;
+    quantizer_.observe(x);
+    if(quantized())
+        return int8_forward(x);
+    if(sparse_weight_) {
+        Tensor y = op::sparse_linear_relu(x, *sparse_weight_, bias_);
+        return y;
+    }
+    Tensor y = op::linear_relu(x, *weight_, bias_);
+    return y;
 }
 }  // namespace nn
 }  // namespace st
 
 namespace st {
 namespace nn {
+
+namespace {
+
+// groups, checked before the initializer of the weight of a Conv2d divides
+// the channels by it.
+index_t checked_groups(index_t in_channels, index_t out_channels, index_t groups) {
+    CHECK_TRUE(groups > 0 && in_channels % groups == 0 && out_channels % groups == 0,
+        "Channels (%d) and output channels (%d) should be divisible by groups (%d).",
+        in_channels, out_channels, groups);
+    return groups;
+}
+
+}  // namespace
+
 Conv2d::Conv2d(index_t in_channels, index_t out_channels,
                const Wsize& kernel_size, const Wsize& stride,
-               const Wsize& padding)
+               const Wsize& padding, index_t groups)
         : in_channels_(in_channels), out_channels_(out_channels),
           kernel_size_(kernel_size), stride_(stride), padding_(padding),
-          weight_(Shape{
+          groups_(checked_groups(in_channels, out_channels, groups)),
+          weight_(new Tensor(Shape{
               out_channels_,
-              in_channels_ * kernel_size_.first * kernel_size_.second},
-              /*requires_grad=*/true) {
-    KaimingInitializer weight_init(weight_);
+              in_channels_ / groups_ * kernel_size_.first * kernel_size_.second},
+              /*requires_grad=*/true)),
+          bias_(Shape{out_channels_}, /*requires_grad=*/true),
+          filter_(Alloc::shared_construct<op::ConvFilter>()) {
+    KaimingInitializer weight_init(*weight_);
     weight_init.init();
+
+    index_t fan_in = weight_->size(1);
+    data_t bound = 1. / std::sqrt(fan_in);
+    UniformInitializer bias_init(bias_, -bound, bound);
+    bias_init.init();
 }
 
-Tensor Conv2d::forward(const Tensor& x) {
+kernel::Conv2dShape Conv2d::conv_shape(const Shape& x_shape) const {
+    return kernel::Conv2dShape{
+        x_shape[0], x_shape[1], x_shape[2], x_shape[3],
+        kernel_size_.first, kernel_size_.second,
+        stride_.first, stride_.second,
+        padding_.first, padding_.second
+    };
+}
+
+Tensor Conv2d::forward_with(const Tensor& x, bool relu, bool max_pool) {
+    quantizer_.observe(x);
+    if(quantized()) {
+        Tensor y = int8_forward(x);
+        if(!max_pool)
+            return y;
+        Tensor pooled = op::max_pool2d(y, {2, 2}, {2, 2}, {0, 0});
+        return pooled;
+    }
+
+    auto algorithm = kernel::conv2d_algorithm(conv_shape(x.size()), out_channels_, groups_);
+    if(algorithm != kernel::Conv2dAlgorithm::im2col_gemm) {
+        if(relu) {
+            Tensor y = op::conv2d_bias_relu(x, *weight_, bias_, kernel_size_, stride_,
+                                            padding_, groups_, max_pool, algorithm,
+                                            filter_);
+            return y;
+        }
+        Tensor y = op::conv2d_bias(x, *weight_, bias_, kernel_size_, stride_,
+                                   padding_, groups_, max_pool, algorithm, filter_);
+        return y;
+    }
+
+    Tensor y = im2col_forward(x, relu);
+    if(!max_pool)
+        return y;
+    Tensor pooled = op::max_pool2d(y, {2, 2}, {2, 2}, {0, 0});
+    return pooled;
+}
+
+Tensor Conv2d::im2col_forward(const Tensor& x, bool relu) {
     auto col_exp = op::img2col(
         x, kernel_size_, stride_, padding_
     );
-
-    Tensor y1 = op::matrix_mul(
-        Tensor(col_exp), op::matrix_transpose(weight_)
-    );
+    Tensor col(col_exp);
+    Tensor y1 = relu ? Tensor(op::linear_relu(col, *weight_, bias_))
+                     : Tensor(op::linear(col, *weight_, bias_));
 
     auto&& conv_feat_size = col_exp.impl().conv_feat_size();
     Tensor y2 = y1.view({
@@ -79,33 +218,103 @@ Tensor Conv2d::forward(const Tensor& x) {
     return y3;
 }
 
+void Conv2d::quantize(bool keep_weight) {
+    CHECK_TRUE(weight_ != nullptr, 
+        "The weight was dropped by quantize(), dequantize() it first.");
+    quantizer_.quantize(*weight_);
+    if(!keep_weight)
+        weight_.reset();
+}
+
+void Conv2d::dequantize(void) {
+    if(!weight_ && quantized()) {
+        weight_.reset(new Tensor(quantizer_.dequantized_weight()));
+        // The new weight may reuse the address the cached filter was of.
+        filter_ = Alloc::shared_construct<op::ConvFilter>();
+    }
+    quantizer_.dequantize();
+}
+
+Int8Tensor Conv2d::quantize_input(const Tensor& x) const {
+    return quantizer_.quantize_input(x);
+}
+
+Int8Tensor Conv2d::forward_int8(const Int8Tensor& x, data_t y_scale) const {
+    CHECK_TRUE(quantized() && y_scale > 0 && !max_pool_, 
+        "Int8 forward of a layer which isn't quantized, pools, or to a scale of %f.",
+        y_scale);
+    CHECK_TRUE(x.shape.ndim() == 4,
+        "Input of %d channels expected, got %dD Tensor.", in_channels_, x.shape.ndim());
+    kernel::Conv2dShape shape = conv_shape(x.shape);
+    Int8Tensor y{Shape{shape.batch, out_channels_, shape.out_h(), shape.out_w()}, 
+                 y_scale, {}};
+    y.data.resize(y.shape.dsize());
+    int8_forward(x.shape, x.data.data(), x.scale, y_scale, nullptr, y.data.data());
+    return y;
+}
+
+Tensor Conv2d::forward_int8(const Int8Tensor& x) const {
+    CHECK_TRUE(quantized() && !max_pool_, 
+        "Int8 forward of a layer which isn't quantized or pools.");
+    CHECK_TRUE(x.shape.ndim() == 4,
+        "Input of %d channels expected, got %dD Tensor.", in_channels_, x.shape.ndim());
+    kernel::Conv2dShape shape = conv_shape(x.shape);
+    Tensor y(Shape{shape.batch, out_channels_, shape.out_h(), shape.out_w()});
+    int8_forward(x.shape, x.data.data(), x.scale, 1, 
+                 const_cast<TensorImpl&>(y.impl()).data(), nullptr);
+    return y;
+}
+
+Tensor Conv2d::int8_forward(const Tensor& x) {
+    CHECK_TRUE(x.ndim() == 4,
+        "Input of %d channels expected, got %dD Tensor.", in_channels_, x.ndim());
+    const int8_t* xq = quantizer_.buffered_input(x);
+    kernel::Conv2dShape shape = conv_shape(x.size());
+    Tensor y(Shape{shape.batch, out_channels_, shape.out_h(), shape.out_w()});
+    int8_forward(x.size(), xq, quantizer_.input_scale(), 1,
+                 const_cast<TensorImpl&>(y.impl()).data(), nullptr);
+    return y;
+}
+
+void Conv2d::int8_forward(const Shape& x_shape, const int8_t* x, data_t x_scale,
+                          data_t y_scale, data_t* y, int8_t* yq) const {
+    CHECK_TRUE(x_shape.ndim() == 4 && x_shape[1] == in_channels_,
+        "Input of %d channels expected, got %dD Tensor.", in_channels_, x_shape.ndim());
+    Tensor bias = bias_.contiguous();
+    kernel::Int8Epilogue epilogue{
+        bias.impl().data(),
+        relu_ ? kernel::Activation::relu : kernel::Activation::identity, y_scale
+    };
+    kernel::int8_conv2d_forward(conv_shape(x_shape), out_channels_, groups_, x, 
+                                x_scale, quantizer_.weight(),
+                                quantizer_.weight_scales(), epilogue, y, yq);
+}
+
+Tensor Conv2d::forward(const Tensor& x) {
+    return forward_with(x, /*relu=*/false, /*max_pool=*/false);
+}
+
 ParamsDict Conv2d::parameters(void) {
-    return {{"weight", weight_}};
+    if(!weight_)
+        return {{"bias", bias_}};
+    return {
+        {"weight", *weight_},
+        {"bias", bias_}
+    };
 }
 
 Conv2dWithReLU::Conv2dWithReLU(index_t in_channels, index_t out_channels,
                                const Wsize& kernel_size, const Wsize& stride,
-                               const Wsize& padding)
+                               const Wsize& padding, index_t groups, 
+                               bool max_pool)
         : Conv2d(in_channels, out_channels, 
-                 kernel_size, stride, padding)
-    {}
+                 kernel_size, stride, padding, groups) {
+    relu_ = true;
+    max_pool_ = max_pool;
+}
 
 Tensor Conv2dWithReLU::forward(const Tensor& x) {
-    auto col_exp = op::img2col(
-        x, kernel_size_, stride_, padding_
-    );
-
-    Tensor y1 = op::relu(op::matrix_mul(
-        Tensor(col_exp), op::matrix_transpose(weight_)
-    ));
-
-    auto& conv_feat_size = col_exp.impl().conv_feat_size();
-    Tensor y2 = y1.view({
-        conv_feat_size.first, conv_feat_size.second, 
-        x.size(0), out_channels_
-    });
-    Tensor y3 = y2.permute({2, 3, 0, 1});
-    return y3;
+    return forward_with(x, relu_, max_pool_);
 }
 }  // namespace nn
 }  // namespace st
@@ -121,20 +330,8 @@ MaxPool2d::MaxPool2d(const Wsize& kernel_size, const Wsize& stride,
     {}
 
 Tensor MaxPool2d::forward(const Tensor& x) {
-    auto col_exp = op::img2col(
-        x, kernel_size_, stride_, padding_
-    );
-    Tensor y1 = col_exp;
-
-    auto& conv_feat_size = col_exp.impl().conv_feat_size();
-    Tensor y2 = y1.view({
-        conv_feat_size.first, conv_feat_size.second, 
-        x.size(0), x.size(1), 
-        kernel_size_.first*kernel_size_.second
-    });
-    Tensor y3 = op::max(y2, /*dim=*/4);
-    Tensor y4 = y3.permute({2, 3, 0, 1});
-    return y4;
+    Tensor y = op::max_pool2d(x, kernel_size_, stride_, padding_);
+    return y;
 }
 
 ParamsDict MaxPool2d::parameters(void) {
@@ -143,10 +340,12 @@ ParamsDict MaxPool2d::parameters(void) {
 
 Tensor CrossEntropy::forward(const Tensor& input,
                              const index_t* labels) {
-    auto logits = op::log_softmax(input);
-    auto nll = op::nll_loss(logits, labels);
-    Tensor loss = op::mean(nll, 0);
-    return loss;
+    return op::cross_entropy(input, labels);
+}
+
+Tensor CrossEntropy::forward(const Tensor& input,
+                             const std::shared_ptr<index_t>& labels) {
+    return op::cross_entropy(input, labels);
 }
 }  // namespace nn
 }  // namespace st
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "tensor/tensor.hpp"
 #include "tensor/tensor_impl.hpp"
 #include "nn/optim.hpp"
+#include "kernel/vector.hpp"
 
 namespace st {
 namespace nn {
@@ -36,8 +37,7 @@ void SGD::step(void) {
         data_t* grad_dptr = get_grad(t);
         index_t dsize = data_size(t);
 
-        for(index_t i = 0; i < dsize; ++i)
-            storage_dptr[i] -= lr_ * grad_dptr[i];
+        kernel::axpy(dsize, -lr_, grad_dptr, storage_dptr);
     }
 }
 
@@ -66,8 +66,7 @@ void SGDwithMomentum::step(void) {
             index_t dsize = data_size(t);
 
             std::memcpy(vx, grad_dptr, dsize * sizeof(data_t));
-            for(index_t j = 0; j < dsize; ++j)
-                storage_dptr[j] -= lr_ * vx[j];
+            kernel::axpy(dsize, -lr_, vx, storage_dptr);
         }
     } else {
         for(index_t i = 0; i < params_.size(); ++i) {
@@ -77,10 +76,8 @@ void SGDwithMomentum::step(void) {
             data_t* vx = running_means_[i].get();
             index_t dsize = data_size(t);
 
-            for(index_t j = 0; j < dsize; ++j) {
-                vx[j] = momentum_ * vx[j] + grad_dptr[j];
-                storage_dptr[j] -= lr_ * vx[j];
-            }
+            kernel::momentum_update(dsize, lr_, momentum_, grad_dptr, 
+                                    vx, storage_dptr);
         }
     }
 }
@@ -0,0 +1,64 @@
+#include "nn/quantize.hpp"
+#include "kernel/quant.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+namespace nn {
+
+void Int8Quantizer::start_calibration(void) {
+    calibrating_ = true;
+    input_range_ = 0;
+}
+
+void Int8Quantizer::observe(const Tensor& x) {
+    if(!calibrating_)
+        return;
+    Tensor data = x.contiguous();
+    data_t range = kernel::max_abs(data.size().dsize(), data.impl().data());
+    input_range_ = range > input_range_ ? range : input_range_;
+}
+
+void Int8Quantizer::quantize(const Tensor& weight) {
+    CHECK_TRUE(input_range_ > 0, 
+        "Input range unknown, calibrate before quantizing.");
+    Tensor data = weight.contiguous();
+    rows_ = data.size(0);
+    cols_ = data.size().dsize() / rows_;
+    weight_.resize(rows_ * cols_);
+    weight_scales_.resize(rows_);
+    kernel::quantize_rows(rows_, cols_, data.impl().data(), 
+                          weight_.data(), weight_scales_.data());
+    calibrating_ = false;
+}
+
+void Int8Quantizer::dequantize(void) {
+    weight_.clear();
+    weight_scales_.clear();
+    std::vector<int8_t>().swap(input_);
+}
+
+Tensor Int8Quantizer::dequantized_weight(void) const {
+    Tensor weight(Shape{rows_, cols_}, /*requires_grad=*/true);
+    data_t* data = const_cast<TensorImpl&>(weight.impl()).data();
+    for(index_t i = 0; i < rows_; ++i)
+        for(index_t j = 0; j < cols_; ++j)
+            data[i * cols_ + j] = weight_[i * cols_ + j] * weight_scales_[i];
+    return weight;
+}
+
+Int8Tensor Int8Quantizer::quantize_input(const Tensor& x) const {
+    Tensor data = x.contiguous();
+    Int8Tensor q{data.size(), input_scale(), std::vector<int8_t>(data.size().dsize())};
+    kernel::quantize(q.data.size(), data.impl().data(), q.scale, q.data.data());
+    return q;
+}
+
+const int8_t* Int8Quantizer::buffered_input(const Tensor& x) {
+    Tensor data = x.contiguous();
+    input_.resize(data.size().dsize());
+    kernel::quantize(input_.size(), data.impl().data(), input_scale(), input_.data());
+    return input_.data();
+}
+
+}  // namespace nn
+}  // namespace st
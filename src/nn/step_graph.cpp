@@ -0,0 +1,54 @@
+#include <cstring>
+
+#include "nn/step_graph.hpp"
+#include "nn/init.hpp"
+
+namespace st {
+namespace nn {
+
+StepGraph::StepGraph(Module& model, CrossEntropy& criterion, 
+                     const Shape& input_shape)
+        : model_(model), criterion_(criterion),
+          input_(input_shape),
+          labels_(Alloc::shared_allocate<index_t>(
+              input_shape[0] * sizeof(index_t))),
+          loss_(nullptr), eager_loss_(nullptr)
+    {}
+
+const Tensor& StepGraph::step(const data_t* samples, const index_t* labels) {
+    CpyInitializer input_init(input_, const_cast<data_t*>(samples));
+    input_init.init();
+    std::memcpy(labels_.get(), labels, input_.size(0) * sizeof(index_t));
+
+    if(loss_) {
+        plan_.replay();
+    } else {
+        plan_.begin_capture();
+        Tensor output = model_.forward(input_);
+        loss_ = Alloc::unique_construct<Tensor>(
+            criterion_.forward(output, labels_)
+        );
+        plan_.end_capture();
+    }
+    loss_->backward();
+    return *loss_;
+}
+
+const Tensor& StepGraph::step(const data_t* samples, const index_t* labels,
+                              index_t n_samples) {
+    if(n_samples == input_.size(0))
+        return step(samples, labels);
+
+    Shape input_shape = input_.size();
+    input_shape[0] = n_samples;
+    Tensor input(samples, input_shape);
+    Tensor output = model_.forward(input);
+    eager_loss_ = Alloc::unique_construct<Tensor>(
+        criterion_.forward(output, labels)
+    );
+    eager_loss_->backward();
+    return *eager_loss_;
+}
+
+}  // namespace nn
+}  // namespace st
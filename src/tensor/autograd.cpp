@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+
+#include "tensor/autograd.hpp"
+#include "tensor/tensor_impl.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace autograd {
+
+namespace {
+
+const index_t num_stripes = 64;
+
+std::mutex grad_mutexes[num_stripes];
+std::mutex expression_mutexes[num_stripes];
+
+thread_local bool enabled = true;
+
+index_t stripe(const void* key) {
+    // The low bits of an address are the same for most allocations.
+    return (reinterpret_cast<std::uintptr_t>(key) >> 6) % num_stripes;
+}
+
+Alloc::NontrivialUniquePtr<ExpImplPtr<TensorImpl>> own(const TensorImpl& tensor) {
+    return Alloc::unique_construct<ExpImplPtr<TensorImpl>>(tensor, false);
+}
+
+}  // namespace
+
+std::mutex& grad_mutex(const Storage& grad) {
+    return grad_mutexes[stripe(grad.base())];
+}
+
+std::mutex& expression_mutex(const void* expression) {
+    return expression_mutexes[stripe(expression)];
+}
+
+bool grad_enabled(void) { return enabled; }
+
+NoGradGuard::NoGradGuard() : previous_(enabled) { enabled = false; }
+NoGradGuard::~NoGradGuard() { enabled = previous_; }
+
+std::vector<Engine::Node> Engine::build_graph(TensorImpl& root) {
+    std::vector<Node> nodes;
+    std::unordered_map<TensorImpl*, index_t> ids;
+    std::vector<index_t> stack;
+    std::vector<TensorImpl*> next;
+
+    nodes.push_back(Node{own(root), {}, 0});
+    ids.emplace(&root, 0);
+    stack.push_back(0);
+    while(!stack.empty()) {
+        index_t id = stack.back();
+        stack.pop_back();
+
+        next.clear();
+        (*nodes[id].tensor)->collect_grad_fn_tensors(next);
+        // A tensor used twice by one expression is counted once, its grads
+        // are all accumulated when the grad_fn returns.
+        std::sort(next.begin(), next.end());
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        for(TensorImpl* tensor : next) {
+            auto inserted = ids.emplace(tensor, nodes.size());
+            index_t next_id = inserted.first->second;
+            if(inserted.second) {
+                nodes.push_back(Node{own(*tensor), {}, 0});
+                stack.push_back(next_id);
+            }
+            nodes[id].next.push_back(next_id);
+            ++nodes[next_id].dependencies;
+        }
+    }
+    return nodes;
+}
+
+void Engine::backward(TensorImpl& root, bool retain_graph) {
+    std::vector<Node> nodes = build_graph(root);
+    std::vector<index_t> ready(1, 0), wave, branches;
+    while(!ready.empty()) {
+        wave.swap(ready);
+        ready.clear();
+        // The leaves of a wave, e.g. the parameters next to the input of a
+        // layer, only have their grad checked, so they are run here and
+        // only the tensors with a grad_fn are split among the threads.
+        branches.clear();
+        for(index_t id : wave) {
+            ExpImplPtr<TensorImpl>& tensor = *nodes[id].tensor;
+            if(tensor->has_grad_fn())
+                branches.push_back(id);
+            else
+                tensor->run_grad_fn();
+        }
+        parallel::parallel_tasks(branches.size(), [&](index_t i) {
+            (*nodes[branches[i]].tensor)->run_grad_fn();
+        });
+        // The dependencies are counted down once the wave is over, in the
+        // order of the wave, so the waves don't depend on the threads. The
+        // references are dropped here too, as refcounts aren't atomic.
+        for(index_t id : wave) {
+            Node& node = nodes[id];
+            if(!retain_graph)
+                (*node.tensor)->release_grad_fn();
+            node.tensor.reset();
+            for(index_t next_id : node.next)
+                if(--nodes[next_id].dependencies == 0)
+                    ready.push_back(next_id);
+        }
+    }
+}
+
+}  // namespace autograd
+}  // namespace st
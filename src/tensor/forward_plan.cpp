@@ -0,0 +1,38 @@
+#include "tensor/forward_plan.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+
+thread_local ForwardPlan* ForwardPlan::active_ = nullptr;
+
+ForwardPlan::~ForwardPlan() {
+    if(active_ == this)
+        active_ = nullptr;
+}
+
+void ForwardPlan::begin_capture(void) {
+    CHECK_TRUE(active_ == nullptr, "Another ForwardPlan is capturing.");
+    clear();
+    active_ = this;
+}
+
+void ForwardPlan::end_capture(void) {
+    CHECK_TRUE(active_ == this, "The ForwardPlan isn't capturing.");
+    active_ = nullptr;
+}
+
+void ForwardPlan::replay(void) const {
+    CHECK_TRUE(active_ == nullptr, "Can't replay a ForwardPlan while capturing.");
+    for(auto& fn: fns_)
+        (*fn)();
+}
+
+void ForwardPlan::clear(void) {
+    fns_.clear();
+}
+
+void ForwardPlan::record(std::shared_ptr<ForwardFn>&& fn) {
+    active_->fns_.push_back(std::move(fn));
+}
+
+}  // namespace st
@@ -0,0 +1,59 @@
+#include <vector>
+
+#include "tensor/sparse_tensor.hpp"
+#include "utils/exception.hpp"
+
+namespace st {
+
+namespace {
+
+std::shared_ptr<const kernel::SparsePattern> 
+dense_pattern(const Tensor& dense, index_t block_h, index_t block_w) {
+    CHECK_EQUAL(dense.ndim(), 2, "Matrix expected, got %dD Tensor.", dense.ndim());
+    Tensor data = dense.contiguous();
+    return Alloc::shared_construct<kernel::SparsePattern>(
+        kernel::sparse_pattern(dense.size(0), dense.size(1), block_h, block_w,
+                               data.impl().data()));
+}
+
+Tensor dense_values(const kernel::SparsePattern& pattern, const Tensor& dense,
+                    bool requires_grad) {
+    Tensor data = dense.contiguous();
+    std::vector<data_t> values(pattern.nnz());
+    kernel::sparse_gather(pattern, data.impl().data(), values.data());
+    return Tensor(values.data(), Shape{pattern.nnz()}, requires_grad);
+}
+
+}  // namespace
+
+SparseTensor::SparseTensor(const Tensor& dense, index_t block_h, 
+                           index_t block_w, bool requires_grad)
+        : pattern_(dense_pattern(dense, block_h, block_w)),
+          values_(dense_values(*pattern_, dense, requires_grad))
+    {}
+
+index_t SparseTensor::size(index_t idx) const {
+    CHECK_IN_RANGE(idx, 0, 2, "Index %d out of range [0, 2).", idx);
+    return idx == 0 ? pattern_->rows : pattern_->cols;
+}
+
+Shape SparseTensor::size(void) const {
+    return Shape{pattern_->rows, pattern_->cols};
+}
+
+data_t SparseTensor::density(void) const {
+    return data_t(nnz()) / (pattern_->rows * pattern_->cols);
+}
+
+bool SparseTensor::is_block_sparse(void) const {
+    return pattern_->block_h != 1 || pattern_->block_w != 1;
+}
+
+Tensor SparseTensor::to_dense(void) const {
+    Tensor values = values_.contiguous();
+    std::vector<data_t> dense(pattern_->rows * pattern_->cols);
+    kernel::sparse_scatter(*pattern_, values.impl().data(), dense.data());
+    return Tensor(dense.data(), size());
+}
+
+}  // namespace st
@@ -1,13 +1,16 @@
 #include <cstring>
+#include <cstddef>
 
 #include "tensor/storage.hpp"
 
 namespace st {
 
 Storage::Storage(index_t size)
-        : bptr_(Alloc::shared_allocate<Vdata>(size * sizeof(data_t) + sizeof(index_t))),
+        : bptr_(Alloc::shared_allocate<Vdata>(
+              size * sizeof(data_t) + offsetof(Vdata, data_))),
           dptr_(bptr_->data_) {
     bptr_->version_ = 0;
+    bptr_->update_count_ = 0;
 }
 
 Storage::Storage(const Storage& other, index_t offset)
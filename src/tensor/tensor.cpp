@@ -1,4 +1,5 @@
 #include "tensor/tensor.hpp"
+#include "tensor/autograd.hpp"
 #include "tensor/shape.hpp"
 #include "exp/operator/constant.hpp"
 #include "exp/grad_impl.hpp"
@@ -39,6 +40,10 @@ Tensor::Tensor(Alloc::NontrivialUniquePtr<TensorImpl>&& ptr)
 
 Tensor& Tensor::operator=(const Tensor& other) {
     impl_ptr_->operator=(other.impl());
+    if(ForwardPlan::capturing())
+        ForwardPlan::record(
+            Alloc::shared_construct<__ForwardFn<TensorImpl>>(impl(), other.impl())
+        );
     return *this;
 }
 
@@ -51,6 +56,8 @@ index_t Tensor::version(void) const { return impl_ptr_->version(); }
 
 bool Tensor::is_contiguous(void) const { return impl_ptr_->is_contiguous(); }
 
+bool Tensor::requires_grad(void) const { return impl_ptr_->requires_grad(); }
+
 data_t& Tensor::operator[](std::initializer_list<index_t> ids) {
     return impl_ptr_->operator[](ids);
 };
@@ -71,6 +78,15 @@ Tensor Tensor::transpose(index_t dim1, index_t dim2) const {
 Tensor Tensor::permute(std::initializer_list<index_t> dims) const {
     return Tensor(impl_ptr_->permute(dims));
 }
+Tensor Tensor::contiguous(void) const {
+    Tensor ret(impl_ptr_->contiguous());
+    // A copy, unlike a view, has to be made again when a plan is replayed.
+    if(ForwardPlan::capturing() && !impl_ptr_->is_contiguous())
+        ForwardPlan::record(
+            Alloc::shared_construct<__ForwardFn<TensorImpl>>(ret.impl(), impl())
+        );
+    return ret;
+}
 Tensor Tensor::view(const Shape& shape) const {
     return Tensor(impl_ptr_->view(shape));
 }
@@ -85,7 +101,7 @@ Tensor Tensor::grad(void) const {
     return Tensor(impl_ptr_->grad());
 }
 
-void Tensor::backward(void) {
+void Tensor::backward(bool retain_graph) {
     CHECK_TRUE(impl_ptr_->requires_grad(),
         "Tensor doesn't require grad and doesn't have a grad_fn.");
     // CHECK_TRUE(ndim() == 1 && size(0) == 1,
@@ -95,6 +111,7 @@ void Tensor::backward(void) {
             1, static_cast<IndexArray>(this->size())
         )
     );
+    autograd::Engine::backward(*impl_ptr_.operator->(), retain_graph);
 }
 
 // friend function
@@ -6,6 +6,7 @@
 #include "tensor/grad_meta.hpp"
 #include "utils/exception.hpp"
 #include "utils/allocator.hpp"
+#include "kernel/transpose.hpp"
 
 namespace st {
 
@@ -120,7 +121,7 @@ TensorImpl::slice(index_t idx, index_t dim) const {
     auto ret_ptr = Alloc::unique_construct<TensorImpl>(
         std::move(storage), std::move(shape), std::move(stride), false
     );
-    if(requires_grad_) {
+    if(requires_grad_ && autograd::grad_enabled()) {
         ret_ptr->requires_grad_ = true;
         ret_ptr->gradmeta_ptr_ = Alloc::unique_construct<AutoGradMeta>(
             gradmeta_ptr_->grad_, offset
@@ -155,7 +156,7 @@ TensorImpl::slice(index_t start_idx, index_t end_idx, index_t dim) const {
     auto ret_ptr =  Alloc::unique_construct<TensorImpl>(
         std::move(storage), std::move(shape), std::move(stride), false
     );
-    if(requires_grad_) {
+    if(requires_grad_ && autograd::grad_enabled()) {
         ret_ptr->requires_grad_ = true;
         ret_ptr->gradmeta_ptr_ = Alloc::unique_construct<AutoGradMeta>(
             gradmeta_ptr_->grad_, offset
@@ -188,7 +189,7 @@ TensorImpl::transpose(index_t dim1, index_t dim2) const {
     auto ret_ptr = Alloc::unique_construct<TensorImpl>(
         Storage(storage_), std::move(shape), std::move(stride), false
     );
-    if(requires_grad_) {
+    if(requires_grad_ && autograd::grad_enabled()) {
         ret_ptr->requires_grad_ = true;
         ret_ptr->gradmeta_ptr_ = Alloc::unique_construct<AutoGradMeta>(
             gradmeta_ptr_->grad_, 0
@@ -216,7 +217,7 @@ TensorImpl::permute(std::initializer_list<index_t> dims) const {
     auto ret_ptr = Alloc::unique_construct<TensorImpl>(
         Storage(storage_), std::move(shape), std::move(stride), false
     );
-    if(requires_grad_) {
+    if(requires_grad_ && autograd::grad_enabled()) {
         ret_ptr->requires_grad_ = true;
         ret_ptr->gradmeta_ptr_ = Alloc::unique_construct<AutoGradMeta>(
             gradmeta_ptr_->grad_, 0
@@ -239,7 +240,7 @@ TensorImpl::view(const Shape& shape) const {
     auto ret_ptr = Alloc::unique_construct<TensorImpl>(
         storage_, shape, false
     );
-    if(requires_grad_) {
+    if(requires_grad_ && autograd::grad_enabled()) {
         ret_ptr->requires_grad_ = true;
         ret_ptr->gradmeta_ptr_ = Alloc::unique_construct<AutoGradMeta>(
             gradmeta_ptr_->grad_, 0
@@ -250,6 +251,16 @@ TensorImpl::view(const Shape& shape) const {
     return ret_ptr;
 }
 
+Alloc::NontrivialUniquePtr<TensorImpl>
+TensorImpl::contiguous(void) const {
+    if(is_contiguous())
+        return view(shape_);
+    auto ret_ptr = Alloc::unique_construct<TensorImpl>(
+        shape_, requires_grad_ && autograd::grad_enabled());
+    *ret_ptr = *this;
+    return ret_ptr;
+}
+
 Alloc::NontrivialUniquePtr<TensorImpl>
 TensorImpl::squeeze(void) const {
     index_t count = 0;
@@ -303,6 +314,110 @@ data_t TensorImpl::eval(index_t idx) const {
     return storage_[idx];
 }
 
+void __assign(Storage& dist_storage, const Shape& dist_shape, 
+              const IndexArray& dist_stride, const TensorImpl& src_exp) {
+    __assign_uncontiguous(dist_storage, dist_shape, dist_stride, src_exp);
+}
+
+void __assign_uncontiguous(Storage& dist_storage, const Shape& dist_shape, 
+                           const IndexArray& dist_stride, const TensorImpl& src_exp) {
+    IndexArray shape = dist_shape;
+    kernel::strided_copy(shape.size(), shape.data(), 
+                         src_exp.data(), src_exp.stride().data(),
+                         dist_storage.data(), dist_stride.data());
+}
+
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, 
+                       const GradFn::TensorGradImpl& src_exp) {
+    __inplacement_add_uncontiguous(dist_storage, dist_shape, dist_stride, src_exp);
+}
+
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const GradFn::TensorGradImpl& src_exp) {
+    // A broadcasted gradient may have more dims than the tensor it flows into.
+    if(dist_shape.ndim() != dist_stride.size() 
+            || src_exp.shape_.ndim() != dist_shape.ndim()) {
+        __inplacement_add_uncontiguous<GradFn::TensorGradImpl>(
+            dist_storage, dist_shape, dist_stride, src_exp
+        );
+        return;
+    }
+    IndexArray shape = dist_shape;
+    kernel::strided_copy(shape.size(), shape.data(),
+                         src_exp.storage_.data(), src_exp.stride_.data(),
+                         dist_storage.data(), dist_stride.data(), true);
+}
+
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, const DenseGradImpl& src_exp) {
+    __inplacement_add_uncontiguous(dist_storage, dist_shape, dist_stride, src_exp);
+}
+
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const DenseGradImpl& src_exp) {
+    if(src_exp.stride().size() != dist_stride.size()) {
+        __inplacement_add_uncontiguous<DenseGradImpl>(
+            dist_storage, dist_shape, dist_stride, src_exp
+        );
+        return;
+    }
+    IndexArray shape = dist_shape;
+    kernel::strided_copy(shape.size(), shape.data(),
+                         src_exp.data(), src_exp.stride().data(),
+                         dist_storage.data(), dist_stride.data(), true);
+}
+
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, const GemmGradImpl& src_exp) {
+    __inplacement_add_uncontiguous(dist_storage, dist_shape, dist_stride, src_exp);
+}
+
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const GemmGradImpl& src_exp) {
+    if(src_exp.accumulate(dist_storage.data(), dist_stride))
+        return;
+    __inplacement_add_uncontiguous<GemmGradImpl>(
+        dist_storage, dist_shape, dist_stride, src_exp
+    );
+}
+
+void __inplacement_add(Storage& dist_storage, const Shape& dist_shape, 
+                       const IndexArray& dist_stride, 
+                       const CrossEntropyGradImpl& src_exp) {
+    __inplacement_add_uncontiguous(dist_storage, dist_shape, dist_stride, src_exp);
+}
+
+void __inplacement_add_uncontiguous(Storage& dist_storage, const Shape& dist_shape,
+                                    const IndexArray& dist_stride, 
+                                    const CrossEntropyGradImpl& src_exp) {
+    if(src_exp.accumulate(dist_storage.data(), dist_stride))
+        return;
+    __inplacement_add_uncontiguous<CrossEntropyGradImpl>(
+        dist_storage, dist_shape, dist_stride, src_exp
+    );
+}
+
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, 
+                        const GradFn::TensorGradImpl& grad) {
+    IndexArray shape = grad_shape;
+    kernel::sum_broadcast(shape.size(), shape.data(),
+                          grad.storage_.data(), grad.stride_.data(),
+                          dist_storage.data(), dist_stride.data());
+}
+
+void __reduce_broadcast(Storage& dist_storage, const Shape& grad_shape,
+                        const IndexArray& dist_stride, const DenseGradImpl& grad) {
+    IndexArray shape = grad_shape;
+    kernel::sum_broadcast(shape.size(), shape.data(),
+                          grad.data(), grad.stride().data(),
+                          dist_storage.data(), dist_stride.data());
+}
+
 std::ostream& operator<<(std::ostream& out, const TensorImpl& src) {
     TensorImpl t(src.size());
     t = src;
@@ -2,6 +2,7 @@
 #include "utils/exception.hpp"
 
 #include <iostream>
+#include <mutex>
 
 namespace st {
 inline unsigned int round_up(int x) { return x == 1 ? 1 : 1 << (64 - __builtin_clz(x-1)); }
@@ -9,12 +10,16 @@ inline unsigned int round_up(int x) { return x == 1 ? 1 : 1 << (64 - __builtin_c
 index_t Alloc::allocate_memory_size;
 index_t Alloc::deallocate_memory_size;
 
+// Kernels allocate their buffers from the workers of utils/parallel.hpp too.
+static std::mutex alloc_mutex;
+
 Alloc& Alloc::self() {
     static Alloc alloc;
     return alloc;
 }
 
 void* Alloc::allocate(index_t size) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
     auto iter = self().cache_.find(size);
     void* res;
     if(iter != self().cache_.end()) {
@@ -29,6 +34,7 @@ void* Alloc::allocate(index_t size) {
 }
 
 void Alloc::deallocate(void* ptr, index_t size) {
+    std::lock_guard<std::mutex> lock(alloc_mutex);
     deallocate_memory_size += size;
     self().cache_.emplace(size, ptr);
 }
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "utils/autotune.hpp"
+#include "utils/cpu.hpp"
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace autotune {
+
+namespace {
+
+bool enabled_from_env(void) {
+    const char* value = std::getenv("ST_AUTOTUNE");
+    return value != nullptr && std::strcmp(value, "0") != 0;
+}
+
+std::string file_from_env(void) {
+    const char* value = std::getenv("ST_TUNING_FILE");
+    if(value != nullptr)
+        return value;
+    const char* home = std::getenv("HOME");
+    if(home == nullptr)
+        home = std::getenv("USERPROFILE");
+    return home == nullptr ? std::string() : std::string(home) + "/.st_tuning";
+}
+
+// "kind isa threads key..." of a problem.
+std::string record_key(const std::string& kind, index_t threads, const Config& key) {
+    std::ostringstream out;
+    out << kind << ' ' << cpu::isa_name(cpu::isa()) << ' ' << threads;
+    for(index_t value : key)
+        out << ' ' << value;
+    return out.str();
+}
+
+// Results of the tuning, a line of the tuning file for each of them:
+//     kind isa threads key... : config... @ cpu model
+// Lines of other CPUs are skipped when it is loaded.
+class Registry {
+public:
+    Registry() : enabled_(enabled_from_env()), path_(file_from_env()),
+                 loaded_(false) {}
+
+    bool enabled(void) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return enabled_;
+    }
+    void set_enabled(bool enable) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enabled_ = enable;
+    }
+
+    double now(void) {
+        std::function<double(void)> timer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            timer = timer_;
+        }
+        if(timer)
+            return timer();
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void set_timer(const std::function<double(void)>& now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timer_ = now;
+    }
+
+    std::string path(void) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return path_;
+    }
+    void set_path(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        path_ = path;
+        results_.clear();
+        load();
+    }
+
+    // Whether a result of key is known, and tuning may run for it if not.
+    bool find(const std::string& key, Config& config, bool& tunable) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!loaded_) load();
+        auto it = results_.find(key);
+        if(it != results_.end()) {
+            config = it->second;
+            return true;
+        }
+        tunable = enabled_;
+        return false;
+    }
+
+    void record(const std::string& key, const Config& config) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A later line of the same key overrides the former ones on load.
+        results_[key] = config;
+        if(path_.empty()) return;
+        std::ofstream file(path_, std::ios::app);
+        if(!file) return;
+        file << key << " :";
+        for(index_t value : config)
+            file << ' ' << value;
+        file << " @ " << cpu_model() << '\n';
+    }
+private:
+    void load(void) {
+        loaded_ = true;
+        if(path_.empty()) return;
+        std::ifstream file(path_);
+        std::string line;
+        while(std::getline(file, line)) {
+            std::size_t colon = line.find(" : ");
+            std::size_t at = line.find(" @ ");
+            if(colon == std::string::npos || at == std::string::npos || at < colon
+                    || line.substr(at + 3) != cpu_model())
+                continue;
+            Config config;
+            std::istringstream values(line.substr(colon + 3, at - colon - 3));
+            index_t value;
+            while(values >> value)
+                config.push_back(value);
+            results_[line.substr(0, colon)] = config;
+        }
+    }
+
+    std::mutex mutex_;
+    bool enabled_;
+    std::function<double(void)> timer_;
+    std::string path_;
+    bool loaded_;
+    std::map<std::string, Config> results_;
+};
+
+Registry& registry(void) {
+    static Registry instance;
+    return instance;
+}
+
+}  // namespace
+
+bool enabled(void) { return registry().enabled(); }
+void set_enabled(bool enable) { registry().set_enabled(enable); }
+
+std::string tuning_file(void) { return registry().path(); }
+void set_tuning_file(const std::string& path) { registry().set_path(path); }
+
+void set_timer(const std::function<double(void)>& now) { registry().set_timer(now); }
+
+const std::string& cpu_model(void) { return cpu::brand(); }
+
+Config select(const std::string& kind, const Config& key,
+              const std::vector<Config>& candidates,
+              const std::function<void(const Config&)>& run) {
+    std::string full_key = record_key(kind, parallel::num_threads(), key);
+    Config config;
+    bool tunable = false;
+    if(registry().find(full_key, config, tunable)) {
+        // A result of a file written with other candidates is tuned again.
+        for(const Config& candidate : candidates)
+            if(candidate == config)
+                return config;
+        tunable = registry().enabled();
+    }
+    if(!tunable || candidates.size() < 2 || parallel::in_parallel())
+        return candidates[0];
+
+    // Each candidate is run once beforehand, which also tunes the kernels
+    // it calls, then the best of two runs is kept. Candidates whose first
+    // run is already 3x slower than the best one are dropped.
+    auto timed_run = [&](const Config& candidate) {
+        double start = registry().now();
+        run(candidate);
+        return registry().now() - start;
+    };
+    double best_time = 0;
+    index_t best = 0;
+    for(index_t i = 0; i < candidates.size(); ++i) {
+        if(timed_run(candidates[i]) > 3 * best_time && i != 0)
+            continue;
+        double time = timed_run(candidates[i]);
+        time = std::min(time, timed_run(candidates[i]));
+        if(i == 0 || time < best_time) {
+            best_time = time;
+            best = i;
+        }
+    }
+    registry().record(full_key, candidates[best]);
+    return candidates[best];
+}
+
+}  // namespace autotune
+}  // namespace st
@@ -0,0 +1,108 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "utils/cpu.hpp"
+
+#ifdef ST_ISA_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace st {
+namespace cpu {
+
+namespace {
+
+#ifdef ST_ISA_DISPATCH
+// The register states enabled by the OS, which must save the vector
+// registers for a thread to use them.
+unsigned long long xgetbv(void) {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (unsigned long long)edx << 32 | eax;
+}
+#endif
+
+Isa detect(void) {
+#ifdef ST_ISA_DISPATCH
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return Isa::sse2;
+    bool osxsave = ecx & (1u << 27), avx = ecx & (1u << 28), fma = ecx & (1u << 12);
+    if(!osxsave || !avx || !fma || __get_cpuid_max(0, nullptr) < 7)
+        return Isa::sse2;
+    unsigned long long xcr0 = xgetbv();
+    // XMM and YMM states, then opmask and ZMM ones.
+    if((xcr0 & 0x6) != 0x6)
+        return Isa::sse2;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if(!(ebx & (1u << 5)))
+        return Isa::sse2;
+    if((ebx & (1u << 16)) && (xcr0 & 0xe6) == 0xe6)
+        return Isa::avx512;
+    return Isa::avx2;
+#else
+    return Isa::sse2;
+#endif
+}
+
+Isa clamp(Isa level) {
+    return int(level) > int(detected_isa()) ? detected_isa() : level;
+}
+
+Isa isa_from_env(void) {
+    const char* value = std::getenv("ST_ISA");
+    Isa level = detected_isa();
+    if(value != nullptr) {
+        for(Isa candidate : {Isa::sse2, Isa::avx2, Isa::avx512})
+            if(std::strcmp(value, isa_name(candidate)) == 0)
+                level = candidate;
+    }
+    return clamp(level);
+}
+
+std::atomic<Isa> current(isa_from_env());
+
+std::string read_brand(void) {
+#ifdef ST_ISA_DISPATCH
+    unsigned int regs[12];
+    if(__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for(unsigned int i = 0; i < 3; ++i)
+            __get_cpuid(0x80000002 + i, regs + 4*i, regs + 4*i + 1,
+                        regs + 4*i + 2, regs + 4*i + 3);
+        std::string brand(reinterpret_cast<const char*>(regs), sizeof(regs));
+        brand = brand.c_str();
+        std::size_t first = brand.find_first_not_of(' ');
+        std::size_t last = brand.find_last_not_of(' ');
+        if(first != std::string::npos)
+            return brand.substr(first, last - first + 1);
+    }
+#endif
+    return "unknown";
+}
+
+}  // namespace
+
+Isa detected_isa(void) {
+    static const Isa detected = detect();
+    return detected;
+}
+
+Isa isa(void) { return current.load(std::memory_order_relaxed); }
+void set_isa(Isa level) { current.store(clamp(level), std::memory_order_relaxed); }
+
+const char* isa_name(Isa level) {
+    switch(level) {
+        case Isa::avx512: return "avx512";
+        case Isa::avx2: return "avx2";
+        default: return "sse2";
+    }
+}
+
+const std::string& brand(void) {
+    static const std::string value = read_brand();
+    return value;
+}
+
+}  // namespace cpu
+}  // namespace st
@@ -0,0 +1,197 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/parallel.hpp"
+
+namespace st {
+namespace parallel {
+
+namespace {
+
+index_t threads_from_env(void) {
+    const char* value = std::getenv("ST_NUM_THREADS");
+    if(value != nullptr && std::atoi(value) > 0)
+        return std::atoi(value);
+    index_t hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+}
+
+index_t max_threads = threads_from_env();
+thread_local bool inside_chunk = false;
+// The threads the parallel_fors of a task of parallel_tasks may use, 0 out
+// of any task.
+thread_local index_t share = 0;
+
+class Pool {
+public:
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for(auto& worker : workers_)
+            worker.join();
+    }
+
+    // Workers are started lazily, when the idle ones are fewer than the
+    // queued tasks, and never more than max_workers. The workers running the
+    // outer chunks of a nested call are busy, so it may take more of them.
+    void submit(std::function<void(void)>&& task, index_t max_workers) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+            while(workers_.size() - busy_ < tasks_.size() 
+                  && workers_.size() < max_workers)
+                workers_.emplace_back([this] { run(); });
+        }
+        cv_.notify_one();
+    }
+private:
+    void run(void) {
+        while(true) {
+            std::function<void(void)> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if(stop_ && tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+                ++busy_;
+            }
+            task();
+            std::lock_guard<std::mutex> lock(mutex_);
+            --busy_;
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void(void)>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    index_t busy_ = 0;
+    bool stop_ = false;
+};
+
+Pool& pool(void) {
+    static Pool instance;
+    return instance;
+}
+
+// State shared by the chunks of one parallel_for. The chunks are claimed
+// by whichever thread comes first, the calling one included, so a thread
+// waiting for its chunks never waits for one nobody has started, even when
+// all the workers are busy with the outer chunks of a nested call. The
+// pool tasks may outlive the call, hence the shared ownership.
+struct Job {
+    index_t begin, size, chunks;
+    // The threads each chunk may use for its own parallel_fors.
+    index_t chunk_threads;
+    const std::function<void(index_t, index_t)>* fn;
+    std::atomic<index_t> next;
+    index_t remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+
+    // Runs the next unclaimed chunk, false if there is none left.
+    bool run_next(void) {
+        index_t i = next++;
+        if(i >= chunks) return false;
+        index_t step = size / chunks, extra = size % chunks;
+        index_t chunk_begin = begin + i * step + (i < extra ? i : extra);
+        index_t chunk_end = chunk_begin + step + (i < extra ? 1 : 0);
+
+        bool outer_inside = inside_chunk;
+        index_t outer_share = share;
+        inside_chunk = chunk_threads <= 1;
+        share = chunk_threads;
+        try {
+            (*fn)(chunk_begin, chunk_end);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!error) error = std::current_exception();
+        }
+        inside_chunk = outer_inside;
+        share = outer_share;
+        // The waiting thread owns fn, it may leave as soon as it sees
+        // remaining reach 0. So it is only touched under the lock.
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--remaining == 0)
+            done.notify_all();
+        return true;
+    }
+};
+
+void run_chunks(index_t begin, index_t end, index_t chunks, index_t chunk_threads,
+                const std::function<void(index_t, index_t)>& fn) {
+    auto job = std::make_shared<Job>();
+    job->begin = begin;
+    job->size = end - begin;
+    job->chunks = chunks;
+    job->chunk_threads = chunk_threads;
+    job->fn = &fn;
+    job->next = 0;
+    job->remaining = chunks;
+    for(index_t i = 1; i < chunks; ++i)
+        pool().submit([job] { while(job->run_next()) {} },
+                      max_threads > chunks ? max_threads - 1 : chunks - 1);
+    while(job->run_next()) {}
+
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done.wait(lock, [&job] { return job->remaining == 0; });
+    }
+    if(job->error)
+        std::rethrow_exception(job->error);
+}
+
+}  // namespace
+
+index_t num_threads(void) { return max_threads; }
+void set_num_threads(index_t num) { max_threads = num == 0 ? 1 : num; }
+bool in_parallel(void) { return inside_chunk; }
+
+index_t available_threads(void) {
+    if(inside_chunk) return 1;
+    return share != 0 && share < max_threads ? share : max_threads;
+}
+
+void parallel_for(index_t begin, index_t end, index_t grain,
+                  const std::function<void(index_t, index_t)>& fn) {
+    if(begin >= end) return;
+    index_t size = end - begin;
+    if(grain == 0) grain = 1;
+    index_t chunks = (size + grain - 1) / grain;
+    index_t threads = available_threads();
+    if(chunks > threads) chunks = threads;
+    if(chunks <= 1) {
+        fn(begin, end);
+        return;
+    }
+    run_chunks(begin, end, chunks, 1, fn);
+}
+
+void parallel_tasks(index_t num, const std::function<void(index_t)>& fn) {
+    index_t threads = available_threads();
+    index_t chunks = num < threads ? num : threads;
+    auto run = [&fn](index_t begin, index_t end) {
+        for(index_t i = begin; i < end; ++i)
+            fn(i);
+    };
+    if(chunks <= 1) {
+        run(0, num);
+        return;
+    }
+    run_chunks(0, num, chunks, threads / chunks, run);
+}
+
+}  // namespace parallel
+}  // namespace st
@@ -7,10 +7,25 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "utils/base_config.hpp"
 #include "utils/array.hpp"
 #include "utils/exception.hpp" // CHECK_XXX is defined in utils/exception.hpp
+#include "utils/autotune.hpp"
+#include "utils/cpu.hpp"
+#include "utils/parallel.hpp"
+#include "kernel/fft_conv.hpp"
+#include "kernel/gemm.hpp"
+#include "kernel/quant.hpp"
+#include "kernel/reduce.hpp"
+#include "kernel/vector.hpp"
 #include "exp/function.hpp"
 #include "tensor/shape.hpp"
 #include "tensor/storage.hpp"
@@ -19,6 +34,8 @@
 #include "nn/init.hpp"
 #include "nn/module.hpp"
 #include "nn/optim.hpp"
+#include "nn/step_graph.hpp"
+#include "jit/jit.hpp"
 
 
 using std::cout;
@@ -38,9 +55,15 @@ void test_img2col_operator_backward();
 void test_broadcasting_operator_backward();
 void test_conv2d_module();
 void test_linear_module();
+void test_sparse_linear_module();
+void test_int8_module();
 void test_maxpool2d_module();
 void test_ce_module();
 void test_optimizer();
+void test_step_graph();
+void test_jit();
+void test_autotune();
+void test_cpu_dispatch();
 
 int main() {
     using namespace std::chrono;
@@ -77,12 +100,24 @@ int main() {
     test_conv2d_module();
     cout << "\033[33mtest Linear module...\033[0m" << endl;
     test_linear_module();
+    cout << "\033[33mtest sparse Linear module...\033[0m" << endl;
+    test_sparse_linear_module();
+    cout << "\033[33mtest int8 modules...\033[0m" << endl;
+    test_int8_module();
     cout << "\033[33mtest MaxPool2d module...\033[0m" << endl;
     test_maxpool2d_module();
     cout << "\033[33mtest CrossEntropy module...\033[0m" << endl;
     test_ce_module();
     cout << "\033[33mtest optimizer...\033[0m" << endl;
     test_optimizer();
+    cout << "\033[33mtest StepGraph...\033[0m" << endl;
+    test_step_graph();
+    cout << "\033[33mtest JIT...\033[0m" << endl;
+    test_jit();
+    cout << "\033[33mtest autotune...\033[0m" << endl;
+    test_autotune();
+    cout << "\033[33mtest CPU dispatch...\033[0m" << endl;
+    test_cpu_dispatch();
 
     cout << "\033[33mcheck all memory is deallocated...\033[0m" << endl;
     CHECK_TRUE(st::Alloc::all_clear(), "check memory all clear");
@@ -229,6 +264,27 @@ void test_Tensor() {
                 data_t value2 = t5[{0, k, 0, i, j}];
                 CHECK_FLOAT_EQUAL(value1, value2, "check7");
             }
+
+    // odd sizes to cover the tails of the blocked transpose
+    Tensor t8(Shape{37, 53});
+    for(index_t i = 0; i < 37; ++i)
+        for(index_t j = 0; j < 53; ++j)
+            t8[{i, j}] = i * 53 + j;
+    auto t9 = t8.transpose(0, 1).contiguous();
+    CHECK_TRUE(t9.is_contiguous(), "check8");
+    for(index_t i = 0; i < 53; ++i)
+        for(index_t j = 0; j < 37; ++j) {
+            data_t value = t9[{i, j}];
+            CHECK_FLOAT_EQUAL(value, j * 53 + i, "check8");
+        }
+
+    auto t10 = t8.view({37, 1, 53}).slice(1, 4, 2).permute({2, 1, 0}).contiguous();
+    CHECK_TRUE(t10.is_contiguous(), "check9");
+    for(index_t i = 0; i < 3; ++i)
+        for(index_t j = 0; j < 37; ++j) {
+            data_t value = t10[{i, 0, j}];
+            CHECK_FLOAT_EQUAL(value, j * 53 + i + 1, "check9");
+        }
 }
 
 void test_basic_operator() {
@@ -390,6 +446,49 @@ void test_matrix_operator() {
             }
         }
     }   
+
+    // The inner matrix_mul is computed when built, so it is read in place
+    // rather than copied into a Tensor. A lazy log_softmax is materialized.
+    auto t10_exp = op::matrix_mul(op::matrix_mul(t1, t2.transpose(0, 1)), t1);
+    using t10_impl_type = 
+        typename std::remove_reference<decltype(t10_exp.impl())>::type;
+    static_assert(std::is_same<t10_impl_type::lhs_type::op, op::MatrixMul>::value,
+                  "check5");
+    auto t13_exp = op::matrix_mul(op::log_softmax(t1), t1.transpose(0, 1));
+    using t13_impl_type = 
+        typename std::remove_reference<decltype(t13_exp.impl())>::type;
+    static_assert(std::is_same<t13_impl_type::lhs_type, TensorImpl>::value,
+                  "check5");
+    Tensor t10 = t10_exp;
+    for(index_t i = 0; i < 2; ++i) {
+        for(index_t j = 0; j < 6; ++j) {
+            data_t value1 = t10[{i, j}];
+            data_t value2 = t3_expect[0][i] * t1[{0, j}]
+                          + t3_expect[1][i] * t1[{1, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check5");
+        }
+    }
+
+    // Sizes beyond one register tile and one block of depth, with a lazy lhs
+    // and a transposed rhs, which are all read by the GEMM in place.
+    Tensor t11(Shape{37, 300});
+    Tensor t12(Shape{7, 300});
+    for(index_t i = 0; i < 37; ++i)
+        for(index_t j = 0; j < 300; ++j)
+            t11[{i, j}] = ((i * 7 + j * 3) % 11) * 0.1 - 0.5;
+    for(index_t i = 0; i < 7; ++i)
+        for(index_t j = 0; j < 300; ++j)
+            t12[{i, j}] = ((i * 5 + j) % 13) * 0.1 - 0.6;
+    Tensor t13 = op::matrix_mul(t11 + t11, op::matrix_transpose(t12));
+    for(index_t i = 0; i < 37; ++i) {
+        for(index_t j = 0; j < 7; ++j) {
+            data_t value1 = t13[{i, j}];
+            data_t value2 = 0;
+            for(index_t p = 0; p < 300; ++p)
+                value2 += 2 * t11[{i, p}] * t12[{j, p}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check6");
+        }
+    }
 }
 
 void test_numeric_operator() {
@@ -530,6 +629,50 @@ void test_conv_operator() {
             data_t value2 = t5_expect[i/2][j%6];
             CHECK_FLOAT_EQUAL(value1, value2, "check5");
         }
+
+    // A permuted input is read through its strides, compared with the
+    // element-wise definition in op::Img2col::map.
+    Tensor t6 = t4.permute({1, 0, 2, 3});
+    auto t7_exp = op::img2col(t6, /*kernel_size=*/{3, 2},
+                              /*stride=*/{2, 1}, /*padding=*/{1, 1});
+    Tensor t7 = t7_exp;
+    IndexArray inds(2);
+    for(index_t i = 0; i < t7.size(0); ++i)
+        for(index_t j = 0; j < t7.size(1); ++j) {
+            inds[0] = i;
+            inds[1] = j;
+            data_t value1 = t7[{i, j}];
+            data_t value2 = op::Img2col::map(inds, t6.impl(), {3, 2}, {2, 1},
+                                             {1, 1}, t7_exp.impl().conv_feat_size());
+            CHECK_FLOAT_EQUAL(value1, value2, "check6");
+        }
+
+    // The grad of max_pool2d goes through its argmax, compared with a max
+    // over the img2col patches, on overlapping and padded windows.
+    Tensor t8(reinterpret_cast<data_t*>(data), Shape{1, 1, 6, 4}, true);
+    Tensor t9(reinterpret_cast<data_t*>(data), Shape{1, 1, 6, 4}, true);
+    Tensor t10 = op::max_pool2d(t8.permute({0, 1, 3, 2}), {3, 2}, {1, 2}, {1, 1});
+    Tensor t11 = op::img2col(t9.permute({0, 1, 3, 2}), {3, 2}, {1, 2}, {1, 1});
+    Tensor t12 = op::max(t11.view({4, 4, 1, 1, 6}), /*dim=*/4);
+    Tensor t13 = t12.permute({2, 3, 0, 1});
+    t10.backward();
+    t13.backward();
+    const Tensor& out10 = t10;
+    const Tensor& out13 = t13;
+    for(index_t i = 0; i < 4; ++i)
+        for(index_t j = 0; j < 4; ++j) {
+            data_t value1 = out10[{0, 0, i, j}];
+            data_t value2 = out13[{0, 0, i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check7");
+        }
+    auto&& t8_grad = t8.grad();
+    auto&& t9_grad = t9.grad();
+    for(index_t i = 0; i < 6; ++i)
+        for(index_t j = 0; j < 4; ++j) {
+            data_t value1 = t8_grad[{0, 0, i, j}];
+            data_t value2 = t9_grad[{0, 0, i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check8");
+        }
 }
 
 void test_tensor_backward() {
@@ -564,6 +707,136 @@ void test_tensor_backward() {
             data_t value2 = t0_grad_expect2[i][j];
             CHECK_FLOAT_EQUAL(value1, value2, "check2");
         }
+
+    Tensor t8(data1, Shape{3, 4}, true);
+    Tensor t9 = t8.view({2, 2, 3}).permute({2, 0, 1}).contiguous();
+    CHECK_TRUE(t9.is_contiguous(), "check3");
+    Tensor t10 = t9.slice(1, /*dim=*/0);
+    t10.backward();
+    data_t t8_grad_expect[][4] = {{0, 1, 0, 0}, {1, 0, 0, 1}, {0, 0, 1, 0}};
+    auto&& grad3 = t8.grad();
+    for(index_t i = 0; i < 3; ++i)
+        for(index_t j = 0; j < 4; ++j) {
+            data_t value1 = grad3[{i, j}];
+            data_t value2 = t8_grad_expect[i][j];
+            CHECK_FLOAT_EQUAL(value1, value2, "check3");
+        }
+
+    // t12 is also used by t14, which isn't backward, and t13 and t15 reach
+    // t11 by two paths.
+    Tensor t11(data1, Shape{12}, true);
+    Tensor t12 = t11 * t11;
+    Tensor t13 = t12 + t11;
+    Tensor t14 = -t12;
+    Tensor t15 = t13 * t12;
+    Tensor t16 = op::mean(t15, 0);
+    t16.backward();
+    auto&& grad4 = t11.grad();
+    for(index_t i = 0; i < 12; ++i) {
+        // d/dx (x^2 + x) * x^2 = 4x^3 + 3x^2, over the 12 of the mean
+        data_t x = data1[i];
+        data_t value1 = grad4[{i}];
+        data_t value2 = (4 * x * x * x + 3 * x * x) / 12;
+        CHECK_FLOAT_EQUAL(value1, value2, "check4");
+    }
+
+    // A chain far deeper than the stack would allow a recursive backward.
+    // It is released from the end, so that no destructor recurses either.
+    std::vector<Tensor> chain;
+    chain.emplace_back(data1, Shape{12}, true);
+    for(index_t i = 0; i < 100000; ++i)
+        chain.emplace_back(-chain.back());
+    {
+        Tensor t17 = op::mean(chain.back(), 0);
+        t17.backward();
+    }
+    auto&& grad5 = chain.front().grad();
+    for(index_t i = 0; i < 12; ++i) {
+        data_t value1 = grad5[{i}];
+        CHECK_FLOAT_EQUAL(value1, 1. / 12, "check5");
+    }
+    while(!chain.empty())
+        chain.pop_back();
+
+    // The eight branches make one wave, which runs on 4 threads. Each one
+    // passes a grad to t18 and to a view of it, so to the one grad buffer.
+    index_t threads = parallel::num_threads();
+    parallel::set_num_threads(4);
+    Tensor t18(data1, Shape{12}, true);
+    std::vector<Tensor> branches;
+    for(index_t i = 0; i < 8; ++i)
+        branches.emplace_back(t18 * t18.view({12}));
+    Tensor t19 = branches[0] + branches[1] + branches[2] + branches[3]
+               + branches[4] + branches[5] + branches[6] + branches[7];
+    Tensor t20 = op::mean(t19, 0);
+    t20.backward();
+    parallel::set_num_threads(threads);
+    auto&& grad6 = t18.grad();
+    for(index_t i = 0; i < 12; ++i) {
+        // d/dx 8 x^2, over the 12 of the mean
+        data_t value1 = grad6[{i}];
+        CHECK_FLOAT_EQUAL(value1, 16 * data1[i] / 12, "check6");
+    }
+
+    // Nothing built under the guard records a grad, but t21 still does once
+    // the guard is gone.
+    Tensor t21(data1, Shape{12}, true);
+    {
+        autograd::NoGradGuard no_grad;
+        Tensor t22 = t21 * t21;
+        Tensor t23 = t21.view({3, 4});
+        Tensor t24 = t23.transpose(0, 1).contiguous();
+        CHECK_TRUE(!t22.requires_grad() && !t23.requires_grad()
+                   && !t24.requires_grad(), "check7");
+        CHECK_TRUE(t21.requires_grad() && !autograd::grad_enabled(), "check7");
+    }
+    CHECK_TRUE(autograd::grad_enabled(), "check7");
+    Tensor t25 = op::mean(t21 * t21, 0);
+    CHECK_TRUE(t25.requires_grad(), "check7");
+    t25.backward();
+    auto&& grad7 = t21.grad();
+    for(index_t i = 0; i < 12; ++i) {
+        data_t value1 = grad7[{i}];
+        CHECK_FLOAT_EQUAL(value1, 2 * data1[i] / 12, "check7");
+    }
+
+    // The expression of t28 holds t27 until a backward releases it, which
+    // the first one doesn't, as it retains the graph.
+    Tensor t26(data1, Shape{12}, true);
+    Tensor t27 = t26 * t26;
+    Tensor t28 = op::mean(t27 + t26, 0);
+    index_t refcount = t27.impl().refcount();
+    t28.backward(/*retain_graph=*/true);
+    CHECK_EQUAL(t27.impl().refcount(), refcount, "check8");
+    t28.backward();
+    CHECK_EQUAL(t27.impl().refcount(), refcount - 1, "check8");
+
+    // The branches of a wave share the threads, so the kernels of each one
+    // still split their work, and the chunks of a kernel don't.
+    parallel::set_num_threads(4);
+    std::mutex mutex;
+    std::vector<index_t> task_chunks, nested_chunks;
+    parallel::parallel_tasks(2, [&](index_t) {
+        index_t chunks = 0;
+        parallel::parallel_for(0, 64, 1, [&](index_t, index_t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++chunks;
+        });
+        std::lock_guard<std::mutex> lock(mutex);
+        task_chunks.push_back(chunks);
+    });
+    parallel::parallel_for(0, 4, 1, [&](index_t, index_t) {
+        index_t chunks = 0;
+        parallel::parallel_for(0, 64, 1, [&](index_t, index_t) { ++chunks; });
+        std::lock_guard<std::mutex> lock(mutex);
+        nested_chunks.push_back(chunks);
+    });
+    parallel::set_num_threads(threads);
+    CHECK_TRUE(task_chunks.size() == 2 && task_chunks[0] == 2 && task_chunks[1] == 2,
+        "check9");
+    CHECK_EQUAL(nested_chunks.size(), 4, "check9");
+    for(index_t chunks : nested_chunks)
+        CHECK_EQUAL(chunks, 1, "check9");
 }
 
 void test_basic_operator_backward() {
@@ -619,6 +892,100 @@ void test_matrix_operator_backward() {
             data_t value2 = t2_grad[{i, j}];
             CHECK_FLOAT_EQUAL(value1, value2, "check1");
         }
+
+    // The grad of a transposed TensorImpl is accumulated by GEMM in place,
+    // the one of a lazy operand is evaluated element by element.
+    Tensor t7(Shape{5, 9}, true);
+    Tensor t8(Shape{4, 9}, true);
+    Tensor w(Shape{5, 4});
+    for(index_t i = 0; i < 5; ++i)
+        for(index_t j = 0; j < 9; ++j)
+            t7[{i, j}] = ((i * 3 + j) % 7) * 0.5 - 1;
+    for(index_t i = 0; i < 4; ++i)
+        for(index_t j = 0; j < 9; ++j)
+            t8[{i, j}] = ((i * 5 + j * 2) % 11) * 0.25 - 1;
+    for(index_t i = 0; i < 5; ++i)
+        for(index_t j = 0; j < 4; ++j)
+            w[{i, j}] = i + 0.5 * j;
+    Tensor t9 = op::matrix_mul(t7 + t7, op::matrix_transpose(t8));
+    Tensor t10 = t9 * w;
+    t10.backward();
+
+    const Tensor& a = t7;
+    const Tensor& b = t8;
+    const Tensor& dy = w;
+    auto&& t7_grad = t7.grad();
+    auto&& t8_grad = t8.grad();
+    for(index_t i = 0; i < 5; ++i)
+        for(index_t p = 0; p < 9; ++p) {
+            data_t value1 = t7_grad[{i, p}];
+            data_t value2 = 0;
+            for(index_t j = 0; j < 4; ++j)
+                value2 += 2 * dy[{i, j}] * b[{j, p}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check2");
+        }
+    for(index_t j = 0; j < 4; ++j)
+        for(index_t p = 0; p < 9; ++p) {
+            data_t value1 = t8_grad[{j, p}];
+            data_t value2 = 0;
+            for(index_t i = 0; i < 5; ++i)
+                value2 += 2 * dy[{i, j}] * a[{i, p}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check3");
+        }
+
+    // A batch of 1 is broadcasted, so its grad is summed over the batch.
+    Tensor t11(Shape{3, 4, 5}, true);
+    Tensor t12(Shape{1, 6, 5}, true);
+    Tensor w2(Shape{3, 4, 6});
+    for(index_t b = 0; b < 3; ++b)
+        for(index_t i = 0; i < 4; ++i)
+            for(index_t j = 0; j < 5; ++j)
+                t11[{b, i, j}] = ((b * 7 + i * 3 + j) % 9) * 0.25 - 1;
+    for(index_t i = 0; i < 6; ++i)
+        for(index_t j = 0; j < 5; ++j)
+            t12[{0, i, j}] = ((i * 5 + j * 2) % 7) * 0.5 - 1.5;
+    for(index_t b = 0; b < 3; ++b)
+        for(index_t i = 0; i < 4; ++i)
+            for(index_t j = 0; j < 6; ++j)
+                w2[{b, i, j}] = b - 0.5 * i + 0.25 * j;
+    Tensor t13 = op::batch_matrix_mul(t11, op::batch_matrix_transpose(t12));
+    CHECK_EQUAL(t13.size(0), 3, "check4");
+    Tensor t14 = t13 * w2;
+    t14.backward();
+
+    const Tensor& a2 = t11;
+    const Tensor& b2 = t12;
+    const Tensor& dy2 = w2;
+    const Tensor& y2 = t13;
+    auto&& t11_grad = t11.grad();
+    auto&& t12_grad = t12.grad();
+    for(index_t b = 0; b < 3; ++b)
+        for(index_t i = 0; i < 4; ++i)
+            for(index_t j = 0; j < 6; ++j) {
+                data_t value1 = y2[{b, i, j}];
+                data_t value2 = 0;
+                for(index_t p = 0; p < 5; ++p)
+                    value2 += a2[{b, i, p}] * b2[{0, j, p}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check4");
+            }
+    for(index_t b = 0; b < 3; ++b)
+        for(index_t i = 0; i < 4; ++i)
+            for(index_t p = 0; p < 5; ++p) {
+                data_t value1 = t11_grad[{b, i, p}];
+                data_t value2 = 0;
+                for(index_t j = 0; j < 6; ++j)
+                    value2 += dy2[{b, i, j}] * b2[{0, j, p}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check5");
+            }
+    for(index_t j = 0; j < 6; ++j)
+        for(index_t p = 0; p < 5; ++p) {
+            data_t value1 = t12_grad[{0, j, p}];
+            data_t value2 = 0;
+            for(index_t b = 0; b < 3; ++b)
+                for(index_t i = 0; i < 4; ++i)
+                    value2 += dy2[{b, i, j}] * a2[{b, i, p}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check6");
+        }
 }
 
 void test_numeric_operator_backward() {
@@ -742,6 +1109,54 @@ void test_img2col_operator_backward() {
                 value2 = t6_grad_expect[j][i][k];
                 CHECK_FLOAT_EQUAL(value1, value2, "check4");
             }
+
+    // Bias grads, reduced over the broadcast dims. 300 columns span more
+    // than one block of the reduction.
+    std::vector<data_t> x_data(4 * 300), bias_data(300, 0.5);
+    for(index_t i = 0; i < 4; ++i)
+        for(index_t j = 0; j < 300; ++j)
+            x_data[i * 300 + j] = i + 0.001 * j;
+    Tensor x(x_data.data(), Shape{4, 300});
+    Tensor bias(bias_data.data(), Shape{1, 300}, true);
+    Tensor t13 = (x + bias) * x;
+    t13.backward();
+    auto&& bias_grad = bias.grad();
+    for(index_t j = 0; j < 300; ++j) {
+        data_t value1 = bias_grad[{0, j}];
+        data_t value2 = 6 + 0.004 * j;
+        CHECK_FLOAT_EQUAL(value1, value2, "check5");
+    }
+
+    std::vector<data_t> img_data(2 * 3 * 5 * 5);
+    for(index_t i = 0; i < img_data.size(); ++i)
+        img_data[i] = 0.01 * i;
+    data_t channel_bias[] = {1, 2, 3};
+    Tensor img(img_data.data(), Shape{2, 3, 5, 5});
+    Tensor channel(channel_bias, Shape{3}, true);
+    Tensor t14 = (img + channel.view({1, 3, 1, 1})) * img;
+    t14.backward();
+    auto&& channel_grad = channel.grad();
+    for(index_t c = 0; c < 3; ++c) {
+        data_t expect = 0;
+        for(index_t b = 0; b < 2; ++b)
+            for(index_t p = 0; p < 25; ++p)
+                expect += img_data[(b * 3 + c) * 25 + p];
+        data_t value = channel_grad[{c}];
+        CHECK_FLOAT_EQUAL(value, expect, "check6");
+    }
+
+    // More reduced dims than the odometer used to hold, none of them merged
+    // as the outer dims have the smaller src strides.
+    index_t ndim = 18, shape[18], src_stride[18], dst_stride[18];
+    for(index_t i = 0; i < ndim; ++i) {
+        shape[i] = 2;
+        src_stride[i] = 1u << i;
+        dst_stride[i] = 0;
+    }
+    std::vector<data_t> ones(1u << ndim, 1.);
+    data_t total = 0;
+    kernel::sum_broadcast(ndim, shape, ones.data(), src_stride, &total, dst_stride);
+    CHECK_FLOAT_EQUAL(total, data_t(1u << ndim), "check7");
 }
 
 void test_conv2d_module(void) {
@@ -759,6 +1174,10 @@ void test_conv2d_module(void) {
     Tensor& weight = params["weight"];
     nn::CpyInitializer initilizer(weight, weight_data);
     initilizer.init();
+    data_t zero_bias_data[3] = {};
+    Tensor& bias = params["bias"];
+    nn::CpyInitializer bias_initilizer(bias, zero_bias_data);
+    bias_initilizer.init();
 
     data_t img_data[2][2][7][7] = 
         {{{{0.906730, 0.916613, 0.722186, 0.386272, 0.100365, 0.618340, 0.609103}, {0.328955, 0.215732, 0.107681, 0.948013, 0.380048, 0.430663, 0.952055}, {0.193987, 0.173216, 0.952505, 0.543355, 0.794108, 0.892996, 0.298362},{0.364147, 0.519262, 0.255671, 0.286267, 0.373460, 0.638731, 0.768166},{0.238655, 0.624588, 0.365848, 0.170788, 0.957593, 0.592034, 0.195187},{0.907456, 0.690784, 0.488165, 0.208965, 0.298154, 0.160431, 0.215673},{0.082201, 0.544421, 0.673148, 0.754322, 0.053999, 0.834828, 0.282316}},
@@ -796,6 +1215,337 @@ void test_conv2d_module(void) {
             data_t value2 = weight_grad_expect[i][j];
             CHECK_FLOAT_EQUAL(value1, value2, "check2");
         }
+
+    // The direct kernels of op::conv2d against img2col + matrix_mul, on a
+    // permuted input with stride and padding, for both grads.
+    Tensor x1(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+    Tensor x2(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+    Tensor w1(weight_data, Shape{3, 12}, true);
+    Tensor w2(weight_data, Shape{3, 12}, true);
+    Tensor y1 = op::conv2d(x1.permute({0, 1, 3, 2}), w1, {2, 3}, {2, 2}, {1, 1});
+    auto col = op::img2col(x2.permute({0, 1, 3, 2}), {2, 3}, {2, 2}, {1, 1});
+    Tensor col_out = op::matrix_mul(col, op::matrix_transpose(w2));
+    Tensor y2 = col_out.view({
+        col.impl().conv_feat_size().first, col.impl().conv_feat_size().second, 2, 3
+    }).permute({2, 3, 0, 1});
+    y1.backward();
+    y2.backward();
+    const Tensor& out1 = y1;
+    const Tensor& out2 = y2;
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 3; ++j)
+            for(index_t k = 0; k < out1.size(2); ++k)
+                for(index_t l = 0; l < out1.size(3); ++l) {
+                    data_t value1 = out1[{i, j, k, l}];
+                    data_t value2 = out2[{i, j, k, l}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check3");
+                }
+    auto&& x1_grad = x1.grad();
+    auto&& x2_grad = x2.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 2; ++j)
+            for(index_t k = 0; k < 7; ++k)
+                for(index_t l = 0; l < 7; ++l) {
+                    data_t value1 = x1_grad[{i, j, k, l}];
+                    data_t value2 = x2_grad[{i, j, k, l}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check4");
+                }
+    auto&& w1_grad = w1.grad();
+    auto&& w2_grad = w2.grad();
+    for(index_t i = 0; i < 3; ++i)
+        for(index_t j = 0; j < 12; ++j) {
+            data_t value1 = w1_grad[{i, j}];
+            data_t value2 = w2_grad[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check5");
+        }
+
+    // Winograd against the direct kernels, F(2x2, 3x3) on a 7x7 output and
+    // F(4x4, 3x3) on a 9x9 one.
+    for(index_t padding = 1; padding <= 2; ++padding) {
+        Tensor x3(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+        Tensor x4(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+        Tensor w3(weight_data, Shape{2, 18}, true);
+        Tensor w4(weight_data, Shape{2, 18}, true);
+        Tensor y3 = op::conv2d(x3, w3, {3, 3}, {1, 1}, {padding, padding},
+                               /*groups=*/1, kernel::Conv2dAlgorithm::winograd);
+        Tensor y4 = op::conv2d(x4, w4, {3, 3}, {1, 1}, {padding, padding},
+                               /*groups=*/1, kernel::Conv2dAlgorithm::direct);
+        y3.backward();
+        y4.backward();
+        const Tensor& out3 = y3;
+        const Tensor& out4 = y4;
+        for(index_t i = 0; i < 2; ++i)
+            for(index_t j = 0; j < 2; ++j)
+                for(index_t k = 0; k < out3.size(2); ++k)
+                    for(index_t l = 0; l < out3.size(3); ++l) {
+                        data_t value1 = out3[{i, j, k, l}];
+                        data_t value2 = out4[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check6");
+                    }
+        auto&& x3_grad = x3.grad();
+        auto&& x4_grad = x4.grad();
+        for(index_t i = 0; i < 2; ++i)
+            for(index_t j = 0; j < 2; ++j)
+                for(index_t k = 0; k < 7; ++k)
+                    for(index_t l = 0; l < 7; ++l) {
+                        data_t value1 = x3_grad[{i, j, k, l}];
+                        data_t value2 = x4_grad[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check7");
+                    }
+        auto&& w3_grad = w3.grad();
+        auto&& w4_grad = w4.grad();
+        for(index_t i = 0; i < 2; ++i)
+            for(index_t j = 0; j < 18; ++j) {
+                data_t value1 = w3_grad[{i, j}];
+                data_t value2 = w4_grad[{i, j}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check8");
+            }
+    }
+
+    // The filter transform is reused until an optimizer updates the weight.
+    auto filter = Alloc::shared_construct<op::ConvFilter>();
+    Tensor w5(weight_data, Shape{2, 18}, true);
+    Tensor y5 = op::conv2d(img, w5, {3, 3}, {1, 1}, {1, 1},
+                           /*groups=*/1, kernel::Conv2dAlgorithm::winograd, filter);
+    const data_t* u = filter->data.get();
+    Tensor y6 = op::conv2d(img, w5, {3, 3}, {1, 1}, {1, 1},
+                           /*groups=*/1, kernel::Conv2dAlgorithm::winograd, filter);
+    CHECK_TRUE(filter->data.get() == u, "check9");
+    y6.backward();
+    nn::SGD optimizer({{"weight", w5}}, /*lr=*/0.1);
+    optimizer.step();
+    Tensor y7 = op::conv2d(img, w5, {3, 3}, {1, 1}, {1, 1},
+                           /*groups=*/1, kernel::Conv2dAlgorithm::winograd, filter);
+    Tensor y8 = op::conv2d(img, w5, {3, 3}, {1, 1}, {1, 1});
+    CHECK_TRUE(filter->data.get() != u, "check9");
+    const Tensor& out7 = y7;
+    const Tensor& out8 = y8;
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 2; ++j)
+            for(index_t k = 0; k < 7; ++k)
+                for(index_t l = 0; l < 7; ++l) {
+                    data_t value1 = out7[{i, j, k, l}];
+                    data_t value2 = out8[{i, j, k, l}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check10");
+                }
+
+    // FFT against the direct kernels, a 5x5 kernel on a permuted input with
+    // stride and padding.
+    Tensor x9(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+    Tensor x10(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+    Tensor w9(reinterpret_cast<data_t*>(img_data), Shape{2, 50}, true);
+    Tensor w10(reinterpret_cast<data_t*>(img_data), Shape{2, 50}, true);
+    Tensor y9 = op::conv2d(x9.permute({0, 1, 3, 2}), w9, {5, 5}, {2, 2}, {2, 1},
+                           /*groups=*/1, kernel::Conv2dAlgorithm::fft);
+    Tensor y10 = op::conv2d(x10.permute({0, 1, 3, 2}), w10, {5, 5}, {2, 2}, {2, 1},
+                            /*groups=*/1, kernel::Conv2dAlgorithm::direct);
+    y9.backward();
+    y10.backward();
+    const Tensor& out9 = y9;
+    const Tensor& out10 = y10;
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 2; ++j)
+            for(index_t k = 0; k < 4; ++k)
+                for(index_t l = 0; l < 3; ++l) {
+                    data_t value1 = out9[{i, j, k, l}];
+                    data_t value2 = out10[{i, j, k, l}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check11");
+                }
+    auto&& x9_grad = x9.grad();
+    auto&& x10_grad = x10.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 2; ++j)
+            for(index_t k = 0; k < 7; ++k)
+                for(index_t l = 0; l < 7; ++l) {
+                    data_t value1 = x9_grad[{i, j, k, l}];
+                    data_t value2 = x10_grad[{i, j, k, l}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check12");
+                }
+    auto&& w9_grad = w9.grad();
+    auto&& w10_grad = w10.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 50; ++j) {
+            data_t value1 = w9_grad[{i, j}];
+            data_t value2 = w10_grad[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check13");
+        }
+
+    // One filter cache for two FFT convs of a graph, as a module applied to
+    // two input sizes. Their backwards run in one wave, on two threads, and
+    // each one replaces the spectrum the other one reads.
+    index_t threads = parallel::num_threads();
+    parallel::set_num_threads(4);
+    auto spectrum = Alloc::shared_construct<op::ConvFilter>();
+    Tensor w11(reinterpret_cast<data_t*>(img_data), Shape{2, 50}, true);
+    Tensor w12(reinterpret_cast<data_t*>(img_data), Shape{2, 50}, true);
+    Tensor y11 = op::conv2d(img, w11, {5, 5}, {1, 1}, {0, 0},
+                            /*groups=*/1, kernel::Conv2dAlgorithm::fft, spectrum);
+    Tensor y12 = op::conv2d(img, w11, {5, 5}, {1, 1}, {2, 2},
+                            /*groups=*/1, kernel::Conv2dAlgorithm::fft, spectrum);
+    Tensor y13 = op::conv2d(img, w12, {5, 5}, {1, 1}, {0, 0});
+    Tensor y14 = op::conv2d(img, w12, {5, 5}, {1, 1}, {2, 2});
+    Tensor loss11 = op::mean(y11.view({2, 18}), 1) + op::mean(y12.view({2, 98}), 1);
+    Tensor loss12 = op::mean(y13.view({2, 18}), 1) + op::mean(y14.view({2, 98}), 1);
+    loss11.backward();
+    loss12.backward();
+    parallel::set_num_threads(threads);
+    auto&& w11_grad = w11.grad();
+    auto&& w12_grad = w12.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 50; ++j) {
+            data_t value1 = w11_grad[{i, j}];
+            data_t value2 = w12_grad[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check13");
+        }
+
+    // Grouped convs against a dense conv by the block diagonal weight, a
+    // depthwise one with two kernels per channel, then two groups of two
+    // channels.
+    for(index_t c = 2; c <= 4; c += 2) {
+        index_t b = 4 / c, oc = 8 / c, groups = 2;
+        index_t group_c = c / groups, group_oc = oc / groups;
+        data_t dense_data[72] = {};
+        for(index_t o = 0; o < oc; ++o)
+            for(index_t ch = 0; ch < c; ++ch)
+                for(index_t k = 0; k < 9; ++k)
+                    if(ch / group_c == o / group_oc)
+                        dense_data[(o * c + ch) * 9 + k] =
+                            weight_data[(o * group_c + ch % group_c) * 9 + k];
+        Tensor x11(reinterpret_cast<data_t*>(img_data), Shape{b, c, 7, 7}, true);
+        Tensor x12(reinterpret_cast<data_t*>(img_data), Shape{b, c, 7, 7}, true);
+        Tensor w11(weight_data, Shape{oc, group_c * 9}, true);
+        Tensor w12(dense_data, Shape{oc, c * 9}, true);
+        Tensor y11 = op::conv2d(x11, w11, {3, 3}, {2, 1}, {1, 1}, groups);
+        Tensor y12 = op::conv2d(x12, w12, {3, 3}, {2, 1}, {1, 1});
+        y11.backward();
+        y12.backward();
+        const Tensor& out11 = y11;
+        const Tensor& out12 = y12;
+        for(index_t i = 0; i < b; ++i)
+            for(index_t j = 0; j < oc; ++j)
+                for(index_t k = 0; k < 4; ++k)
+                    for(index_t l = 0; l < 7; ++l) {
+                        data_t value1 = out11[{i, j, k, l}];
+                        data_t value2 = out12[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check14");
+                    }
+        auto&& x11_grad = x11.grad();
+        auto&& x12_grad = x12.grad();
+        for(index_t i = 0; i < b; ++i)
+            for(index_t j = 0; j < c; ++j)
+                for(index_t k = 0; k < 7; ++k)
+                    for(index_t l = 0; l < 7; ++l) {
+                        data_t value1 = x11_grad[{i, j, k, l}];
+                        data_t value2 = x12_grad[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check15");
+                    }
+        auto&& w11_grad = w11.grad();
+        auto&& w12_grad = w12.grad();
+        for(index_t o = 0; o < oc; ++o)
+            for(index_t k = 0; k < group_c * 9; ++k) {
+                index_t ch = o / group_oc * group_c + k / 9;
+                data_t value1 = w11_grad[{o, k}];
+                data_t value2 = w12_grad[{o, ch * 9 + k % 9}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check16");
+            }
+    }
+
+    // The fused bias, ReLU and pooling of op::conv2d_bias_relu against
+    // conv2d + bias, relu and max_pool2d, on a permuted input, by the direct,
+    // FFT and Winograd kernels. The 8x7 output drops its last column when
+    // pooled, the 7x7 one of Winograd its last row too.
+    data_t bias_data[] = {0.1, -0.25, 0.05};
+    for(index_t run = 0; run < 6; ++run) {
+        bool pool = run % 2;
+        auto algorithm = run < 2 ? kernel::Conv2dAlgorithm::direct
+                       : run < 4 ? kernel::Conv2dAlgorithm::fft
+                       : kernel::Conv2dAlgorithm::winograd;
+        bool winograd = algorithm == kernel::Conv2dAlgorithm::winograd;
+        index_t oc = winograd ? 2 : 3;
+        op::Conv2d::Wsize kernel_size = winograd ? op::Conv2d::Wsize(3, 3) 
+                                                 : op::Conv2d::Wsize(2, 3);
+        index_t patch = 2 * kernel_size.first * kernel_size.second;
+        Tensor x13(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+        Tensor x14(reinterpret_cast<data_t*>(img_data), Shape{2, 2, 7, 7}, true);
+        Tensor w13(weight_data, Shape{oc, patch}, true);
+        Tensor w14(weight_data, Shape{oc, patch}, true);
+        Tensor b13(bias_data, Shape{oc}, true);
+        Tensor b14(bias_data, Shape{oc}, true);
+        Tensor y13 = op::conv2d_bias_relu(x13.permute({0, 1, 3, 2}), w13, b13,
+                                          kernel_size, {1, 1}, {1, 1}, /*groups=*/1, 
+                                          pool, algorithm);
+        Tensor conv14 = op::conv2d(x14.permute({0, 1, 3, 2}), w14, 
+                                   kernel_size, {1, 1}, {1, 1});
+        Tensor relu14 = op::relu(conv14 + b14.view({1, oc, 1, 1}));
+        Tensor y14 = pool ? Tensor(op::max_pool2d(relu14, {2, 2}, {2, 2}, {0, 0}))
+                          : relu14;
+        y13.backward();
+        y14.backward();
+        index_t conv_h = winograd ? 7 : 8;
+        index_t oh = pool ? conv_h / 2 : conv_h, ow = pool ? 3 : 7;
+        const Tensor& out13 = y13;
+        const Tensor& out14 = y14;
+        CHECK_TRUE(out13.size(2) == oh && out13.size(3) == ow, "check17");
+        for(index_t i = 0; i < 2; ++i)
+            for(index_t j = 0; j < oc; ++j)
+                for(index_t k = 0; k < oh; ++k)
+                    for(index_t l = 0; l < ow; ++l) {
+                        data_t value1 = out13[{i, j, k, l}];
+                        data_t value2 = out14[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check17");
+                    }
+        auto&& x13_grad = x13.grad();
+        auto&& x14_grad = x14.grad();
+        for(index_t i = 0; i < 2; ++i)
+            for(index_t j = 0; j < 2; ++j)
+                for(index_t k = 0; k < 7; ++k)
+                    for(index_t l = 0; l < 7; ++l) {
+                        data_t value1 = x13_grad[{i, j, k, l}];
+                        data_t value2 = x14_grad[{i, j, k, l}];
+                        CHECK_FLOAT_EQUAL(value1, value2, "check18");
+                    }
+        auto&& w13_grad = w13.grad();
+        auto&& w14_grad = w14.grad();
+        for(index_t i = 0; i < oc; ++i)
+            for(index_t j = 0; j < patch; ++j) {
+                data_t value1 = w13_grad[{i, j}];
+                data_t value2 = w14_grad[{i, j}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check19");
+            }
+        auto&& b13_grad = b13.grad();
+        auto&& b14_grad = b14.grad();
+        for(index_t i = 0; i < oc; ++i) {
+            data_t value1 = b13_grad[{i}];
+            data_t value2 = b14_grad[{i}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check20");
+        }
+    }
+    // groups = 0 is refused before the channels are divided by it.
+    {
+        bool refused = false;
+        try {
+            nn::Conv2d conv(2, 2, {3, 3}, {1, 1}, {1, 1}, 0);
+        } catch(const err::Error&) {
+            refused = true;
+        }
+        CHECK_TRUE(refused, "check21");
+    }
+
+    // The spectra are sized in size_t, and the dispatcher leaves the convs
+    // whose spectra exceed its budget to the other kernels.
+    {
+        bool was_enabled = autotune::enabled();
+        autotune::set_enabled(false);
+        kernel::Conv2dShape large{1, 128, 256, 256, 10, 10, 1, 1, 0, 0};
+        CHECK_TRUE(kernel::fft_filter_size(large, 128) == (size_t)2 * 128 * 128 * 256 * 129,
+            "check22");
+        CHECK_TRUE(kernel::conv2d_algorithm(large, 128) != kernel::Conv2dAlgorithm::fft,
+            "check23");
+        kernel::Conv2dShape small{1, 4, 32, 32, 11, 11, 1, 1, 0, 0};
+        CHECK_TRUE(kernel::conv2d_algorithm(small, 4) == kernel::Conv2dAlgorithm::fft,
+            "check24");
+        autotune::set_enabled(was_enabled);
+    }
 }
 
 void test_linear_module(void) {
@@ -856,6 +1606,288 @@ void test_linear_module(void) {
         data_t value2 = bias_grad_expect[i];
         CHECK_FLOAT_EQUAL(value1, value2, "check3");
     }
+
+    // fused op::linear against matrix_mul + bias, with a transposed input
+    Tensor x(reinterpret_cast<data_t*>(input_data), Shape{3, 5}, true);
+    Tensor w(reinterpret_cast<data_t*>(weight_data), Shape{6, 5}, true);
+    Tensor b(bias_data, Shape{1, 6}, true);
+    Tensor xt = x.transpose(0, 1);
+    Tensor xt2(Shape{5, 3}, true);
+    xt2 = xt;
+    Tensor y1 = op::linear(xt2.transpose(0, 1), w, b);
+    Tensor y2 = op::mean(op::mean(y1 * y1, 1), 0);
+    y2.backward();
+    auto&& x_grad = x.grad();
+    auto&& w_grad = w.grad();
+    auto&& b_grad = b.grad();
+
+    Tensor x_(reinterpret_cast<data_t*>(input_data), Shape{3, 5}, true);
+    Tensor w_(reinterpret_cast<data_t*>(weight_data), Shape{6, 5}, true);
+    Tensor b_(bias_data, Shape{1, 6}, true);
+    Tensor z0 = op::matrix_mul(x_, op::matrix_transpose(w_));
+    Tensor z1 = z0 + b_;
+    Tensor z2 = op::mean(op::mean(z1 * z1, 1), 0);
+    z2.backward();
+    auto&& x_grad_ = x_.grad();
+    auto&& w_grad_ = w_.grad();
+    auto&& b_grad_ = b_.grad();
+    CHECK_FLOAT_EQUAL(y2.item(), z2.item(), "check4");
+    for(index_t i = 0; i < 6; ++i) {
+        for(index_t j = 0; j < 5; ++j) {
+            data_t value1 = w_grad[{i, j}];
+            data_t value2 = w_grad_[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check5");
+        }
+        data_t value1 = b_grad[{0, i}];
+        data_t value2 = b_grad_[{0, i}];
+        CHECK_FLOAT_EQUAL(value1, value2, "check6");
+    }
+    for(index_t i = 0; i < 3; ++i)
+        for(index_t j = 0; j < 5; ++j) {
+            data_t value1 = x_grad[{i, j}];
+            data_t value2 = x_grad_[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check7");
+        }
+}
+
+void test_sparse_linear_module(void) {
+    using namespace st;
+    // A pruned [8, 6] weight, whose 2x3 blocks (1, 0), (1, 1) and (3, 1) are
+    // zeros, and 5 samples to leave a tail to the groups of 4 rows.
+    index_t n = 5, k = 6, m = 8;
+    std::vector<data_t> weight_data(m * k), bias_data(m), input_data(n * k);
+    for(index_t i = 0; i < m; ++i)
+        for(index_t j = 0; j < k; ++j) {
+            bool pruned = (i / 2 == 1) || (i / 2 == 3 && j >= 3) || (i + j) % 4 == 0;
+            weight_data[i * k + j] = pruned ? 0 : data_t((i * 7 + j * 3) % 11) / 11 - 0.4;
+        }
+    for(index_t i = 0; i < m; ++i) bias_data[i] = data_t(i % 3) / 10 - 0.1;
+    for(index_t i = 0; i < n * k; ++i) input_data[i] = data_t(i % 9) / 9 - 0.3;
+
+    Tensor x_(input_data.data(), Shape{n, k}, true);
+    Tensor w_(weight_data.data(), Shape{m, k}, true);
+    Tensor b_(bias_data.data(), Shape{m}, true);
+    Tensor y_ = op::linear_relu(x_, w_, b_);
+    Tensor z_ = op::mean(op::mean(y_ * y_, 1), 0);
+    z_.backward();
+    auto&& x_grad_ = x_.grad();
+    auto&& w_grad_ = w_.grad();
+    auto&& b_grad_ = b_.grad();
+
+    for(index_t block : {1, 2}) {
+        index_t block_h = block, block_w = block == 1 ? 1 : 3;
+        SparseTensor w(w_, block_h, block_w, true);
+        CHECK_EQUAL(w.is_block_sparse(), block != 1, "check1");
+        CHECK_EQUAL(w.nnz(), block == 1 ? 22 : 30, "check2");
+        CHECK_EQUAL(w.values().size(0), w.nnz(), "check2");
+        Tensor dense = w.to_dense();
+        for(index_t i = 0; i < m; ++i)
+            for(index_t j = 0; j < k; ++j) {
+                data_t value1 = dense[{i, j}];
+                data_t value2 = weight_data[i * k + j];
+                CHECK_FLOAT_EQUAL(value1, value2, "check3");
+            }
+
+        Tensor x(input_data.data(), Shape{n, k}, true);
+        Tensor b(bias_data.data(), Shape{m}, true);
+        Tensor y = op::sparse_linear_relu(x, w, b);
+        Tensor z = op::mean(op::mean(y * y, 1), 0);
+        z.backward();
+        for(index_t i = 0; i < n; ++i)
+            for(index_t j = 0; j < m; ++j) {
+                data_t value1 = y[{i, j}];
+                data_t value2 = y_[{i, j}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check4");
+            }
+
+        // The grads of the stored values are those of the dense weight.
+        auto&& x_grad = x.grad();
+        auto&& v_grad = w.values().grad();
+        auto&& b_grad = b.grad();
+        std::vector<data_t> dense_grad(m * k), v_grad_expect(w.nnz());
+        for(index_t i = 0; i < m; ++i)
+            for(index_t j = 0; j < k; ++j)
+                dense_grad[i * k + j] = w_grad_[{i, j}];
+        kernel::sparse_gather(*w.pattern(), dense_grad.data(), v_grad_expect.data());
+        for(index_t p = 0; p < w.nnz(); ++p) {
+            data_t value1 = v_grad[{p}];
+            data_t value2 = v_grad_expect[p];
+            CHECK_FLOAT_EQUAL(value1, value2, "check5");
+        }
+        for(index_t i = 0; i < m; ++i) {
+            data_t value1 = b_grad[{i}];
+            data_t value2 = b_grad_[{i}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check6");
+        }
+        for(index_t i = 0; i < n; ++i)
+            for(index_t j = 0; j < k; ++j) {
+                data_t value1 = x_grad[{i, j}];
+                data_t value2 = x_grad_[{i, j}];
+                CHECK_FLOAT_EQUAL(value1, value2, "check7");
+            }
+    }
+
+    // A sparsified module computes as before, and its parameter is the
+    // stored values, which SGD updates without filling the zeros.
+    nn::Linear linear(k, m);
+    nn::ParamsDict params = linear.parameters();
+    nn::CpyInitializer weight_initializer(params["weight"], weight_data.data());
+    nn::CpyInitializer bias_initializer(params["bias"], bias_data.data());
+    weight_initializer.init();
+    bias_initializer.init();
+    Tensor input(input_data.data(), Shape{n, k});
+    Tensor dense_out = linear.forward(input);
+    linear.sparsify(2, 3);
+    Tensor sparse_out = linear.forward(input);
+    for(index_t i = 0; i < n; ++i)
+        for(index_t j = 0; j < m; ++j) {
+            data_t value1 = sparse_out[{i, j}];
+            data_t value2 = dense_out[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check8");
+        }
+
+    params = linear.parameters();
+    CHECK_EQUAL(params["weight"].size(0), 30, "check9");
+    nn::SGD optimizer(params, 0.1);
+    optimizer.zero_grad();
+    Tensor loss = op::mean(op::mean(linear.forward(input), 1), 0);
+    loss.backward();
+    optimizer.step();
+    Tensor trained = linear.sparse_weight()->to_dense();
+    for(index_t i = 0; i < m; ++i)
+        for(index_t j = 0; j < k; ++j) {
+            data_t value = trained[{i, j}];
+            if(i / 2 == 1 || (i / 2 == 3 && j >= 3)) {
+                CHECK_TRUE(value == 0, "check10");
+            } else {
+                CHECK_TRUE(value != weight_data[i * k + j], "check11");
+            }
+        }
+
+    // The dense weight is released, sparsifying again starts from the
+    // trained values.
+    linear.sparsify();
+    Tensor resparsified = linear.sparse_weight()->to_dense();
+    for(index_t i = 0; i < m; ++i)
+        for(index_t j = 0; j < k; ++j) {
+            data_t value1 = resparsified[{i, j}];
+            data_t value2 = trained[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check12");
+        }
+}
+
+void test_int8_module(void) {
+    using namespace st;
+    // Values which are exact in int8 give exact results, at every level of
+    // the kernels, with tails after the 16 bytes of a vector and the 4
+    // output channels of a micro kernel.
+    index_t n = 3, k = 37, m = 7;
+    std::vector<int8_t> xq(n * k), wq(m * k), yq(n * m);
+    std::vector<data_t> w_scales(m), bias(m), y(n * m);
+    for(index_t i = 0; i < n * k; ++i) xq[i] = int8_t(i * 37 % 255 - 127);
+    for(index_t i = 0; i < m * k; ++i) wq[i] = int8_t(i * 91 % 255 - 127);
+    for(index_t j = 0; j < m; ++j) {
+        w_scales[j] = 1. / (j + 1);
+        bias[j] = data_t(j) - 3;
+    }
+    cpu::Isa old_isa = cpu::isa();
+    for(cpu::Isa level : {cpu::Isa::sse2, cpu::Isa::avx2}) {
+        if(int(level) > int(cpu::detected_isa()))
+            break;
+        cpu::set_isa(level);
+        kernel::Int8Epilogue epilogue{bias.data(), kernel::Activation::relu, 64};
+        kernel::int8_linear_forward(n, k, m, xq.data(), 0.5, wq.data(), w_scales.data(),
+                                    epilogue, y.data(), yq.data());
+        for(index_t i = 0; i < n; ++i)
+            for(index_t j = 0; j < m; ++j) {
+                long long acc = 0;
+                for(index_t p = 0; p < k; ++p)
+                    acc += xq[i * k + p] * wq[j * k + p];
+                data_t expect = acc * 0.5 * w_scales[j] + bias[j];
+                expect = expect < 0 ? 0 : expect;
+                data_t expect_q = std::nearbyint(expect / 64);
+                expect_q = expect_q > 127 ? 127 : expect_q;
+                CHECK_FLOAT_EQUAL(y[i * m + j], expect, "check1");
+                CHECK_FLOAT_EQUAL(data_t(yq[i * m + j]), expect_q, "check2");
+            }
+    }
+    cpu::set_isa(old_isa);
+
+    // Quantized modules against their double forward. The error of a value
+    // is at most half a step of its scale, so the outputs agree within a
+    // few percent of their range.
+    auto max_error = [](const Tensor& a, const Tensor& b) {
+        data_t error = 0, range = 0;
+        Tensor a_ = a.contiguous(), b_ = b.contiguous();
+        for(index_t i = 0; i < a_.size().dsize(); ++i) {
+            data_t value1 = a_.impl().data()[i], value2 = b_.impl().data()[i];
+            error = std::fabs(value1 - value2) > error ? std::fabs(value1 - value2) : error;
+            range = std::fabs(value2) > range ? std::fabs(value2) : range;
+        }
+        return error / range;
+    };
+    std::vector<data_t> input_data(4 * 4 * 9 * 9);
+    for(index_t i = 0; i < input_data.size(); ++i)
+        input_data[i] = data_t(i * 13 % 29) / 29 - 0.2;
+
+    nn::LinearWithReLU linear(/*in_features=*/81, /*out_features=*/10);
+    Tensor linear_in(input_data.data(), Shape{16, 81});
+    Tensor linear_expect = linear.forward(linear_in);
+    CHECK_TRUE(!linear.quantized(), "check3");
+    linear.start_calibration();
+    linear.forward(linear_in);
+    linear.quantize();
+    CHECK_TRUE(linear.quantized(), "check4");
+    Tensor linear_out = linear.forward(linear_in);
+    CHECK_TRUE(!linear_out.impl().requires_grad(), "check5");
+    CHECK_TRUE(max_error(linear_out, linear_expect) < 0.02, "check6");
+
+    nn::Conv2dWithReLU conv(/*in_channels=*/4, /*out_channels=*/6, {3, 3}, {1, 1}, 
+                            {1, 1}, /*groups=*/2, /*max_pool=*/true);
+    Tensor conv_in(input_data.data(), Shape{4, 4, 9, 9});
+    Tensor conv_expect = conv.forward(conv_in);
+    conv.start_calibration();
+    conv.forward(conv_in);
+    conv.quantize();
+    Tensor conv_out = conv.forward(conv_in);
+    CHECK_TRUE(conv_out.size() == conv_expect.size(), "check7");
+    CHECK_TRUE(max_error(conv_out, conv_expect) < 0.02, "check8");
+    conv.dequantize();
+    Tensor conv_double = conv.forward(conv_in);
+    CHECK_TRUE(max_error(conv_double, conv_expect) < 1e-12, "check9");
+
+    // Without the double weight the int8 forward is the same, and 
+    // dequantize() brings back a weight within a step of the original.
+    conv.start_calibration();
+    conv.forward(conv_in);
+    conv.quantize(/*keep_weight=*/false);
+    CHECK_EQUAL(conv.parameters().count("weight"), 0, "check10");
+    Tensor conv_dropped = conv.forward(conv_in);
+    CHECK_TRUE(max_error(conv_dropped, conv_out) < 1e-12, "check11");
+    conv.dequantize();
+    CHECK_EQUAL(conv.parameters().count("weight"), 1, "check12");
+    Tensor conv_rebuilt = conv.forward(conv_in);
+    CHECK_TRUE(max_error(conv_rebuilt, conv_expect) < 0.02, "check13");
+
+    // A chain of int8 layers requantizes between them in the epilogue, as
+    // the next layer quantizes the double output of the previous one.
+    nn::Conv2dWithReLU chain_conv(/*in_channels=*/4, /*out_channels=*/6, {3, 3}, 
+                                  {1, 1}, {1, 1});
+    nn::Linear chain_linear(/*in_features=*/6 * 81, /*out_features=*/5);
+    chain_conv.start_calibration();
+    chain_linear.start_calibration();
+    chain_linear.forward(chain_conv.forward(conv_in).contiguous().view({4, 6 * 81}));
+    chain_conv.quantize();
+    chain_linear.quantize(/*keep_weight=*/false);
+    Tensor chain_expect = chain_linear.forward(
+        chain_conv.forward(conv_in).view({4, 6 * 81}));
+    nn::Int8Tensor hidden = chain_conv.forward_int8(chain_conv.quantize_input(conv_in),
+                                                    chain_linear.input_scale());
+    CHECK_TRUE(hidden.shape == Shape({4, 6, 9, 9}), "check14");
+    nn::Int8Tensor flat{Shape{4, 6 * 81}, hidden.scale, hidden.data};
+    Tensor chain_out = chain_linear.forward_int8(flat);
+    CHECK_TRUE(chain_out.size() == Shape({4, 5}), "check15");
+    CHECK_TRUE(max_error(chain_out, chain_expect) < 1e-12, "check16");
 }
 
 void test_maxpool2d_module(void) {
@@ -953,6 +1985,47 @@ void test_ce_module() {
         data_t value2 = bias_grad[{0, i}];
         CHECK_FLOAT_EQUAL(value1, value2, "check3");
     }
+
+    // The fused op against log_softmax, nll_loss and mean, with logits far
+    // apart enough for a naive softmax to overflow.
+    data_t logits_data[2][4] = {{1000, 998, 1001, -5}, {0.5, -0.25, 0.125, 2}};
+    index_t labels2[] = {3, 1};
+    Tensor logits1(reinterpret_cast<data_t*>(logits_data), Shape{2, 4}, true);
+    Tensor logits2(reinterpret_cast<data_t*>(logits_data), Shape{2, 4}, true);
+    Tensor loss1 = op::cross_entropy(logits1, labels2);
+    Tensor loss2 = op::mean(op::nll_loss(op::log_softmax(logits2), labels2), 0);
+    CHECK_FLOAT_EQUAL(loss1.item(), loss2.item(), "check4");
+    loss1.backward();
+    loss2.backward();
+    auto&& logits_grad1 = logits1.grad();
+    auto&& logits_grad2 = logits2.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 4; ++j) {
+            data_t value1 = logits_grad1[{i, j}];
+            data_t value2 = logits_grad2[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check4");
+        }
+
+    // The grad is added into the one of a contiguous tensor, and reaches a
+    // transposed view too.
+    data_t logits_t_data[4][2] = {{1000, 0.5}, {998, -0.25}, {1001, 0.125}, {-5, 2}};
+    Tensor logits3(reinterpret_cast<data_t*>(logits_t_data), Shape{4, 2}, true);
+    Tensor loss3 = op::cross_entropy(logits1, labels2);
+    Tensor loss4 = op::cross_entropy(logits3.transpose(0, 1), labels2);
+    CHECK_FLOAT_EQUAL(loss3.item(), loss2.item(), "check5");
+    CHECK_FLOAT_EQUAL(loss4.item(), loss2.item(), "check5");
+    loss3.backward();
+    loss4.backward();
+    auto&& logits_grad3 = logits1.grad();
+    auto&& logits_grad4 = logits3.grad();
+    for(index_t i = 0; i < 2; ++i)
+        for(index_t j = 0; j < 4; ++j) {
+            data_t value1 = logits_grad2[{i, j}];
+            data_t value2 = logits_grad3[{i, j}];
+            data_t value3 = logits_grad4[{j, i}];
+            CHECK_FLOAT_EQUAL(2 * value1, value2, "check5");
+            CHECK_FLOAT_EQUAL(value1, value3, "check5");
+        }
 }
 
 void test_optimizer() {
@@ -1009,4 +2082,354 @@ void test_optimizer() {
         data_t value2 = bias[{0, i}];
         CHECK_FLOAT_EQUAL(value1, value2, "check1");
     }
-}
\ No newline at end of file
+}
+
+struct TwoLayerNet : public st::nn::Module {
+    st::nn::LinearWithReLU fc1;
+    st::nn::Linear fc2;
+
+    TwoLayerNet() : fc1(4, 6), fc2(6, 3) {}
+    st::Tensor forward(const st::Tensor& input) override {
+        st::Tensor hidden = fc1.forward(input);
+        return fc2.forward(hidden);
+    }
+    st::nn::ParamsDict parameters(void) override {
+        return {{"fc1", fc1.parameters()}, {"fc2", fc2.parameters()}};
+    }
+};
+
+void test_step_graph() {
+    using namespace st;
+    data_t w1[6][4], b1[6], w2[3][6], b2[3];
+    for(index_t i = 0; i < 24; ++i) (&w1[0][0])[i] = 0.05 * ((i * 7) % 11) - 0.25;
+    for(index_t i = 0; i < 6; ++i) b1[i] = 0.02 * i - 0.05;
+    for(index_t i = 0; i < 18; ++i) (&w2[0][0])[i] = 0.04 * ((i * 5) % 13) - 0.24;
+    for(index_t i = 0; i < 3; ++i) b2[i] = 0.03 * i;
+
+    TwoLayerNet eager_net, graph_net;
+    for(TwoLayerNet* net : {&eager_net, &graph_net}) {
+        nn::ParamsDict params = net->parameters();
+        nn::CpyInitializer(params["fc1weight"], &w1[0][0]).init();
+        nn::CpyInitializer(params["fc1bias"], b1).init();
+        nn::CpyInitializer(params["fc2weight"], &w2[0][0]).init();
+        nn::CpyInitializer(params["fc2bias"], b2).init();
+    }
+    nn::CrossEntropy criterion;
+    nn::SGD eager_optim(eager_net.parameters(), 0.1);
+    nn::SGD graph_optim(graph_net.parameters(), 0.1);
+    nn::StepGraph graph(graph_net, criterion, Shape{2, 4});
+
+    // The last step has a smaller batch, which runs eagerly.
+    for(index_t step = 0; step < 4; ++step) {
+        index_t n_samples = step < 3 ? 2 : 1;
+        data_t input_data[2][4];
+        for(index_t i = 0; i < 8; ++i)
+            (&input_data[0][0])[i] = 0.1 * ((i + 3 * step) % 8) - 0.3;
+        index_t labels[2] = {step % 3, (step + 2) % 3};
+
+        Tensor input(&input_data[0][0], Shape{n_samples, 4});
+        Tensor eager_loss = criterion.forward(eager_net.forward(input), labels);
+        eager_loss.backward();
+        const Tensor& graph_loss = graph.step(&input_data[0][0], labels,
+                                              n_samples);
+        CHECK_TRUE(graph.captured(), "check1");
+        CHECK_FLOAT_EQUAL(eager_loss.item(), graph_loss.item(), "check2");
+
+        nn::ParamsDict eager_params = eager_net.parameters();
+        nn::ParamsDict graph_params = graph_net.parameters();
+        for(auto& named_param : eager_params) {
+            Tensor& p1 = named_param.second;
+            Tensor& p2 = graph_params[named_param.first];
+            auto&& g1 = p1.grad();
+            auto&& g2 = p2.grad();
+            for(index_t i = 0; i < p1.size(0); ++i)
+                for(index_t j = 0; j < p1.size(1); ++j) {
+                    data_t value1 = g1[{i, j}];
+                    data_t value2 = g2[{i, j}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check3");
+                }
+        }
+        eager_optim.step();
+        eager_optim.zero_grad();
+        graph_optim.step();
+        graph_optim.zero_grad();
+    }
+
+    // The labels of a replayed step are checked as those of a new loss.
+    data_t input_data[2][4] = {{0}};
+    index_t bad_labels[2] = {0, 3};
+    bool refused = false;
+    try {
+        graph.step(&input_data[0][0], bad_labels);
+    } catch(const err::Error&) {
+        refused = true;
+    }
+    CHECK_TRUE(refused, "check4");
+}
+
+void test_jit() {
+    using namespace st;
+    data_t a_data[2][3] = {{0.2, -0.5, 0.7}, {-0.1, 0.4, -0.9}};
+    data_t b_data[2][3] = {{0.3, 0.6, -0.2}, {0.8, -0.7, 0.5}};
+    data_t c_data[3] = {0.05, -0.1, 0.15};
+    Tensor a(&a_data[0][0], Shape{2, 3});
+    Tensor b(&b_data[0][0], Shape{2, 3}, /*requires_grad=*/true);
+    Tensor c(c_data, Shape{1, 3});
+
+    jit::set_enabled(true);
+    ForwardPlan plan;
+    plan.begin_capture();
+    // fused with a broadcasted operand and a constant
+    Tensor y1 = op::relu(a * b + c) - op::constant(0.5, {2, 3});
+    // matrix_mul is evaluated by the interpreter, the rest is fused
+    Tensor y2 = op::sigmoid(op::matrix_mul(a, b.transpose(0, 1)) + y1.slice(0, 2, 1));
+    Tensor loss = op::mean(op::mean(y2, 0), 0);
+    plan.end_capture();
+    jit::set_enabled(false);
+    loss.backward();
+
+    Tensor a_eager(&a_data[0][0], Shape{2, 3});
+    Tensor b_eager(&b_data[0][0], Shape{2, 3}, /*requires_grad=*/true);
+    for(index_t i = 0; i < 6; ++i)
+        (&a_data[0][0])[i] += 0.25;
+    nn::CpyInitializer(a, &a_data[0][0]).init();
+    plan.replay();
+    loss.backward();
+
+    // The same two steps without JIT and replay.
+    for(index_t step = 0; step < 2; ++step) {
+        Tensor e1 = op::relu(a_eager * b_eager + c) - op::constant(0.5, {2, 3});
+        Tensor e2 = op::sigmoid(op::matrix_mul(a_eager, b_eager.transpose(0, 1)) 
+                                + e1.slice(0, 2, 1));
+        Tensor e_loss = op::mean(op::mean(e2, 0), 0);
+        e_loss.backward();
+        if(step == 1) {
+            const Tensor& r1 = y1;
+            const Tensor& r2 = y2;
+            for(index_t i = 0; i < 2; ++i) {
+                for(index_t j = 0; j < 3; ++j) {
+                    data_t value1 = r1[{i, j}];
+                    data_t value2 = e1[{i, j}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check1");
+                }
+                for(index_t j = 0; j < 2; ++j) {
+                    data_t value1 = r2[{i, j}];
+                    data_t value2 = e2[{i, j}];
+                    CHECK_FLOAT_EQUAL(value1, value2, "check2");
+                }
+            }
+        }
+        nn::CpyInitializer(a_eager, &a_data[0][0]).init();
+    }
+
+    auto&& b_grad = b.grad();
+    auto&& b_eager_grad = b_eager.grad();
+    for(index_t i = 0; i < 2; ++i) {
+        for(index_t j = 0; j < 3; ++j) {
+            data_t value1 = b_grad[{i, j}];
+            data_t value2 = b_eager_grad[{i, j}];
+            CHECK_FLOAT_EQUAL(value1, value2, "check3");
+        }
+    }
+
+    // A cache which others can write to is refused, nothing is loaded from it.
+    char shared_dir[] = "/tmp/st_jit_shared_XXXXXX";
+    CHECK_NOT_NULL(mkdtemp(shared_dir), "check4");
+    chmod(shared_dir, 0777);
+    const char* env_cache = std::getenv("ST_JIT_CACHE");
+    std::string saved_cache = env_cache != nullptr ? env_cache : "";
+    setenv("ST_JIT_CACHE", shared_dir, 1);
+    bool refused = false;
+    try {
+        jit::load("extern \"C\" void st_jit_kernel(const double* const*, double*) {}\n");
+    } catch(const err::Error&) {
+        refused = true;
+    }
+    if(env_cache != nullptr)
+        setenv("ST_JIT_CACHE", saved_cache.c_str(), 1);
+    else
+        unsetenv("ST_JIT_CACHE");
+    rmdir(shared_dir);
+    CHECK_TRUE(refused, "check4");
+}
+
+void test_autotune(void) {
+    using namespace st;
+    char path[] = "/tmp/st_tuning_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK_TRUE(fd >= 0, "check0");
+    close(fd);
+    bool was_enabled = autotune::enabled();
+    std::string old_path = autotune::tuning_file();
+    autotune::set_enabled(true);
+    autotune::set_tuning_file(path);
+
+    // The fastest candidate wins, and is found again without any timing,
+    // then from the file. A candidate takes its value on a fake clock.
+    std::vector<autotune::Config> candidates{{30}, {20}, {0}};
+    index_t runs = 0;
+    data_t fake_time = 0;
+    autotune::set_timer([&]() { return fake_time; });
+    auto sleep = [&](const autotune::Config& candidate) {
+        ++runs;
+        fake_time += candidate[0];
+    };
+    autotune::Config winner = autotune::select("test", {3, 5}, candidates, sleep);
+    CHECK_TRUE(winner == autotune::Config{0} && runs == 9, "check1");
+    winner = autotune::select("test", {3, 5}, candidates, sleep);
+    CHECK_TRUE(winner == autotune::Config{0} && runs == 9, "check2");
+    autotune::set_tuning_file(path);
+    winner = autotune::select("test", {3, 5}, candidates, sleep);
+    CHECK_TRUE(winner == autotune::Config{0} && runs == 9, "check3");
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    CHECK_TRUE(line.find(autotune::cpu_model()) != std::string::npos, "check4");
+
+    // Other shapes fall back to the first candidate when tuning is disabled.
+    autotune::set_enabled(false);
+    winner = autotune::select("test", {3, 6}, candidates, sleep);
+    CHECK_TRUE(winner == autotune::Config{30} && runs == 9, "check5");
+    autotune::set_enabled(true);
+    autotune::set_timer(nullptr);
+
+    // A tuned gemm, whose candidates are run on the operands, still gives
+    // the product.
+    index_t m = 70, n = 90, k = 60;
+    std::vector<data_t> a(m * k), b(k * n), c(m * n, 1.);
+    for(index_t i = 0; i < m * k; ++i) a[i] = data_t(i % 7) - 3;
+    for(index_t i = 0; i < k * n; ++i) b[i] = data_t(i % 5) - 2;
+    kernel::gemm(m, n, k, a.data(), k, 1, b.data(), n, 1, c.data(), n, true);
+    for(index_t i = 0; i < m; ++i)
+        for(index_t j = 0; j < n; ++j) {
+            data_t expect = 1.;
+            for(index_t p = 0; p < k; ++p)
+                expect += a[i * k + p] * b[p * n + j];
+            CHECK_FLOAT_EQUAL(c[i * n + j], expect, "check6");
+        }
+    std::ifstream tuned(path);
+    bool gemm_tuned = false;
+    while(std::getline(tuned, line))
+        gemm_tuned |= line.find("gemm") == 0;
+    CHECK_TRUE(gemm_tuned, "check7");
+
+    std::remove(path);
+    autotune::set_tuning_file(old_path);
+    autotune::set_enabled(was_enabled);
+}
+
+void test_cpu_dispatch(void) {
+    using namespace st;
+    cpu::Isa old_isa = cpu::isa();
+    cpu::set_isa(cpu::Isa::avx512);
+    CHECK_TRUE(cpu::isa() == cpu::detected_isa(), "check1");
+
+    // Every variant the CPU can run against plain loops, on sizes which
+    // leave tails to the scalar code.
+    index_t m = 37, n = 41, k = 53, size = 19;
+    std::vector<data_t> a(m * k), b(k * n), c(m * n);
+    for(index_t i = 0; i < m * k; ++i) a[i] = data_t(i % 7) / 7 - 0.5;
+    for(index_t i = 0; i < k * n; ++i) b[i] = data_t(i % 5) / 5 - 0.5;
+    for(cpu::Isa level : {cpu::Isa::sse2, cpu::Isa::avx2, cpu::Isa::avx512}) {
+        if(int(level) > int(cpu::detected_isa()))
+            break;
+        cpu::set_isa(level);
+        CHECK_TRUE(cpu::isa() == level, "check2");
+
+        kernel::gemm(m, n, k, a.data(), 1, m, b.data(), n, 1, c.data(), n);
+        for(index_t i = 0; i < m; ++i)
+            for(index_t j = 0; j < n; ++j) {
+                data_t expect = 0;
+                for(index_t p = 0; p < k; ++p)
+                    expect += a[p * m + i] * b[p * n + j];
+                CHECK_FLOAT_EQUAL(c[i * n + j], expect, "check3");
+            }
+
+        std::vector<data_t> x(size), y(size), dy(size, 1.), v(size, 0.5), w(size, 1.);
+        for(index_t i = 0; i < size; ++i) {
+            x[i] = data_t(i) - 9;
+            y[i] = data_t(i % 3) - 1;
+        }
+        kernel::axpy(size, 2., x.data(), y.data());
+        kernel::relu_mask(size, y.data(), dy.data());
+        kernel::momentum_update(size, 0.1, 0.9, x.data(), v.data(), w.data());
+        for(index_t i = 0; i < size; ++i) {
+            data_t y_expect = data_t(i % 3) - 1 + 2 * x[i];
+            data_t v_expect = 0.9 * 0.5 + x[i];
+            CHECK_FLOAT_EQUAL(y[i], y_expect, "check4");
+            CHECK_FLOAT_EQUAL(dy[i], y_expect > 0 ? 1. : 0., "check5");
+            CHECK_FLOAT_EQUAL(v[i], v_expect, "check6");
+            CHECK_FLOAT_EQUAL(w[i], 1. - 0.1 * v_expect, "check6");
+        }
+
+        std::vector<data_t> s(3 * size), z(size, 1.);
+        for(index_t i = 0; i < 3 * size; ++i) s[i] = data_t(i % 11) - 5;
+        kernel::axpy(size, 0.5, s.data(), 3, z.data());
+        data_t total = kernel::sum(size, s.data(), 3), total_expect = 0;
+        kernel::bias_act(size, -1., true, z.data());
+        for(index_t i = 0; i < size; ++i) {
+            data_t z_expect = 0.5 * s[3 * i];
+            CHECK_FLOAT_EQUAL(z[i], z_expect < 0 ? 0. : z_expect, "check7");
+            total_expect += s[3 * i];
+        }
+        CHECK_FLOAT_EQUAL(total, total_expect, "check7");
+
+        // The direct conv kernels on rows which end in a partial vector, on
+        // blocks of fewer output channels than a tile, with strides, groups
+        // and a depthwise conv, against plain loops.
+        struct ConvCase { index_t stride, padding, groups, out_channels; };
+        for(const ConvCase& cc : {ConvCase{1, 1, 1, 6}, ConvCase{2, 0, 2, 6},
+                                  ConvCase{1, 1, 4, 8}, ConvCase{2, 1, 4, 4}}) {
+            kernel::Conv2dShape shape{2, 4, 7, 21, 3, 3, cc.stride, cc.stride,
+                                      cc.padding, cc.padding};
+            index_t oc = cc.out_channels, gc = 4 / cc.groups, goc = oc / cc.groups;
+            index_t oh = shape.out_h(), ow = shape.out_w(), depth = gc * 9;
+            std::vector<data_t> x(2 * 4 * 7 * 21), w(oc * depth), bias(oc);
+            std::vector<data_t> dy(2 * oc * oh * ow), y(dy.size());
+            std::vector<data_t> dx(x.size()), dw(w.size());
+            for(index_t i = 0; i < x.size(); ++i) x[i] = data_t(i % 13) / 13 - 0.5;
+            for(index_t i = 0; i < w.size(); ++i) w[i] = data_t(i % 7) / 7 - 0.4;
+            for(index_t i = 0; i < dy.size(); ++i) dy[i] = data_t(i % 5) / 5 - 0.3;
+            for(index_t i = 0; i < oc; ++i) bias[i] = data_t(i % 3) - 1;
+            index_t xs[4] = {4 * 7 * 21, 7 * 21, 21, 1}, ws[2] = {depth, 1};
+            kernel::Conv2dEpilogue epilogue{bias.data(), kernel::Activation::relu,
+                                            false, nullptr};
+            kernel::conv2d_forward(shape, oc, x.data(), xs, w.data(), ws, y.data(),
+                                   cc.groups, &epilogue);
+            kernel::conv2d_backward_input(shape, oc, dy.data(), w.data(), ws, dx.data(),
+                                          cc.groups);
+            kernel::conv2d_backward_weight(shape, oc, x.data(), xs, dy.data(), dw.data(),
+                                           cc.groups);
+
+            std::vector<data_t> dx_expect(x.size(), 0.), dw_expect(w.size(), 0.);
+            for(index_t b = 0; b < 2; ++b)
+                for(index_t o = 0; o < oc; ++o)
+                    for(index_t r = 0; r < oh; ++r)
+                        for(index_t col = 0; col < ow; ++col) {
+                            index_t yi = ((b * oc + o) * oh + r) * ow + col;
+                            data_t y_expect = bias[o];
+                            for(index_t c = 0; c < gc; ++c)
+                                for(index_t i = 0; i < 3; ++i)
+                                    for(index_t j = 0; j < 3; ++j) {
+                                        int h = int(r * cc.stride + i) - int(cc.padding);
+                                        int v = int(col * cc.stride + j) - int(cc.padding);
+                                        if(h < 0 || h >= 7 || v < 0 || v >= 21)
+                                            continue;
+                                        index_t xi = ((b * 4 + o / goc * gc + c) * 7 + h)
+                                                     * 21 + v;
+                                        index_t wi = o * depth + (c * 3 + i) * 3 + j;
+                                        y_expect += w[wi] * x[xi];
+                                        dx_expect[xi] += w[wi] * dy[yi];
+                                        dw_expect[wi] += x[xi] * dy[yi];
+                                    }
+                            y_expect = y_expect < 0 ? 0 : y_expect;
+                            CHECK_FLOAT_EQUAL(y[yi], y_expect, "check8");
+                        }
+            for(index_t i = 0; i < x.size(); ++i)
+                CHECK_FLOAT_EQUAL(dx[i], dx_expect[i], "check8");
+            for(index_t i = 0; i < w.size(); ++i)
+                CHECK_FLOAT_EQUAL(dw[i], dw_expect[i], "check8");
+        }
+    }
+    cpu::set_isa(old_isa);
+}
@@ -8,6 +8,7 @@
 #include "nn/module.hpp"
 #include "data/data.hpp"
 #include "nn/optim.hpp"
+#include "nn/step_graph.hpp"
 
 using st::index_t;
 using st::data_t;
@@ -23,14 +24,11 @@ public:
 
         st::Tensor s1_x1 = s1_conv1.forward(s0_x1);
         st::Tensor s1_x2 = s1_conv2.forward(s1_x1);
-        st::Tensor s1_x3 = s1_pool.forward(s1_x2);
 
-        st::Tensor s2_x1 = s2_conv1.forward(s1_x3);
+        st::Tensor s2_x1 = s2_conv1.forward(s1_x2);
         st::Tensor s2_x2 = s2_conv2.forward(s2_x1);
-        st::Tensor s2_x3 = s2_pool.forward(s2_x2);
 
-        st::Tensor feat(s2_x3.size());
-        feat = s2_x3;
+        st::Tensor feat = s2_x2.contiguous();
 
         st::Tensor y1 = linear1.forward(feat.view({
             feat.size(0), 64*4*4
@@ -54,12 +52,12 @@ private:
     st::nn::Conv2dWithReLU conv0{3, 32, {5, 5}, {2, 2}, {2, 2}};
 
     st::nn::Conv2dWithReLU s1_conv1{32, 32, {3, 3}, {1, 1}, {1, 1}};
-    st::nn::Conv2dWithReLU s1_conv2{32, 32, {3, 3}, {1, 1}, {1, 1}};
-    st::nn::MaxPool2d s1_pool{{2, 2}, {2, 2}, {0, 0}};
+    st::nn::Conv2dWithReLU s1_conv2{32, 32, {3, 3}, {1, 1}, {1, 1},
+                                    /*groups=*/1, /*max_pool=*/true};
 
     st::nn::Conv2dWithReLU s2_conv1{32, 64, {3, 3}, {1, 1}, {1, 1}};
-    st::nn::Conv2dWithReLU s2_conv2{64, 64, {3, 3}, {1, 1}, {1, 1}};
-    st::nn::MaxPool2d s2_pool{{2, 2}, {2, 2}, {0, 0}};
+    st::nn::Conv2dWithReLU s2_conv2{64, 64, {3, 3}, {1, 1}, {1, 1},
+                                    /*groups=*/1, /*max_pool=*/true};
 
     st::nn::LinearWithReLU linear1{64*4*4, 256};
     st::nn::Linear linear2{256, 10};
@@ -108,6 +106,15 @@ int main() {
         scnn.parameters(), /*lr=*/lr, /*momentum=*/momentum
     );
 
+    // full batches replay the captured training step, the last one runs eagerly
+    st::nn::StepGraph step_graph(
+        scnn, criterion, 
+        {batch_size, 
+         st::data::Cifar10::Img::n_channels_, 
+         st::data::Cifar10::Img::n_rows_, 
+         st::data::Cifar10::Img::n_cols_}
+    );
+
     index_t n_samples;
     const data_t* batch_samples;
     const index_t* batch_labels;
@@ -125,28 +132,23 @@ int main() {
         for(index_t j = 0; j < train_dataset.n_batchs(); ++j) {
             std::tie(n_samples, batch_samples, batch_labels) = 
                 train_dataset.get_batch(j);
-            st::Tensor input(
-                batch_samples, 
-                {n_samples, 
-                 st::data::Cifar10::Img::n_channels_, 
-                 st::data::Cifar10::Img::n_rows_, 
-                 st::data::Cifar10::Img::n_cols_}
-            );
 
-            st::Tensor output = scnn.forward(input);
-            st::Tensor loss = criterion.forward(output, batch_labels);
-            loss.backward();
+            data_t loss_value = step_graph.step(
+                batch_samples, batch_labels, n_samples
+            ).item();
 
             optimizer.step();
             optimizer.zero_grad();
 
             if(j % print_iters == 0) {
                 std::cout << "iter " << j << " | ";
-                std::cout << "loss: " << loss.item() << std::endl;
+                std::cout << "loss: " << loss_value << std::endl;
             }
         }
 
         std::cout << "Epoch " << i << " evaluating..." << std::endl;
+        // The outputs aren't backward, so no grad is kept for them.
+        st::autograd::NoGradGuard no_grad;
         index_t total_samples = 0, correct_samples = 0;
         for(index_t j = 0; j < val_dataset.n_batchs(); ++j) {
             std::tie(n_samples, batch_samples, batch_labels) =
@@ -12,6 +12,7 @@
 #include "nn/module.hpp"
 #include "data/data.hpp"
 #include "nn/optim.hpp"
+#include "nn/step_graph.hpp"
 
 using st::index_t;
 using st::data_t;
@@ -82,6 +83,11 @@ int main() {
         mlp.parameters(), /*lr=*/lr, /*momentum=*/momentum
     );
 
+    // full batches replay the captured training step, the last one runs eagerly
+    st::nn::StepGraph step_graph(
+        mlp, criterion, {batch_size, st::data::MNIST::Img::n_pixels_}
+    );
+
     index_t n_samples;
     const data_t* batch_samples;
     const index_t* batch_labels;
@@ -99,25 +105,23 @@ int main() {
         for(index_t j = 0; j < train_dataset.n_batchs(); ++j) {
             std::tie(n_samples, batch_samples, batch_labels) = 
                 train_dataset.get_batch(j);
-            st::Tensor input(
-                batch_samples, 
-                {n_samples, st::data::MNIST::Img::n_pixels_}
-            );
 
-            st::Tensor output = mlp.forward(input);
-            st::Tensor loss = criterion.forward(output, batch_labels);
-            loss.backward();
+            data_t loss_value = step_graph.step(
+                batch_samples, batch_labels, n_samples
+            ).item();
 
             optimizer.step();
             optimizer.zero_grad();
 
             if(j % print_iters == 0) {
                 std::cout << "iter " << j << " | ";
-                std::cout << "loss: " << loss.item() << std::endl;
+                std::cout << "loss: " << loss_value << std::endl;
             }
         }
 
         std::cout << "Epoch " << i << " evaluating..." << std::endl;
+        // The outputs aren't backward, so no grad is kept for them.
+        st::autograd::NoGradGuard no_grad;
         index_t total_samples = 0, correct_samples = 0;
         for(index_t j = 0; j < val_dataset.n_batchs(); ++j) {
             std::tie(n_samples, batch_samples, batch_labels) =